@@ -20,7 +20,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := lights.c
 
 
-LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_SHARED_LIBRARIES := liblog libcutils
 
 LOCAL_MODULE := lights.exynos3
 LOCAL_MODULE_RELATIVE_PATH := hw
@@ -29,3 +29,53 @@ LOCAL_PROPRIETARY_MODULE := true
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+# backlight ramp timing and panel writes, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := backlight_ramp_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := backlight_ramp_test.c
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# set_light_backlight() caller time with a slow panel node, worker and not
+include $(CLEAR_VARS)
+LOCAL_MODULE := backlight_caller_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := backlight_caller_test.c
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# writes through the open nodes against reopening them, and after a failure
+include $(CLEAR_VARS)
+LOCAL_MODULE := sysfs_writes_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := sysfs_writes_test.c
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# panel brightness and LED colours against what the old HAL wrote
+include $(CLEAR_VARS)
+LOCAL_MODULE := lights_parity_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := lights_parity_test.c
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# LED source arbitration against a model, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := led_arbitration_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := led_arbitration_test.c
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
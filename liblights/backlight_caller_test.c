@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of what set_light_backlight() costs its caller, on a fake
+ * sysfs whose panel node takes 20 ms per write, as a slow panel driver
+ * does.
+ *
+ * 200 targets, 5 ms apart, go through set_light_backlight() twice: first
+ * with the synchronous write the HAL falls back to (and did before the
+ * worker), then with the backlight worker running. For each it prints the
+ * time spent in the call, the writes that reach the panel node and the
+ * value the panel ends on, which must be the last target.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+static int g_slow_fd = -1;
+static long g_write_delay_ns = 20000000L;
+
+/* pwrite() of lights.c; writes to g_slow_fd take g_write_delay_ns */
+static ssize_t slow_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+    struct timespec delay = { 0, g_write_delay_ns };
+
+    if (fd == g_slow_fd)
+        nanosleep(&delay, NULL);
+    return pwrite(fd, buf, len, off);
+}
+
+#define pwrite slow_pwrite
+#include "lights.c"
+#undef pwrite
+#include "fake_sysfs.h"
+
+#define MS              1000000LL
+#define CALLS           200
+#define CALL_PERIOD_NS  (5 * MS)
+#define SETTLE_NS       (1000 * MS)
+
+struct result {
+    int64_t total, max;     // In set_light_backlight().
+    unsigned int writes;    // That reached the panel node.
+    int final;
+};
+
+static int panel_value(void)
+{
+    char buf[32];
+
+    return fake_sysfs_read(NODE_PANEL, buf, sizeof(buf)) ? -1 : atoi(buf);
+}
+
+static int target(int i)
+{
+    return 20 + i;
+}
+
+static void run(struct result *res)
+{
+    struct light_state_t state;
+    unsigned int issued = g_nodes[NODE_PANEL].issued;
+    int64_t next = monotonic_ns(), start, spent, deadline;
+    int i;
+
+    memset(res, 0, sizeof(*res));
+    memset(&state, 0, sizeof(state));
+    for (i = 0; i < CALLS; i++) {
+        struct timespec ts;
+        int v = target(i);
+
+        next += CALL_PERIOD_NS;
+        ts.tv_sec = next / 1000000000LL;
+        ts.tv_nsec = next % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        state.color = 0xff000000 | (v << 16) | (v << 8) | v;
+        start = monotonic_ns();
+        set_light_backlight(NULL, &state);
+        spent = monotonic_ns() - start;
+        res->total += spent;
+        if (spent > res->max)
+            res->max = spent;
+    }
+
+    /* the worker may still be on its way to the last target */
+    deadline = monotonic_ns() + SETTLE_NS;
+    while (panel_value() != target(CALLS - 1) && monotonic_ns() < deadline)
+        usleep(1000);
+    usleep(50000);
+    pthread_mutex_lock(&g_lock);
+    res->writes = g_nodes[NODE_PANEL].issued - issued;
+    pthread_mutex_unlock(&g_lock);
+    res->final = panel_value();
+}
+
+static void report(const char *what, const struct result *res)
+{
+    printf("%-22s mean %9.1f us  max %9.1f us  %3u panel writes, ends on %d\n",
+           what, res->total / 1e3 / CALLS, res->max / 1e3, res->writes,
+           res->final);
+}
+
+static int check(int ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(void)
+{
+    struct result sync, worker;
+    int failed = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    g_slow_fd = g_nodes[NODE_PANEL].fd;
+    printf("%d targets %lld ms apart, %ld ms per panel write\n", CALLS,
+           CALL_PERIOD_NS / MS, g_write_delay_ns / 1000000L);
+
+    /* the worker is not started yet: the synchronous fallback */
+    run(&sync);
+    report("synchronous write", &sync);
+
+    /* start over from an unknown panel value */
+    g_nodes[NODE_PANEL].last[0] = '\0';
+    pthread_once(&g_backlight_init, init_backlight_writer);
+    if (g_backlight.event_fd < 0) {
+        fprintf(stderr, "cannot start the backlight worker\n");
+        fake_sysfs_cleanup();
+        return 2;
+    }
+    run(&worker);
+    report("backlight worker", &worker);
+
+    failed |= check(sync.final == target(CALLS - 1) &&
+                    worker.final == target(CALLS - 1),
+                    "the panel ends on the last target");
+    failed |= check(sync.writes == CALLS, "synchronous: one write per call");
+    failed |= check(worker.writes < CALLS,
+                    "worker: targets set meanwhile are coalesced");
+    failed |= check(worker.max < g_write_delay_ns,
+                    "worker: no call waits for a panel write");
+
+    /* the detached worker is idle by now, and never stopped */
+    g_slow_fd = -1;
+    fake_sysfs_cleanup();
+    return failed;
+}
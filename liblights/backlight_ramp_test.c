@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the backlight ramp on a fake sysfs.
+ *
+ * Runs the backlight worker on a synthetic clock: targets come in as the
+ * framework sends them for a single change, an auto-brightness staircase
+ * (a target every 100 ms) and a slider drag (a target every 8 ms), and
+ * the frame timer ticks at 60 Hz while a ramp runs. For each case it
+ * counts the writes that reach the panel node, how long after the last
+ * target the panel settles, and the frames the panel stands still once
+ * it has started moving, before it reaches the last target. Also checks
+ * that the ramp never goes the wrong way and ends on the last target.
+ */
+
+#include "lights.c"
+#include "fake_sysfs.h"
+
+#define MS  1000000LL
+
+struct scenario {
+    const char *name;
+    int ramp_ms;
+    int64_t interval;       // Between targets.
+    int count;              // Targets, evenly stepped from 'start' to 'end'.
+    int start, end;
+};
+
+static const struct scenario g_scenarios[] = {
+    { "single step, no ramp",        0,   0,        1,   30,  200 },
+    { "auto-brightness, no ramp",    0,   100 * MS, 8,   40,  200 },
+    { "slider drag, no ramp",        0,   8 * MS,   120, 20,  220 },
+    { "single step, 250 ms",         250, 0,        1,   30,  200 },
+    { "auto-brightness, 250 ms",     250, 100 * MS, 8,   40,  200 },
+    { "slider drag, 250 ms",         250, 8 * MS,   120, 20,  220 },
+};
+
+struct result {
+    unsigned int writes;
+    int64_t settle;         // Last write after the last target.
+    int stalls;             // Ticks with no change, once moving.
+    int reversals;          // Writes going the wrong way.
+    int lag;                // Target minus panel right after the last target.
+    int final;
+};
+
+static int panel_value(void)
+{
+    char buf[32];
+
+    return fake_sysfs_read(NODE_PANEL, buf, sizeof(buf)) ? -1 : atoi(buf);
+}
+
+static void run(const struct scenario *sc, int curve, struct result *res)
+{
+    struct backlight_writer *w = &g_backlight;
+    unsigned int issued;
+    int64_t now, tick = -1, last_write = 0, last_target;
+    int i = 0, prev;
+
+    memset(res, 0, sizeof(*res));
+    w->ramp_ns = sc->ramp_ms * MS;
+    w->curve = curve;
+    w->last_target = -1000 * MS;
+    backlight_write(w, sc->start);
+    w->ramp_from = w->ramp_to = sc->start;
+    w->ramp_v0 = 0.f;
+    issued = g_nodes[NODE_PANEL].issued;
+    prev = sc->start;
+    last_target = (sc->count - 1) * sc->interval;
+
+    for (;;) {
+        int64_t next_target = i < sc->count ? i * sc->interval : INT64_MAX;
+        int ramping = w->ramp_from != w->ramp_to;
+
+        if (next_target == INT64_MAX && !ramping)
+            break;
+        if (ramping && tick < next_target) {
+            /* The frame timer, as the worker handles it. */
+            now = tick;
+            backlight_write(w, backlight_ramp_step(w, now, NULL));
+            tick += BACKLIGHT_FRAME_NS;
+            if (w->written == prev && prev != sc->start && prev != sc->end)
+                res->stalls++;
+        } else {
+            now = next_target;
+            backlight_retarget(w, sc->start + (sc->end - sc->start) *
+                               (i + 1) / sc->count, now);
+            i++;
+            /* Arming the timer starts its period over. */
+            if (w->ramp_from != w->ramp_to)
+                tick = now + BACKLIGHT_FRAME_NS;
+            if (i == sc->count)
+                res->lag = sc->end - w->written;
+        }
+
+        if (w->written != prev) {
+            if ((w->written - prev) * (sc->end - sc->start) < 0)
+                res->reversals++;
+            prev = w->written;
+            last_write = now;
+        }
+    }
+
+    res->writes = g_nodes[NODE_PANEL].issued - issued;
+    res->settle = last_write > last_target ? last_write - last_target : 0;
+    res->final = panel_value();
+}
+
+int main(void)
+{
+    unsigned int i;
+    int curve, failed = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    g_backlight.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    printf("%-26s %-7s %7s %6s %9s %6s %5s\n", "case", "curve", "targets",
+           "writes", "settle ms", "stalls", "lag");
+    for (curve = RAMP_CURVE_LINEAR; curve <= RAMP_CURVE_EASE; curve++) {
+        for (i = 0; i < sizeof(g_scenarios) / sizeof(g_scenarios[0]); i++) {
+            const struct scenario *sc = &g_scenarios[i];
+            int64_t frames = sc->ramp_ms * MS / BACKLIGHT_FRAME_NS + 1;
+            struct result res;
+
+            if (!sc->ramp_ms && curve != RAMP_CURVE_LINEAR)
+                continue;
+            run(sc, curve, &res);
+            printf("%-26s %-7s %7d %6u %9.1f %6d %5d\n", sc->name,
+                   !sc->ramp_ms ? "-" : curve == RAMP_CURVE_EASE ? "ease" : "linear",
+                   sc->count, res.writes, res.settle / 1e6, res.stalls, res.lag);
+
+            if (res.final != sc->end || res.reversals) {
+                printf("  ended on %d, %d reversals\n", res.final, res.reversals);
+                failed = 1;
+            }
+            if (!sc->ramp_ms && (res.writes != (unsigned int)sc->count ||
+                                 res.settle || res.lag)) {
+                printf("  targets not written as they came\n");
+                failed = 1;
+            }
+            if (sc->ramp_ms && res.settle > sc->ramp_ms * MS + BACKLIGHT_FRAME_NS) {
+                printf("  settled later than one ramp after the last target\n");
+                failed = 1;
+            }
+            if (sc->ramp_ms && sc->count == 1 && res.writes > frames) {
+                printf("  more than a write per frame\n");
+                failed = 1;
+            }
+            if (sc->ramp_ms && sc->interval >= BACKLIGHT_FRAME_NS && res.stalls) {
+                printf("  the ramp stood still on the way\n");
+                failed = 1;
+            }
+            if (sc->interval && sc->interval < BACKLIGHT_FRAME_NS &&
+                    (res.lag || res.writes > (unsigned int)sc->count + frames)) {
+                printf("  a fast stream of targets was ramped\n");
+                failed = 1;
+            }
+        }
+    }
+
+    fake_sysfs_cleanup();
+    return failed;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake sysfs for the lights host tests. A test builds lights.c in, and
+ * includes this after it: fake_sysfs_setup() creates the nodes as plain
+ * files under a temporary directory and points g_nodes at them before
+ * open_lights() would open the real ones.
+ */
+
+#ifndef FAKE_SYSFS_H
+#define FAKE_SYSFS_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+static char g_fake_root[] = "/tmp/lights_sysfs_XXXXXX";
+static char g_fake_paths[NODE_COUNT][PATH_MAX];
+
+static void fake_sysfs_mkdirs(char *path)
+{
+    char *slash;
+
+    for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+}
+
+static void fake_sysfs_nodes(void)
+{
+    int i;
+
+    for (i = 0; i < NODE_COUNT; i++) {
+        snprintf(g_fake_paths[i], PATH_MAX, "%s%s", g_fake_root, g_node_paths[i]);
+        fake_sysfs_mkdirs(g_fake_paths[i]);
+        g_nodes[i].path = g_fake_paths[i];
+        g_nodes[i].fd = open(g_fake_paths[i], O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (g_nodes[i].fd < 0)
+            fprintf(stderr, "cannot create %s\n", g_fake_paths[i]);
+    }
+}
+
+static int fake_sysfs_setup(void)
+{
+    if (!mkdtemp(g_fake_root))
+        return -errno;
+    pthread_once(&g_nodes_init, fake_sysfs_nodes);
+    return g_nodes[0].fd < 0 ? -ENOENT : 0;
+}
+
+/* What the driver would see: the last value written to the node. */
+static int fake_sysfs_read(int node, char *buf, size_t len)
+{
+    ssize_t n = pread(g_nodes[node].fd, buf, len - 1, 0);
+
+    if (n < 0)
+        return -errno;
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* Removes the nodes and the directories made for them. */
+static void fake_sysfs_cleanup(void)
+{
+    size_t root = strlen(g_fake_root);
+    char *slash;
+    int i;
+
+    for (i = 0; i < NODE_COUNT; i++) {
+        close(g_nodes[i].fd);
+        g_nodes[i].fd = -1;
+        unlink(g_fake_paths[i]);
+        while ((slash = strrchr(g_fake_paths[i], '/')) &&
+                (size_t)(slash - g_fake_paths[i]) > root) {
+            *slash = '\0';
+            rmdir(g_fake_paths[i]);
+        }
+    }
+    rmdir(g_fake_root);
+}
+
+#endif  /* FAKE_SYSFS_H */
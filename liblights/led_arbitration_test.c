@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host simulator of the LED arbitration on a fake sysfs.
+ *
+ * Sends a random stream of battery, notification and attention requests
+ * (colours, off, solid, timed and hardware blinks, and the odd attention
+ * calls the framework makes) through the HAL entry points. After each one
+ * the led_blink node must show what a plain model of the rules says: the
+ * highest priority lit source, blinking if it asked for both an on and an
+ * off time. Also counts the writes that reach the node, and the requests
+ * of a source below the one shown, which must not write at all.
+ */
+
+#include "lights.c"
+#include "fake_sysfs.h"
+
+#define REQUESTS    100000
+
+typedef int (*set_light_fn)(struct light_device_t *,
+                            struct light_state_t const *);
+
+static const set_light_fn g_setters[LED_SOURCES] = {
+    [LED_BATTERY] = set_light_leds_battery,
+    [LED_NOTIFICATIONS] = set_light_leds_notifications,
+    [LED_ATTENTION] = set_light_leds_attention,
+};
+
+/* What each source asked for, as the model sees it. */
+struct model_source {
+    unsigned int color;
+    int on, off;
+};
+
+static void model_request(struct model_source *src, int type,
+                          struct light_state_t const *state)
+{
+    int mode = state->flashMode;
+    unsigned int color = state->color & 0x00ffffff;
+
+    /* The attention fix-ups, from the framework's callers. */
+    if (type == LED_ATTENTION && mode == LIGHT_FLASH_NONE)
+        color = 0;
+    if (type == LED_ATTENTION && mode == LIGHT_FLASH_HARDWARE &&
+            state->flashOnMS > 0 && state->flashOffMS == 0)
+        mode = LIGHT_FLASH_NONE;
+
+    src->color = color;
+    src->on = src->off = 0;
+    if (color && mode != LIGHT_FLASH_NONE && state->flashOnMS > 0 &&
+            state->flashOffMS > 0) {
+        src->on = state->flashOnMS;
+        src->off = state->flashOffMS;
+    }
+}
+
+/* The node content for the source on top, and which one that is. */
+static int model_shown(const struct model_source *srcs, char *buf, size_t len)
+{
+    int i;
+
+    for (i = LED_SOURCES - 1; i >= 0; i--) {
+        if (srcs[i].color) {
+            snprintf(buf, len, "0x%08x %d %d", srcs[i].color, srcs[i].on,
+                     srcs[i].off);
+            return i;
+        }
+    }
+    snprintf(buf, len, "0x%08x 0 0", 0);
+    return -1;
+}
+
+static void random_state(struct light_state_t *state)
+{
+    static const unsigned int colors[] = {
+        0x00ff0000, 0x0000ff00, 0x000000ff, 0x00ffffff, 0x00123456,
+    };
+    static const int times[] = { 0, 3, 500, 1000, 5000 };
+
+    memset(state, 0, sizeof(*state));
+    /* About half the requests switch the source off. */
+    state->color = rand() % 2 ? 0xff000000 | colors[rand() % 5] : 0xff000000;
+    state->flashMode = rand() % 3;      // NONE, TIMED, HARDWARE
+    state->flashOnMS = times[rand() % 5];
+    state->flashOffMS = times[rand() % 5];
+}
+
+int main(void)
+{
+    struct model_source srcs[LED_SOURCES] = { { 0, 0, 0 } };
+    struct light_state_t state;
+    char buf[64], expect[64];
+    unsigned int issued, skipped, mismatches = 0, below = 0, below_writes = 0;
+    int i, type, shown;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    pthread_once(&g_init, init_g_lock);
+    /* The LED is off at boot. */
+    model_shown(srcs, buf, sizeof(buf));
+    strcat(buf, "\n");
+    if (pwrite(g_nodes[NODE_LED_BLINK].fd, buf, strlen(buf), 0) < 0)
+        return 2;
+    srand(1);
+    issued = g_nodes[NODE_LED_BLINK].issued;
+    skipped = g_nodes[NODE_LED_BLINK].skipped;
+
+    for (i = 0; i < REQUESTS; i++) {
+        unsigned int before = g_nodes[NODE_LED_BLINK].issued +
+                g_nodes[NODE_LED_BLINK].skipped;
+
+        type = rand() % LED_SOURCES;
+        random_state(&state);
+        shown = model_shown(srcs, expect, sizeof(expect));
+
+        g_setters[type](NULL, &state);
+        model_request(&srcs[type], type, &state);
+
+        if (type < shown) {
+            below++;
+            if (g_nodes[NODE_LED_BLINK].issued +
+                    g_nodes[NODE_LED_BLINK].skipped != before)
+                below_writes++;
+        }
+
+        model_shown(srcs, expect, sizeof(expect));
+        fake_sysfs_read(NODE_LED_BLINK, buf, sizeof(buf));
+        if (strcmp(buf, expect)) {
+            if (mismatches++ < 5)
+                printf("  request %d, source %d: node \"%s\", expected \"%s\"\n",
+                       i, type, buf, expect);
+        }
+    }
+
+    issued = g_nodes[NODE_LED_BLINK].issued - issued;
+    skipped = g_nodes[NODE_LED_BLINK].skipped - skipped;
+    printf("%d requests: %u node writes, %u dropped as redundant\n",
+           REQUESTS, issued, skipped);
+    printf("%u requests below the source shown, %u of them wrote\n", below,
+           below_writes);
+    printf("%u times the node did not show the top source\n", mismatches);
+
+    fake_sysfs_cleanup();
+    return mismatches || below_writes;
+}
@@ -18,13 +18,19 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "lights"
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <hardware/lights.h>
 
@@ -36,47 +42,189 @@
 static pthread_once_t g_init = PTHREAD_ONCE_INIT;
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 
-char const*const PANEL_FILE = "/sys/class/backlight/panel/brightness";
-char const*const BUTTON_FILE = "/sys/class/sec/sec_touchkey/brightness";
+#define PANEL_FILE  "/sys/class/backlight/panel/brightness"
+#define BUTTON_FILE "/sys/class/sec/sec_touchkey/brightness"
 
-char const*const LED_BLINK = "/sys/class/sec/led/led_blink";
+#define LED_BLINK   "/sys/class/sec/led/led_blink"
+
+/*
+ * The sysfs nodes stay open for the life of the HAL and remember the last
+ * value written to them, so writing a value that is already there costs
+ * nothing; set_light_buttons, for one, is called on every user activity.
+ */
+struct sysfs_node {
+    char const *path;
+    int fd;
+    char last[32];              // Last value written, "" if unknown.
+    unsigned int issued;        // Writes that reached the node.
+    unsigned int skipped;       // Writes dropped as redundant.
+};
+
+enum {
+    NODE_PANEL = 0,
+    NODE_BUTTON,
+    NODE_LED_BLINK,
+    NODE_COUNT,
+};
+
+/* Counters are logged every this many requests on a node. */
+#define NODE_STATS_PERIOD   1024
+
+static char const *const g_node_paths[NODE_COUNT] = {
+    [NODE_PANEL] = PANEL_FILE,
+    [NODE_BUTTON] = BUTTON_FILE,
+    [NODE_LED_BLINK] = LED_BLINK,
+};
+
+static pthread_once_t g_nodes_init = PTHREAD_ONCE_INIT;
+static struct sysfs_node g_nodes[NODE_COUNT];
 
 struct led_config {
     unsigned int color;
     int delay_on, delay_off;
 };
 
-static struct led_config g_leds[3]; // For battery, notifications, and attention.
-static int g_cur_led = -1;          // Presently showing LED of the above.
+/*
+ * Each source multiplexed onto the LED keeps its own colour and blink;
+ * the highest set bit of g_led_active is the source on display. A colour,
+ * optionally alternating with off, is what the KTD2026 blinks by itself,
+ * so the AP does not have to wake up for it.
+ */
+enum {
+    LED_BATTERY = 0,
+    LED_NOTIFICATIONS,
+    LED_ATTENTION,
+    LED_SOURCES,                    // In increasing priority.
+};
+
+static struct led_config g_leds[LED_SOURCES];
+static unsigned int g_led_active;   // Bit per lit source.
+static int g_cur_led = -1;          // Presently showing source.
+
+/*
+ * Backlight writes are handed to a worker thread. During auto-brightness
+ * changes and slider drags the framework sets the backlight dozens of
+ * times a second, and the panel driver is slow to take a value; callers
+ * only publish the newest target and return.
+ *
+ * If BACKLIGHT_RAMP_PROP is set, the worker ramps from the brightness on
+ * the panel to the target over that many milliseconds, one step per
+ * display frame. A new target retargets the ramp from wherever it is, and
+ * the ease curve keeps the speed the ramp had. Targets that come in less
+ * than a frame apart are the framework animating by itself, and are
+ * written as they are. Steps equal to the value on the panel are not
+ * written. Switching the panel on or off is never ramped.
+ */
+#define BACKLIGHT_RAMP_PROP         "persist.lights.backlight_ramp_ms"
+#define BACKLIGHT_RAMP_CURVE_PROP   "persist.lights.backlight_ramp_curve"
+#define BACKLIGHT_RAMP_DEFAULT_MS   0
+#define BACKLIGHT_MAX               255
+#define BACKLIGHT_FRAME_NS          16666667LL  // 60Hz panel
+
+enum {
+    RAMP_CURVE_LINEAR = 0,
+    RAMP_CURVE_EASE,                // smoothstep, slow at both ends
+};
+
+struct backlight_writer {
+    pthread_mutex_t lock;
+    int event_fd;   // Wakes the worker for a new target.
+    int timer_fd;   // Ticks once a frame while ramping.
+    int target;     // Newest requested brightness.
+    int pending;    // Target not picked up by the worker yet.
+
+    /* Worker only. */
+    int written;    // Last brightness written, -1 if unknown.
+    int64_t last_target;
+    int ramp_from, ramp_to;
+    float ramp_v0;  // Speed at ramp_start, brightness per ramp length.
+    int64_t ramp_start;
+    int64_t ramp_ns;
+    int curve;
+};
+
+static pthread_once_t g_backlight_init = PTHREAD_ONCE_INIT;
+static struct backlight_writer g_backlight = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .event_fd = -1,
+    .timer_fd = -1,
+    .target = 0,
+    .pending = 0,
+    .written = -1,
+};
 
 void init_g_lock(void)
 {
     pthread_mutex_init(&g_lock, NULL);
 }
 
-static int write_int(char const *path, int value)
+static void init_sysfs_nodes(void)
 {
-    int fd;
-    static int already_warned;
+    int i;
 
-    already_warned = 0;
+    for (i = 0; i < NODE_COUNT; i++) {
+        g_nodes[i].path = g_node_paths[i];
+        g_nodes[i].fd = open(g_node_paths[i], O_RDWR | O_CLOEXEC);
+        if (g_nodes[i].fd < 0)
+            ALOGE("failed to open %s: %d\n", g_node_paths[i], -errno);
+    }
+}
 
-    ALOGV("write_int: path %s, value %d", path, value);
-    fd = open(path, O_RDWR);
+static void dump_sysfs_node(const struct sysfs_node *node)
+{
+    ALOGD("%s: %u writes, %u skipped, last \"%.*s\"", node->path,
+          node->issued, node->skipped,
+          (int)strcspn(node->last, "\n"), node->last);
+}
 
-    if (fd >= 0) {
-        char buffer[20];
-        int bytes = sprintf(buffer, "%d\n", value);
-        int amt = write(fd, buffer, bytes);
-        close(fd);
-        return amt == -1 ? -errno : 0;
+static void dump_sysfs_nodes(void)
+{
+    int i;
+
+    for (i = 0; i < NODE_COUNT; i++)
+        dump_sysfs_node(&g_nodes[i]);
+}
+
+static int write_str(struct sysfs_node *node, const char* value)
+{
+    size_t len = strlen(value);
+    int err = 0;
+
+    if (!strcmp(node->last, value)) {
+        node->skipped++;
+        goto out;
+    }
+
+    ALOGV("write_str: path %s, value %s", node->path, value);
+    if (node->fd < 0) {
+        /* Not there at init, e.g. a driver that probes late. */
+        node->fd = open(node->path, O_RDWR | O_CLOEXEC);
+        if (node->fd < 0)
+            return -errno;
+    }
+
+    node->issued++;
+    if (pwrite(node->fd, value, len, 0) == -1) {
+        err = -errno;
+        node->last[0] = '\0';
+    } else if (len < sizeof(node->last)) {
+        memcpy(node->last, value, len + 1);
     } else {
-        if (already_warned == 0) {
-            ALOGE("write_int failed to open %s\n", path);
-            already_warned = 1;
-        }
-        return -errno;
+        node->last[0] = '\0';
     }
+
+out:
+    if ((node->issued + node->skipped) % NODE_STATS_PERIOD == 0)
+        dump_sysfs_node(node);
+    return err;
+}
+
+static int write_int(struct sysfs_node *node, int value)
+{
+    char buffer[20];
+
+    snprintf(buffer, sizeof(buffer), "%d\n", value);
+    return write_str(node, buffer);
 }
 
 /* Currently unused.
@@ -96,29 +244,6 @@ static int read_int(char const *path)
 }
 */
 
-static int write_str(char const *path, const char* value)
-{
-    int fd;
-    static int already_warned;
-
-    already_warned = 0;
-
-    ALOGV("write_str: path %s, value %s", path, value);
-    fd = open(path, O_RDWR);
-
-    if (fd >= 0) {
-        int amt = write(fd, value, strlen(value));
-        close(fd);
-        return amt == -1 ? -errno : 0;
-    } else {
-        if (already_warned == 0) {
-            ALOGE("write_str failed to open %s\n", path);
-            already_warned = 1;
-        }
-        return -errno;
-    }
-}
-
 static int rgb_to_brightness(struct light_state_t const *state)
 {
     int color = state->color & 0x00ffffff;
@@ -143,16 +268,221 @@ static int is_lit(struct light_state_t const* state)
     return state->color & 0x00ffffff;
 }
 
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void backlight_set_timer(struct backlight_writer *w, int64_t period)
+{
+    struct itimerspec spec;
+
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(w->timer_fd, 0, &spec, NULL);
+}
+
+static void backlight_write(struct backlight_writer *w, int brightness)
+{
+    int err;
+
+    if (brightness == w->written)
+        return;
+
+    ALOGV("backlight_write: brightness %d", brightness);
+    /* The node's cache and counters are shared with the synchronous
+       fallback and dump_sysfs_nodes(). */
+    pthread_mutex_lock(&g_lock);
+    err = write_int(&g_nodes[NODE_PANEL], brightness);
+    pthread_mutex_unlock(&g_lock);
+    if (err)
+        ALOGE("failed to write %s: %d\n", PANEL_FILE, err);
+    w->written = err ? -1 : brightness;
+}
+
+/*
+ * Brightness the ramp has reached at 'now', and its speed if 'speed' is
+ * not NULL; ends the ramp when done. The ease curve is a cubic Hermite
+ * from ramp_from at speed ramp_v0 to ramp_to at rest, a smoothstep when
+ * it starts at rest.
+ */
+static int backlight_ramp_step(struct backlight_writer *w, int64_t now,
+                               float *speed)
+{
+    int64_t elapsed = now - w->ramp_start;
+    float from = w->ramp_from, to = w->ramp_to, v0 = w->ramp_v0;
+    float t, t2, t3, value;
+
+    if (elapsed >= w->ramp_ns) {
+        backlight_set_timer(w, 0);
+        w->ramp_from = w->ramp_to;
+        w->ramp_v0 = 0.f;
+        if (speed)
+            *speed = 0.f;
+        return w->ramp_to;
+    }
+
+    t = (float)elapsed / (float)w->ramp_ns;
+    if (w->curve == RAMP_CURVE_LINEAR) {
+        value = from + (to - from) * t;
+        if (speed)
+            *speed = to - from;
+    } else {
+        t2 = t * t;
+        t3 = t2 * t;
+        value = from * (2.f * t3 - 3.f * t2 + 1.f) + v0 * (t3 - 2.f * t2 + t)
+                + to * (3.f * t2 - 2.f * t3);
+        if (speed)
+            *speed = (from - to) * (6.f * t2 - 6.f * t)
+                    + v0 * (3.f * t2 - 4.f * t + 1.f);
+    }
+
+    /* Carrying on at speed may overshoot the ends, not switch off. */
+    if (value < 1.f)
+        return 1;
+    if (value > BACKLIGHT_MAX)
+        return BACKLIGHT_MAX;
+    return (int)(value + 0.5f);
+}
+
+static void backlight_retarget(struct backlight_writer *w, int brightness,
+                               int64_t now)
+{
+    int64_t since = now - w->last_target;
+    int from = w->written;
+    float speed = 0.f;
+
+    w->last_target = now;
+
+    /* Start from where a running ramp is now, not from its target. */
+    if (w->ramp_from != w->ramp_to)
+        from = backlight_ramp_step(w, now, &speed);
+
+    if (w->ramp_ns <= 0 || from <= 0 || brightness == 0 ||
+            since < BACKLIGHT_FRAME_NS) {
+        backlight_set_timer(w, 0);
+        w->ramp_from = w->ramp_to = brightness;
+        w->ramp_v0 = 0.f;
+        backlight_write(w, brightness);
+        return;
+    }
+
+    w->ramp_from = from;
+    w->ramp_to = brightness;
+    w->ramp_v0 = speed;
+    w->ramp_start = now;
+    if (from != brightness)
+        backlight_set_timer(w, BACKLIGHT_FRAME_NS);
+}
+
+static void *backlight_thread(void *arg)
+{
+    struct backlight_writer *w = arg;
+    struct pollfd fds[2];
+    uint64_t count;
+    int brightness, pending;
+
+    fds[0].fd = w->event_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = w->timer_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR)
+                ALOGE("backlight_thread: poll failed: %d\n", -errno);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if (read(w->event_fd, &count, sizeof(count)) < 0)
+                ALOGE("backlight_thread: read failed: %d\n", -errno);
+            pthread_mutex_lock(&w->lock);
+            brightness = w->target;
+            pending = w->pending;
+            w->pending = 0;
+            pthread_mutex_unlock(&w->lock);
+
+            /* Requests that came in meanwhile are simply overwritten. */
+            if (pending)
+                backlight_retarget(w, brightness, monotonic_ns());
+        }
+
+        if (fds[1].revents & POLLIN) {
+            if (read(w->timer_fd, &count, sizeof(count)) < 0)
+                ALOGE("backlight_thread: read failed: %d\n", -errno);
+            if (w->ramp_from != w->ramp_to)
+                backlight_write(w, backlight_ramp_step(w, monotonic_ns(), NULL));
+        }
+    }
+
+    return NULL;
+}
+
+static void init_backlight_writer(void)
+{
+    struct backlight_writer *w = &g_backlight;
+    char value[PROPERTY_VALUE_MAX];
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    w->ramp_ns = property_get_int32(BACKLIGHT_RAMP_PROP,
+                                    BACKLIGHT_RAMP_DEFAULT_MS) * 1000000LL;
+    property_get(BACKLIGHT_RAMP_CURVE_PROP, value, "ease");
+    w->curve = strcmp(value, "linear") ? RAMP_CURVE_EASE : RAMP_CURVE_LINEAR;
+
+    w->event_fd = eventfd(0, EFD_CLOEXEC);
+    w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (g_nodes[NODE_PANEL].fd < 0 || w->event_fd < 0 || w->timer_fd < 0) {
+        ALOGE("failed to set up the backlight writer: %d, writing synchronously\n",
+              -errno);
+        goto fail;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, backlight_thread, w)) {
+        ALOGE("failed to start the backlight writer, writing synchronously\n");
+        pthread_attr_destroy(&attr);
+        goto fail;
+    }
+    pthread_attr_destroy(&attr);
+    return;
+
+fail:
+    if (w->event_fd >= 0)
+        close(w->event_fd);
+    if (w->timer_fd >= 0)
+        close(w->timer_fd);
+    w->event_fd = w->timer_fd = -1;
+}
+
 static int set_light_backlight(struct light_device_t *dev,
             struct light_state_t const *state)
 {
+    struct backlight_writer *w = &g_backlight;
     int err = 0;
     int brightness = rgb_to_brightness(state);
 
-    pthread_mutex_lock(&g_lock);
-    err = write_int(PANEL_FILE, brightness);
+    if (w->event_fd < 0) {
+        pthread_mutex_lock(&g_lock);
+        err = write_int(&g_nodes[NODE_PANEL], brightness);
+        pthread_mutex_unlock(&g_lock);
+        return err;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->target = brightness;
+    w->pending = 1;
+    pthread_mutex_unlock(&w->lock);
+
+    if (eventfd_write(w->event_fd, 1))
+        err = -errno;
 
-    pthread_mutex_unlock(&g_lock);
     return err;
 }
 
@@ -164,16 +494,18 @@ set_light_buttons(struct light_device_t* dev,
     int on = is_lit(state);
 
     pthread_mutex_lock(&g_lock);
-    err = write_int(BUTTON_FILE, on?1:0);
+    err = write_int(&g_nodes[NODE_BUTTON], on?1:0);
     pthread_mutex_unlock(&g_lock);
 
     return err;
-
 }
 
 static int close_lights(struct light_device_t *dev)
 {
     ALOGV("close_light is called");
+    pthread_mutex_lock(&g_lock);
+    dump_sysfs_nodes();
+    pthread_mutex_unlock(&g_lock);
     if (dev)
         free(dev);
 
@@ -207,87 +539,98 @@ static int write_leds(const struct led_config *led)
     blink[count+1] = '\0';
 
     pthread_mutex_lock(&g_lock);
-    err = write_str(LED_BLINK, blink);
+    err = write_str(&g_nodes[NODE_LED_BLINK], blink);
     pthread_mutex_unlock(&g_lock);
 
     return err;
 }
 
+/* Solid or blinking colour, as the framework asks for it. */
+static int led_config_from_state(struct light_state_t const *state,
+                                 struct led_config *led)
+{
+    int on = 0, off = 0;
+
+    switch (state->flashMode) {
+    case LIGHT_FLASH_NONE:
+        /* Set LED to a solid color, spec is unclear on the exact behavior here. */
+        break;
+    case LIGHT_FLASH_TIMED:
+    case LIGHT_FLASH_HARDWARE:
+        on = state->flashOnMS;
+        off = state->flashOffMS;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    led->color = state->color & 0x00ffffff;
+    if (led->color && on > 0 && off > 0) {
+        led->delay_on = on;
+        led->delay_off = off;
+    } else {
+        led->delay_on = led->delay_off = 0;
+    }
+
+    return 0;
+}
+
 static int set_light_leds(struct light_state_t const *state, int type)
 {
     struct led_config *led;
-    int err = 0;
+    int err, top;
 
     ALOGD("%s: type=%d, color=0x%010x, fM=%d, fOnMS=%d, fOffMs=%d.", __func__,
           type, state->color,state->flashMode, state->flashOnMS, state->flashOffMS);
 
-    if (type < 0 || (unsigned int)type >= sizeof(g_leds)/sizeof(g_leds[0]))
+    if (type < 0 || type >= LED_SOURCES)
         return -EINVAL;
 
     /* type is one of:
      *   0. battery
      *   1. notifications
      *   2. attention
-     * which are multiplexed onto the same physical LED in the above order. */
+     * which are multiplexed onto the same physical LED in the above order;
+     * type is also the bit of the source in g_led_active, see below. */
     led = &g_leds[type];
+    err = led_config_from_state(state, led);
+    if (err)
+        return err;
 
-    switch (state->flashMode) {
-    case LIGHT_FLASH_NONE:
-        /* Set LED to a solid color, spec is unclear on the exact behavior here. */
-        led->delay_on = led->delay_off = 0;
-        break;
-    case LIGHT_FLASH_TIMED:
-    case LIGHT_FLASH_HARDWARE:
-        led->delay_on  = state->flashOnMS;
-        led->delay_off = state->flashOffMS;
-        break;
-    default:
-        return -EINVAL;
-    }
+    if (led->color)
+        g_led_active |= 1u << type;
+    else
+        g_led_active &= ~(1u << type);
 
-    led->color = state->color & 0x00ffffff;
+    /* The highest set bit is the source on display, so the priority
+       order is the bit order: battery < notifications < attention. */
+    top = g_led_active ? 31 - __builtin_clz(g_led_active) : -1;
 
-    if (led->color > 0) {
-        /* This LED is lit. */
-        if (type >= g_cur_led) {
-            /* And it has the highest priority, so show it. */
-            err = write_leds(led);
-            g_cur_led = type;
-        }
-    } else {
-        /* This LED is not (any longer) lit. */
-        if (type == g_cur_led) {
-            /* But it is currently showing, switch to a lower-priority LED. */
-            int i;
-
-            for (i = type-1; i >= 0; i--) {
-                if (g_leds[i].color > 0) {
-                    /* Found a lower-priority LED to switch to. */
-                    err = write_leds(&g_leds[i]);
-                    goto switched;
-                }
-            }
-
-            /* No LEDs are lit, turn off. */
-            err = write_leds(NULL);
-switched:
-            g_cur_led = i;
-        }
+    /* Lower priority sources change without touching the hardware. */
+    if (top != g_cur_led || top == type) {
+        err = write_leds(top < 0 ? NULL : &g_leds[top]);
+        g_cur_led = top;
     }
 
     return err;
 }
 
+/*
+ * The type each entry point passes is its bit in g_led_active, and
+ * set_light_leds() shows the highest set bit: battery is bit 0,
+ * notifications bit 1 and attention bit 2. Keep LED_BATTERY,
+ * LED_NOTIFICATIONS and LED_ATTENTION in that order.
+ */
 static int set_light_leds_battery(struct light_device_t *dev,
             struct light_state_t const *state)
 {
-    return set_light_leds(state, 0);
+    return set_light_leds(state, LED_BATTERY);
 }
 
 static int set_light_leds_notifications(struct light_device_t *dev,
             struct light_state_t const *state)
 {
-    return set_light_leds(state, 1);
+    return set_light_leds(state, LED_NOTIFICATIONS);
 }
 
 static int set_light_leds_attention(struct light_device_t *dev,
@@ -312,7 +655,7 @@ static int set_light_leds_attention(struct light_device_t *dev,
         break;
     }
 
-    return set_light_leds(&fixed, 2);
+    return set_light_leds(&fixed, LED_ATTENTION);
 }
 
 static int open_lights(const struct hw_module_t *module, char const *name,
@@ -335,6 +678,9 @@ static int open_lights(const struct hw_module_t *module, char const *name,
         return -EINVAL;
 
     pthread_once(&g_init, init_g_lock);
+    pthread_once(&g_nodes_init, init_sysfs_nodes);
+    if (set_light == set_light_backlight)
+        pthread_once(&g_backlight_init, init_backlight_writer);
 
     struct light_device_t *dev = malloc(sizeof(struct light_device_t));
     memset(dev, 0, sizeof(*dev));
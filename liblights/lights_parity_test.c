@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the values the HAL writes for a colour, on a fake sysfs.
+ *
+ * Colours go through set_light_backlight() and the notification LED, and
+ * the panel and led_blink nodes must hold what the old HAL wrote for
+ * them: the brightness from the weighted sum of the channels, and the
+ * framework's colour as is.
+ */
+
+#include "lights.c"
+#include "fake_sysfs.h"
+
+#define COLOURS         (1 << 24)
+/* colours sent through the HAL entry points */
+#define HAL_STEP        0x010307
+
+static int old_rgb_to_brightness(struct light_state_t const *state)
+{
+    int color = state->color & 0x00ffffff;
+
+    return ((77*((color>>16) & 0x00ff))
+        + (150*((color>>8) & 0x00ff)) + (29*(color & 0x00ff))) >> 8;
+}
+
+int main(void)
+{
+    struct light_state_t state;
+    char buf[64], expect[64];
+    unsigned int c, panel = 0, leds = 0, sent = 0;
+
+    memset(&state, 0, sizeof(state));
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    pthread_once(&g_init, init_g_lock);
+
+    for (c = HAL_STEP; c < COLOURS; c += HAL_STEP) {
+        state.color = 0xff000000 | c;
+        state.flashMode = LIGHT_FLASH_NONE;
+        sent++;
+
+        /* The writer thread is not started, so this writes in place. */
+        set_light_backlight(NULL, &state);
+        fake_sysfs_read(NODE_PANEL, buf, sizeof(buf));
+        if (atoi(buf) != old_rgb_to_brightness(&state))
+            panel++;
+
+        set_light_leds_notifications(NULL, &state);
+        fake_sysfs_read(NODE_LED_BLINK, buf, sizeof(buf));
+        snprintf(expect, sizeof(expect), "0x%08x 0 0", c);
+        if (strcmp(buf, expect))
+            leds++;
+    }
+    printf("through the HAL: %u colours, %u panel and %u LED values differ\n",
+           sent, panel, leds);
+
+    fake_sysfs_cleanup();
+    return panel || leds;
+}
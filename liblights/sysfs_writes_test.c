@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the open sysfs nodes and their redundant write check, on a
+ * fake sysfs.
+ *
+ * 100000 set_light_buttons() calls, the light toggling every 50 calls as
+ * it does when the framework passes user activity down, against writing
+ * the node the way the HAL did before: open, write and close it on every
+ * call. It prints the time per call and the writes that reach the node.
+ * Then it makes a write to the node fail once, and checks that the same
+ * value is written again on the next call rather than skipped.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+static int g_fail_fd = -1;
+
+/* pwrite() of lights.c; fails once on g_fail_fd, then clears it */
+static ssize_t failing_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+    if (fd >= 0 && fd == g_fail_fd) {
+        g_fail_fd = -1;
+        errno = EIO;
+        return -1;
+    }
+    return pwrite(fd, buf, len, off);
+}
+
+#define pwrite failing_pwrite
+#include "lights.c"
+#undef pwrite
+#include "fake_sysfs.h"
+
+#define CALLS           100000
+#define TOGGLE_EVERY    50
+
+/* what write_int() did before the nodes were kept open */
+static int write_int_reopen(char const *path, int value)
+{
+    char buffer[20];
+    int fd, bytes, amt;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -errno;
+    bytes = snprintf(buffer, sizeof(buffer), "%d\n", value);
+    amt = write(fd, buffer, bytes);
+    close(fd);
+    return amt == -1 ? -errno : 0;
+}
+
+static int button_value(void)
+{
+    char buf[32];
+
+    return fake_sysfs_read(NODE_BUTTON, buf, sizeof(buf)) ? -1 : atoi(buf);
+}
+
+static int check(int ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(void)
+{
+    struct light_state_t state;
+    struct sysfs_node *node;
+    int64_t start, reopen_ns, open_ns;
+    unsigned int issued, skipped;
+    int i, on, failed = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    node = &g_nodes[NODE_BUTTON];
+    memset(&state, 0, sizeof(state));
+
+    start = monotonic_ns();
+    for (i = 0; i < CALLS; i++) {
+        on = (i / TOGGLE_EVERY) & 1;
+        write_int_reopen(node->path, on);
+    }
+    reopen_ns = monotonic_ns() - start;
+
+    issued = node->issued;
+    skipped = node->skipped;
+    start = monotonic_ns();
+    for (i = 0; i < CALLS; i++) {
+        on = (i / TOGGLE_EVERY) & 1;
+        state.color = on ? 0xffffffff : 0;
+        set_light_buttons(NULL, &state);
+    }
+    open_ns = monotonic_ns() - start;
+    issued = node->issued - issued;
+    skipped = node->skipped - skipped;
+
+    printf("%d calls, the light toggling every %d\n", CALLS, TOGGLE_EVERY);
+    printf("%-28s %6.3f us per call  %6d writes\n", "open, write, close",
+           reopen_ns / 1e3 / CALLS, CALLS);
+    printf("%-28s %6.3f us per call  %6u writes, %u skipped\n",
+           "open node, redundant check", open_ns / 1e3 / CALLS, issued,
+           skipped);
+
+    failed |= check(issued == CALLS / TOGGLE_EVERY,
+                    "one write per toggle reaches the node");
+    failed |= check(issued + skipped == CALLS, "every call counted");
+    failed |= check(button_value() == on, "the node holds the last value");
+
+    /* a failed write must not be remembered as written */
+    on = !on;
+    state.color = on ? 0xffffffff : 0;
+    g_fail_fd = node->fd;
+    set_light_buttons(NULL, &state);
+    failed |= check(button_value() == !on, "the failed write left the node");
+    issued = node->issued;
+    set_light_buttons(NULL, &state);
+    failed |= check(node->issued == issued + 1 && button_value() == on,
+                    "the same value goes through after a failure");
+
+    fake_sysfs_cleanup();
+    return failed;
+}
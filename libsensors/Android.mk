@@ -60,6 +60,12 @@ LOCAL_SRC_FILES += MPLSensor.cpp
 LOCAL_SRC_FILES += ../../../../$(INVENSENSE_IIO_PATH)/MPLSupport.cpp
 LOCAL_SRC_FILES += ../../../../$(INVENSENSE_IIO_PATH)/InputEventReader.cpp
 LOCAL_SRC_FILES += CompassSensor.HSCDTD008A.cpp
+LOCAL_SRC_FILES += CompassCalibrator.cpp
+LOCAL_SRC_FILES += CalibrationStore.cpp
+LOCAL_SRC_FILES += DirectChannel.cpp
+LOCAL_SRC_FILES += SensorTrace.cpp
+LOCAL_SRC_FILES += TimestampNormalizer.cpp
+LOCAL_SRC_FILES += MahonyFusion.cpp
 
 LOCAL_C_INCLUDES += $(INVENSENSE_IIO_PATH)
 LOCAL_C_INCLUDES += $(INVENSENSE_IIO_PATH)/software/core/mllite
@@ -151,4 +157,150 @@ OVERRIDE_BUILT_MODULE_PATH := $(TARGET_OUT_INTERMEDIATE_LIBRARIES)
 LOCAL_STRIP_MODULE := true
 include $(BUILD_PREBUILT)
 
+
+# synthetic IIO data for exercising MPLSensor::buildMpuEvent() on a host
+include $(CLEAR_VARS)
+LOCAL_MODULE := mpu_packet_gen
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	mpu_packet_gen.cpp \
+	MpuPacketGenerator.cpp \
+	SensorTrace.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+
+# per-sensor decimation of readEvents() over a replayed or generated trace
+include $(CLEAR_VARS)
+LOCAL_MODULE := decimation_replay_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	decimation_replay_test.cpp \
+	MpuPacketGenerator.cpp \
+	SensorTrace.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+
+# wakeups of the step count timer per batch() setting
+include $(CLEAR_VARS)
+LOCAL_MODULE := step_count_timer_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := step_count_timer_test.cpp
+include $(BUILD_HOST_EXECUTABLE)
+
+# batch timeouts against a simulated FIFO for each batch output
+include $(CLEAR_VARS)
+LOCAL_MODULE := batch_fifo_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := batch_fifo_test.cpp
+include $(BUILD_HOST_EXECUTABLE)
+
+# TimestampNormalizer on synthetic clocks across suspends
+include $(CLEAR_VARS)
+LOCAL_MODULE := timestamp_normalizer_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	timestamp_normalizer_test.cpp \
+	TimestampNormalizer.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+
+# updateNavDerived() math against the MPL handlers it replaced
+include $(CLEAR_VARS)
+LOCAL_MODULE := nav_derived_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	nav_derived_test.cpp \
+	MpuPacketGenerator.cpp \
+	SensorTrace.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+
+# CompassCalibrator with a stand-in for the vendor calibration library
+include $(CLEAR_VARS)
+LOCAL_MODULE := compass_calibrator_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	compass_calibrator_test.cpp \
+	CompassCalibrator.cpp
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# CalibrationStore against writing the calibration file in place
+include $(CLEAR_VARS)
+LOCAL_MODULE := calibration_store_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	calibration_store_test.cpp \
+	CalibrationStore.cpp
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# interrupt-to-event time of the DMP features, attribute reads now and before
+include $(CLEAR_VARS)
+LOCAL_MODULE := dmp_interrupt_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := dmp_interrupt_test.cpp
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# gyro bias vs. die temperature table on synthetic temperature ramps
+include $(CLEAR_VARS)
+LOCAL_MODULE := gyro_temp_bias_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	gyro_temp_bias_test.cpp \
+	CalibrationStore.cpp
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# time to the first HIGH gyro event with a cached bias reapplied
+include $(CLEAR_VARS)
+LOCAL_MODULE := bias_warm_start_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	bias_warm_start_test.cpp \
+	CalibrationStore.cpp \
+	SensorTrace.cpp
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# direct report ring read by another process at the FAST rate
+include $(CLEAR_VARS)
+LOCAL_MODULE := direct_channel_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	direct_channel_test.cpp \
+	DirectChannel.cpp
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+include $(BUILD_HOST_EXECUTABLE)
+
+# fallback fusion against the MPL on a recorded or generated trace
+include $(CLEAR_VARS)
+LOCAL_MODULE := fusion_compare_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Werror -Wall
+LOCAL_SRC_FILES := \
+	fusion_compare_test.cpp \
+	MahonyFusion.cpp \
+	MpuPacketGenerator.cpp \
+	SensorTrace.cpp
+LOCAL_SHARED_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+
 endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BATCH_FIFO_H
+#define BATCH_FIFO_H
+
+#include <stdint.h>
+
+/* hardware FIFO size and bytes per sample in it, used to keep the batch
+   timeout below the time the FIFO takes to fill up */
+#define MPU_FIFO_SIZE                   4096
+#define FIFO_HEADER_BYTES               2
+#define FIFO_GYRO_BYTES                 6
+#define FIFO_ACCEL_BYTES                6
+#define FIFO_COMPASS_BYTES              6
+#define FIFO_QUAT_BYTES                 12
+#define FIFO_PED_QUAT_BYTES             6
+/* a step, standalone or next to other outputs, is a DMP timestamp */
+#define FIFO_STEP_BYTES                 4
+/* fastest cadence planned for, a sprint is about 3.5 steps/s */
+#define FIFO_STEP_MAX_HZ                4
+/* share of the fill time used as timeout, leaves room for wakeup latency */
+#define FIFO_SAFE_PERCENT               90
+
+/*
+ * What the FIFO holds in batch mode: the period (ns) each output is
+ * programmed at by setBatchDataRates(), 0 for an output that is off.
+ * Steps are on when computeBatchDataOutput() picks the pedometer
+ * indicator or standalone output.
+ */
+struct batch_fifo_t {
+    int64_t gyro;
+    int64_t accel;
+    int64_t compass;
+    int64_t quat;
+    int64_t pedQuat;
+    bool steps;
+};
+
+static inline int64_t batchFifoStreamRate(int64_t period, int bytes)
+{
+    return period > 0 ? (FIFO_HEADER_BYTES + bytes) * 1000000000LL / period : 0;
+}
+
+/* bytes per second put into the FIFO */
+static inline int64_t batchFifoFillRate(const batch_fifo_t *fifo)
+{
+    int64_t bytes = 0;
+
+    bytes += batchFifoStreamRate(fifo->gyro, FIFO_GYRO_BYTES);
+    bytes += batchFifoStreamRate(fifo->accel, FIFO_ACCEL_BYTES);
+    bytes += batchFifoStreamRate(fifo->compass, FIFO_COMPASS_BYTES);
+    bytes += batchFifoStreamRate(fifo->quat, FIFO_QUAT_BYTES);
+    bytes += batchFifoStreamRate(fifo->pedQuat, FIFO_PED_QUAT_BYTES);
+    if (fifo->steps)
+        bytes += (FIFO_HEADER_BYTES + FIFO_STEP_BYTES) * FIFO_STEP_MAX_HZ;
+    return bytes;
+}
+
+/* The kernel only drains the FIFO when the batch timeout expires, so a
+   timeout longer than the FIFO takes to fill loses data. The longest
+   timeout not above 'requestedMs' that is safe at 'rate' bytes/s. */
+static inline int64_t batchFifoTimeout(int64_t rate, int64_t requestedMs)
+{
+    int64_t plannedMs = requestedMs;
+
+    if (rate > 0) {
+        int64_t safeMs = MPU_FIFO_SIZE * 1000LL / rate * FIFO_SAFE_PERCENT / 100;
+        if (plannedMs > safeMs)
+            plannedMs = safeMs;
+    }
+    return plannedMs < 1 ? 1 : plannedMs;
+}
+
+#endif  /* BATCH_FIFO_H */
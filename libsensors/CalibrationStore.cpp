@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cutils/log.h>
+#include <hardware/sensors.h>
+
+#include "CalibrationStore.h"
+
+#define CAL_STORE_DEBUG 0
+
+static int64_t clockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t monotonicNs(void)
+{
+    return clockNs(CLOCK_MONOTONIC);
+}
+
+static char *makeTmpPath(const char *path)
+{
+    char *tmp = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp) {
+        strcpy(tmp, path);
+        strcat(tmp, ".tmp");
+    }
+    return tmp;
+}
+
+CalibrationStore::CalibrationStore(const char *path, const char *cachePath,
+                                   cal_clock_t clock)
+    : mThreadStarted(false),
+      mClock(clock ? clock : monotonicNs),
+      mWriterBusy(false),
+      mExit(false),
+      mTemperature(0),
+      mGyroTempValid(0),
+      mDirty(false),
+      mStateChanged(false),
+      mLastCommitTime(mClock()),
+      mPending(NULL),
+      mPendingLen(0),
+      mPendingSize(0),
+      mPendingValid(false),
+      mLastWriteTime(0),
+      mFileWrites(0)
+{
+    pthread_condattr_t attr;
+
+    memset(mBias, 0, sizeof(mBias));
+    memset(mAccuracy, 0, sizeof(mAccuracy));
+    memset(mBiasTemperature, 0, sizeof(mBiasTemperature));
+    memset(mBiasTime, 0, sizeof(mBiasTime));
+    memset(mGyroTemp, 0, sizeof(mGyroTemp));
+    memset(mGyroTempTime, 0, sizeof(mGyroTempTime));
+    memset(&mPendingCache, 0, sizeof(mPendingCache));
+    mPath = strdup(path);
+    mTmpPath = makeTmpPath(path);
+    mCachePath = strdup(cachePath);
+    mCacheTmpPath = makeTmpPath(cachePath);
+
+    pthread_mutex_init(&mLock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mCond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&mIdleCond, NULL);
+
+    if (!mPath || !mTmpPath || !mCachePath || !mCacheTmpPath) {
+        ALOGE("CalStore: unable to allocate path for %s", path);
+        return;
+    }
+    if (pthread_create(&mThread, NULL, writerThread, this)) {
+        ALOGE("CalStore: unable to start writer thread");
+        return;
+    }
+    mThreadStarted = true;
+}
+
+CalibrationStore::~CalibrationStore()
+{
+    if (mThreadStarted) {
+        pthread_mutex_lock(&mLock);
+        mExit = true;
+        pthread_cond_signal(&mCond);
+        pthread_mutex_unlock(&mLock);
+        pthread_join(mThread, NULL);
+    }
+    pthread_cond_destroy(&mIdleCond);
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+    free(mPending);
+    free(mCacheTmpPath);
+    free(mCachePath);
+    free(mTmpPath);
+    free(mPath);
+}
+
+void CalibrationStore::updateBias(int which, const long *bias, int accuracy)
+{
+    if (which < 0 || which >= CAL_BIAS_NUM)
+        return;
+
+    pthread_mutex_lock(&mLock);
+    if (memcmp(mBias[which], bias, sizeof(mBias[which]))) {
+        memcpy(mBias[which], bias, sizeof(mBias[which]));
+        mAccuracy[which] = accuracy;
+        mBiasTemperature[which] = mTemperature;
+        mBiasTime[which] = clockNs(CLOCK_REALTIME);
+        mDirty = true;
+    } else if (accuracy > mAccuracy[which]) {
+        /* the same bias read back, e.g. after it was reapplied with a
+           lower accuracy, keeps when and how well it was learned */
+        mAccuracy[which] = accuracy;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void CalibrationStore::setTemperature(int64_t temperature)
+{
+    pthread_mutex_lock(&mLock);
+    mTemperature = temperature;
+    pthread_mutex_unlock(&mLock);
+}
+
+void CalibrationStore::markStateChanged()
+{
+    pthread_mutex_lock(&mLock);
+    mStateChanged = true;
+    pthread_mutex_unlock(&mLock);
+}
+
+bool CalibrationStore::isDirty()
+{
+    bool dirty;
+
+    pthread_mutex_lock(&mLock);
+    dirty = mDirty || mStateChanged;
+    pthread_mutex_unlock(&mLock);
+    return dirty;
+}
+
+bool CalibrationStore::isSaveDue()
+{
+    bool due;
+
+    pthread_mutex_lock(&mLock);
+    int64_t age = mClock() - mLastCommitTime;
+    due = (mDirty && age >= CAL_STORE_MIN_INTERVAL_NS) ||
+            (mStateChanged && age >= CAL_STORE_STATE_INTERVAL_NS);
+    pthread_mutex_unlock(&mLock);
+    return due;
+}
+
+void CalibrationStore::markClean()
+{
+    pthread_mutex_lock(&mLock);
+    mDirty = false;
+    mStateChanged = false;
+    pthread_mutex_unlock(&mLock);
+}
+
+int CalibrationStore::commit(const unsigned char *data, size_t len)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&mLock);
+    if (len > mPendingSize) {
+        unsigned char *buf = (unsigned char *)realloc(mPending, len);
+        if (!buf) {
+            err = -ENOMEM;
+            goto done;
+        }
+        mPending = buf;
+        mPendingSize = len;
+    }
+    memcpy(mPending, data, len);
+    mPendingLen = len;
+
+    mPendingCache.magic = CAL_CACHE_MAGIC;
+    mPendingCache.version = CAL_CACHE_VERSION;
+    for (int i = 0; i < CAL_BIAS_NUM; i++) {
+        for (int j = 0; j < 3; j++)
+            mPendingCache.bias[i][j] = (int32_t)mBias[i][j];
+        mPendingCache.accuracy[i] = mAccuracy[i];
+        mPendingCache.temperature[i] = mBiasTemperature[i];
+        mPendingCache.time[i] = mBiasTime[i];
+    }
+    mPendingCache.gyroTempValid = mGyroTempValid;
+    for (int i = 0; i < CAL_GYRO_TEMP_BINS; i++) {
+        for (int j = 0; j < 3; j++)
+            mPendingCache.gyroTemp[i][j] = (int32_t)mGyroTemp[i][j];
+        mPendingCache.gyroTempTime[i] = mGyroTempTime[i];
+    }
+
+    mPendingValid = true;
+    mDirty = false;
+    mStateChanged = false;
+    mLastCommitTime = mClock();
+    pthread_cond_signal(&mCond);
+done:
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+int CalibrationStore::loadBiasCache()
+{
+    cal_bias_cache_t cache;
+    int fd = open(mCachePath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    ssize_t res = read(fd, &cache, sizeof(cache));
+    close(fd);
+    if (res != (ssize_t)sizeof(cache) ||
+            cache.magic != CAL_CACHE_MAGIC ||
+            cache.version != CAL_CACHE_VERSION) {
+        ALOGW("CalStore: ignoring invalid bias cache %s", mCachePath);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&mLock);
+    for (int i = 0; i < CAL_BIAS_NUM; i++) {
+        for (int j = 0; j < 3; j++)
+            mBias[i][j] = cache.bias[i][j];
+        mAccuracy[i] = cache.accuracy[i];
+        mBiasTemperature[i] = cache.temperature[i];
+        mBiasTime[i] = cache.time[i];
+    }
+    mGyroTempValid = cache.gyroTempValid;
+    for (int i = 0; i < CAL_GYRO_TEMP_BINS; i++) {
+        for (int j = 0; j < 3; j++)
+            mGyroTemp[i][j] = cache.gyroTemp[i][j];
+        mGyroTempTime[i] = cache.gyroTempTime[i];
+    }
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+bool CalibrationStore::getBias(int which, bool haveTemperature,
+                               int64_t temperature, long *bias, int *accuracy)
+{
+    bool usable, trusted;
+
+    if (which < 0 || which >= CAL_BIAS_NUM)
+        return false;
+
+    pthread_mutex_lock(&mLock);
+    int64_t age = clockNs(CLOCK_REALTIME) - mBiasTime[which];
+    int64_t delta = temperature - mBiasTemperature[which];
+
+    usable = mBiasTime[which] && mAccuracy[which] > 0 &&
+            age >= 0 && age <= CAL_CACHE_MAX_AGE_NS;
+    if (haveTemperature &&
+            (delta > CAL_CACHE_MAX_TEMP_DELTA || delta < -CAL_CACHE_MAX_TEMP_DELTA))
+        usable = false;
+    if (usable) {
+        memcpy(bias, mBias[which], sizeof(mBias[which]));
+        *accuracy = mAccuracy[which];
+        /* the MPL has not seen it converge in this session, only a bias
+           learned moments ago in the same conditions keeps its accuracy */
+        trusted = haveTemperature && age <= CAL_CACHE_TRUST_AGE_NS &&
+                delta <= CAL_CACHE_TRUST_TEMP_DELTA &&
+                delta >= -CAL_CACHE_TRUST_TEMP_DELTA;
+        if (!trusted && *accuracy > SENSOR_STATUS_ACCURACY_MEDIUM)
+            *accuracy = SENSOR_STATUS_ACCURACY_MEDIUM;
+    }
+    pthread_mutex_unlock(&mLock);
+    return usable;
+}
+
+int CalibrationStore::gyroTempBin(int64_t temperature)
+{
+    int64_t bin;
+
+    if (temperature < CAL_GYRO_TEMP_MIN)
+        return -1;
+    bin = (temperature - CAL_GYRO_TEMP_MIN) / CAL_GYRO_TEMP_BIN_WIDTH;
+    return bin < CAL_GYRO_TEMP_BINS ? (int)bin : -1;
+}
+
+int CalibrationStore::learnGyroBias(const long *bias)
+{
+    pthread_mutex_lock(&mLock);
+    int bin = gyroTempBin(mTemperature);
+    if (bin >= 0) {
+        /* converge quickly, but do not let a single sample replace a
+           bin that was learned several times */
+        for (int i = 0; i < 3; i++) {
+            if (mGyroTempValid & (1ULL << bin))
+                mGyroTemp[bin][i] = (mGyroTemp[bin][i] * 3 + bias[i]) / 4;
+            else
+                mGyroTemp[bin][i] = bias[i];
+        }
+        mGyroTempValid |= (1ULL << bin);
+        mGyroTempTime[bin] = clockNs(CLOCK_REALTIME);
+        mDirty = true;
+    }
+    pthread_mutex_unlock(&mLock);
+    return bin;
+}
+
+bool CalibrationStore::lookupGyroBias(int64_t temperature, long *bias,
+                                      int *accuracy)
+{
+    bool found = false;
+    int bin = gyroTempBin(temperature);
+
+    pthread_mutex_lock(&mLock);
+    if (bin >= 0 && (mGyroTempValid & (1ULL << bin))) {
+        int64_t age = clockNs(CLOCK_REALTIME) - mGyroTempTime[bin];
+
+        memcpy(bias, mGyroTemp[bin], sizeof(mGyroTemp[bin]));
+        /* the bias drifts with age too, an old bin still beats the bias
+           of another temperature but not by much */
+        *accuracy = age >= 0 && age <= CAL_CACHE_MAX_AGE_NS ?
+                SENSOR_STATUS_ACCURACY_MEDIUM : SENSOR_STATUS_ACCURACY_LOW;
+        found = true;
+    }
+    pthread_mutex_unlock(&mLock);
+    return found;
+}
+
+bool CalibrationStore::takeGyroTempBias(int64_t temperature, bool force,
+                                        int *bin, long *bias, int *accuracy)
+{
+    int newBin = gyroTempBin(temperature);
+
+    if (!force && newBin == *bin)
+        return false;
+    *bin = newBin;
+    return lookupGyroBias(temperature, bias, accuracy);
+}
+
+unsigned int CalibrationStore::syncWriter()
+{
+    unsigned int writes;
+
+    pthread_mutex_lock(&mLock);
+    if (mThreadStarted) {
+        mWriterBusy = true;
+        pthread_cond_signal(&mCond);
+        while (mWriterBusy)
+            pthread_cond_wait(&mIdleCond, &mLock);
+    }
+    writes = mFileWrites;
+    pthread_mutex_unlock(&mLock);
+    return writes;
+}
+
+/* called with mLock held, before the writer waits */
+void CalibrationStore::writerIdle()
+{
+    mWriterBusy = false;
+    pthread_cond_broadcast(&mIdleCond);
+}
+
+void *CalibrationStore::writerThread(void *arg)
+{
+    ((CalibrationStore *)arg)->writerLoop();
+    return NULL;
+}
+
+void CalibrationStore::writerLoop()
+{
+    unsigned char *buf = NULL;
+    size_t bufSize = 0;
+    size_t len;
+    cal_bias_cache_t cache;
+
+    pthread_mutex_lock(&mLock);
+    while (true) {
+        if (!mPendingValid && !mExit) {
+            writerIdle();
+            pthread_cond_wait(&mCond, &mLock);
+            continue;
+        }
+
+        if (!mPendingValid)
+            break;
+
+        /* rate limit, except for the final write on exit */
+        int64_t now = mClock();
+        int64_t due = mLastWriteTime + CAL_STORE_MIN_INTERVAL_NS;
+        if (!mExit && mLastWriteTime && now < due) {
+            /* the deadline on the real clock, whatever mClock is */
+            int64_t deadline = clockNs(CLOCK_MONOTONIC) + (due - now);
+            struct timespec ts;
+            ts.tv_sec = deadline / 1000000000LL;
+            ts.tv_nsec = deadline % 1000000000LL;
+            writerIdle();
+            pthread_cond_timedwait(&mCond, &mLock, &ts);
+            continue;
+        }
+
+        if (mPendingLen > bufSize) {
+            unsigned char *tmp = (unsigned char *)realloc(buf, mPendingLen);
+            if (!tmp) {
+                ALOGE("CalStore: out of memory");
+                mPendingValid = false;
+                continue;
+            }
+            buf = tmp;
+            bufSize = mPendingLen;
+        }
+        len = mPendingLen;
+        memcpy(buf, mPending, len);
+        cache = mPendingCache;
+        mPendingValid = false;
+        mLastWriteTime = now;
+        pthread_mutex_unlock(&mLock);
+
+        int err = writeFile(mPath, mTmpPath, buf, len);
+        writeFile(mCachePath, mCacheTmpPath, (const unsigned char *)&cache, sizeof(cache));
+
+        pthread_mutex_lock(&mLock);
+        if (!err)
+            mFileWrites++;
+    }
+    writerIdle();
+    pthread_mutex_unlock(&mLock);
+    free(buf);
+}
+
+/* write to a temporary file and rename it, so the file is never torn */
+int CalibrationStore::writeFile(const char *path, const char *tmpPath,
+                                const unsigned char *data, size_t len)
+{
+    size_t done = 0;
+    int fd, err;
+
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        err = -errno;
+        ALOGE("CalStore: cannot open %s: %s", tmpPath, strerror(errno));
+        return err;
+    }
+    while (done < len) {
+        ssize_t res = write(fd, data + done, len - done);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            err = -errno;
+            ALOGE("CalStore: cannot write %s: %s", tmpPath, strerror(errno));
+            close(fd);
+            unlink(tmpPath);
+            return err;
+        }
+        done += res;
+    }
+    err = fsync(fd) < 0 ? -errno : 0;
+    if (close(fd) < 0 && !err)
+        err = -errno;
+    if (err) {
+        ALOGE("CalStore: cannot sync %s: %s", tmpPath, strerror(-err));
+        unlink(tmpPath);
+        return err;
+    }
+    if (rename(tmpPath, path) < 0) {
+        err = -errno;
+        ALOGE("CalStore: cannot rename %s: %s", tmpPath, strerror(errno));
+        unlink(tmpPath);
+        return err;
+    }
+    ALOGV_IF(CAL_STORE_DEBUG, "CalStore: wrote %zu bytes to %s", len, path);
+    return 0;
+}
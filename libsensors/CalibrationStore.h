@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CALIBRATION_STORE_H
+#define CALIBRATION_STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* minimum time between two writes of the calibration file */
+#define CAL_STORE_MIN_INTERVAL_NS   (60LL * 1000000000LL)
+/* the MPL state also holds the compass fit and the gyro temperature
+   compensation, which change without any bias changing; while the
+   sensors feeding them run, it is saved this often */
+#define CAL_STORE_STATE_INTERVAL_NS (10LL * 60LL * 1000000000LL)
+
+/* a cached bias is only reapplied if it is younger than this ... */
+#define CAL_CACHE_MAX_AGE_NS        (24LL * 3600LL * 1000000000LL)
+/* ... and was learned within this die temperature range (q16 deg C) */
+#define CAL_CACHE_MAX_TEMP_DELTA    (5L << 16)
+/* it keeps the accuracy it was learned with only if it is younger than
+   this and was learned this close to the known die temperature; it is
+   reapplied at MEDIUM at best otherwise */
+#define CAL_CACHE_TRUST_AGE_NS      (3600LL * 1000000000LL)
+#define CAL_CACHE_TRUST_TEMP_DELTA  (1L << 16)
+
+#define CAL_CACHE_MAGIC             0x43424e49 /* "INBC" */
+#define CAL_CACHE_VERSION           4
+
+/* gyro bias vs. die temperature table: 2 deg C bins from -10 to 60 deg C */
+#define CAL_GYRO_TEMP_MIN           (-10L << 16)
+#define CAL_GYRO_TEMP_BIN_WIDTH     (2L << 16)
+#define CAL_GYRO_TEMP_BINS          35
+
+enum cal_bias_t {
+    CAL_BIAS_GYRO = 0,
+    CAL_BIAS_ACCEL,
+    CAL_BIAS_COMPASS,
+    CAL_BIAS_NUM
+};
+
+/* last known biases, kept next to the cal file for warm starts */
+struct cal_bias_cache_t {
+    uint32_t magic;
+    uint32_t version;
+    int32_t bias[CAL_BIAS_NUM][3];      /* MPL units, chip frame */
+    int32_t accuracy[CAL_BIAS_NUM];     /* SENSOR_STATUS_* when learned */
+    int64_t temperature[CAL_BIAS_NUM];  /* q16 deg C when learned */
+    int64_t time[CAL_BIAS_NUM];         /* CLOCK_REALTIME ns when learned,
+                                           0 if never */
+    /* gyro bias learned at no-motion, per temperature bin */
+    uint64_t gyroTempValid;             /* bit n set: gyroTemp[n] is valid */
+    int32_t gyroTemp[CAL_GYRO_TEMP_BINS][3];
+    int64_t gyroTempTime[CAL_GYRO_TEMP_BINS];   /* CLOCK_REALTIME ns when
+                                                   last learned */
+};
+
+/* CLOCK_MONOTONIC in ns */
+typedef int64_t (*cal_clock_t)(void);
+
+/*****************************************************************************/
+
+/*
+ * Write-behind store for the MPL calibration file.
+ *
+ * The HAL keeps the last known biases here and marks the store dirty when
+ * one of them changes, or when it feeds data to the parts of the MPL that
+ * learn from it. isSaveDue() tells the HAL when to commit() while the
+ * sensors run. commit() only copies the serialized MPL state; the
+ * file itself is written by a background thread, at most once every
+ * CAL_STORE_MIN_INTERVAL_NS, to a temporary file that is then renamed over
+ * the real one. The biases themselves go to a small cache file the same
+ * way, so they can be reapplied right away on the next start.
+ */
+class CalibrationStore {
+public:
+    /* 'clock' stands in for CLOCK_MONOTONIC, e.g. for a replay on a
+       simulated clock; NULL for the real one */
+    CalibrationStore(const char *path, const char *cachePath,
+                     cal_clock_t clock = NULL);
+    ~CalibrationStore();
+
+    /* record a bias (in MPL units); if it changed, it is stamped with the
+       current time and temperature and the store is marked dirty */
+    void updateBias(int which, const long *bias, int accuracy);
+    /* die temperature (q16 deg C) stored along with the biases */
+    void setTemperature(int64_t temperature);
+    /* the HAL fed data that updates the MPL state (compass fit, gyro
+       temperature compensation) */
+    void markStateChanged();
+    bool isDirty();
+    /* dirty, and the last commit() is long enough ago: a changed bias
+       after CAL_STORE_MIN_INTERVAL_NS, MPL state alone after
+       CAL_STORE_STATE_INTERVAL_NS */
+    bool isSaveDue();
+    /* biases match what is on disk, e.g. right after loading the file */
+    void markClean();
+
+    /* hand over a serialized MPL state for the next write */
+    int commit(const unsigned char *data, size_t len);
+    /* let the writer catch up with the clock and wait until it is idle;
+       returns how many times it wrote the calibration file so far */
+    unsigned int syncWriter();
+
+    /* seed the biases and the gyro temperature table from the cache
+       written by an earlier instance; meant to be called once */
+    int loadBiasCache();
+    /* bias 'which', if it was learned less than CAL_CACHE_MAX_AGE_NS ago
+       and near 'temperature', with the accuracy to reapply it at: the one
+       it was learned with if it is trusted (CAL_CACHE_TRUST_*), at most
+       MEDIUM if not; the temperature check is skipped if haveTemperature
+       is false, and the bias is not trusted then */
+    bool getBias(int which, bool haveTemperature, int64_t temperature,
+                 long *bias, int *accuracy);
+
+    /* temperature table bin for a q16 deg C temperature, -1 if outside */
+    static int gyroTempBin(int64_t temperature);
+    /* blend a gyro bias learned at no-motion into the current bin;
+       returns that bin, -1 if the temperature is outside the table */
+    int learnGyroBias(const long *bias);
+    /* gyro bias learned for 'temperature' and the accuracy it is good
+       for: MEDIUM if its bin was learned less than CAL_CACHE_MAX_AGE_NS
+       ago, LOW if earlier; false if there is none */
+    bool lookupGyroBias(int64_t temperature, long *bias, int *accuracy);
+    /* same, for the HAL to push when the die temperature moved out of
+       bin '*bin' (or always if 'force'); '*bin' is updated to the bin of
+       'temperature' either way. False if there is nothing to push. */
+    bool takeGyroTempBias(int64_t temperature, bool force, int *bin,
+                          long *bias, int *accuracy);
+
+private:
+    static void *writerThread(void *arg);
+    void writerLoop();
+    void writerIdle();
+    int writeFile(const char *path, const char *tmpPath,
+                  const unsigned char *data, size_t len);
+
+    char *mPath;
+    char *mTmpPath;
+    char *mCachePath;
+    char *mCacheTmpPath;
+
+    pthread_t mThread;
+    bool mThreadStarted;
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    pthread_cond_t mIdleCond;
+    cal_clock_t mClock;
+    bool mWriterBusy;
+    bool mExit;
+
+    long mBias[CAL_BIAS_NUM][3];
+    int mAccuracy[CAL_BIAS_NUM];
+    int64_t mBiasTemperature[CAL_BIAS_NUM];
+    int64_t mBiasTime[CAL_BIAS_NUM];
+    int64_t mTemperature;
+    uint64_t mGyroTempValid;
+    long mGyroTemp[CAL_GYRO_TEMP_BINS][3];
+    int64_t mGyroTempTime[CAL_GYRO_TEMP_BINS];
+    bool mDirty;
+    bool mStateChanged;
+    int64_t mLastCommitTime;
+    cal_bias_cache_t mPendingCache;
+
+    unsigned char *mPending;
+    size_t mPendingLen;
+    size_t mPendingSize;
+    bool mPendingValid;
+    int64_t mLastWriteTime;
+    unsigned int mFileWrites;
+};
+
+/*****************************************************************************/
+
+#endif  /* CALIBRATION_STORE_H */
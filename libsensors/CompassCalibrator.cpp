@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/log.h>
+
+#include "CompassCalibrator.h"
+
+CompassCalibrator::CompassCalibrator(compass_calibrate_t calibrate, void *cookie)
+    : mCalibrate(calibrate),
+      mCookie(cookie),
+      mThreadStarted(false),
+      mExit(0)
+{
+    memset(mConsumedSeq, 0, sizeof(mConsumedSeq));
+    mWakePipe[0] = mWakePipe[1] = -1;
+    sem_init(&mRawSampleSem, 0, 0);
+
+    if (pipe2(mWakePipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        ALOGE("Compass: unable to create calibration pipe: %s", strerror(errno));
+        return;
+    }
+    if (pthread_create(&mThread, NULL, workerThread, this)) {
+        ALOGE("Compass: unable to start calibration thread, calibrating inline");
+        return;
+    }
+    mThreadStarted = true;
+}
+
+CompassCalibrator::~CompassCalibrator()
+{
+    if (mThreadStarted) {
+        android_atomic_release_store(1, &mExit);
+        sem_post(&mRawSampleSem);
+        pthread_join(mThread, NULL);
+    }
+    if (mWakePipe[0] >= 0)
+        close(mWakePipe[0]);
+    if (mWakePipe[1] >= 0)
+        close(mWakePipe[1]);
+    sem_destroy(&mRawSampleSem);
+}
+
+void *CompassCalibrator::workerThread(void *arg)
+{
+    ((CompassCalibrator *)arg)->workerLoop();
+    return NULL;
+}
+
+void CompassCalibrator::workerLoop()
+{
+    compass_raw_sample_t raw;
+
+    while (true) {
+        if (sem_wait(&mRawSampleSem) < 0 && errno == EINTR)
+            continue;
+        if (android_atomic_acquire_load(&mExit))
+            break;
+
+        while (mRawQueue.pop(&raw))
+            publish(raw);
+    }
+}
+
+void CompassCalibrator::publish(const compass_raw_sample_t &raw)
+{
+    compass_raw_sample_t in = raw;
+    compass_data_t cal;
+    sensors_vec_t out;
+
+    if (!mCalibrate(mCookie, in.in, &out))
+        return;
+
+    for (int i = 0; i < 3; i++) {
+        cal.uncalibrated_magnetic.uncalib[i] = (float)raw.in[i];
+        cal.uncalibrated_magnetic.bias[i] = (float)raw.in[i] - out.v[i];
+    }
+    cal.magnetic = out;
+    cal.timestamp = raw.timestamp;
+    mLatest.write(cal);
+    wake();
+}
+
+void CompassCalibrator::wake()
+{
+    char token = 0;
+
+    write(mWakePipe[1], &token, 1);
+}
+
+bool CompassCalibrator::submit(const compass_raw_sample_t &raw)
+{
+    if (!mThreadStarted) {
+        publish(raw);
+        return true;
+    }
+    if (!mRawQueue.push(raw))
+        return false;
+    sem_post(&mRawSampleSem);
+    return true;
+}
+
+int CompassCalibrator::fetch(int consumer, compass_data_t *sample,
+                             uint32_t active, bool polled)
+{
+    char tokens[COMPASS_QUEUE_SIZE];
+    int32_t seq = mLatest.read(sample);
+    int fresh = seq != 0 && seq != mConsumedSeq[consumer];
+
+    if (fresh)
+        mConsumedSeq[consumer] = seq;
+
+    if (fresh || !polled) {
+        for (int i = 0; i < COMPASS_CONSUMERS; i++) {
+            if ((active & (1 << i)) && mConsumedSeq[i] != seq)
+                return fresh;
+        }
+    }
+
+    // the slot only keeps the newest sample, so all wake-ups are consumed
+    // at once; re-arm if the worker published another one meanwhile
+    while (read(mWakePipe[0], tokens, sizeof(tokens)) > 0)
+        ;
+    if (mLatest.sequence() != seq)
+        wake();
+
+    return fresh;
+}
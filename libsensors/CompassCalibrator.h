@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPASS_CALIBRATOR_H
+#define COMPASS_CALIBRATOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <hardware/sensors.h>
+
+#include "LockFreeQueue.h"
+#include "SeqLockSlot.h"
+
+/* depth of the raw sample queue of the calibration worker */
+#define COMPASS_QUEUE_SIZE 32
+
+/* readers of the calibrated samples, see CompassCalibrator::fetch() */
+#define COMPASS_CONSUMERS 2
+
+/* raw sample handed from the poll thread to the calibration worker */
+struct compass_raw_sample_t {
+    int in[3];
+    int64_t timestamp;
+};
+
+struct compass_data_t {
+    /* time is in nanosecond */
+    int64_t timestamp;
+    /* calibrated data */
+    sensors_vec_t magnetic;
+    /* raw data */
+    uncalibrated_event_t uncalibrated_magnetic;
+};
+
+/* returns non-zero if 'out' holds a calibrated sample */
+typedef int (*compass_calibrate_t)(void *cookie, int *in, sensors_vec_t *out);
+
+/*****************************************************************************/
+
+/*
+ * Runs the compass calibration on a worker thread, off the poll thread.
+ *
+ * submit() queues a raw sample and never waits. The worker calibrates it
+ * and publishes the result as the latest sample; getFd() becomes readable
+ * for every result. Several consumers can fetch() the latest sample from
+ * the same thread, each gets a sample once. If the worker cannot be
+ * started, submit() calibrates inline.
+ */
+class CompassCalibrator {
+public:
+    CompassCalibrator(compass_calibrate_t calibrate, void *cookie);
+    ~CompassCalibrator();
+
+    int getFd() const { return mWakePipe[0]; }
+
+    /* poll thread only; false if the sample was dropped */
+    bool submit(const compass_raw_sample_t &raw);
+
+    /*
+     * Copies the latest calibrated sample into *sample if 'consumer'
+     * (0 .. COMPASS_CONSUMERS - 1) has not had it yet. Returns 1 if a
+     * sample was copied, 0 if not.
+     *
+     * The wake-up is shared, so it is only cleared once every consumer in
+     * 'active' (a bitmask of consumer indices) has had the sample, or when
+     * the consumer that is run on every wake-up ('polled') finds nothing
+     * new, so that the poll loop cannot spin on it.
+     */
+    int fetch(int consumer, compass_data_t *sample, uint32_t active,
+              bool polled);
+
+private:
+    static void *workerThread(void *arg);
+    void workerLoop();
+    void publish(const compass_raw_sample_t &raw);
+    void wake();
+
+    compass_calibrate_t mCalibrate;
+    void *mCookie;
+
+    pthread_t mThread;
+    bool mThreadStarted;
+    volatile int32_t mExit;
+    sem_t mRawSampleSem;
+    int mWakePipe[2];
+    LockFreeQueue<compass_raw_sample_t, COMPASS_QUEUE_SIZE> mRawQueue;
+
+    /* latest calibrated sample, written by the worker */
+    SeqLockSlot<compass_data_t> mLatest;
+    /* sequence number last handed to each consumer */
+    int32_t mConsumedSeq[COMPASS_CONSUMERS];
+};
+
+/*****************************************************************************/
+
+#endif  /* COMPASS_CALIBRATOR_H */
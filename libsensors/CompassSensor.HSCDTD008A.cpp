@@ -24,6 +24,7 @@
 #include <cutils/log.h>
 #include <linux/input.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include "sensor_params.h"
 #include "MPLSupport.h"
@@ -31,6 +32,9 @@
 #include "CompassSensor.HSCDTD008A.h"
 
 #define COMPASS_EVENT_DEBUG 0
+// log how long the poll thread is held up in CompassSensor::readEvents()
+#define COMPASS_TIMING_DEBUG 0
+#define COMPASS_TIMING_SAMPLES 100
 
 typedef int (*Magnetic_Enable_func)(void);
 typedef int (*Magnetic_Disable_func)(void);
@@ -45,6 +49,11 @@ static Magnetic_Calibrate_func Magnetic_Calibrate = 0;
 static Magnetic_Set_Delay_func Magnetic_Set_Delay = 0;
 static Magnetic_Initialize_func Magnetic_Initialize = 0;
 
+/* the library is not known to be thread safe, and Magnetic_Calibrate()
+   runs on the calibration worker while the rest is called from the HAL
+   threads, so every call into it holds this lock */
+static pthread_mutex_t sLibLock = PTHREAD_MUTEX_INITIALIZER;
+
 static void LoadLibrary() {
     lib_acdapi_clb = dlopen("libacdapi_clb.so", RTLD_NOW);
     if (!lib_acdapi_clb) {
@@ -67,13 +76,18 @@ static void LoadLibrary() {
 CompassSensor::CompassSensor() :
     SamsungSensorBase(NULL, "magnetic_sensor"),
     mAccuracy(0),
-    mSelectMask(SENSOR_NONE)
+    mSelectMask(SENSOR_NONE),
+    mCalibrator(calibrate, this),
+    mReadTimeTotal(0),
+    mReadTimeMax(0),
+    mReadTimeCount(0)
 {
     VFUNC_LOG;
+    pthread_mutex_lock(&sLibLock);
     LoadLibrary();
     Magnetic_Initialize();
+    pthread_mutex_unlock(&sLibLock);
     memset(&mCachedCompassData, 0, sizeof(mCachedCompassData));   
-    memset(&mLastCompassData, 0, sizeof(mLastCompassData));   
 }
 
 CompassSensor::~CompassSensor()
@@ -81,6 +95,22 @@ CompassSensor::~CompassSensor()
     VFUNC_LOG;
 }
 
+/* called by the calibration worker */
+int CompassSensor::calibrate(void *cookie, int *in, sensors_vec_t *out)
+{
+    int res = 0;
+
+    UNUSED(cookie);
+    pthread_mutex_lock(&sLibLock);
+    if (Magnetic_Calibrate)
+        res = Magnetic_Calibrate(in, out);
+    pthread_mutex_unlock(&sLibLock);
+
+    LOGI_IF(COMPASS_EVENT_DEBUG && res, "Magnetic_Calibrate: (%d/%d/%d) -> (%f/%f/%f %d)\n",
+        in[0], in[1], in[2], out->x, out->y, out->z, out->status);
+    return res;
+}
+
 int CompassSensor::enable(int32_t handle, int en)
 {
     LOGI_IF(COMPASS_EVENT_DEBUG, "enable compass: %ld handle: %d", (long)en, handle);
@@ -95,7 +125,9 @@ int CompassSensor::enable(int32_t handle, int en)
         if (mSelectMask != SENSOR_M_RM) {
             if (!Magnetic_Enable)
                 return -1;
+            pthread_mutex_lock(&sLibLock);
             Magnetic_Enable();
+            pthread_mutex_unlock(&sLibLock);
             return SamsungSensorBase::enable(handle, 1);
         } 
     } else {
@@ -103,7 +135,9 @@ int CompassSensor::enable(int32_t handle, int en)
         if (mSelectMask == SENSOR_NONE) {
             if (!Magnetic_Disable)
                 return -1;
+            pthread_mutex_lock(&sLibLock);
             Magnetic_Disable();
+            pthread_mutex_unlock(&sLibLock);
             return SamsungSensorBase::enable(handle, 0);
         }
     }
@@ -137,7 +171,9 @@ int CompassSensor::setDelay(int32_t handle, int64_t ns)
 {
     // TODO: does Magnetic_Set_Delay() expect ms?
     LOGI_IF(COMPASS_EVENT_DEBUG, "Set delay: %ld", (long)ns);
+    pthread_mutex_lock(&sLibLock);
     Magnetic_Set_Delay(ns/1000000);
+    pthread_mutex_unlock(&sLibLock);
     return SamsungSensorBase::setDelay(handle, ns);
 }
 
@@ -161,44 +197,71 @@ bool CompassSensor::handleEvent(input_event const *event)
             mCachedCompassData.time_lo = (uint32_t)event->value;
         }
     } else if (event->type == EV_SYN) {
-        sensors_vec_t out;
-        int in_raw[3] = { mCachedCompassData.x, mCachedCompassData.y, mCachedCompassData.z };
-        if (Magnetic_Calibrate(in_raw, &out)) {
-            // MPLSensor uses timestamps generated by SensorBase::getTimestamp() (which at the moment
-            // uses elapsedRealtimeNano(), i.e. boottime).
-            // As the alps-input.c kernel driver uses ktime_get_boottime() for the time_hi/lo timestamp
-            // the timestamps are compatible with SensorBase::getTimestamp() and no conversion has to take place.
-            uint64_t timestamp = ((uint64_t)mCachedCompassData.time_hi << TIME_HI_SHIFT) | mCachedCompassData.time_lo;
-
-            LOGI_IF(COMPASS_EVENT_DEBUG, "Magnetic_Calibrate (raw:%d): [%lld] (%d/%d/%d) -> (%f/%f/%f %d)\n",
-                mSelectMask, timestamp, mCachedCompassData.x, mCachedCompassData.y, mCachedCompassData.z,
-                out.x, out.y, out.z, out.status);
-
-            mAccuracy = out.status;
-            
-            mLastCompassData.uncalibrated_magnetic.x_uncalib = (float)mCachedCompassData.x;
-            mLastCompassData.uncalibrated_magnetic.y_uncalib = (float)mCachedCompassData.y;
-            mLastCompassData.uncalibrated_magnetic.z_uncalib = (float)mCachedCompassData.z;
-            mLastCompassData.uncalibrated_magnetic.x_bias = (float)mCachedCompassData.x - out.x;
-            mLastCompassData.uncalibrated_magnetic.y_bias = (float)mCachedCompassData.y - out.y;
-            mLastCompassData.uncalibrated_magnetic.z_bias = (float)mCachedCompassData.z - out.z;
-            mLastCompassData.magnetic.x = out.x;
-            mLastCompassData.magnetic.y = out.y;
-            mLastCompassData.magnetic.z = out.z;
-            mLastCompassData.magnetic.status = out.status;
-            mLastCompassData.timestamp = (int64_t)timestamp;
-            mLastCompassData.validMask = SENSOR_M_RM;
-
-            mPendingEvent.magnetic = mLastCompassData.magnetic;
-            mPendingEvent.timestamp = timestamp;
-            return true;
-        }        
+        // MPLSensor uses timestamps generated by SensorBase::getTimestamp() (which at the moment
+        // uses elapsedRealtimeNano(), i.e. boottime).
+        // As the alps-input.c kernel driver uses ktime_get_boottime() for the time_hi/lo timestamp
+        // the timestamps are compatible with SensorBase::getTimestamp() and no conversion has to take place.
+        uint64_t timestamp = ((uint64_t)mCachedCompassData.time_hi << TIME_HI_SHIFT) | mCachedCompassData.time_lo;
+        compass_raw_sample_t raw = {
+            { mCachedCompassData.x, mCachedCompassData.y, mCachedCompassData.z },
+            (int64_t)timestamp
+        };
+
+        // calibration is done by the worker, which reports back through
+        // getCalibratedFd()
+        if (!mCalibrator.submit(raw))
+            LOGW("Compass: raw queue full, dropping sample %lld", raw.timestamp);
     }    
     
     // no event created
     return false;
 }
 
+int CompassSensor::readEvents(sensors_event_t *data, int count)
+{
+    int64_t start = COMPASS_TIMING_DEBUG ? getTimestamp() : 0;
+    int res = SamsungSensorBase::readEvents(data, count);
+
+    if (COMPASS_TIMING_DEBUG) {
+        int64_t elapsed = getTimestamp() - start;
+        mReadTimeTotal += elapsed;
+        if (elapsed > mReadTimeMax)
+            mReadTimeMax = elapsed;
+        if (++mReadTimeCount == COMPASS_TIMING_SAMPLES) {
+            LOGI("Compass: poll thread time in readEvents avg=%lldns max=%lldns (%d calls)",
+                 mReadTimeTotal / mReadTimeCount, mReadTimeMax, mReadTimeCount);
+            mReadTimeTotal = 0;
+            mReadTimeMax = 0;
+            mReadTimeCount = 0;
+        }
+    }
+    return res;
+}
+
+/*
+ * Copy the latest calibrated sample into *sample if 'consumer' (SENSOR_M
+ * or SENSOR_RM) has not seen it yet. Otherwise hand any pending input
+ * events to the calibration worker.
+ * Returns 1 if a new sample was copied, 0 if not, negative on error.
+ * Never waits for the calibration worker.
+ */
+int CompassSensor::fetchSample(int consumer, compass_data_t *sample)
+{
+    int idx = (consumer == SENSOR_M) ? 0 : 1;
+
+    // buildCompassEvent() reads M on every wake-up of getCalibratedFd();
+    // RM is read from MPLSensor::readEvents(), which other fds wake as well
+    if (mCalibrator.fetch(idx, sample, mSelectMask & SENSOR_M_RM,
+                          consumer == SENSOR_M)) {
+        mAccuracy = sample->magnetic.status;
+        return 1;
+    }
+
+    sensors_event_t event;
+    int res = readEvents(&event, 1);
+    return res < 0 ? res : 0;
+}
+
 /**
     @brief         Integrators need to implement this function per 3rd-party solution
     @param[out]    data      sensor data is stored in this variable. Scaled such that
@@ -210,21 +273,16 @@ int CompassSensor::readSample(long *data, int64_t *timestamp)
 {
     VFUNC_LOG;
     
-    if ((mLastCompassData.validMask & SENSOR_M) == 0) {
-        sensors_event_t event;
-        int res = readEvents(&event, 1);
-        if (res <= 0) {
-            return res;
-        }
+    compass_data_t sample;
+    int res = fetchSample(SENSOR_M, &sample);
+    if (res <= 0) {
+        return res;
     }
 
-    pthread_mutex_lock(&mLock);
-    *timestamp = mLastCompassData.timestamp;
+    *timestamp = sample.timestamp;
     for(int i=0; i<3; i++) {
-        data[i] = (long)(mLastCompassData.magnetic.v[i] * 65536.0);
+        data[i] = (long)(sample.magnetic.v[i] * 65536.0);
     }
-    mLastCompassData.validMask &= ~SENSOR_M;
-    pthread_mutex_unlock(&mLock);
 
     LOGI_IF(COMPASS_EVENT_DEBUG, "readSample: (%ld/%ld/%ld)", data[0], data[1], data[2]);
     return 1;
@@ -240,21 +298,16 @@ int CompassSensor::readRawSample(float *data, int64_t *timestamp)
 {
     VFUNC_LOG;
 
-    if ((mLastCompassData.validMask & SENSOR_RM) == 0) {
-        sensors_event_t event;
-        int res = readEvents(&event, 1);
-        if (res <= 0) {
-            return res;
-        }
+    compass_data_t sample;
+    int res = fetchSample(SENSOR_RM, &sample);
+    if (res <= 0) {
+        return res;
     }
     
-    pthread_mutex_lock(&mLock);
-    *timestamp = mLastCompassData.timestamp;
+    *timestamp = sample.timestamp;
     for(int i=0; i<3; i++) {
-        data[i] = mLastCompassData.uncalibrated_magnetic.uncalib[i];
+        data[i] = sample.uncalibrated_magnetic.uncalib[i];
     }
-    mLastCompassData.validMask &= ~SENSOR_RM;
-    pthread_mutex_unlock(&mLock);
 
     LOGI_IF(COMPASS_EVENT_DEBUG, "readSample (raw): (%f/%f/%f)", data[0], data[1], data[2]);
     return 1;
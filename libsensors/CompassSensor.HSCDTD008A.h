@@ -24,6 +24,7 @@
 
 #include "sensors_local.h"
 #include "SamsungSensorBase.h"
+#include "CompassCalibrator.h"
 
 #define TIME_HI_SHIFT 32
 
@@ -46,17 +47,6 @@ struct sensor_data_t {
     uint32_t time_lo;
 };
 
-struct compass_data_t {
-    /* time is in nanosecond */
-    int64_t timestamp;
-    /* mask determines which sensor data is valid: SENSOR_M->magnetic, SENSOR_RM->uncalibrated_magnetic */
-    int validMask;
-    /* calibrated data */
-    sensors_vec_t magnetic;
-    /* raw data */
-    uncalibrated_event_t uncalibrated_magnetic;
-};
-
 /*****************************************************************************/
 
 class CompassSensor : public SamsungSensorBase {
@@ -72,6 +62,8 @@ public:
     //       functions, or SensorBase.cpp could provide equal functionalities
     //virtual int getFd() const;
     virtual int getRawFd() {return 0;};
+    // readable whenever the calibration worker has a calibrated sample ready
+    int getCalibratedFd() const { return mCalibrator.getFd(); }
     virtual int enable(int32_t handle, int en);
     virtual int getEnable(int32_t handle);
     virtual int64_t getDelay(int32_t handle);
@@ -79,6 +71,7 @@ public:
     virtual int64_t getMinDelay() { return -1; } // stub
 
     virtual bool handleEvent(input_event const *event);
+    virtual int readEvents(sensors_event_t *data, int count);
     
     // following four APIs need further implementation for MPL's
     //       reference (look into .cpp for detailed information, also refer to
@@ -104,10 +97,20 @@ public:
     int isYasCompass(void) { return 0; };
     
 private:
+    static int calibrate(void *cookie, int *in, sensors_vec_t *out);
+    int fetchSample(int consumer, compass_data_t *sample);
+
     int mAccuracy;
     int mSelectMask;
     sensor_data_t mCachedCompassData;
-    compass_data_t mLastCompassData;
+
+    /* Magnetic_Calibrate() runs on the calibrator's worker thread */
+    CompassCalibrator mCalibrator;
+
+    /* time spent by the poll thread in readEvents() (COMPASS_TIMING_DEBUG) */
+    int64_t mReadTimeTotal;
+    int64_t mReadTimeMax;
+    int mReadTimeCount;
 };
 
 /*****************************************************************************/
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "DirectChannel.h"
+
+DirectChannel::DirectChannel(int fd, size_t size)
+    : mFd(-1),
+      mRing(NULL),
+      mMapSize(0),
+      mSlots(size / sizeof(sensors_event_t)),
+      mPos(0),
+      mCounter(1)
+{
+    int regionSize;
+    void *ring;
+
+    if (fd < 0 || mSlots == 0) {
+        ALOGE("DirectChannel: invalid region (fd %d, %zu bytes)", fd, size);
+        return;
+    }
+    regionSize = ashmem_get_size_region(fd);
+    if (regionSize < 0 || (size_t)regionSize < size) {
+        ALOGE("DirectChannel: region of %d bytes is smaller than %zu",
+              regionSize, size);
+        return;
+    }
+
+    mFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (mFd < 0) {
+        ALOGE("DirectChannel: cannot dup fd %d: %s", fd, strerror(errno));
+        return;
+    }
+    mMapSize = mSlots * sizeof(sensors_event_t);
+    ring = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (ring == MAP_FAILED) {
+        ALOGE("DirectChannel: cannot map region: %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+    /* a zero counter marks a slot that was never written */
+    memset(ring, 0, mMapSize);
+    mRing = (sensors_event_t *)ring;
+}
+
+DirectChannel::~DirectChannel()
+{
+    if (mRing)
+        munmap(mRing, mMapSize);
+    if (mFd >= 0)
+        close(mFd);
+}
+
+void DirectChannel::write(const sensors_event_t *ev, int token)
+{
+    sensors_event_t *slot;
+
+    if (!mRing)
+        return;
+
+    slot = &mRing[mPos];
+    /* invalidate the slot first, so a reader never sees a torn record
+       under a counter it already checked */
+    android_atomic_release_store(0, &slot->reserved0);
+    android_memory_barrier();
+    slot->version = sizeof(sensors_event_t);
+    slot->sensor = token;
+    slot->type = ev->type;
+    memcpy((char *)slot + offsetof(sensors_event_t, timestamp),
+           (const char *)ev + offsetof(sensors_event_t, timestamp),
+           sizeof(sensors_event_t) - offsetof(sensors_event_t, timestamp));
+    android_atomic_release_store(mCounter, &slot->reserved0);
+
+    if (++mPos == mSlots)
+        mPos = 0;
+    /* 0 is reserved for slots that hold no record */
+    mCounter = (int32_t)((uint32_t)mCounter + 1);
+    if (mCounter == 0)
+        mCounter = 1;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DIRECT_CHANNEL_H
+#define DIRECT_CHANNEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <hardware/sensors.h>
+
+/* most channels the HAL keeps registered at the same time */
+#define DIRECT_MAX_CHANNELS         4
+
+/* nominal report periods of the direct report rate levels */
+#define DIRECT_RATE_NORMAL_NS       20000000LL  /* ~50 Hz */
+#define DIRECT_RATE_FAST_NS         5000000LL   /* ~200 Hz */
+
+/*****************************************************************************/
+
+/*
+ * Shared memory ring of sensors_event_t written by the HAL.
+ *
+ * Uses the layout of the sensors HAL 1.4 direct report channel: the ring
+ * wraps around without waiting for the reader, 'sensor' carries the report
+ * token and 'reserved0' a counter that is stored last, with release
+ * semantics, and is never 0 for a written record. A reader copies a record
+ * and checks that the counter did not change meanwhile.
+ *
+ * There is only one writer, the thread running MPLSensor::readEvents().
+ * The HAL only registers channels when it is built against the 1.4
+ * headers (SENSORS_DEVICE_API_VERSION_1_4).
+ */
+class DirectChannel {
+public:
+    /* maps 'size' bytes of the ashmem region 'fd'; the fd is duplicated */
+    DirectChannel(int fd, size_t size);
+    ~DirectChannel();
+
+    bool isValid() const { return mRing != NULL; }
+
+    /* append 'ev', reported under 'token' */
+    void write(const sensors_event_t *ev, int token);
+
+private:
+    int mFd;
+    sensors_event_t *mRing;
+    size_t mMapSize;
+    size_t mSlots;
+    size_t mPos;
+    int32_t mCounter;
+};
+
+/*****************************************************************************/
+
+#endif  /* DIRECT_CHANNEL_H */
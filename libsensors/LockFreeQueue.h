@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOCK_FREE_QUEUE_H
+#define LOCK_FREE_QUEUE_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+
+/*****************************************************************************/
+
+/*
+ * Bounded single-producer/single-consumer queue.
+ *
+ * push() must only be called from one thread and pop() from one (other)
+ * thread. Neither side ever blocks; push() fails if the queue is full and
+ * pop() fails if it is empty. N must be a power of two.
+ */
+template <typename T, int32_t N>
+class LockFreeQueue {
+public:
+    LockFreeQueue() : mHead(0), mTail(0) {}
+
+    bool push(const T &item) {
+        int32_t tail = mTail;
+        int32_t head = android_atomic_acquire_load(&mHead);
+        if ((uint32_t)tail - (uint32_t)head >= (uint32_t)N)
+            return false;
+        mItems[tail & (N - 1)] = item;
+        android_atomic_release_store((int32_t)((uint32_t)tail + 1), &mTail);
+        return true;
+    }
+
+    bool pop(T *item) {
+        int32_t head = mHead;
+        int32_t tail = android_atomic_acquire_load(&mTail);
+        if (head == tail)
+            return false;
+        *item = mItems[head & (N - 1)];
+        android_atomic_release_store((int32_t)((uint32_t)head + 1), &mHead);
+        return true;
+    }
+
+    /* only meaningful when both sides are quiescent */
+    void reset() {
+        mHead = 0;
+        mTail = 0;
+    }
+
+private:
+    /* free-running indices; only their (unsigned) difference is used */
+    volatile int32_t mHead;
+    volatile int32_t mTail;
+    T mItems[N];
+};
+
+/*****************************************************************************/
+
+#endif  /* LOCK_FREE_QUEUE_H */
@@ -28,9 +28,11 @@
 #include <stdlib.h>
 #include <sys/select.h>
 #include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <utils/KeyedVector.h>
 #include <utils/Vector.h>
 #include <utils/String8.h>
@@ -40,6 +42,12 @@
 #include <utils/SystemClock.h>
 
 #include "MPLSensor.h"
+#include "SensorTrace.h"
+#include "RotationMath.h"
+#include "SampleDecimation.h"
+#include "StepCountTimer.h"
+#include "SysfsAttr.h"
+#include "MahonyFusion.h"
 #include "PressureSensor.IIO.secondary.h"
 #include "MPLSupport.h"
 #include "sensor_params.h"
@@ -49,6 +57,7 @@
 #include "ml_stored_data.h"
 #include "ml_load_dmp.h"
 #include "ml_sysfs_helper.h"
+#include "storage_manager.h"
 
 #define ENABLE_MULTI_RATE
 // #define TESTING
@@ -63,6 +72,12 @@
 
 #define MAX_SYSFS_ATTRB (sizeof(struct sysfs_attrbs) / sizeof(char*))
 
+#ifndef MLCAL_FILE
+#define MLCAL_FILE "/data/inv_cal_data.bin"
+#endif
+// last known biases, for warm starts
+#define BIAS_CACHE_FILE "/data/inv_bias_cache.bin"
+
 // query path to determine if vibrator is currently vibrating
 #define VIBRATOR_ENABLE_FILE "/sys/class/timed_output/vibrator/enable"
 
@@ -85,8 +100,6 @@ static FILE *logfile = NULL;
  * MPLSensor class implementation
  ******************************************************************************/
 
-static int64_t mt_pre_ns;
-
 // following extended initializer list would only be available with -std=c++11
 //  or -std=gnu+11
 MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *))
@@ -95,7 +108,13 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          mLocalSensorMask(0),
                          mPollTime(-1),
                          mStepCountPollTime(-1),
+                         mStepCountLatency(0),
                          mHaveGoodMpuCal(0),
+                         mCalStore(NULL),
+                         mCalBuffer(NULL),
+                         mCalBufferSize(0),
+                         mGyroTempBin(-1),
+                         mBiasRestoreMask((1 << CAL_BIAS_NUM) - 1),
                          mGyroAccuracy(0),
                          mAccelAccuracy(0),
                          mCompassAccuracy(0),
@@ -104,6 +123,7 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          dmp_sign_motion_fd(-1),
                          mDmpSignificantMotionEnabled(0),
                          dmp_pedometer_fd(-1),
+                         mStepCountTimerFd(-1),
                          mDmpPedometerEnabled(0),
                          mDmpStepCountEnabled(0),
                          mEnabled(0),
@@ -149,6 +169,11 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                          mPressureUpdate(0),
                          mQuatSensorTimestamp(0),
                          mStepSensorTimestamp(0),
+                         mMpuClock(TS_DOMAIN_UNKNOWN),
+                         mMpuArrival(0),
+                         mFallbackFusionMask(0),
+                         mFusion6(false),
+                         mFusion9(true),
                          mLastStepCount(-1),
                          mLeftOverBufferSize(0),
                          mInitial6QuatValueAvailable(0),
@@ -173,6 +198,12 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
 
     pthread_mutex_init(&mMplMutex, NULL);
     pthread_mutex_init(&mHALMutex, NULL);
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    pthread_mutex_init(&mDirectLock, NULL);
+    memset(mDirectReports, 0, sizeof(mDirectReports));
+    mDirectMask = 0;
+    mPollOutputMask = ~0U;
+#endif
     mFlushBatchSet = 0;
     memset(mGyroOrientation, 0, sizeof(mGyroOrientation));
     memset(mAccelOrientation, 0, sizeof(mAccelOrientation));
@@ -180,6 +211,26 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     mFlushSensorEnabledVector.setCapacity(NumSensors);
     memset(mEnabledTime, 0, sizeof(mEnabledTime));
     memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+    memset(mReportDue, 0, sizeof(mReportDue));
+    memset(&mNav, 0, sizeof(mNav));
+    memset(mFusionCompassOrient, 0, sizeof(mFusionCompassOrient));
+
+    char fusion[PROPERTY_VALUE_MAX];
+    if (property_get(FUSION_FALLBACK_PROPERTY, fusion, NULL) > 0) {
+        char *save = NULL;
+        for (char *tok = strtok_r(fusion, ",", &save); tok;
+                tok = strtok_r(NULL, ",", &save)) {
+            if (!strcmp(tok, "rv"))
+                mFallbackFusionMask |= 1 << RotationVector;
+            else if (!strcmp(tok, "grv"))
+                mFallbackFusionMask |= 1 << GameRotationVector;
+            else
+                ALOGE("HAL:unknown fallback fusion sensor '%s'", tok);
+        }
+        ALOGI("HAL:built-in fusion for rv %d grv %d",
+              !!(mFallbackFusionMask & (1 << RotationVector)),
+              !!(mFallbackFusionMask & (1 << GameRotationVector)));
+    }
 
     /* setup sysfs paths */
     inv_init_sysfs_attributes();
@@ -399,6 +450,23 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
                 "HAL:dmp_pedometer_fd opened : %d", dmp_pedometer_fd);
     }
 
+    /* attributes read on every DMP interrupt are kept open */
+    pedometer_steps_fd = open(mpu.pedometer_steps, O_RDONLY | O_CLOEXEC);
+    pedometer_counter_fd = open(mpu.pedometer_counter, O_RDONLY | O_CLOEXEC);
+    if (pedometer_steps_fd < 0 || pedometer_counter_fd < 0) {
+        LOGE("HAL:ERR couldn't open pedometer step count nodes");
+    }
+    vibrator_enable_fd = open(VIBRATOR_ENABLE_FILE, O_RDONLY | O_CLOEXEC);
+    if (vibrator_enable_fd < 0) {
+        LOGE("HAL:cannot open %s", VIBRATOR_ENABLE_FILE);
+    }
+
+    /* the step count is read when this expires, see updateStepCountTimer() */
+    mStepCountTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mStepCountTimerFd < 0) {
+        LOGE("HAL:ERR couldn't create step count timer");
+    }
+
     initBias();
 
     (void)inv_get_version(&ver_str);
@@ -542,6 +610,9 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     memset(mGyroBias, 0, sizeof(mGyroBias));
     memset(mGyroChipBias, 0, sizeof(mGyroChipBias));
 
+    /* calibration file is written behind by mCalStore */
+    mCalStore = new CalibrationStore(MLCAL_FILE, BIAS_CACHE_FILE);
+
     /* load calibration file from /data/inv_cal_data.bin */
     rv = inv_load_calibration();
     if(rv == INV_SUCCESS) {
@@ -561,6 +632,8 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
         if (mFactoryAccelBiasAvailable) {
             setFactoryAccelBias();
         }
+        /* biases just read back from the file need no rewrite */
+        mCalStore->markClean();
     }
     else
         LOGE("HAL:Could not open or load MPL calibration file (%d)", rv);
@@ -588,6 +661,10 @@ MPLSensor::MPLSensor(CompassSensor *compass, int (*m_pt2AccelCalLoadFunc)(long *
     }
     /* end of external accel calibration load workflow */
 
+    /* recent biases, reapplied as each sensor is enabled */
+    if (mCalStore->loadBiasCache() == 0)
+        LOGV_IF(PROCESS_VERBOSE, "HAL:bias cache loaded");
+
     /* disable all sensors and features */
     masterEnable(0);
     enableGyro(0);
@@ -821,6 +898,7 @@ void MPLSensor::inv_set_device_properties(void)
     /* compass setup */
     signed char orientMtx[9];
     mCompassSensor->getOrientationMatrix(orientMtx);
+    memcpy(mFusionCompassOrient, orientMtx, sizeof(orientMtx));
     orient =
         inv_orientation_matrix_to_scalar(orientMtx);
     long sensitivity;
@@ -945,6 +1023,11 @@ MPLSensor::~MPLSensor()
 {
     VFUNC_LOG;
 
+    /* queue the latest calibration; the store writes it before going away */
+    storeCalibration();
+    delete mCalStore;
+    free(mCalBuffer);
+
     /* Close open fds */
     if (iio_fd > 0)
         close(iio_fd);
@@ -952,6 +1035,14 @@ MPLSensor::~MPLSensor()
         close(accel_fd );
     if (gyro_temperature_fd > 0)
         close(gyro_temperature_fd);
+    if (mStepCountTimerFd >= 0)
+        close(mStepCountTimerFd);
+    if (pedometer_steps_fd >= 0)
+        close(pedometer_steps_fd);
+    if (pedometer_counter_fd >= 0)
+        close(pedometer_counter_fd);
+    if (vibrator_enable_fd >= 0)
+        close(vibrator_enable_fd);
     if (sysfs_names_ptr)
         free(sysfs_names_ptr);
 
@@ -1835,8 +1926,6 @@ int MPLSensor::enableDmpPedometer(int en, int interruptMode)
         else {
             mFeatureActiveMask |= INV_DMP_PEDOMETER_STEP;
         }
-
-        mt_pre_ns = android::elapsedRealtimeNano();
     } else {
         if (interruptMode) {
             mFeatureActiveMask &= ~INV_DMP_PEDOMETER;
@@ -1912,6 +2001,9 @@ int MPLSensor::enableGyro(int en)
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_gyro_was_turned_off");
         inv_gyro_was_turned_off();
+        mBiasRestoreMask |= (1 << CAL_BIAS_GYRO);
+    } else {
+        applyBiasCache(CAL_BIAS_GYRO);
     }
 
     return res;
@@ -1947,6 +2039,9 @@ int MPLSensor::enableAccel(int en)
     if (!en) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_accel_was_turned_off");
         inv_accel_was_turned_off();
+        mBiasRestoreMask |= (1 << CAL_BIAS_ACCEL);
+    } else {
+        applyBiasCache(CAL_BIAS_ACCEL);
     }
 
     return res;
@@ -1966,6 +2061,9 @@ int MPLSensor::enableCompass(int en, int rawSensorRequested)
     if (en == 0 || res != 0) {
         LOGV_IF(EXTRA_VERBOSE, "HAL:MPL:inv_compass_was_turned_off %d", res);
         inv_compass_was_turned_off();
+        mBiasRestoreMask |= (1 << CAL_BIAS_COMPASS);
+    } else {
+        applyBiasCache(CAL_BIAS_COMPASS);
     }
 
     return res;
@@ -2555,7 +2653,7 @@ int MPLSensor::calcBatchTimeout(int en, int64_t *out)
             }
         }
         /* Convert ns to millisecond */
-        timeoutInMs = timeout / 1000000;
+        timeoutInMs = planBatchTimeout(timeout / 1000000);
     } else {
         timeoutInMs = 0;
     }
@@ -2565,6 +2663,56 @@ int MPLSensor::calcBatchTimeout(int en, int64_t *out)
     return 0;
 }
 
+/* Bytes per second the batch outputs put into the hardware FIFO, at the
+   rates setBatchDataRates() programs for the current batch requests. */
+int64_t MPLSensor::calcFifoFillRate()
+{
+    int featureMask = computeBatchDataOutput();
+    int64_t gyroRate, accelRate, compassRate, pressureRate = 0, quatRate;
+    batch_fifo_t fifo;
+
+    calcBatchDataRates(&gyroRate, &accelRate, &compassRate, &pressureRate,
+                       &quatRate);
+    memset(&fifo, 0, sizeof(fifo));
+    if (mEnabled & ((1 << Gyro) | (1 << RawGyro)))
+        fifo.gyro = gyroRate;
+    if (mEnabled & (1 << Accelerometer))
+        fifo.accel = accelRate;
+    if ((mEnabled & ((1 << MagneticField) | (1 << RawMagneticField))) &&
+            mCompassSensor->isIntegrated()) {
+        /* as setBatchDataRates() clamps it */
+        if (compassRate < mCompassSensor->getMinDelay() * 1000LL)
+            compassRate = mCompassSensor->getMinDelay() * 1000LL;
+        fifo.compass = compassRate;
+    }
+    /* the quaternion outputs run at the rate batch() programs them at */
+    if (featureMask & INV_DMP_6AXIS_QUATERNION)
+        fifo.quat = mBatchDelays[GameRotationVector];
+    else if (featureMask & INV_DMP_PED_QUATERNION)
+        fifo.pedQuat = mBatchDelays[GameRotationVector];
+    fifo.steps = !!(featureMask &
+            (INV_DMP_PED_INDICATOR | INV_DMP_PED_STANDALONE));
+
+    return batchFifoFillRate(&fifo);
+}
+
+/* Return the longest timeout not above 'requestedMs' that is safe for the
+   current outputs and rates, see batchFifoTimeout(). */
+int64_t MPLSensor::planBatchTimeout(int64_t requestedMs)
+{
+    VFUNC_LOG;
+
+    int64_t rate = calcFifoFillRate();
+    int64_t plannedMs = batchFifoTimeout(rate, requestedMs);
+
+    LOGV_IF(PROCESS_VERBOSE && rate > 0,
+            "HAL:batch FIFO fills at %lld B/s in %lld ms, timeout %lld -> %lld ms",
+            rate, MPU_FIFO_SIZE * 1000LL / rate, requestedMs, plannedMs);
+    LOGV_IF(PROCESS_VERBOSE, "HAL:batch predicted wakeups: %lld/hour",
+            3600000LL / plannedMs);
+    return plannedMs;
+}
+
 int MPLSensor::writeBatchTimeout(int en, int64_t timeoutInMs)
 {
     VFUNC_LOG;
@@ -2598,7 +2746,10 @@ int MPLSensor::writeBatchTimeout(int en)
     return 0;
 }
 
-/* Store calibration file */
+/* Store calibration file
+   Only serializes the MPL state; mCalStore writes the file in the
+   background, rate limited, and only when a bias or the learned MPL
+   state changed. */
 void MPLSensor::storeCalibration(void)
 {
     VFUNC_LOG;
@@ -2606,11 +2757,31 @@ void MPLSensor::storeCalibration(void)
     if(mHaveGoodMpuCal == true
         || mAccelAccuracy >= 2
         || mCompassAccuracy >= 3) {
-       int res = inv_store_calibration();
-       if (res) {
-           LOGE("HAL:Cannot store calibration on file");
+       if (!mCalStore->isDirty())
+           return;
+
+       int64_t start = getTimestamp();
+       size_t len = 0;
+       inv_error_t res = inv_get_mpl_state_size(&len);
+       if (res || len == 0) {
+           LOGE("HAL:Cannot get calibration size (%d)", res);
+           return;
+       }
+       if (len > mCalBufferSize) {
+           unsigned char *buf = (unsigned char *)realloc(mCalBuffer, len);
+           if (!buf) {
+               LOGE("HAL:Cannot allocate calibration buffer");
+               return;
+           }
+           mCalBuffer = buf;
+           mCalBufferSize = len;
+       }
+       res = inv_save_mpl_states(mCalBuffer, len);
+       if (res || mCalStore->commit(mCalBuffer, len)) {
+           LOGE("HAL:Cannot store calibration (%d)", res);
        } else {
-           LOGV_IF(PROCESS_VERBOSE, "HAL:Cal file updated");
+           LOGV_IF(PROCESS_VERBOSE, "HAL:Cal state queued (%zu bytes, %lld ns)",
+                   len, getTimestamp() - start);
        }
     }
 }
@@ -2766,16 +2937,12 @@ int MPLSensor::rawCompassHandler(sensors_event_t* s)
 int MPLSensor::rvHandler(sensors_event_t* s)
 {
     VHANDLER_LOG;
-    int8_t status;
     int update;
-#if defined ANDROID_LOLLIPOP
-    update = inv_get_sensor_type_rotation_vector(s->data, &status,
-                                                 (inv_time_t *)(&s->timestamp));
-#else
-    update = inv_get_sensor_type_rotation_vector(s->data, &status,
-                                                 &s->timestamp);
-#endif
-    s->orientation.status = status;
+
+    memcpy(s->data, mNav.rv, sizeof(mNav.rv));
+    s->orientation.status = mNav.rvStatus;
+    s->timestamp = mNav.rvTimestamp;
+    update = mNav.rvUpdate;
 
     update |= isCompassDisabled();
 
@@ -2801,14 +2968,23 @@ int MPLSensor::grvHandler(sensors_event_t* s)
     VHANDLER_LOG;
     int8_t status;
     int update;
+
+    if (mFallbackFusionMask & (1 << GameRotationVector)) {
+        int64_t last = s->timestamp;
+        update = mFusion6.getRotationVector(s->data, &s->timestamp) &&
+                 s->timestamp != last;
+        s->data[4] = -1.f;
+        s->orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
+    } else {
 #if defined ANDROID_LOLLIPOP
-    update = inv_get_sensor_type_rotation_vector_6_axis(s->data, &status,
+        update = inv_get_sensor_type_rotation_vector_6_axis(s->data, &status,
                                                      (inv_time_t *)(&s->timestamp));
 #else
-    update = inv_get_sensor_type_rotation_vector_6_axis(s->data, &status,
+        update = inv_get_sensor_type_rotation_vector_6_axis(s->data, &status,
                                                      &s->timestamp);
 #endif
-    s->orientation.status = status;
+        s->orientation.status = status;
+    }
 
     if (!mEnabledTime[GameRotationVector] || !(s->timestamp > mEnabledTime[GameRotationVector])) {
         LOGV_IF(ENG_VERBOSE, "HAL:grv incorrect timestamp Enabled=%lld, Timestamp=%lld, Now=%lld",
@@ -2826,13 +3002,15 @@ int MPLSensor::laHandler(sensors_event_t* s)
 {
     VHANDLER_LOG;
     int update;
-#if defined ANDROID_LOLLIPOP
-    update = inv_get_sensor_type_linear_acceleration(
-            s->gyro.v, &s->gyro.status, (inv_time_t *)(&s->timestamp));
-#else
-    update = inv_get_sensor_type_linear_acceleration(
-            s->gyro.v, &s->gyro.status, &s->timestamp);
-#endif
+    float gravity[3];
+
+    rot_gravity(mNav.rot, gravity);
+    s->gyro.v[0] = mNav.accel[0] - gravity[0];
+    s->gyro.v[1] = mNav.accel[1] - gravity[1];
+    s->gyro.v[2] = mNav.accel[2] - gravity[2];
+    s->gyro.status = mNav.accelStatus;
+    s->timestamp = mNav.accelTimestamp;
+    update = mNav.rvUpdate;
     update |= isCompassDisabled();
 
     if (!mEnabledTime[LinearAccel] || !(s->timestamp > mEnabledTime[LinearAccel])) {
@@ -2850,13 +3028,11 @@ int MPLSensor::gravHandler(sensors_event_t* s)
 {
     VHANDLER_LOG;
     int update;
-#if defined ANDROID_LOLLIPOP
-    update = inv_get_sensor_type_gravity(s->gyro.v, &s->gyro.status,
-                                         (inv_time_t *)(&s->timestamp));
-#else
-    update = inv_get_sensor_type_gravity(s->gyro.v, &s->gyro.status,
-                                         &s->timestamp);
-#endif
+
+    rot_gravity(mNav.rot, s->gyro.v);
+    s->gyro.status = mNav.rvStatus;
+    s->timestamp = mNav.rvTimestamp;
+    update = mNav.rvUpdate;
     update |= isCompassDisabled();
 
     if (!mEnabledTime[Gravity] || !(s->timestamp > mEnabledTime[Gravity])) {
@@ -2874,14 +3050,11 @@ int MPLSensor::orienHandler(sensors_event_t* s)
 {
     VHANDLER_LOG;
     int update;
-#if defined ANDROID_LOLLIPOP
-    update = inv_get_sensor_type_orientation(
-            s->orientation.v, &s->orientation.status, (inv_time_t *)(&s->timestamp));
-#else
-    update = inv_get_sensor_type_orientation(
-            s->orientation.v, &s->orientation.status, &s->timestamp);
 
-#endif
+    rot_orientation(mNav.rot, s->orientation.v);
+    s->orientation.status = mCompassAccuracy;
+    s->timestamp = mNav.rvTimestamp;
+    update = mNav.rvUpdate;
     update |= isCompassDisabled();
 
     if (!mEnabledTime[Orientation] || !(s->timestamp > mEnabledTime[Orientation])) {
@@ -3079,10 +3252,13 @@ int MPLSensor::enable(int32_t handle, int en)
                 (en? "en" : "dis"));
         enableDmpPedometer(en, 0);
         mDmpStepCountEnabled = !!en;
-        if (en)
+        if (en) {
             mEnabledTime[StepCounter] = android::elapsedRealtimeNano();
-        else
+        } else {
             mEnabledTime[StepCounter] = 0;
+            mStepCountLatency = 0;
+        }
+        updateStepCountTimer();
 
         if (!en)
             mBatchDelays[what] = 1000000000LL;
@@ -3452,6 +3628,7 @@ int MPLSensor::setDelay(int32_t handle, int64_t ns)
     /* store request rate to mDelays arrary for each sensor */
     int64_t previousDelay = mDelays[what];
     mDelays[what] = ns;
+    mReportDue[what] = 0;
     LOGV_IF(ENG_VERBOSE, "storing mDelays[%d] = %lld, previousDelay = %lld", what, ns, previousDelay);
 
     switch (what) {
@@ -3459,6 +3636,7 @@ int MPLSensor::setDelay(int32_t handle, int64_t ns)
             /* set limits of delivery rate of events */
             mStepCountPollTime = ns;
             LOGV_IF(ENG_VERBOSE, "step count rate =%lld ns", ns);
+            updateStepCountTimer();
             break;
         case StepDetector:
         case SignificantMotion:
@@ -3868,13 +4046,16 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
         }
         if(msg & INV_MSG_NEW_AB_EVENT) {
             LOGV_IF(EXTRA_VERBOSE, "HAL:***** New Accel Bias *****\n");
-            getAccelBias();
             mAccelAccuracy = inv_get_accel_accuracy();
+            getAccelBias();
         }
         if(msg & INV_MSG_NEW_GB_EVENT) {
             LOGV_IF(EXTRA_VERBOSE, "HAL:***** New Gyro Bias *****\n");
             getGyroBias();
             setGyroBias();
+            /* a bias settled at no-motion is good enough to learn from */
+            if (mGyroAccuracy == SENSOR_STATUS_ACCURACY_HIGH)
+                mGyroTempBin = mCalStore->learnGyroBias(mGyroChipBias);
         }
         if(msg & INV_MSG_NEW_FGB_EVENT) {
             LOGV_IF(EXTRA_VERBOSE, "HAL:***** New Factory Gyro Bias *****\n");
@@ -3886,12 +4067,20 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
         }
         if(msg & INV_MSG_NEW_CB_EVENT) {
             LOGV_IF(EXTRA_VERBOSE, "HAL:***** New Compass Bias *****\n");
-            getCompassBias();
             mCompassAccuracy = inv_get_mag_accuracy();
+            getCompassBias();
         }
     }
 
+    /* save what was learned while the sensors stay on, not only when
+       they are switched */
+    if (mCalStore->isSaveDue())
+        storeCalibration();
+
     if (!mSkipReadEvents) {
+        if (mEnabledCached & VIRTUAL_SENSOR_9AXES_MASK)
+            updateNavDerived();
+
         for (int i = 0; i < NumSensors; i++) {
             int update = 0;
 
@@ -3925,13 +4114,22 @@ int MPLSensor::readEvents(sensors_event_t* data, int count)
                 update = CALL_MEMBER_FN(this, mHandlers[i])(mPendingEvents + i);
                 mPendingMask |= (1 << i);
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+                if (update && (mDirectMask & (1 << i)))
+                    writeDirectReports(i, &mPendingEvents[i]);
+                if (!(mPollOutputMask & (1 << i)))
+                    update = 0;
+#endif
+
                 if (update && (count > 0)) {
                     // Discard any events with duplicate timestamps
                     if (mLastTimestamp[i] != mPendingEvents[i].timestamp) {
-                        mLastTimestamp[i] = mPendingEvents[i].timestamp;
-                        *data++ = mPendingEvents[i];
-                        count--;
-                        numEventReceived++;
+                        if (!isDecimated(i, mPendingEvents[i].timestamp)) {
+                            mLastTimestamp[i] = mPendingEvents[i].timestamp;
+                            *data++ = mPendingEvents[i];
+                            count--;
+                            numEventReceived++;
+                        }
                     } else {
                         ALOGE("Event from type=%d with duplicate timestamp %lld (%+f, %+f, %+f) discarded",
                                     mPendingEvents[i].type, mLastTimestamp[i], mPendingEvents[i].data[0], mPendingEvents[i].data[1], mPendingEvents[i].data[2]);
@@ -4060,6 +4258,12 @@ void MPLSensor::buildMpuEvent(void)
         return;
     }
 
+    mMpuArrival = getTimestamp();
+
+    SensorTraceWriter *trace = SensorTraceWriter::get();
+    if (trace)
+        trace->record(SENSOR_TRACE_IIO, 0, rdataP, rsize);
+
 #ifdef TESTING
 LOGV_IF(INPUT_DATA,
          "HAL:input just read rdataP:r=%d, n=%d,"
@@ -4161,7 +4365,7 @@ LOGV_IF(INPUT_DATA,
         if (data_format & DATA_FORMAT_STEP) {
             if (data_format == DATA_FORMAT_STEP) {
                 rdata += BYTES_PER_SENSOR;
-                latestTimestamp = *((long long*) (rdata));
+                latestTimestamp = mpuTimestamp(-1, rdata);
                 LOGV_IF(ENG_VERBOSE && INPUT_DATA, "STEP DETECTED:0x%x - ts: %lld", data_format, latestTimestamp);
                 // readCounter is decrement by 24 because DATA_FORMAT_STEP only applies in batch  mode
                 readCounter -= BYTES_PER_SENSOR_PACKET;
@@ -4197,7 +4401,7 @@ LOGV_IF(INPUT_DATA,
                 mCachedQuaternionData[1] = *((int *) (rdata + 8));
                 mCachedQuaternionData[2] = *((int *) (rdata + 12));
                 rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-                mQuatSensorTimestamp = *((long long*) (rdata));
+                mQuatSensorTimestamp = mpuTimestamp(MPU_TS_QUAT, rdata);
                 mask |= DATA_FORMAT_QUAT;
                 readCounter -= BYTES_QUAT_DATA;
             }
@@ -4212,7 +4416,7 @@ LOGV_IF(INPUT_DATA,
                 mCached6AxisQuaternionData[1] = *((int *) (rdata + 8));
                 mCached6AxisQuaternionData[2] = *((int *) (rdata + 12));
                 rdata += QUAT_ONLY_LAST_PACKET_OFFSET;
-                mQuatSensorTimestamp = *((long long*) (rdata));
+                mQuatSensorTimestamp = mpuTimestamp(MPU_TS_6_AXIS, rdata);
                 mask |= DATA_FORMAT_6_AXIS;
                 readCounter -= BYTES_QUAT_DATA;
             }
@@ -4227,7 +4431,7 @@ LOGV_IF(INPUT_DATA,
                 mCachedPedQuaternionData[1] = *((short *) (rdata + 4));
                 mCachedPedQuaternionData[2] = *((short *) (rdata + 6));
                 rdata += BYTES_PER_SENSOR;
-                mQuatSensorTimestamp = *((long long*) (rdata));
+                mQuatSensorTimestamp = mpuTimestamp(MPU_TS_PED_QUAT, rdata);
                 mask |= DATA_FORMAT_PED_QUAT;
                 readCounter -= BYTES_PER_SENSOR_PACKET;
             }
@@ -4239,7 +4443,7 @@ LOGV_IF(INPUT_DATA,
             LOGV_IF(ENG_VERBOSE && INPUT_DATA, "STANDALONE STEP DETECTED:0x%x", data_format);
             if (readCounter >= BYTES_PER_SENSOR_PACKET) {
                 rdata += BYTES_PER_SENSOR;
-                mStepSensorTimestamp = *((long long*) (rdata));
+                mStepSensorTimestamp = mpuTimestamp(-1, rdata);
                 mask |= DATA_FORMAT_PED_STANDALONE;
                 readCounter -= BYTES_PER_SENSOR_PACKET;
                 mPedUpdate |= data_format;
@@ -4255,7 +4459,7 @@ LOGV_IF(INPUT_DATA,
                 mCachedGyroData[1] = *((short *) (rdata + 4));
                 mCachedGyroData[2] = *((short *) (rdata + 6));
                 rdata += BYTES_PER_SENSOR;
-                mGyroSensorTimestamp = *((long long*) (rdata));
+                mGyroSensorTimestamp = mpuTimestamp(MPU_TS_GYRO, rdata);
                 mask |= DATA_FORMAT_GYRO;
                 readCounter -= BYTES_PER_SENSOR_PACKET;
             } else {
@@ -4269,7 +4473,7 @@ LOGV_IF(INPUT_DATA,
                 mCachedAccelData[1] = *((short *) (rdata + 4));
                 mCachedAccelData[2] = *((short *) (rdata + 6));
                 rdata += BYTES_PER_SENSOR;
-                mAccelSensorTimestamp = *((long long*) (rdata));
+                mAccelSensorTimestamp = mpuTimestamp(MPU_TS_ACCEL, rdata);
                 mask |= DATA_FORMAT_ACCEL;
                 readCounter -= BYTES_PER_SENSOR_PACKET;
             }
@@ -4285,7 +4489,7 @@ LOGV_IF(INPUT_DATA,
                     mCachedCompassData[1] = *((short *) (rdata + 4));
                     mCachedCompassData[2] = *((short *) (rdata + 6));
                     rdata += BYTES_PER_SENSOR;
-                    mCompassTimestamp = *((long long*) (rdata));
+                    mCompassTimestamp = mpuTimestamp(MPU_TS_COMPASS, rdata);
                     mask |= DATA_FORMAT_COMPASS;
                     readCounter -= BYTES_PER_SENSOR_PACKET;
                 }
@@ -4305,7 +4509,7 @@ LOGV_IF(INPUT_DATA,
                     mCachedCompassData[1] = *((short *) (rdata + 4));
                     mCachedCompassData[2] = *((short *) (rdata + 6));
                     rdata += BYTES_PER_SENSOR;
-                    mCompassTimestamp = *((long long*) (rdata));
+                    mCompassTimestamp = mpuTimestamp(MPU_TS_COMPASS, rdata);
                     readCounter -= BYTES_PER_SENSOR_PACKET;
                 }
             }
@@ -4322,7 +4526,7 @@ LOGV_IF(INPUT_DATA,
                         ((*((short *)(rdata + 4))) << 16) +
                         (*((unsigned short *) (rdata + 6)));
                     rdata += BYTES_PER_SENSOR;
-                    mPressureTimestamp = *((long long*) (rdata));
+                    mPressureTimestamp = mpuTimestamp(MPU_TS_PRESSURE, rdata);
                     if (mCachedPressureData != 0) {
                         mask |= DATA_FORMAT_PRESSURE;
                     }
@@ -4397,6 +4601,10 @@ LOGV_IF(INPUT_DATA,
                         "HAL:input inv_read_temperature = %lld, timestamp= %lld",
                         temperature[0], temperature[1]);
                         inv_build_temp(temperature[0], temperature[1]);
+                        mCalStore->setTemperature(temperature[0]);
+                        /* gyro temperature compensation learns from it */
+                        mCalStore->markStateChanged();
+                        applyGyroTempBias(temperature[0], false);
                         mSkipExecuteOnData = 0;
                      }
 #ifdef TESTING
@@ -4421,6 +4629,8 @@ LOGV_IF(INPUT_DATA,
             mPendingMask |= 1 << RawGyro;
 
             inv_build_gyro(mCachedGyroData, mGyroSensorTimestamp);
+            if (mFallbackFusionMask)
+                feedFusion(DATA_FORMAT_GYRO);
             LOGV_IF(INPUT_DATA,
                    "HAL:input inv_build_gyro: %+8d %+8d %+8d - %lld",
                     mCachedGyroData[0], mCachedGyroData[1],
@@ -4432,6 +4642,8 @@ LOGV_IF(INPUT_DATA,
         if (mask == DATA_FORMAT_ACCEL) {
             mPendingMask |= 1 << Accelerometer;
             inv_build_accel(mCachedAccelData, 0, mAccelSensorTimestamp);
+            if (mFallbackFusionMask)
+                feedFusion(DATA_FORMAT_ACCEL);
             LOGV_IF(INPUT_DATA,
                "HAL:input inv_build_accel: %+8ld %+8ld %+8ld - %lld",
                 mCachedAccelData[0], mCachedAccelData[1],
@@ -4473,6 +4685,8 @@ LOGV_IF(INPUT_DATA,
             }
             inv_build_compass(mCachedCompassData, status,
                               mCompassTimestamp);
+            if (mFallbackFusionMask)
+                feedFusion(DATA_FORMAT_COMPASS);
             LOGV_IF(INPUT_DATA,
                     "HAL:input inv_build_compass: %+8ld %+8ld %+8ld - %lld",
                     mCachedCompassData[0], mCachedCompassData[1],
@@ -4631,6 +4845,10 @@ void MPLSensor::buildCompassEvent(void)
         }
         inv_build_compass(mCachedCompassData, status,
                           mCompassTimestamp);
+        if (mMplFeatureActiveMask & INV_COMPASS_FIT)
+            mCalStore->markStateChanged();
+        if (mFallbackFusionMask)
+            feedFusion(DATA_FORMAT_COMPASS);
         LOGV_IF(INPUT_DATA,
                 "HAL:input inv_build_compass: %+8ld %+8ld %+8ld - %lld",
                 mCachedCompassData[0], mCachedCompassData[1],
@@ -4826,20 +5044,15 @@ int MPLSensor::readDmpOrientEvents(sensors_event_t* data, int count)
 {
     VFUNC_LOG;
 
-    char dummy[4];
+    int64_t value = 0;
     int screen_orientation = 0;
-    FILE *fp;
 
-    fp = fopen(mpu.event_display_orientation, "r");
-    if (fp == NULL) {
-        LOGE("HAL:cannot open event_display_orientation");
+    /* also acknowledges the interrupt */
+    if (read_attr_int64(dmp_orient_fd, &value) < 0) {
+        LOGE("HAL:cannot read event_display_orientation");
         return 0;
-    } else {
-        if (fscanf(fp, "%d\n", &screen_orientation) < 0 || fclose(fp) < 0)
-        {
-            LOGE("HAL:cannot write event_display_orientation");
-        }
     }
+    screen_orientation = (int)value;
 
     int numEventReceived = 0;
 
@@ -4864,9 +5077,7 @@ int MPLSensor::readDmpOrientEvents(sensors_event_t* data, int count)
         numEventReceived++;
     }
 
-    // read dummy data per driver's request
     dmpOrientHandler(screen_orientation);
-    read(dmp_orient_fd, dummy, 4);
 
     return numEventReceived;
 }
@@ -4911,39 +5122,43 @@ int MPLSensor::getPollTime(void)
     return mPollTime;
 }
 
-int MPLSensor::getStepCountPollTime(void)
+/* Arm mStepCountTimerFd to read the step count every mStepCountPollTime,
+   or at the report latency the step counter was batched with if that is
+   longer, while the step counter is enabled (see StepCountTimer.h). */
+void MPLSensor::updateStepCountTimer(void)
 {
     VFUNC_LOG;
-    if (mDmpStepCountEnabled) {
-        // convert poll time from nS to mS
-        return (mStepCountPollTime / 1000000LL);
+
+    int64_t period = 0;
+
+    if (mStepCountTimerFd < 0)
+        return;
+
+    if (mDmpStepCountEnabled)
+        period = stepCountTimerPeriod(mStepCountPollTime, mStepCountLatency);
+
+    if (armStepCountTimer(mStepCountTimerFd, period, false) < 0) {
+        LOGE("HAL:ERR can't set step count timer: %s", strerror(errno));
+        return;
     }
-    return 1000;
+    LOGV_IF(ENG_VERBOSE, "HAL:step count timer period=%lld ns", period);
+}
+
+int MPLSensor::getStepCountTimerFd()
+{
+    VFUNC_LOG;
+    return mStepCountTimerFd;
 }
 
-bool MPLSensor::hasStepCountPendingEvents(void)
+int MPLSensor::readStepCountEvents(sensors_event_t* data, int count)
 {
     VFUNC_LOG;
-    if (mDmpStepCountEnabled) {
-        int64_t t_now_ns;
-        int64_t interval = 0;
 
-        t_now_ns = android::elapsedRealtimeNano();
-        interval = t_now_ns - mt_pre_ns;
+    uint64_t expirations;
 
-        if (interval < mStepCountPollTime) {
-            LOGV_IF(0,
-                    "Step Count interval elapsed: %lld, triggered: %lld",
-                    interval, mStepCountPollTime);
-            return false;
-        } else {
-            mt_pre_ns = android::elapsedRealtimeNano();
-            LOGV_IF(0, "Step Count previous time: %lld ms",
-                    mt_pre_ns / 1000000);
-            return true;
-        }
-    }
-    return false;
+    /* only the fact that it expired matters */
+    read(mStepCountTimerFd, &expirations, sizeof(expirations));
+    return readDmpPedometerEvents(data, count, ID_SC, 0);
 }
 
 bool MPLSensor::hasPendingEvents(void) const
@@ -5105,6 +5320,10 @@ int MPLSensor::populateSensorList(struct sensor_t *list, int len)
         fillLinearAccel(list);
         /* fill in Significant motion values */
         fillSignificantMotion(list);
+        /* the framework drops the report latency of sensors without a
+           FIFO; the step counter "queues" its last count, see batch() */
+        if (!list[StepCounter].fifoMaxEventCount)
+            list[StepCounter].fifoMaxEventCount = 1;
 #ifdef ENABLE_DMP_SCREEN_AUTO_ROTATION
         /* fill in screen orientation values */
         fillScreenOrientation(list);
@@ -5549,6 +5768,7 @@ void MPLSensor::getCompassBias()
 
     /* Get Values from MPL */
     inv_get_compass_bias(bias);
+    mCalStore->updateBias(CAL_BIAS_COMPASS, bias, mCompassAccuracy);
     inv_convert_to_body(orient, bias, compassBias);
     LOGV_IF(HANDLER_DATA, "Mpl Compass Bias (HW unit) %ld %ld %ld", bias[0], bias[1], bias[2]);
     LOGV_IF(HANDLER_DATA, "Mpl Compass Bias (HW unit) (body) %ld %ld %ld", compassBias[0], compassBias[1], compassBias[2]);
@@ -5640,6 +5860,7 @@ void MPLSensor::getGyroBias()
 
     /* Get Values from MPL */
     inv_get_mpl_gyro_bias(mGyroChipBias, temp);
+    mCalStore->updateBias(CAL_BIAS_GYRO, mGyroChipBias, mGyroAccuracy);
     orient = inv_orientation_matrix_to_scalar(mGyroOrientation);
     inv_convert_to_body(orient, mGyroChipBias, bias);
     LOGV_IF(ENG_VERBOSE && INPUT_DATA, "Mpl Gyro Bias (HW unit) %ld %ld %ld", mGyroChipBias[0], mGyroChipBias[1], mGyroChipBias[2]);
@@ -5794,6 +6015,7 @@ void MPLSensor::getAccelBias()
 
     /* Get Values from MPL */
     inv_get_mpl_accel_bias(mAccelBias, &temp);
+    mCalStore->updateBias(CAL_BIAS_ACCEL, mAccelBias, mAccelAccuracy);
     LOGV_IF(ENG_VERBOSE, "Accel Bias (mg) %ld %ld %ld",
             mAccelBias[0], mAccelBias[1], mAccelBias[2]);
     mAccelBiasAvailable = true;
@@ -5943,6 +6165,10 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
         else
             LOGV_IF(PROCESS_VERBOSE, "HAL: batch - select sensor (handle %d)", handle);
         break;
+    case StepCounter:
+        /* batched by reading the count less often, see StepCountTimer.h */
+        LOGV_IF(PROCESS_VERBOSE, "HAL: batch - select sensor (handle %d)", handle);
+        break;
     default:
         if (timeout > 0) {
             LOGE("sensor (handle %d) is not supported in batch mode", handle);
@@ -5957,8 +6183,12 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
 
     if (what == StepCounter) {
         mStepCountPollTime = period_ns;
-        LOGI("HAL: set step count poll time = %lld nS (%.2f Hz)",
-            mStepCountPollTime, 1000000000.f / mStepCountPollTime);
+        mStepCountLatency = timeout;
+        LOGI("HAL: set step count poll time = %lld nS (%.2f Hz), latency %lld nS",
+            mStepCountPollTime, 1000000000.f / mStepCountPollTime,
+            mStepCountLatency);
+        /* nothing goes through the FIFO, so the rest sees it unbatched */
+        timeout = 0;
     }
 
     int tempBatch = 0;
@@ -6014,6 +6244,9 @@ int MPLSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
         mDelays[what] = period_ns;
         mBatchTimeouts[what] = timeout;
     }
+    mReportDue[what] = 0;
+    if (what == StepCounter)
+        updateStepCountTimer();
 
     // Check if need to change configurations
     int  master_enable_call = 0;
@@ -6253,6 +6486,16 @@ int MPLSensor::flush(int handle)
 
     LOGV_IF(PROCESS_VERBOSE, "HAL: flush - select sensor %s (handle %d)", sname.string(), handle);
 
+    /* the step count is not in the FIFO; a batched one is read right
+       away instead, poll__flush() reports the flush as complete */
+    if (what == StepCounter) {
+        if (!mDmpStepCountEnabled || mStepCountTimerFd < 0)
+            return -EINVAL;
+        armStepCountTimer(mStepCountTimerFd,
+                stepCountTimerPeriod(mStepCountPollTime, mStepCountLatency),
+                true);
+        return 0;
+    }
 
     if (((what != StepDetector) && (!(mEnabled & (1 << what)))) ||
         ((what == StepDetector) && !(mFeatureActiveMask & INV_DMP_PEDOMETER))) {
@@ -6418,7 +6661,7 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
     VFUNC_LOG;
 
     int res = 0;
-    char dummy[4];
+    int64_t value;
 
     int numEventReceived = 0;
     int update = 0;
@@ -6439,51 +6682,26 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
         }
         break;
     case ID_SC:
-        FILE *fp;
-        uint64_t stepCount = 0;
-        uint64_t stepCountTs = 0;
+        int64_t stepCount = 0;
+        int64_t stepCountTs = 0;
 
         if (mDmpStepCountEnabled && count > 0) {
-            fp = fopen(mpu.pedometer_steps, "r");
-            if (fp == NULL) {
-                LOGE("HAL:cannot open pedometer_steps");
-            } else {
-                if (fscanf(fp, "%lld\n", &stepCount) < 0) {
-                    LOGV_IF(PROCESS_VERBOSE, "HAL:cannot read pedometer_steps");
-                    if (fclose(fp) < 0) {
-                       LOGW("HAL:cannot close pedometer_steps");
-                    }
-                    return 0;
-                }
-                if (fclose(fp) < 0) {
-                       LOGW("HAL:cannot close pedometer_steps");
-                }
+            /* fetched back to back, so the timestamp goes with the count */
+            if (read_attr_int64(pedometer_steps_fd, &stepCount) < 0) {
+                LOGV_IF(PROCESS_VERBOSE, "HAL:cannot read pedometer_steps");
+                return 0;
+            }
+            if (read_attr_int64(pedometer_counter_fd, &stepCountTs) < 0) {
+                LOGE("HAL:cannot read pedometer_counter");
+                return 0;
             }
 
             /* return event onChange only */
-            if (stepCount == mLastStepCount) {
+            if ((uint64_t)stepCount == mLastStepCount) {
                 return 0;
             }
 
             mLastStepCount = stepCount;
-
-            /* Read step count timestamp */
-            fp = fopen(mpu.pedometer_counter, "r");
-            if (fp == NULL) {
-                LOGE("HAL:cannot open pedometer_counter");
-            } else{
-                if (fscanf(fp, "%lld\n", &stepCountTs) < 0) {
-                    LOGE("HAL:cannot read pedometer_counter");
-                    if (fclose(fp) < 0) {
-                        LOGE("HAL:cannot close pedometer_counter");
-                    }
-                    return 0;
-                }
-                if (fclose(fp) < 0) {
-                        LOGE("HAL:cannot close pedometer_counter");
-                        return 0;
-                }
-            }
             mScEvents.timestamp = stepCountTs;
 
             /* Handles return event */
@@ -6499,9 +6717,11 @@ int MPLSensor::readDmpPedometerEvents(sensors_event_t* data, int count,
     }
 
     if (!outputType) {
-        // read dummy data per driver's request
-        // only required if actual irq is issued
-        read(dmp_pedometer_fd, dummy, 4);
+        // read data per driver's request
+        // only required if actual irq is issued, i.e. for the step
+        // detector; the step count is read on a timer
+        if (id == ID_P)
+            read_attr_int64(dmp_pedometer_fd, &value);
     } else {
         return 1;
     }
@@ -6523,25 +6743,24 @@ int MPLSensor::readDmpSignificantMotionEvents(sensors_event_t* data, int count)
     VFUNC_LOG;
 
     int res = 0;
-    char dummy[4];
-    int vibrator = 0;
-    FILE *fp;
+    int64_t value;
+    int64_t vibrator = 0;
     int sensors = mEnabled;
     int numEventReceived = 0;
     int update = 0;
     static int64_t lastVibTrigger = 0;
 
+    // read data per driver's request; this acknowledges the interrupt
+    // even if the event is ignored below
+    read_attr_int64(dmp_sign_motion_fd, &value);
+
     if (mDmpSignificantMotionEnabled && count > 0) {
 
         // If vibrator is going off, ignore this event
-        fp = fopen(VIBRATOR_ENABLE_FILE, "r");
-        if (fp != NULL) {
-            if (fscanf(fp, "%d\n", &vibrator) < 0) {
+        if (vibrator_enable_fd >= 0) {
+            if (read_attr_int64(vibrator_enable_fd, &vibrator) < 0) {
                 LOGE("HAL:cannot read %s", VIBRATOR_ENABLE_FILE);
             }
-            if (fclose(fp) < 0) {
-                LOGE("HAL:cannot close %s", VIBRATOR_ENABLE_FILE);
-            }
             if (vibrator != 0) {
                 lastVibTrigger = android::elapsedRealtimeNano();
                 LOGV_IF(ENG_VERBOSE, "SMD triggered by vibrator, ignoring SMD event");
@@ -6559,8 +6778,6 @@ int MPLSensor::readDmpSignificantMotionEvents(sensors_event_t* data, int count)
                     lastVibTrigger = 0;
                 }
             }
-        } else {
-            LOGE("HAL:cannot open %s", VIBRATOR_ENABLE_FILE);
         }
 
         /* By implementation, smd is disabled once an event is triggered */
@@ -6583,9 +6800,6 @@ int MPLSensor::readDmpSignificantMotionEvents(sensors_event_t* data, int count)
         }
     }
 
-    // read dummy data per driver's request
-    read(dmp_sign_motion_fd, dummy, 4);
-
     return numEventReceived;
 }
 
@@ -7043,6 +7257,335 @@ void MPLSensor::resetMplStates()
     return;
 }
 
+/* Apply the gyro bias learned for the temperature bin of 'temperature'.
+   Unless forced, this only happens when the die temperature moves into
+   another bin, so the MPL's own estimate is left alone otherwise. The
+   accuracy is raised to what the bin is good for given its age, never
+   lowered. */
+void MPLSensor::applyGyroTempBias(int64_t temperature, bool force)
+{
+    VFUNC_LOG;
+
+    long bias[3];
+    int accuracy;
+
+    if (!mCalStore->takeGyroTempBias(temperature, force, &mGyroTempBin,
+                                     bias, &accuracy))
+        return;
+
+    if (mGyroAccuracy < accuracy)
+        mGyroAccuracy = accuracy;
+    inv_set_gyro_bias(bias, mGyroAccuracy);
+    getGyroBias();
+    setGyroBias();
+    LOGV_IF(PROCESS_VERBOSE, "HAL:gyro bias for %.1f C: %ld %ld %ld",
+            temperature / 65536.f, bias[0], bias[1], bias[2]);
+}
+
+/* Reapply the last bias mCalStore knows for sensor 'which' (CAL_BIAS_*)
+   when the sensor is enabled, if it was learned recently and at a similar
+   die temperature, so that the fused sensors report a usable accuracy
+   without waiting for the first no-motion event. A bias learned within
+   the last hour at the current temperature, e.g. across a restart of the
+   sensor service, comes back at the accuracy it was learned with; any
+   older one at MEDIUM at best (see CalibrationStore::getBias()). The bias
+   the MPL then reports is the same one, which leaves the store clean.
+   Only done once per time the sensor was off, as the sensors are also
+   re-enabled while running. */
+void MPLSensor::applyBiasCache(int which)
+{
+    VFUNC_LOG;
+
+    long long temperature[2] = { 0, 0 };
+    long bias[3];
+    int accuracy;
+    bool haveTemperature;
+
+    if (!(mBiasRestoreMask & (1 << which)))
+        return;
+    mBiasRestoreMask &= ~(1 << which);
+
+    haveTemperature = (inv_read_temperature(temperature) == 0);
+    if (haveTemperature)
+        mCalStore->setTemperature(temperature[0]);
+
+    if (mCalStore->getBias(which, haveTemperature, temperature[0],
+                           bias, &accuracy)) {
+        switch (which) {
+        case CAL_BIAS_GYRO:
+            mGyroAccuracy = accuracy;
+            inv_set_gyro_bias(bias, mGyroAccuracy);
+            getGyroBias();
+            setGyroBias();
+            break;
+        case CAL_BIAS_ACCEL:
+            mAccelAccuracy = accuracy;
+            inv_set_accel_bias_mask(bias, mAccelAccuracy, 7);
+            getAccelBias();
+            setAccelBias();
+            break;
+        case CAL_BIAS_COMPASS:
+            mCompassAccuracy = accuracy;
+            inv_set_compass_bias(bias, mCompassAccuracy);
+            getCompassBias();
+            break;
+        }
+        LOGV_IF(PROCESS_VERBOSE, "HAL:warm start bias %d: %ld %ld %ld (%d)",
+                which, bias[0], bias[1], bias[2], accuracy);
+    }
+
+    /* a gyro bias learned at the current temperature beats the last one */
+    if (which == CAL_BIAS_GYRO && haveTemperature)
+        applyGyroTempBias(temperature[0], true);
+}
+
+/* The sensors run at the rate of the fastest enabled one. Drop the events
+   of sensor 'i' that come earlier than its own client asked for, so slow
+   clients do not get (and wake up for) the faster rate. */
+bool MPLSensor::isDecimated(int i, int64_t timestamp)
+{
+    if ((1 << i) & DECIMATION_EXEMPT_MASK)
+        return false;
+    return !takeSample(&mReportDue[i], timestamp, mDelays[i]);
+}
+
+/* timestamp of the packet field at 'data', in CLOCK_BOOTTIME; 'stream' is
+   one of MPU_TS_*, or -1 for sporadic events that are only mapped */
+int64_t MPLSensor::mpuTimestamp(int stream, const char *data)
+{
+    int64_t timestamp;
+
+    memcpy(&timestamp, data, sizeof(timestamp));
+    timestamp = mMpuClock.toBoottime(timestamp, mMpuArrival);
+    if (stream >= 0)
+        timestamp = mMpuStreams[stream].correct(timestamp, mMpuArrival);
+    return timestamp;
+}
+
+/* Fetch the 9-axis quaternion (and accel, for linear acceleration) once
+   and turn it into a rotation matrix, instead of having the MPL redo the
+   conversion for every virtual sensor. */
+void MPLSensor::updateNavDerived()
+{
+    if (mFallbackFusionMask & (1 << RotationVector)) {
+        int64_t timestamp;
+        /* the derived sensors follow whichever rotation vector is used */
+        if (mFusion9.getRotationVector(mNav.rv, &timestamp)) {
+            mNav.rvUpdate = timestamp != mNav.rvTimestamp;
+            mNav.rvTimestamp = timestamp;
+        } else {
+            mNav.rvUpdate = 0;
+        }
+        mNav.rv[4] = -1.f;  /* no heading accuracy estimate */
+        mNav.rvStatus = mCompassAccuracy;
+    } else {
+#if defined ANDROID_LOLLIPOP
+        mNav.rvUpdate = inv_get_sensor_type_rotation_vector(mNav.rv, &mNav.rvStatus,
+                                                        (inv_time_t *)(&mNav.rvTimestamp));
+#else
+        mNav.rvUpdate = inv_get_sensor_type_rotation_vector(mNav.rv, &mNav.rvStatus,
+                                                        &mNav.rvTimestamp);
+#endif
+    }
+    if (mEnabledCached & (1 << LinearAccel)) {
+#if defined ANDROID_LOLLIPOP
+        inv_get_sensor_type_accelerometer(mNav.accel, &mNav.accelStatus,
+                                          (inv_time_t *)(&mNav.accelTimestamp));
+#else
+        inv_get_sensor_type_accelerometer(mNav.accel, &mNav.accelStatus,
+                                          &mNav.accelTimestamp);
+#endif
+    }
+
+    /* rv[0..3] is x, y, z, w */
+    rot_from_quat(mNav.rv, mNav.rot);
+}
+
+/* hand the sample of 'format' just decoded into the mCached*Data arrays
+   to the built-in fusion, rotated into the device frame like the MPL
+   does through the orientation matrices */
+void MPLSensor::feedFusion(int format)
+{
+    bool fuse6 = mFallbackFusionMask & (1 << GameRotationVector);
+    bool fuse9 = mFallbackFusionMask & (1 << RotationVector);
+    const signed char *orient;
+    float in[3], out[3], scale;
+
+    /* each filter only runs if the sensor it stands in for uses it */
+    if (format == DATA_FORMAT_COMPASS ? !fuse9 : !(fuse6 || fuse9))
+        return;
+
+    switch (format) {
+    case DATA_FORMAT_GYRO:
+        orient = mGyroOrientation;
+        scale = (float)mGyroScale / 32768.f * (float)M_PI / 180.f;
+        for (int i = 0; i < 3; i++)
+            in[i] = mCachedGyroData[i] * scale;
+        break;
+    case DATA_FORMAT_ACCEL:
+        /* only the direction is used */
+        orient = mAccelOrientation;
+        for (int i = 0; i < 3; i++)
+            in[i] = (float)mCachedAccelData[i];
+        break;
+    case DATA_FORMAT_COMPASS:
+        orient = mFusionCompassOrient;
+        scale = (float)mCompassScale / (float)(1L << 30) / 65536.f;
+        for (int i = 0; i < 3; i++)
+            in[i] = mCachedCompassData[i] * scale;
+        break;
+    default:
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+        out[i] = orient[i * 3] * in[0] + orient[i * 3 + 1] * in[1] +
+                 orient[i * 3 + 2] * in[2];
+
+    switch (format) {
+    case DATA_FORMAT_GYRO:
+        if (fuse6)
+            mFusion6.handleGyro(out, mGyroSensorTimestamp);
+        if (fuse9)
+            mFusion9.handleGyro(out, mGyroSensorTimestamp);
+        break;
+    case DATA_FORMAT_ACCEL:
+        if (fuse6)
+            mFusion6.handleAccel(out);
+        if (fuse9)
+            mFusion9.handleAccel(out);
+        break;
+    case DATA_FORMAT_COMPASS:
+        mFusion9.handleMag(out);
+        break;
+    }
+}
+
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+bool MPLSensor::isDirectReportSensor(int handle)
+{
+    return handle == ID_A || handle == ID_GY || handle == ID_GRV;
+}
+
+/* Write the events of 'handle' to 'channel' every 'period_ns' (0 stops).
+   The caller enables the sensor at a rate at least that high. */
+int MPLSensor::configDirectReport(int handle, DirectChannel *channel,
+                                  int token, int64_t period_ns)
+{
+    VFUNC_LOG;
+
+    direct_report_t *report = NULL, *unused = NULL;
+    int err = 0;
+
+    if (!isDirectReportSensor(handle) || !channel)
+        return -EINVAL;
+
+    pthread_mutex_lock(&mDirectLock);
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        direct_report_t *r = &mDirectReports[i];
+        if (r->channel == channel && r->handle == handle)
+            report = r;
+        else if (!r->channel && !unused)
+            unused = r;
+    }
+
+    if (period_ns == 0) {
+        if (report)
+            report->channel = NULL;
+    } else {
+        if (!report)
+            report = unused;
+        if (report) {
+            report->channel = channel;
+            report->handle = handle;
+            report->token = token;
+            report->period = period_ns;
+            report->lastTimestamp = 0;
+        } else {
+            err = -ENOSPC;
+        }
+    }
+
+    mDirectMask &= ~(1 << handle);
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        if (mDirectReports[i].channel && mDirectReports[i].handle == handle)
+            mDirectMask |= (1 << handle);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+
+    LOGV_IF(ENG_VERBOSE, "HAL:direct report handle=%d token=%d period=%lld err=%d",
+            handle, token, period_ns, err);
+    return err;
+}
+
+/* Stop all reports to 'channel'. */
+void MPLSensor::removeDirectChannel(DirectChannel *channel)
+{
+    VFUNC_LOG;
+
+    pthread_mutex_lock(&mDirectLock);
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        if (mDirectReports[i].channel == channel)
+            mDirectReports[i].channel = NULL;
+    }
+    mDirectMask = 0;
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        if (mDirectReports[i].channel)
+            mDirectMask |= (1 << mDirectReports[i].handle);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+}
+
+/* Shortest period any channel wants 'handle' at, 0 if there is none. */
+int64_t MPLSensor::getDirectPeriod(int handle)
+{
+    int64_t period = 0;
+
+    pthread_mutex_lock(&mDirectLock);
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        direct_report_t *r = &mDirectReports[i];
+        if (r->channel && r->handle == handle &&
+                (period == 0 || r->period < period))
+            period = r->period;
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return period;
+}
+
+/* Whether readEvents() returns the events of 'handle'. Sensors that are
+   only enabled for a direct channel skip the poll path altogether. */
+void MPLSensor::setPollOutput(int handle, bool enabled)
+{
+    if (uint32_t(handle) >= NumSensors)
+        return;
+
+    pthread_mutex_lock(&mDirectLock);
+    if (enabled)
+        mPollOutputMask |= (1 << handle);
+    else
+        mPollOutputMask &= ~(1 << handle);
+    pthread_mutex_unlock(&mDirectLock);
+}
+
+void MPLSensor::writeDirectReports(int handle, const sensors_event_t *event)
+{
+    pthread_mutex_lock(&mDirectLock);
+    for (int i = 0; i < MAX_DIRECT_REPORTS; i++) {
+        direct_report_t *r = &mDirectReports[i];
+        if (!r->channel || r->handle != handle)
+            continue;
+        /* the sensor may run faster for another client; allow some jitter
+           so a report at exactly the requested rate is not dropped */
+        if (r->lastTimestamp &&
+                event->timestamp - r->lastTimestamp < r->period - r->period / 8)
+            continue;
+        r->lastTimestamp = event->timestamp;
+        r->channel->write(event, r->token);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+}
+#endif
+
 void MPLSensor::initBias()
 {
     VFUNC_LOG;
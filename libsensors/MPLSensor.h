@@ -29,6 +29,12 @@
 #include "sensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "CalibrationStore.h"
+#include "DirectChannel.h"
+#include "MpuDataFormat.h"
+#include "BatchFifo.h"
+#include "TimestampNormalizer.h"
+#include "MahonyFusion.h"
 
 #include "CompassSensor.HSCDTD008A.h"
 
@@ -90,6 +96,13 @@ class PressureSensor;
         | VIRTUAL_SENSOR_MAG_6AXES_MASK     \
 )
 
+// sensors whose events are never dropped to match the requested rate
+#define DECIMATION_EXEMPT_MASK (            \
+        (1 << SignificantMotion)            \
+        | (1 << StepDetector)               \
+        | (1 << StepCounter)                \
+)
+
 // bit mask of current MPL active features (mMplFeatureActiveMask)
 #define INV_COMPASS_CAL              0x01
 #define INV_COMPASS_FIT              0x02
@@ -127,28 +140,10 @@ class PressureSensor;
         | (INV_DMP_6AXIS_QUATERNION)                 \
 )
 
-// data header format used by kernel driver.
-#define DATA_FORMAT_STEP           0x0001
-#define DATA_FORMAT_MARKER         0x0010
-#define DATA_FORMAT_EMPTY_MARKER   0x0020
-#define DATA_FORMAT_PED_STANDALONE 0x0100
-#define DATA_FORMAT_PED_QUAT       0x0200
-#define DATA_FORMAT_6_AXIS         0x0400
-#define DATA_FORMAT_QUAT           0x0800
-#define DATA_FORMAT_COMPASS        0x1000
-#define DATA_FORMAT_COMPASS_OF     0x1800
-#define DATA_FORMAT_GYRO           0x2000
-#define DATA_FORMAT_ACCEL          0x4000
-#define DATA_FORMAT_PRESSURE       0x8000
-#define DATA_FORMAT_MASK           0xffff
-
-#define BYTES_PER_SENSOR                8
-#define BYTES_PER_SENSOR_PACKET         16
-#define QUAT_ONLY_LAST_PACKET_OFFSET    16
-#define BYTES_QUAT_DATA                 24
-#define MAX_READ_SIZE                   BYTES_QUAT_DATA
-#define MAX_SUSPEND_BATCH_PACKET_SIZE   1024
-#define MAX_PACKET_SIZE                 80 //8 * 4 + (2 * 24)
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+/* (sensor, channel) pairs that can report to a direct channel at once */
+#define MAX_DIRECT_REPORTS              (3 * DIRECT_MAX_CHANNELS)
+#endif
 
 /* Uncomment to enable Low Power Quaternion */
 #define ENABLE_LP_QUAT_FEAT
@@ -199,9 +194,7 @@ public:
     virtual int getAccelFd() const;
     virtual int getCompassFd() const;
     virtual int getPollTime();
-    virtual int getStepCountPollTime();
     virtual bool hasPendingEvents() const;
-    virtual bool hasStepCountPendingEvents();
     int populateSensorList(struct sensor_t *list, int len);
 
     void buildCompassEvent();
@@ -229,11 +222,23 @@ public:
     int enableDmpPedometer(int, int);
     int readDmpPedometerEvents(sensors_event_t* data, int count, int32_t id, int outputType);
     int getDmpPedometerFd();
+    int getStepCountTimerFd();
+    int readStepCountEvents(sensors_event_t* data, int count);
     bool checkPedometerSupport() {return (mDmpPedometerEnabled || mDmpStepCountEnabled);};
     bool checkOrientationSupport() {return ((isDmpDisplayOrientationOn()
                                        && (mDmpOrientationEnabled
                                        || !isDmpScreenAutoRotationEnabled())));};
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    /* direct report channels (see DirectChannel.h) */
+    static bool isDirectReportSensor(int handle);
+    int configDirectReport(int handle, DirectChannel *channel, int token,
+                           int64_t period_ns);
+    void removeDirectChannel(DirectChannel *channel);
+    int64_t getDirectPeriod(int handle);
+    void setPollOutput(int handle, bool enabled);
+#endif
+
 protected:
     CompassSensor *mCompassSensor;
     PressureSensor *mPressureSensor;
@@ -316,10 +321,36 @@ protected:
     long mLocalSensorMask;
     int mPollTime;
     int64_t mStepCountPollTime;
+    int64_t mStepCountLatency;  // report latency the step counter was batched with
     bool mHaveGoodMpuCal;   // flag indicating that the cal file can be written
+    CalibrationStore *mCalStore; // write-behind store for the cal file
+    unsigned char *mCalBuffer;   // serialized MPL state handed to mCalStore
+    size_t mCalBufferSize;
+    int mGyroTempBin;            // table bin the current gyro bias belongs to
+    int mBiasRestoreMask;        // CAL_BIAS_* to reapply on the next enable
     int mGyroAccuracy;      // value indicating the quality of the gyro calibr.
     int mAccelAccuracy;     // value indicating the quality of the accel calibr.
     int mCompassAccuracy;   // value indicating the quality of the compass calibr.
+
+    /* 9-axis quaternion and what is derived from it, fetched from the MPL
+       once per sample by updateNavDerived() for rv/gravity/la/orientation */
+    struct {
+        float rv[5];
+        int8_t rvStatus;
+        int rvUpdate;
+        int64_t rvTimestamp;
+        float rot[9];
+        float accel[3];
+        int8_t accelStatus;
+        int64_t accelTimestamp;
+    } mNav;
+
+    /* built-in fusion standing in for the MPL rotation vectors selected
+       by FUSION_FALLBACK_PROPERTY, fed with the same raw samples */
+    uint32_t mFallbackFusionMask;
+    MahonyFusion mFusion6;
+    MahonyFusion mFusion9;
+    signed char mFusionCompassOrient[9];
     struct pollfd mPollFds[5];
     pthread_mutex_t mMplMutex;
     pthread_mutex_t mHALMutex;
@@ -353,6 +384,10 @@ protected:
     int mDmpSignificantMotionEnabled;
 
     int dmp_pedometer_fd;
+    int mStepCountTimerFd;  // paces step count reads, see updateStepCountTimer()
+    int pedometer_steps_fd;
+    int pedometer_counter_fd;
+    int vibrator_enable_fd;
     int mDmpPedometerEnabled;
     int mDmpStepCountEnabled;
 
@@ -373,6 +408,7 @@ protected:
     hfunc_t mHandlers[NumSensors];
     int64_t mEnabledTime[NumSensors];
     int64_t mLastTimestamp[NumSensors];
+    int64_t mReportDue[NumSensors];     // next report of a decimated sensor
     short mCachedGyroData[3];
     long mCachedAccelData[3];
     long mCachedCompassData[3];
@@ -535,6 +571,21 @@ protected:
     int mPressureUpdate;
     int64_t mQuatSensorTimestamp;
     int64_t mStepSensorTimestamp;
+    /* MPU packet timestamps are mapped to CLOCK_BOOTTIME and each
+       periodic stream is re-spaced; see TimestampNormalizer.h */
+    enum {
+        MPU_TS_GYRO = 0,
+        MPU_TS_ACCEL,
+        MPU_TS_COMPASS,
+        MPU_TS_QUAT,
+        MPU_TS_6_AXIS,
+        MPU_TS_PED_QUAT,
+        MPU_TS_PRESSURE,
+        MPU_TS_NUM
+    };
+    TimestampNormalizer mMpuClock;
+    BurstTimestampFilter mMpuStreams[MPU_TS_NUM];
+    int64_t mMpuArrival;
     uint64_t mLastStepCount;
     int mLeftOverBufferSize;
     char mLeftOverBuffer[1024];
@@ -547,6 +598,20 @@ protected:
     bool mEmptyDataMarkerDetected;
     int mDmpState;
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    struct direct_report_t {
+        DirectChannel *channel;
+        int handle;
+        int token;
+        int64_t period;
+        int64_t lastTimestamp;
+    };
+    pthread_mutex_t mDirectLock;
+    direct_report_t mDirectReports[MAX_DIRECT_REPORTS];
+    uint32_t mDirectMask;       // sensors reporting to a direct channel
+    uint32_t mPollOutputMask;   // sensors whose events go to readEvents()
+#endif
+
 private:
     /* added for dynamic get sensor list */
     void fillAccel(const char* accel, struct sensor_t *list);
@@ -584,9 +649,21 @@ private:
     int calctDataRates(int64_t *resetRate, int64_t *gyroRate, int64_t *accelRate, int64_t *compassRate, int64_t *pressureRate);
     int resetDataRates(int64_t resetRate, int64_t gyroRate, int64_t accelRate, int64_t compassRate, int64_t pressureRate);
     void initBias();
+    void applyBiasCache(int which);
+    void applyGyroTempBias(int64_t temperature, bool force);
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    void writeDirectReports(int handle, const sensors_event_t *event);
+#endif
+    void updateStepCountTimer(void);
+    bool isDecimated(int i, int64_t timestamp);
+    int64_t mpuTimestamp(int stream, const char *data);
+    void updateNavDerived();
+    void feedFusion(int format);
     void resetMplStates();
     void sys_dump(bool fileMode);
     int calcBatchTimeout(int en, int64_t *out);
+    int64_t calcFifoFillRate();
+    int64_t planBatchTimeout(int64_t requestedMs);
 };
 
 extern "C" {
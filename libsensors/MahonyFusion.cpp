@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "MahonyFusion.h"
+#include "RotationMath.h"
+
+static inline float vec_norm(const float *v)
+{
+    return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static inline void vec_cross(const float *a, const float *b, float *out)
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/* rotation matrix as built by rot_from_quat() back to x, y, z, w */
+static void quat_from_rot(const float *r, float *q)
+{
+    float t = r[0] + r[4] + r[8];
+    float s;
+
+    if (t > 0.f) {
+        s = sqrtf(t + 1.f) * 2.f;
+        q[3] = 0.25f * s;
+        q[0] = (r[7] - r[5]) / s;
+        q[1] = (r[2] - r[6]) / s;
+        q[2] = (r[3] - r[1]) / s;
+    } else if (r[0] > r[4] && r[0] > r[8]) {
+        s = sqrtf(1.f + r[0] - r[4] - r[8]) * 2.f;
+        q[3] = (r[7] - r[5]) / s;
+        q[0] = 0.25f * s;
+        q[1] = (r[1] + r[3]) / s;
+        q[2] = (r[2] + r[6]) / s;
+    } else if (r[4] > r[8]) {
+        s = sqrtf(1.f + r[4] - r[0] - r[8]) * 2.f;
+        q[3] = (r[2] - r[6]) / s;
+        q[0] = (r[1] + r[3]) / s;
+        q[1] = 0.25f * s;
+        q[2] = (r[5] + r[7]) / s;
+    } else {
+        s = sqrtf(1.f + r[8] - r[0] - r[4]) * 2.f;
+        q[3] = (r[3] - r[1]) / s;
+        q[0] = (r[2] + r[6]) / s;
+        q[1] = (r[5] + r[7]) / s;
+        q[2] = 0.25f * s;
+    }
+}
+
+MahonyFusion::MahonyFusion(bool useMag)
+    : mUseMag(useMag)
+{
+    reset();
+}
+
+void MahonyFusion::reset()
+{
+    mInitialized = false;
+    mQ[0] = mQ[1] = mQ[2] = 0.f;
+    mQ[3] = 1.f;
+    memset(mBias, 0, sizeof(mBias));
+    memset(mAccel, 0, sizeof(mAccel));
+    mAccelNorm = 0.f;
+    mAccelValid = false;
+    memset(mMag, 0, sizeof(mMag));
+    mMagValid = false;
+    mTimestamp = 0;
+}
+
+void MahonyFusion::handleAccel(const float *accel)
+{
+    float norm = vec_norm(accel);
+
+    if (norm <= 0.f)
+        return;
+    mAccelNorm = mAccelNorm > 0.f ? mAccelNorm * 0.99f + norm * 0.01f : norm;
+
+    /* under linear acceleration the vector is not gravity */
+    mAccelValid = fabsf(norm - mAccelNorm) < FUSION_ACCEL_TOLERANCE * mAccelNorm;
+    if (mAccelValid) {
+        mAccel[0] = accel[0] / norm;
+        mAccel[1] = accel[1] / norm;
+        mAccel[2] = accel[2] / norm;
+    }
+    if (!mInitialized && (!mUseMag || mMagValid))
+        initAttitude();
+}
+
+void MahonyFusion::handleMag(const float *mag)
+{
+    float norm = vec_norm(mag);
+
+    if (!mUseMag)
+        return;
+    mMagValid = norm > FUSION_MAG_MIN && norm < FUSION_MAG_MAX;
+    if (mMagValid) {
+        mMag[0] = mag[0] / norm;
+        mMag[1] = mag[1] / norm;
+        mMag[2] = mag[2] / norm;
+    }
+}
+
+/* attitude from the reference vectors alone; without a magnetometer the
+   heading is arbitrary, like that of the game rotation vector */
+void MahonyFusion::initAttitude()
+{
+    float east[3], north[3], r[9];
+    const float *up = mAccel;
+    float norm;
+
+    if (!mAccelValid)
+        return;
+
+    if (mUseMag) {
+        vec_cross(mMag, up, east);
+    } else {
+        /* any horizontal direction will do */
+        const float x[3] = { 1.f, 0.f, 0.f }, y[3] = { 0.f, 1.f, 0.f };
+        vec_cross(fabsf(up[1]) < 0.9f ? y : x, up, east);
+    }
+    norm = vec_norm(east);
+    if (norm < 0.1f)
+        return;
+    east[0] /= norm;
+    east[1] /= norm;
+    east[2] /= norm;
+    vec_cross(up, east, north);
+
+    /* rows are the world axes in device coordinates */
+    memcpy(r, east, sizeof(east));
+    memcpy(r + 3, north, sizeof(north));
+    memcpy(r + 6, up, 3 * sizeof(float));
+    quat_from_rot(r, mQ);
+    normalize();
+    mInitialized = true;
+}
+
+void MahonyFusion::handleGyro(const float *gyro, int64_t timestamp)
+{
+    float r[9], e[3] = { 0.f, 0.f, 0.f }, w[3], c[3];
+    float x, y, z, qw, dt;
+    int64_t last = mTimestamp;
+
+    mTimestamp = timestamp;
+    if (!mInitialized || !last || timestamp <= last ||
+            timestamp - last > FUSION_MAX_DT_NS)
+        return;
+    dt = (float)(timestamp - last) * 1e-9f;
+
+    rot_from_quat(mQ, r);
+
+    /* error between measured and estimated reference directions */
+    if (mAccelValid) {
+        vec_cross(mAccel, r + 6, c);
+        e[0] += c[0];
+        e[1] += c[1];
+        e[2] += c[2];
+    }
+    if (mUseMag && mMagValid) {
+        /* field in the world frame, with its horizontal part turned
+           onto north so that only the heading is corrected */
+        float hx = r[0] * mMag[0] + r[1] * mMag[1] + r[2] * mMag[2];
+        float hy = r[3] * mMag[0] + r[4] * mMag[1] + r[5] * mMag[2];
+        float hz = r[6] * mMag[0] + r[7] * mMag[1] + r[8] * mMag[2];
+        float by = sqrtf(hx * hx + hy * hy);
+        w[0] = by * r[3] + hz * r[6];
+        w[1] = by * r[4] + hz * r[7];
+        w[2] = by * r[5] + hz * r[8];
+        vec_cross(mMag, w, c);
+        e[0] += c[0];
+        e[1] += c[1];
+        e[2] += c[2];
+    }
+
+    mBias[0] += FUSION_KI * e[0] * dt;
+    mBias[1] += FUSION_KI * e[1] * dt;
+    mBias[2] += FUSION_KI * e[2] * dt;
+
+    float gx = gyro[0] + mBias[0] + FUSION_KP * e[0];
+    float gy = gyro[1] + mBias[1] + FUSION_KP * e[1];
+    float gz = gyro[2] + mBias[2] + FUSION_KP * e[2];
+
+    /* q' = q + 1/2 q * (0, g) dt */
+    x = mQ[0];
+    y = mQ[1];
+    z = mQ[2];
+    qw = mQ[3];
+    dt *= 0.5f;
+    mQ[0] += ( qw * gx + y * gz - z * gy) * dt;
+    mQ[1] += ( qw * gy - x * gz + z * gx) * dt;
+    mQ[2] += ( qw * gz + x * gy - y * gx) * dt;
+    mQ[3] += (-x * gx - y * gy - z * gz) * dt;
+    normalize();
+}
+
+void MahonyFusion::normalize()
+{
+    float norm = sqrtf(mQ[0] * mQ[0] + mQ[1] * mQ[1] +
+                       mQ[2] * mQ[2] + mQ[3] * mQ[3]);
+
+    if (norm <= 0.f) {
+        reset();
+        return;
+    }
+    /* keep w positive, as the rotation vector sensors do */
+    if (mQ[3] < 0.f)
+        norm = -norm;
+    mQ[0] /= norm;
+    mQ[1] /= norm;
+    mQ[2] /= norm;
+    mQ[3] /= norm;
+}
+
+bool MahonyFusion::getRotationVector(float *rv, int64_t *timestamp) const
+{
+    if (!mInitialized)
+        return false;
+    memcpy(rv, mQ, sizeof(mQ));
+    *timestamp = mTimestamp;
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MAHONY_FUSION_H
+#define MAHONY_FUSION_H
+
+#include <stdint.h>
+
+/* debug property selecting the sensors computed by the built-in fusion
+   instead of the MPL: a comma separated list of "rv" and "grv" */
+#define FUSION_FALLBACK_PROPERTY    "persist.sensors.fallback_fusion"
+
+/* proportional and integral (gyro bias) gains of the correction */
+#define FUSION_KP                   1.0f
+#define FUSION_KI                   0.1f
+/* gyro samples further apart than this restart the integration */
+#define FUSION_MAX_DT_NS            500000000LL
+/* accel is only trusted within this fraction of its average magnitude */
+#define FUSION_ACCEL_TOLERANCE      0.25f
+/* plausible geomagnetic field strength, uT */
+#define FUSION_MAG_MIN              15.f
+#define FUSION_MAG_MAX              100.f
+
+/*****************************************************************************/
+
+/*
+ * Mahony complementary filter: gyro integration corrected towards the
+ * accel (and, for 9 axes, the magnetometer) reference directions, with an
+ * integral term that soaks up the gyro bias. Fixed-size state and float
+ * math only, so it is deterministic for a given input sequence.
+ *
+ * Inputs are in the Android device frame: rad/s, accel in any unit, mag
+ * in uT. The output is a rotation vector (x, y, z, w) of the device in
+ * the east-north-up world frame.
+ */
+class MahonyFusion {
+public:
+    MahonyFusion(bool useMag);
+
+    void reset();
+
+    void handleAccel(const float *accel);
+    void handleMag(const float *mag);
+    /* integrates up to 'timestamp' and applies the correction */
+    void handleGyro(const float *gyro, int64_t timestamp);
+
+    /* false until the filter has been initialised from the accel */
+    bool getRotationVector(float *rv, int64_t *timestamp) const;
+
+private:
+    void initAttitude();
+    void normalize();
+
+    bool mUseMag;
+    bool mInitialized;
+    float mQ[4];            /* x, y, z, w */
+    float mBias[3];         /* integral term, rad/s */
+    float mAccel[3];
+    float mAccelNorm;       /* running average magnitude */
+    bool mAccelValid;
+    float mMag[3];
+    bool mMagValid;
+    int64_t mTimestamp;
+};
+
+/*****************************************************************************/
+
+#endif  /* MAHONY_FUSION_H */
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MPU_DATA_FORMAT_H
+#define MPU_DATA_FORMAT_H
+
+/* Layout of the packets the MPU kernel driver hands out through the IIO
+   buffer, as parsed by MPLSensor::buildMpuEvent(). */
+
+// data header format used by kernel driver.
+#define DATA_FORMAT_STEP           0x0001
+#define DATA_FORMAT_MARKER         0x0010
+#define DATA_FORMAT_EMPTY_MARKER   0x0020
+#define DATA_FORMAT_PED_STANDALONE 0x0100
+#define DATA_FORMAT_PED_QUAT       0x0200
+#define DATA_FORMAT_6_AXIS         0x0400
+#define DATA_FORMAT_QUAT           0x0800
+#define DATA_FORMAT_COMPASS        0x1000
+#define DATA_FORMAT_COMPASS_OF     0x1800
+#define DATA_FORMAT_GYRO           0x2000
+#define DATA_FORMAT_ACCEL          0x4000
+#define DATA_FORMAT_PRESSURE       0x8000
+#define DATA_FORMAT_MASK           0xffff
+
+#define BYTES_PER_SENSOR                8
+#define BYTES_PER_SENSOR_PACKET         16
+#define QUAT_ONLY_LAST_PACKET_OFFSET    16
+#define BYTES_QUAT_DATA                 24
+#define MAX_READ_SIZE                   BYTES_QUAT_DATA
+#define MAX_SUSPEND_BATCH_PACKET_SIZE   1024
+#define MAX_PACKET_SIZE                 80 //8 * 4 + (2 * 24)
+
+#endif  /* MPU_DATA_FORMAT_H */
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MpuPacketGenerator.h"
+
+/* the synthetic device turns about z at this rate (rad/s) */
+#define GEN_TURN_RATE       0.5
+
+static const unsigned short sFormat[MPU_GEN_NUM] = {
+    DATA_FORMAT_GYRO,
+    DATA_FORMAT_ACCEL,
+    DATA_FORMAT_COMPASS,
+    DATA_FORMAT_QUAT,
+    DATA_FORMAT_6_AXIS,
+    DATA_FORMAT_PED_QUAT,
+    DATA_FORMAT_STEP,
+};
+
+MpuPacketGenerator::MpuPacketGenerator(const mpu_gen_config_t *config)
+    : mConfig(*config),
+      mLastTime(config->startTime),
+      mStepPending(false),
+      mBurstCount(0),
+      mDataSinceFlush(false),
+      mDone(false),
+      mHead(0),
+      mTail(0),
+      mStepFlags(0),
+      mMarkers(0),
+      mEmptyMarkers(0),
+      mPartialReads(0),
+      mBytes(0)
+{
+    int packets = mConfig.burstPackets > MPU_GEN_NUM ?
+            mConfig.burstPackets : MPU_GEN_NUM;
+
+    /* room for a burst plus the markers of two flushes */
+    mBufSize = packets * BYTES_QUAT_DATA + 2 * BYTES_PER_SENSOR;
+    mBuf = (unsigned char *)calloc(1, mBufSize);
+    for (int i = 0; i < MPU_GEN_NUM; i++) {
+        mNext[i] = mConfig.startTime;
+        mPackets[i] = 0;
+    }
+}
+
+MpuPacketGenerator::~MpuPacketGenerator()
+{
+    free(mBuf);
+}
+
+void MpuPacketGenerator::defaultConfig(mpu_gen_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->period[MPU_GEN_GYRO] = 5000000LL;
+    config->period[MPU_GEN_ACCEL] = 5000000LL;
+    config->period[MPU_GEN_COMPASS] = 20000000LL;
+    config->period[MPU_GEN_QUAT] = 5000000LL;
+    config->duration = 10000000000LL;
+    config->seed = 1;
+}
+
+size_t MpuPacketGenerator::packetSize(int which)
+{
+    switch (which) {
+    case MPU_GEN_QUAT:
+    case MPU_GEN_6_AXIS:
+        return BYTES_QUAT_DATA;
+    default:
+        return BYTES_PER_SENSOR_PACKET;
+    }
+}
+
+size_t MpuPacketGenerator::read(void *buf, size_t len)
+{
+    size_t n;
+
+    if (!mBuf || !len)
+        return 0;
+
+    if (mHead == mTail) {
+        mHead = mTail = 0;
+        while (mHead == mTail) {
+            if (!generate())
+                return 0;
+        }
+    }
+
+    n = mTail - mHead;
+    if (n > len)
+        n = len;
+    if (n > 1 && chance(mConfig.partialPercent)) {
+        n = 1 + rand_r(&mConfig.seed) % (n - 1);
+        mPartialReads++;
+    }
+
+    memcpy(buf, mBuf + mHead, n);
+    mHead += n;
+    mBytes += n;
+    return n;
+}
+
+/* enabled stream with the earliest pending packet, -1 if none */
+int MpuPacketGenerator::nextStream() const
+{
+    int next = -1;
+
+    for (int i = 0; i < MPU_GEN_NUM; i++) {
+        if (mConfig.period[i] <= 0)
+            continue;
+        if (next < 0 || mNext[i] < mNext[next])
+            next = i;
+    }
+    return next;
+}
+
+/* append one burst, or one sample set when unbatched; false when done */
+bool MpuPacketGenerator::generate()
+{
+    int packets = mConfig.burstPackets;
+    int64_t end = mConfig.startTime + mConfig.duration;
+    int64_t setTime = 0;
+
+    if (mDone)
+        return false;
+
+    for (int n = 0; !packets || n < packets; n++) {
+        int which = nextStream();
+        if (which < 0 || (mConfig.duration && mNext[which] >= end)) {
+            /* final flush, so the consumer sees the end of the data */
+            if (mConfig.flushBursts)
+                flush();
+            mDone = true;
+            return mTail > 0;
+        }
+        /* unbatched: only the packets sharing one timestamp */
+        if (!packets) {
+            if (n && mNext[which] != setTime)
+                break;
+            setTime = mNext[which];
+        }
+
+        if (which == MPU_GEN_STEP) {
+            if (chance(mConfig.stepInHeaderPercent))
+                mStepPending = true;
+            else
+                appendPacket(which, mNext[which], false);
+        } else {
+            appendPacket(which, mNext[which], mStepPending);
+            mStepPending = false;
+        }
+        mNext[which] += mConfig.period[which];
+    }
+
+    mBurstCount++;
+    if (mConfig.flushBursts && mBurstCount % mConfig.flushBursts == 0)
+        flush();
+    return true;
+}
+
+void MpuPacketGenerator::flush()
+{
+    if (!mDataSinceFlush || chance(mConfig.emptyFlushPercent)) {
+        appendMarker(DATA_FORMAT_EMPTY_MARKER);
+        mEmptyMarkers++;
+    } else {
+        appendMarker(DATA_FORMAT_MARKER);
+        mMarkers++;
+    }
+    mDataSinceFlush = false;
+}
+
+/* z of the rotation by 'angle' about z, on the q0 >= 0 side */
+static double halfTurnSin(double angle)
+{
+    return cos(angle / 2) < 0 ? -sin(angle / 2) : sin(angle / 2);
+}
+
+void MpuPacketGenerator::appendPacket(int which, int64_t ts, bool step)
+{
+    size_t size = packetSize(which);
+    double angle = (double)(ts - mConfig.startTime) * 1e-9 * GEN_TURN_RATE;
+    unsigned short format = sFormat[which];
+
+    if (mTail + size > mBufSize)
+        return;
+
+    memset(mBuf + mTail, 0, size);
+    /* the capture time stays nominal, so it never goes backwards */
+    mLastTime = ts;
+    if (mConfig.jitter)
+        ts += noise(mConfig.jitter);
+    if (step) {
+        format |= DATA_FORMAT_STEP;
+        mStepFlags++;
+    }
+    putShort(0, format);
+
+    switch (which) {
+    case MPU_GEN_GYRO:
+        /* +-2000 dps full scale */
+        putShort(2, noise(8));
+        putShort(4, noise(8));
+        putShort(6, (int16_t)(GEN_TURN_RATE * 180.0 / M_PI * 16.4) + noise(8));
+        putInt64(8, ts);
+        break;
+    case MPU_GEN_ACCEL:
+        /* +-2g full scale, lying flat */
+        putShort(2, noise(40));
+        putShort(4, noise(40));
+        putShort(6, 16384 + noise(40));
+        putInt64(8, ts);
+        break;
+    case MPU_GEN_COMPASS:
+        putShort(2, (int16_t)(300 * cos(angle)) + noise(4));
+        putShort(4, (int16_t)(-300 * sin(angle)) + noise(4));
+        putShort(6, -400 + noise(4));
+        putInt64(8, ts);
+        break;
+    case MPU_GEN_QUAT:
+    case MPU_GEN_6_AXIS:
+        /* q1..q3 in q30, rotation about z; q0 is rebuilt as a positive
+           root, so the sign is that of the quaternion with q0 >= 0 */
+        putInt(4, 0);
+        putInt(8, 0);
+        putInt(12, (int32_t)(halfTurnSin(angle) * (1L << 30)));
+        putInt64(QUAT_ONLY_LAST_PACKET_OFFSET, ts);
+        break;
+    case MPU_GEN_PED_QUAT:
+        /* q1..q3 in q14 */
+        putShort(2, 0);
+        putShort(4, 0);
+        putShort(6, (int16_t)(halfTurnSin(angle) * (1 << 14)));
+        putInt64(8, ts);
+        break;
+    case MPU_GEN_STEP:
+        putInt64(BYTES_PER_SENSOR, ts);
+        break;
+    }
+
+    mTail += size;
+    mPackets[which]++;
+    mDataSinceFlush = true;
+}
+
+void MpuPacketGenerator::appendMarker(unsigned short format)
+{
+    if (mTail + BYTES_PER_SENSOR > mBufSize)
+        return;
+    memset(mBuf + mTail, 0, BYTES_PER_SENSOR);
+    putShort(0, format);
+    mTail += BYTES_PER_SENSOR;
+}
+
+/* packet fields, relative to the packet being appended at mTail */
+void MpuPacketGenerator::putShort(size_t offset, int16_t value)
+{
+    memcpy(mBuf + mTail + offset, &value, sizeof(value));
+}
+
+void MpuPacketGenerator::putInt(size_t offset, int32_t value)
+{
+    memcpy(mBuf + mTail + offset, &value, sizeof(value));
+}
+
+void MpuPacketGenerator::putInt64(size_t offset, int64_t value)
+{
+    memcpy(mBuf + mTail + offset, &value, sizeof(value));
+}
+
+int MpuPacketGenerator::chance(int percent)
+{
+    return percent > 0 && (int)(rand_r(&mConfig.seed) % 100) < percent;
+}
+
+int MpuPacketGenerator::noise(int amplitude)
+{
+    return (int)(rand_r(&mConfig.seed) % (2 * amplitude + 1)) - amplitude;
+}
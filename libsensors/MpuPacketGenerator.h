@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MPU_PACKET_GENERATOR_H
+#define MPU_PACKET_GENERATOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "MpuDataFormat.h"
+
+enum {
+    MPU_GEN_GYRO = 0,
+    MPU_GEN_ACCEL,
+    MPU_GEN_COMPASS,
+    MPU_GEN_QUAT,
+    MPU_GEN_6_AXIS,
+    MPU_GEN_PED_QUAT,
+    MPU_GEN_STEP,
+    MPU_GEN_NUM
+};
+
+struct mpu_gen_config_t {
+    int64_t period[MPU_GEN_NUM];    /* ns between packets, 0 disables */
+    int64_t startTime;              /* timestamp of the first packets */
+    int64_t duration;               /* ns of data to generate, 0 is endless */
+    unsigned int seed;
+    /* packets per batch burst; 0 behaves like the unbatched driver,
+       which never has more than one sample set pending */
+    int burstPackets;
+    /* bursts between flushes, 0 never flushes; each flush appends a
+       MARKER, or an EMPTY_MARKER if there is no data since the last */
+    int flushBursts;
+    /* chance (0-100) that a read returns fewer bytes than asked for
+       and than are pending, so the caller sees a split packet */
+    int partialPercent;
+    /* chance (0-100) that a step is flagged in the header of the next
+       data packet instead of sent as a standalone STEP packet */
+    int stepInHeaderPercent;
+    /* chance (0-100) that a flush finds the FIFO already drained by
+       normal reads and yields an EMPTY_MARKER */
+    int emptyFlushPercent;
+    /* packet timestamps are off their nominal time by up to this
+       many ns, like the interrupt timestamps of the driver */
+    int jitter;
+};
+
+/*****************************************************************************/
+
+/*
+ * Produces a byte stream in the format the MPU driver hands out through
+ * its IIO buffer, for feeding MPLSensor::buildMpuEvent() from a file or
+ * a pipe on a host. Packets of all enabled streams are interleaved in
+ * timestamp order; read() cuts the stream like a read() of the iio fd
+ * would.
+ */
+class MpuPacketGenerator {
+public:
+    MpuPacketGenerator(const mpu_gen_config_t *config);
+    ~MpuPacketGenerator();
+
+    static void defaultConfig(mpu_gen_config_t *config);
+    /* size of one packet of stream 'which' */
+    static size_t packetSize(int which);
+
+    /* copy up to 'len' bytes of the stream into 'buf'; returns the
+       number of bytes copied, 0 once 'duration' is over */
+    size_t read(void *buf, size_t len);
+    /* timestamp of the most recently generated packet */
+    int64_t time() const { return mLastTime; }
+
+    /* counters, for checking what the consumer reported */
+    uint64_t packets(int which) const { return mPackets[which]; }
+    uint64_t stepFlags() const { return mStepFlags; }
+    uint64_t markers() const { return mMarkers; }
+    uint64_t emptyMarkers() const { return mEmptyMarkers; }
+    uint64_t partialReads() const { return mPartialReads; }
+    uint64_t bytes() const { return mBytes; }
+
+private:
+    int nextStream() const;
+    bool generate();
+    void appendPacket(int which, int64_t ts, bool step);
+    void appendMarker(unsigned short format);
+    void putShort(size_t offset, int16_t value);
+    void putInt(size_t offset, int32_t value);
+    void putInt64(size_t offset, int64_t value);
+    void flush();
+    int chance(int percent);
+    int noise(int amplitude);
+
+    mpu_gen_config_t mConfig;
+    int64_t mNext[MPU_GEN_NUM];
+    int64_t mLastTime;
+    bool mStepPending;
+    int mBurstCount;
+    bool mDataSinceFlush;
+    bool mDone;
+
+    /* generated but not yet read; large enough for one whole burst */
+    unsigned char *mBuf;
+    size_t mBufSize;
+    size_t mHead;
+    size_t mTail;
+
+    uint64_t mPackets[MPU_GEN_NUM];
+    uint64_t mStepFlags;
+    uint64_t mMarkers;
+    uint64_t mEmptyMarkers;
+    uint64_t mPartialReads;
+    uint64_t mBytes;
+};
+
+/*****************************************************************************/
+
+#endif  /* MPU_PACKET_GENERATOR_H */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ROTATION_MATH_H
+#define ROTATION_MATH_H
+
+#include <math.h>
+
+/*
+ * Float helpers for the sensors derived from the 9-axis quaternion.
+ *
+ * The matrix is the row-major device-to-world rotation, laid out like
+ * SensorManager.getRotationMatrixFromVector(); its last row is the world
+ * z axis (up) in device coordinates. Everything is straight-line float
+ * code so the compiler can keep it in vector registers.
+ */
+
+#define ROT_GRAVITY_EARTH       9.80665f
+#define ROT_RAD2DEG             57.29577951f
+
+/* q is a rotation vector: x, y, z, w */
+static inline void rot_from_quat(const float *q, float *r)
+{
+    float x2 = q[0] + q[0], y2 = q[1] + q[1], z2 = q[2] + q[2];
+    float xx = q[0] * x2, yy = q[1] * y2, zz = q[2] * z2;
+    float xy = q[0] * y2, xz = q[0] * z2, yz = q[1] * z2;
+    float wx = q[3] * x2, wy = q[3] * y2, wz = q[3] * z2;
+
+    r[0] = 1.f - yy - zz;  r[1] = xy - wz;        r[2] = xz + wy;
+    r[3] = xy + wz;        r[4] = 1.f - xx - zz;  r[5] = yz - wx;
+    r[6] = xz - wy;        r[7] = yz + wx;        r[8] = 1.f - xx - yy;
+}
+
+/* gravity in device coordinates, m/s^2 */
+static inline void rot_gravity(const float *r, float *g)
+{
+    g[0] = r[6] * ROT_GRAVITY_EARTH;
+    g[1] = r[7] * ROT_GRAVITY_EARTH;
+    g[2] = r[8] * ROT_GRAVITY_EARTH;
+}
+
+/* legacy TYPE_ORIENTATION as inv_get_sensor_type_orientation() reports
+   it: azimuth [0, 360) is the heading of the device y axis, pitch
+   [-180, 180] its elevation, past 90 when the screen faces down, and roll
+   [-90, 90] from the x axis and the screen normal, in degrees */
+static inline void rot_orientation(const float *r, float *o)
+{
+    o[0] = atan2f(r[1], r[4]) * ROT_RAD2DEG;
+    if (o[0] < 0.f)
+        o[0] += 360.f;
+
+    o[1] = -atan2f(r[7], sqrtf(r[1] * r[1] + r[4] * r[4])) * ROT_RAD2DEG;
+    if (r[8] < 0.f)
+        o[1] = (o[1] >= 0.f ? 180.f : -180.f) - o[1];
+
+    o[2] = atan2f(r[8], r[6]) * ROT_RAD2DEG - 90.f;
+    if (o[2] >= 90.f)
+        o[2] = 180.f - o[2];
+    else if (o[2] < -90.f)
+        o[2] = -180.f - o[2];
+}
+
+#endif  /* ROTATION_MATH_H */
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SAMPLE_DECIMATION_H
+#define SAMPLE_DECIMATION_H
+
+#include <stdint.h>
+
+/*
+ * Whether to report a sample at 'timestamp' to a client that asked for one
+ * every 'period', when the sensor runs faster for someone else. '*due' is
+ * when the next report is due, 0 before the first. It advances by whole
+ * periods, so the reports average out to the requested rate even when the
+ * samples do not fall on multiples of it. A sample up to an eighth of a
+ * period early still counts, to absorb timestamp jitter. After a gap of a
+ * period or more, or a timestamp going backwards, the schedule starts over
+ * from the sample.
+ */
+static inline bool takeSample(int64_t *due, int64_t timestamp, int64_t period)
+{
+    int64_t early = period / 8;
+
+    if (*due) {
+        if (timestamp >= *due - early && timestamp < *due + period) {
+            *due += period;
+            return true;
+        }
+        if (timestamp < *due - early && timestamp >= *due - period - early)
+            return false;
+    }
+    *due = timestamp + period;
+    return true;
+}
+
+#endif  /* SAMPLE_DECIMATION_H */
@@ -26,6 +26,7 @@
 #include <pthread.h>
 
 #include "SamsungSensorBase.h"
+#include "SensorTrace.h"
 
 char *SamsungSensorBase::makeSysfsName(const char *input_name,
                                        const char *file_name) {
@@ -165,6 +166,9 @@ int SamsungSensorBase::readEvents(sensors_event_t* data, int count)
     
     mInputReader.fill(data_fd);
     while (count && mInputReader.readEvent(&event)) {
+        SensorTraceWriter *trace = SensorTraceWriter::get();
+        if (trace)
+            trace->record(SENSOR_TRACE_INPUT, mPendingEvent.sensor, event, sizeof(*event));
         mPendingEvent.timestamp = 0;
         if (mEnabled && handleEvent(event)) {
             mPendingEvent.timestamp = (mPendingEvent.timestamp ? mPendingEvent.timestamp : getTimestamp());
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cutils/log.h>
+
+#include "SensorTrace.h"
+
+#define TRACE_BUFFER_SIZE   (64 * 1024)
+#define TRACE_ALIGN(len)    (((len) + 7) & ~(size_t)7)
+
+static int64_t clockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*****************************************************************************/
+
+SensorTraceWriter *SensorTraceWriter::sInstance = NULL;
+
+SensorTraceWriter *SensorTraceWriter::create(const char *path)
+{
+    return open(path, O_TRUNC);
+}
+
+SensorTraceWriter *SensorTraceWriter::createInDir(const char *dir)
+{
+    char path[PATH_MAX];
+    int64_t now = clockNs(CLOCK_BOOTTIME);
+
+    snprintf(path, sizeof(path), "%s/sensors-%lld-%d.trace", dir,
+             (long long)(now / 1000000000LL), (int)getpid());
+    return open(path, O_EXCL | O_NOFOLLOW);
+}
+
+SensorTraceWriter *SensorTraceWriter::open(const char *path, int flags)
+{
+    sensor_trace_header_t header;
+    int fd;
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0640);
+    if (fd < 0) {
+        ALOGE("SensorTrace: cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    SensorTraceWriter *writer = new SensorTraceWriter(fd);
+    if (!writer->mBuf) {
+        delete writer;
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SENSOR_TRACE_MAGIC;
+    header.version = SENSOR_TRACE_VERSION;
+    header.startTime = clockNs(CLOCK_BOOTTIME);
+    pthread_mutex_lock(&writer->mLock);
+    writer->append(&header, sizeof(header));
+    pthread_mutex_unlock(&writer->mLock);
+
+    ALOGI("SensorTrace: recording to %s", path);
+    return writer;
+}
+
+SensorTraceWriter::SensorTraceWriter(int fd)
+    : mFd(fd),
+      mBuf((char *)malloc(TRACE_BUFFER_SIZE)),
+      mBufLen(0),
+      mOffset(0),
+      mNextIndexTime(0),
+      mIndex(NULL),
+      mIndexCount(0),
+      mIndexSize(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+}
+
+SensorTraceWriter::~SensorTraceWriter()
+{
+    sensor_trace_record_t rec;
+    sensor_trace_trailer_t trailer;
+
+    pthread_mutex_lock(&mLock);
+    if (mBuf) {
+        memset(&rec, 0, sizeof(rec));
+        rec.length = mIndexCount * sizeof(sensor_trace_index_t);
+        rec.type = SENSOR_TRACE_INDEX;
+        rec.timestamp = clockNs(CLOCK_BOOTTIME);
+
+        memset(&trailer, 0, sizeof(trailer));
+        trailer.magic = SENSOR_TRACE_TRAILER_MAGIC;
+        trailer.count = mIndexCount;
+        trailer.offset = mOffset;
+
+        append(&rec, sizeof(rec));
+        append(mIndex, rec.length);
+        append(&trailer, sizeof(trailer));
+        flushLocked();
+    }
+    pthread_mutex_unlock(&mLock);
+
+    close(mFd);
+    pthread_mutex_destroy(&mLock);
+    free(mIndex);
+    free(mBuf);
+}
+
+void SensorTraceWriter::record(int type, int source, const void *data, size_t len)
+{
+    recordAt(clockNs(CLOCK_BOOTTIME), type, source, data, len);
+}
+
+void SensorTraceWriter::recordAt(int64_t timestamp, int type, int source,
+                                 const void *data, size_t len)
+{
+    sensor_trace_record_t rec;
+    static const char pad[8] = { 0 };
+
+    rec.length = len;
+    rec.type = type;
+    rec.source = source;
+    rec.timestamp = timestamp;
+
+    pthread_mutex_lock(&mLock);
+    if (rec.timestamp >= mNextIndexTime) {
+        if (mIndexCount == mIndexSize) {
+            uint32_t size = mIndexSize ? mIndexSize * 2 : 256;
+            sensor_trace_index_t *index = (sensor_trace_index_t *)
+                    realloc(mIndex, size * sizeof(*index));
+            if (index) {
+                mIndex = index;
+                mIndexSize = size;
+            }
+        }
+        if (mIndexCount < mIndexSize) {
+            mIndex[mIndexCount].timestamp = rec.timestamp;
+            mIndex[mIndexCount].offset = mOffset;
+            mIndexCount++;
+        }
+        mNextIndexTime = rec.timestamp + SENSOR_TRACE_INDEX_INTERVAL_NS;
+    }
+    append(&rec, sizeof(rec));
+    append(data, len);
+    append(pad, TRACE_ALIGN(len) - len);
+    pthread_mutex_unlock(&mLock);
+}
+
+/* called with mLock held */
+void SensorTraceWriter::append(const void *data, size_t len)
+{
+    const char *src = (const char *)data;
+
+    mOffset += len;
+    while (len) {
+        size_t n = TRACE_BUFFER_SIZE - mBufLen;
+        if (n > len)
+            n = len;
+        memcpy(mBuf + mBufLen, src, n);
+        mBufLen += n;
+        src += n;
+        len -= n;
+        if (mBufLen == TRACE_BUFFER_SIZE)
+            flushLocked();
+    }
+}
+
+void SensorTraceWriter::flushLocked()
+{
+    size_t done = 0;
+
+    while (done < mBufLen) {
+        ssize_t res = write(mFd, mBuf + done, mBufLen - done);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("SensorTrace: write failed: %s", strerror(errno));
+            break;
+        }
+        done += res;
+    }
+    mBufLen = 0;
+}
+
+/*****************************************************************************/
+
+SensorTraceReader::SensorTraceReader()
+    : mBase(NULL),
+      mSize(0),
+      mIndex(NULL),
+      mIndexCount(0)
+{
+}
+
+SensorTraceReader::~SensorTraceReader()
+{
+    if (mBase)
+        munmap((void *)mBase, mSize);
+}
+
+int SensorTraceReader::open(const char *path)
+{
+    const sensor_trace_header_t *header;
+    const sensor_trace_trailer_t *trailer;
+    const sensor_trace_record_t *rec;
+    struct stat st;
+    void *base;
+    int fd, err;
+
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (fstat(fd, &st) < 0) {
+        err = -errno;
+        close(fd);
+        return err;
+    }
+    if ((size_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        return -EINVAL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    err = -errno;
+    close(fd);
+    if (base == MAP_FAILED)
+        return err;
+
+    header = (const sensor_trace_header_t *)base;
+    if (header->magic != SENSOR_TRACE_MAGIC ||
+            header->version != SENSOR_TRACE_VERSION) {
+        munmap(base, st.st_size);
+        return -EINVAL;
+    }
+    mBase = (const char *)base;
+    mSize = st.st_size;
+
+    /* the index is optional, the file is usable without it */
+    if (mSize >= sizeof(*header) + sizeof(*trailer)) {
+        trailer = (const sensor_trace_trailer_t *)
+                (mBase + mSize - sizeof(*trailer));
+        rec = (trailer->magic == SENSOR_TRACE_TRAILER_MAGIC) ?
+                at(trailer->offset) : NULL;
+        if (rec && rec->type == SENSOR_TRACE_INDEX &&
+                rec->length == trailer->count * sizeof(sensor_trace_index_t)) {
+            mIndex = (const sensor_trace_index_t *)payload(rec);
+            mIndexCount = trailer->count;
+        }
+    }
+    return 0;
+}
+
+int64_t SensorTraceReader::startTime() const
+{
+    return mBase ? ((const sensor_trace_header_t *)mBase)->startTime : 0;
+}
+
+/* the record at 'offset', if it lies entirely within the file */
+const sensor_trace_record_t *SensorTraceReader::at(uint64_t offset) const
+{
+    const sensor_trace_record_t *rec;
+
+    if (!mBase || offset < sizeof(sensor_trace_header_t) || (offset & 7) ||
+            offset + sizeof(*rec) > mSize)
+        return NULL;
+    rec = (const sensor_trace_record_t *)(mBase + offset);
+    if (offset + sizeof(*rec) + TRACE_ALIGN(rec->length) > mSize)
+        return NULL;
+    return rec;
+}
+
+const sensor_trace_record_t *SensorTraceReader::first() const
+{
+    return at(sizeof(sensor_trace_header_t));
+}
+
+const sensor_trace_record_t *SensorTraceReader::next(
+        const sensor_trace_record_t *rec) const
+{
+    const sensor_trace_record_t *n;
+
+    n = at((const char *)rec - mBase + sizeof(*rec) + TRACE_ALIGN(rec->length));
+    /* the index closes the trace */
+    return (n && n->type != SENSOR_TRACE_INDEX) ? n : NULL;
+}
+
+const sensor_trace_record_t *SensorTraceReader::seek(int64_t timestamp) const
+{
+    const sensor_trace_record_t *rec = first();
+    uint32_t lo = 0, hi = mIndexCount;
+
+    /* last index entry at or before 'timestamp', then walk from there */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (mIndex[mid].timestamp <= timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && at(mIndex[lo - 1].offset))
+        rec = at(mIndex[lo - 1].offset);
+
+    while (rec && rec->type == SENSOR_TRACE_INDEX)
+        rec = next(rec);
+    while (rec && rec->timestamp < timestamp)
+        rec = next(rec);
+    return rec;
+}
+
+int SensorTraceReader::replay(int64_t timestamp, float speed,
+                              replay_cb_t cb, void *arg) const
+{
+    const sensor_trace_record_t *rec = seek(timestamp);
+    int64_t traceStart, wallStart;
+    int res;
+
+    if (!rec)
+        return 0;
+    traceStart = rec->timestamp;
+    wallStart = clockNs(CLOCK_MONOTONIC);
+
+    for (; rec; rec = next(rec)) {
+        if (speed > 0) {
+            int64_t due = wallStart +
+                    (int64_t)((rec->timestamp - traceStart) / speed);
+            struct timespec ts;
+            ts.tv_sec = due / 1000000000LL;
+            ts.tv_nsec = due % 1000000000LL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+        res = cb(rec, payload(rec), arg);
+        if (res)
+            return res;
+    }
+    return 0;
+}
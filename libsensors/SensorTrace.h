@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SENSOR_TRACE_H
+#define SENSOR_TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Sensor trace file format
+ *
+ *   header | record | record | ... | index record | trailer
+ *
+ * Every record is a sensor_trace_record_t followed by 'length' bytes of
+ * payload, padded to 8 bytes so that a mapped file can be walked without
+ * unaligned accesses. All fields are in host byte order.
+ *
+ * The index record holds one sensor_trace_index_t per second of capture
+ * and the trailer at the very end of the file points at it. A file cut
+ * short (e.g. the HAL was killed) has no trailer; it can still be read
+ * sequentially.
+ */
+
+#define SENSOR_TRACE_MAGIC          0x43525453  /* "STRC" */
+#define SENSOR_TRACE_TRAILER_MAGIC  0x58444953  /* "SIDX" */
+#define SENSOR_TRACE_VERSION        1
+
+/* one index entry per this much capture time */
+#define SENSOR_TRACE_INDEX_INTERVAL_NS  1000000000LL
+
+/* debug property that turns recording on when set to 1; it is ignored
+   unless ro.debuggable is 1 */
+#define SENSOR_TRACE_PROPERTY       "debug.sensors.record"
+/* the HAL only records to new files in here, named by createInDir() */
+#define SENSOR_TRACE_DIR            "/data/misc/sensors"
+
+enum {
+    SENSOR_TRACE_IIO = 1,   /* bytes read from the MPU IIO buffer */
+    SENSOR_TRACE_INPUT,     /* struct input_event of an input sensor */
+    SENSOR_TRACE_EVENTS,    /* sensors_event_t array returned by poll() */
+    SENSOR_TRACE_INDEX,     /* sensor_trace_index_t array */
+};
+
+struct sensor_trace_header_t {
+    uint32_t magic;
+    uint32_t version;
+    int64_t startTime;          /* CLOCK_BOOTTIME ns */
+};
+
+struct sensor_trace_record_t {
+    uint32_t length;            /* payload bytes, without padding */
+    uint16_t type;              /* SENSOR_TRACE_* */
+    uint16_t source;            /* sensor handle, 0 if not specific */
+    int64_t timestamp;          /* CLOCK_BOOTTIME ns when captured */
+};
+
+struct sensor_trace_index_t {
+    int64_t timestamp;
+    uint64_t offset;            /* of the record, from the file start */
+};
+
+struct sensor_trace_trailer_t {
+    uint32_t magic;
+    uint32_t count;             /* index entries */
+    uint64_t offset;            /* of the index record */
+};
+
+/*****************************************************************************/
+
+/*
+ * Appends records to a trace file. The HAL hooks record to the instance
+ * returned by get(), if there is one, so recording costs one pointer test
+ * when it is off. Records are buffered and written in large chunks.
+ */
+class SensorTraceWriter {
+public:
+    /* start a new trace at 'path', for host tools; NULL on failure */
+    static SensorTraceWriter *create(const char *path);
+    /* start a trace in a new file of 'dir' named after the boot time and
+       pid; never follows a link nor reuses a file; NULL on failure */
+    static SensorTraceWriter *createInDir(const char *dir);
+    /* writes the index and closes the file */
+    ~SensorTraceWriter();
+
+    static SensorTraceWriter *get() { return sInstance; }
+    static void set(SensorTraceWriter *writer) { sInstance = writer; }
+
+    void record(int type, int source, const void *data, size_t len);
+    /* same, with a capture time other than now, e.g. for synthetic data */
+    void recordAt(int64_t timestamp, int type, int source,
+                  const void *data, size_t len);
+
+private:
+    SensorTraceWriter(int fd);
+    static SensorTraceWriter *open(const char *path, int flags);
+    void append(const void *data, size_t len);
+    void flushLocked();
+
+    static SensorTraceWriter *sInstance;
+
+    int mFd;
+    pthread_mutex_t mLock;
+    char *mBuf;
+    size_t mBufLen;
+    uint64_t mOffset;           /* file offset of the next record */
+    int64_t mNextIndexTime;
+    sensor_trace_index_t *mIndex;
+    uint32_t mIndexCount;
+    uint32_t mIndexSize;
+};
+
+/*
+ * Maps a trace file and walks or replays its records.
+ */
+class SensorTraceReader {
+public:
+    typedef int (*replay_cb_t)(const sensor_trace_record_t *rec,
+                               const void *payload, void *arg);
+
+    SensorTraceReader();
+    ~SensorTraceReader();
+
+    int open(const char *path);
+    int64_t startTime() const;
+
+    /* first record, or the first one captured at or after 'timestamp';
+       NULL if there is none */
+    const sensor_trace_record_t *first() const;
+    const sensor_trace_record_t *seek(int64_t timestamp) const;
+    /* record after 'rec', NULL at the end */
+    const sensor_trace_record_t *next(const sensor_trace_record_t *rec) const;
+    static const void *payload(const sensor_trace_record_t *rec) {
+        return rec + 1;
+    }
+
+    /* call 'cb' for every record from 'timestamp' on, spaced as captured
+       but 'speed' times faster; speed 0 replays without waiting. Stops
+       early and returns the callback's result if it is not 0. */
+    int replay(int64_t timestamp, float speed, replay_cb_t cb, void *arg) const;
+
+private:
+    const sensor_trace_record_t *at(uint64_t offset) const;
+
+    const char *mBase;
+    size_t mSize;
+    const sensor_trace_index_t *mIndex;
+    uint32_t mIndexCount;
+};
+
+/*****************************************************************************/
+
+#endif  /* SENSOR_TRACE_H */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEQ_LOCK_SLOT_H
+#define SEQ_LOCK_SLOT_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+
+/*****************************************************************************/
+
+/*
+ * Single-writer "latest value" slot protected by a sequence counter.
+ *
+ * The writer never waits for readers. A reader only retries while a write
+ * is in progress, which takes as long as copying one T. T must be plain
+ * old data.
+ */
+template <typename T>
+class SeqLockSlot {
+public:
+    SeqLockSlot() : mSeq(0) {}
+
+    void write(const T &value) {
+        int32_t seq = mSeq;
+        android_atomic_release_store((int32_t)((uint32_t)seq + 1), &mSeq);
+        android_memory_barrier();
+        mValue = value;
+        android_atomic_release_store((int32_t)((uint32_t)seq + 2), &mSeq);
+    }
+
+    /*
+     * Copies the latest value into *value and returns its sequence number,
+     * which changes with every write() and is 0 if nothing was written yet.
+     */
+    int32_t read(T *value) const {
+        int32_t seq, check;
+        do {
+            seq = android_atomic_acquire_load(&mSeq);
+            if (seq & 1)
+                continue;
+            *value = mValue;
+            android_memory_barrier();
+            check = android_atomic_acquire_load(&mSeq);
+        } while ((seq & 1) || seq != check);
+        return seq;
+    }
+
+    /* sequence number of the latest (or in progress) write, without a copy */
+    int32_t sequence() const {
+        return android_atomic_acquire_load(&mSeq);
+    }
+
+    /* only meaningful when there is no concurrent writer */
+    void reset() {
+        mSeq = 0;
+    }
+
+private:
+    /* odd while a write is in progress */
+    volatile int32_t mSeq;
+    T mValue;
+};
+
+/*****************************************************************************/
+
+#endif  /* SEQ_LOCK_SLOT_H */
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STEP_COUNT_TIMER_H
+#define STEP_COUNT_TIMER_H
+
+#include <stdint.h>
+#include <sys/timerfd.h>
+
+/* step count read period when no rate was asked for */
+#define STEP_COUNT_DEFAULT_PERIOD_NS    1000000000LL
+
+/*
+ * The DMP counts steps by itself and raises no interrupt for the count,
+ * so the HAL reads it on a timer. An on-change sensor has no samples to
+ * queue: batching it with a report latency only means the count may be
+ * read that much later, so the timer runs at the longer of the rate and
+ * the latency.
+ */
+static inline int64_t stepCountTimerPeriod(int64_t pollTime, int64_t latency)
+{
+    int64_t period = pollTime > 0 ? pollTime : STEP_COUNT_DEFAULT_PERIOD_NS;
+
+    return latency > period ? latency : period;
+}
+
+/* arm 'fd' to expire every 'period' ns, first right away if 'now' is set;
+   a zero period disarms it */
+static inline int armStepCountTimer(int fd, int64_t period, bool now)
+{
+    struct itimerspec spec;
+
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+    if (period && now) {
+        spec.it_value.tv_sec = 0;
+        spec.it_value.tv_nsec = 1;
+    }
+    return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+#endif  /* STEP_COUNT_TIMER_H */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSFS_ATTR_H
+#define SYSFS_ATTR_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+/* Parse a decimal integer, as printed by a sysfs attribute, without
+   going through stdio. Leading blanks are skipped, trailing text is not
+   looked at. */
+static inline int parse_int64(const char *str, int64_t *value)
+{
+    uint64_t v = 0;
+    bool neg = false;
+
+    while (*str == ' ' || *str == '\t')
+        str++;
+    if (*str == '-' || *str == '+')
+        neg = (*str++ == '-');
+    if (*str < '0' || *str > '9')
+        return -1;
+    while (*str >= '0' && *str <= '9')
+        v = v * 10 + (*str++ - '0');
+    *value = neg ? -(int64_t)v : (int64_t)v;
+    return 0;
+}
+
+/* Read an integer attribute through an fd kept open for it. Reading from
+   offset 0 makes sysfs regenerate the value, and also acknowledges a
+   POLLPRI notification on that attribute. */
+static inline int read_attr_int64(int fd, int64_t *value)
+{
+    char buf[24];
+    ssize_t len;
+
+    if (fd < 0)
+        return -1;
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    return parse_int64(buf, value);
+}
+
+#endif  /* SYSFS_ATTR_H */
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <cutils/log.h>
+
+#include "TimestampNormalizer.h"
+
+static const char *sDomainNames[] = { "boottime", "monotonic", "estimated" };
+
+TimestampNormalizer::TimestampNormalizer(int domain)
+    : mConfigured(domain)
+{
+    reset();
+}
+
+void TimestampNormalizer::reset()
+{
+    mDomain = mConfigured;
+    mIdentified = false;
+    mOffset = 0;
+    mMonoOffset = 0;
+    clearWindows();
+}
+
+void TimestampNormalizer::clearWindows()
+{
+    mWindowStart = 0;
+    for (int i = 0; i < CAND_NUM; i++) {
+        for (int j = 0; j < 2; j++) {
+            mMin[i][j] = INT64_MAX;
+            mFuture[i][j] = false;
+        }
+    }
+}
+
+int64_t TimestampNormalizer::monotonicOffset()
+{
+    struct timespec mono, boot;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    return (int64_t)(boot.tv_sec - mono.tv_sec) * 1000000000LL +
+            (boot.tv_nsec - mono.tv_nsec);
+}
+
+int64_t TimestampNormalizer::toBoottime(int64_t timestamp, int64_t arrival)
+{
+    if (mConfigured == TS_DOMAIN_BOOTTIME)
+        return timestamp;
+    return toBoottime(timestamp, arrival, monotonicOffset());
+}
+
+int64_t TimestampNormalizer::toBoottime(int64_t timestamp, int64_t arrival,
+                                        int64_t monoOffset)
+{
+    int64_t latency[CAND_NUM];
+    int domain = TS_DOMAIN_UNKNOWN;
+    int best = -1;
+
+    if (mConfigured == TS_DOMAIN_BOOTTIME)
+        return timestamp;
+    if (mConfigured == TS_DOMAIN_MONOTONIC)
+        return timestamp + monoOffset;
+
+    if (mIdentified) {
+        mMonoOffset = monoOffset;
+        mOffset = (mDomain == TS_DOMAIN_MONOTONIC) ? monoOffset : 0;
+        return timestamp + mOffset;
+    }
+
+    /* an estimated offset is not valid across a suspend; the latencies
+       of the two clocks still are, that is how they are told apart */
+    if (mDomain == TS_DOMAIN_UNKNOWN &&
+            (monoOffset - mMonoOffset > TS_FUTURE_SLACK_NS ||
+             mMonoOffset - monoOffset > TS_FUTURE_SLACK_NS))
+        clearWindows();
+    mMonoOffset = monoOffset;
+
+    latency[CAND_BOOT] = arrival - timestamp;
+    latency[CAND_MONO] = arrival - (timestamp + monoOffset);
+    track(arrival, latency);
+
+    /* BOOTTIME wins ties, e.g. before the first suspend */
+    for (int i = 0; i < CAND_NUM; i++) {
+        int64_t min = minLatency(i);
+        if (mFuture[i][0] || mFuture[i][1] || min > TS_MAX_LATENCY_NS)
+            continue;
+        if (best < 0 || min < minLatency(best) - TS_FUTURE_SLACK_NS)
+            best = i;
+    }
+
+    if (best == CAND_BOOT) {
+        domain = TS_DOMAIN_BOOTTIME;
+        mOffset = 0;
+    } else if (best == CAND_MONO) {
+        domain = TS_DOMAIN_MONOTONIC;
+        mOffset = monoOffset;
+    } else {
+        /* stamp + offset is then at most the arrival time */
+        mOffset = minLatency(CAND_BOOT);
+    }
+
+    /* the other clock is ruled out, not just behind by less than the
+       slack, over at least a whole window so a drain was seen */
+    if (best >= 0 && mMin[best][1] != INT64_MAX) {
+        int other = CAND_NUM - 1 - best;
+        mIdentified = mFuture[other][0] || mFuture[other][1] ||
+                minLatency(other) > TS_MAX_LATENCY_NS ||
+                minLatency(other) - minLatency(best) > TS_FUTURE_SLACK_NS;
+    }
+
+    if (domain != mDomain || mIdentified) {
+        ALOGI("HAL:timestamps %s %s clock (offset %lld)",
+              mIdentified ? "identified as" : "switch to",
+              sDomainNames[domain], (long long)mOffset);
+        mDomain = domain;
+    }
+    return timestamp + mOffset;
+}
+
+void TimestampNormalizer::track(int64_t arrival, const int64_t *latency)
+{
+    if (!mWindowStart || arrival - mWindowStart >= TS_WINDOW_NS) {
+        for (int i = 0; i < CAND_NUM; i++) {
+            mMin[i][1] = mMin[i][0];
+            mFuture[i][1] = mFuture[i][0];
+            mMin[i][0] = INT64_MAX;
+            mFuture[i][0] = false;
+        }
+        mWindowStart = arrival;
+    }
+
+    for (int i = 0; i < CAND_NUM; i++) {
+        if (latency[i] < mMin[i][0])
+            mMin[i][0] = latency[i];
+        if (latency[i] < -TS_FUTURE_SLACK_NS)
+            mFuture[i][0] = true;
+    }
+}
+
+int64_t TimestampNormalizer::minLatency(int cand) const
+{
+    return mMin[cand][0] < mMin[cand][1] ? mMin[cand][0] : mMin[cand][1];
+}
+
+/*****************************************************************************/
+
+BurstTimestampFilter::BurstTimestampFilter()
+{
+    reset();
+}
+
+void BurstTimestampFilter::reset()
+{
+    mLastRaw = 0;
+    mLastOut = 0;
+    mPeriod = 0;
+    mWindowStart = 0;
+    mWindowCount = 0;
+}
+
+int64_t BurstTimestampFilter::correct(int64_t timestamp, int64_t arrival)
+{
+    int64_t out = timestamp;
+
+    if (!mLastOut) {
+        mWindowStart = timestamp;
+        mWindowCount = 0;
+    } else if (mPeriod &&
+            timestamp - mLastRaw > TS_BURST_MAX_ERROR_PERIODS * mPeriod) {
+        /* a real gap, e.g. the sensor was off; the rate may have
+           changed as well, so learn the period again */
+        mPeriod = 0;
+        mWindowStart = timestamp;
+        mWindowCount = 0;
+    } else {
+        if (++mWindowCount == TS_BURST_WINDOW) {
+            int64_t period = (timestamp - mWindowStart) / TS_BURST_WINDOW;
+            if (period > 0)
+                mPeriod = mPeriod ? (mPeriod * 3 + period) / 4 : period;
+            mWindowStart = timestamp;
+            mWindowCount = 0;
+        }
+
+        if (mPeriod) {
+            int64_t predicted = mLastOut + mPeriod;
+            int64_t err = timestamp - predicted;
+            int64_t limit = TS_BURST_MAX_ERROR_PERIODS * mPeriod;
+
+            if (err <= limit && err >= -limit)
+                out = predicted + err / (1 << TS_BURST_GAIN_SHIFT);
+        }
+    }
+
+    if (out > arrival)
+        out = arrival;
+    if (mLastOut && out <= mLastOut)
+        out = mLastOut + 1;
+    mLastRaw = timestamp;
+    mLastOut = out;
+    return out;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMESTAMP_NORMALIZER_H
+#define TIMESTAMP_NORMALIZER_H
+
+#include <stdint.h>
+
+/*
+ * Clock domains of the timestamps handed to the HAL:
+ *  - SensorBase::getTimestamp() and the ALPS compass time_hi/time_lo
+ *    are CLOCK_BOOTTIME, i.e. elapsedRealtimeNano(), what the framework
+ *    expects;
+ *  - HeartRateSensor only uses CLOCK_MONOTONIC for pulse intervals;
+ *  - the MPU driver stamps its FIFO packets with a kernel clock the HAL
+ *    cannot query, so its domain is worked out from arrival times.
+ */
+enum {
+    TS_DOMAIN_BOOTTIME = 0,
+    TS_DOMAIN_MONOTONIC,
+    TS_DOMAIN_UNKNOWN,
+};
+
+/* a stamp may be this far ahead of its arrival (clock read skew) */
+#define TS_FUTURE_SLACK_NS          1000000LL
+/* minimum latencies are taken over two windows of this length; must be
+   longer than the longest batch timeout, so every window sees a drain */
+#define TS_WINDOW_NS                (30LL * 1000000000LL)
+/* beyond this minimum latency a known domain is not believed */
+#define TS_MAX_LATENCY_NS           1000000000LL
+
+/* re-spacing of bursts: a packet this many periods off the predicted
+   time restarts the stream; the error is absorbed 1/N per packet */
+#define TS_BURST_MAX_ERROR_PERIODS  16
+#define TS_BURST_GAIN_SHIFT         5
+/* packets per period estimate */
+#define TS_BURST_WINDOW             128
+
+/*****************************************************************************/
+
+/*
+ * Maps the timestamps of one source to CLOCK_BOOTTIME.
+ *
+ * For TS_DOMAIN_UNKNOWN, the latency (arrival - stamp) a sample would
+ * have if the source ran on CLOCK_BOOTTIME or on CLOCK_MONOTONIC is
+ * tracked; a domain is out as soon as one of its samples would land in
+ * the future, and of the remaining ones the lowest minimum latency wins.
+ * Only if neither is plausible is the offset itself estimated, as the
+ * minimum of arrival - stamp.
+ *
+ * Until the first suspend the two clocks hardly differ and BOOTTIME is
+ * picked on a tie. A suspend moves them apart; once the other clock is
+ * ruled out over a whole window, the domain is identified and kept until
+ * reset(), and a later suspend only changes the MONOTONIC offset. An
+ * estimated offset does not survive a suspend: its history is dropped
+ * then and the next samples decide again.
+ */
+class TimestampNormalizer {
+public:
+    TimestampNormalizer(int domain);
+
+    /* 'arrival' is the CLOCK_BOOTTIME time the sample was read at */
+    int64_t toBoottime(int64_t timestamp, int64_t arrival);
+    /* same with an explicit CLOCK_BOOTTIME - CLOCK_MONOTONIC, for replay */
+    int64_t toBoottime(int64_t timestamp, int64_t arrival, int64_t monoOffset);
+
+    /* domain in use; for TS_DOMAIN_UNKNOWN sources the detected one */
+    int domain() const { return mDomain; }
+    /* the detected domain is known for sure, not just a tie */
+    bool identified() const { return mIdentified; }
+    int64_t offset() const { return mOffset; }
+    void reset();
+
+    /* CLOCK_BOOTTIME - CLOCK_MONOTONIC, i.e. the time spent suspended */
+    static int64_t monotonicOffset();
+
+private:
+    enum { CAND_BOOT = 0, CAND_MONO, CAND_NUM };
+
+    void clearWindows();
+    void track(int64_t arrival, const int64_t *latency);
+    int64_t minLatency(int cand) const;
+
+    int mConfigured;
+    int mDomain;
+    bool mIdentified;
+    int64_t mOffset;
+    int64_t mWindowStart;
+    int64_t mMonoOffset;
+    /* per candidate: minimum latency of the current and previous window,
+       and whether a sample of either would have been in the future */
+    int64_t mMin[CAND_NUM][2];
+    bool mFuture[CAND_NUM][2];
+};
+
+/*
+ * Re-spaces the timestamps of one periodic stream.
+ *
+ * After a batch drain the driver's stamps can bunch up at the end of a
+ * burst and jump at the start of the next one. The stream is kept on a
+ * grid of its measured period instead, pulled slowly towards the raw
+ * stamps and restarted on a real gap. Output stamps always increase and
+ * are never later than the arrival time.
+ */
+class BurstTimestampFilter {
+public:
+    BurstTimestampFilter();
+
+    int64_t correct(int64_t timestamp, int64_t arrival);
+    int64_t period() const { return mPeriod; }
+    void reset();
+
+private:
+    int64_t mLastRaw;
+    int64_t mLastOut;
+    int64_t mPeriod;
+    int64_t mWindowStart;
+    int mWindowCount;
+};
+
+/*****************************************************************************/
+
+#endif  /* TIMESTAMP_NORMALIZER_H */
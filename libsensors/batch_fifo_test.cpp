@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the batch timeout planning (BatchFifo.h).
+ *
+ * Goes through the outputs computeBatchDataOutput() picks (cases a to g)
+ * at the rates setBatchDataRates() can program, plans the timeout for a
+ * client asking for 10 min, then fills a simulated FIFO packet by packet
+ * until that timeout, with steps at FIFO_STEP_MAX_HZ, and checks it never
+ * overflows. The plan calcFifoFillRate() made before, from the rates the
+ * clients passed to setDelay() and without steps, is checked the same way.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BatchFifo.h"
+
+/* a client asking for a ten minute latency */
+#define REQUESTED_MS    600000LL
+
+struct output_t {
+    const char *name;
+    bool gyro, accel, compass, quat, pedQuat, steps;
+};
+
+/* what the FIFO holds for each case of computeBatchDataOutput() */
+static const output_t sOutputs[] = {
+    { "a: step + GRV + hw",     true,  true,  true,  true,  false, true  },
+    { "b: step + GRV",          false, false, false, false, true,  true  },
+    { "c: step + hw",           true,  true,  false, false, false, true  },
+    { "d: step only",           false, false, false, false, false, true  },
+    { "e: GRV + hw",            true,  true,  true,  true,  false, false },
+    { "f: GRV",                 false, false, false, true,  false, false },
+    { "g: hw",                  true,  true,  true,  false, false, false },
+};
+
+/* batch() keeps periods within 5..200 ms */
+static const int64_t sPeriods[] = {
+    5000000LL, 10000000LL, 20000000LL, 66667000LL, 200000000LL,
+};
+
+/* FIFO bytes written in the first 'ms' ms, one packet at t=0 per stream */
+static int64_t fill(const batch_fifo_t *fifo, int64_t ms)
+{
+    int64_t ns = ms * 1000000LL, bytes = 0;
+    const struct {
+        int64_t period;
+        int size;
+    } streams[] = {
+        { fifo->gyro, FIFO_GYRO_BYTES },
+        { fifo->accel, FIFO_ACCEL_BYTES },
+        { fifo->compass, FIFO_COMPASS_BYTES },
+        { fifo->quat, FIFO_QUAT_BYTES },
+        { fifo->pedQuat, FIFO_PED_QUAT_BYTES },
+        { fifo->steps ? 1000000000LL / FIFO_STEP_MAX_HZ : 0, FIFO_STEP_BYTES },
+    };
+
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+        if (streams[i].period > 0)
+            bytes += (ns / streams[i].period + 1) *
+                    (FIFO_HEADER_BYTES + streams[i].size);
+    }
+    return bytes;
+}
+
+static void setOutputs(batch_fifo_t *fifo, const output_t *out, int64_t hw,
+                       int64_t quat, bool steps)
+{
+    memset(fifo, 0, sizeof(*fifo));
+    fifo->gyro = out->gyro ? hw : 0;
+    fifo->accel = out->accel ? hw : 0;
+    /* the compass does 100 Hz at most */
+    fifo->compass = out->compass ? (hw < 10000000LL ? 10000000LL : hw) : 0;
+    fifo->quat = out->quat ? quat : 0;
+    fifo->pedQuat = out->pedQuat ? quat : 0;
+    fifo->steps = steps && out->steps;
+}
+
+int main()
+{
+    int cases = 0, overflows = 0, oldOverflows = 0;
+    int numPeriods = sizeof(sPeriods) / sizeof(sPeriods[0]);
+
+    printf("%-22s %9s %9s %9s %10s %10s\n", "output", "hw ms", "quat ms",
+           "B/s", "timeout ms", "peak B");
+    for (size_t o = 0; o < sizeof(sOutputs) / sizeof(sOutputs[0]); o++) {
+        const output_t *out = &sOutputs[o];
+
+        for (int h = 0; h < numPeriods; h++) {
+            for (int q = 0; q < numPeriods; q++) {
+                batch_fifo_t fifo, old;
+
+                setOutputs(&fifo, out, sPeriods[h], sPeriods[q], true);
+                int64_t rate = batchFifoFillRate(&fifo);
+                int64_t timeout = batchFifoTimeout(rate, REQUESTED_MS);
+                int64_t peak = fill(&fifo, timeout);
+
+                cases++;
+                if (q == h && (out->quat || out->pedQuat))
+                    printf("%-22s %9.1f %9.1f %9lld %10lld %10lld\n",
+                           out->name, sPeriods[h] / 1e6, sPeriods[q] / 1e6,
+                           (long long)rate, (long long)timeout,
+                           (long long)peak);
+                else if (!(out->quat || out->pedQuat))
+                    printf("%-22s %9.1f %9s %9lld %10lld %10lld\n",
+                           out->name, sPeriods[h] / 1e6, "-",
+                           (long long)rate, (long long)timeout,
+                           (long long)peak);
+                if (peak > MPU_FIFO_SIZE || timeout > REQUESTED_MS) {
+                    printf("  FIFO overflow: %lld bytes in %lld ms\n",
+                           (long long)peak, (long long)timeout);
+                    overflows++;
+                }
+
+                /* before: the setDelay() rates, here the slowest, and no
+                   steps, against what the FIFO really gets */
+                setOutputs(&old, out, sPeriods[numPeriods - 1],
+                           sPeriods[numPeriods - 1], false);
+                int64_t oldTimeout = batchFifoTimeout(batchFifoFillRate(&old),
+                                                      REQUESTED_MS);
+                if (fill(&fifo, oldTimeout) > MPU_FIFO_SIZE)
+                    oldOverflows++;
+
+                if (!(out->quat || out->pedQuat))
+                    break;
+            }
+        }
+    }
+
+    printf("%d cases, %d overflow with the rates programmed now, %d with the"
+           " setDelay() rates and no steps\n", cases, overflows, oldOverflows);
+    if (oldOverflows == 0)
+        printf("the old plan was expected to overflow somewhere\n");
+    return overflows || !oldOverflows;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Time to the first ACCURACY_HIGH gyro event after the gyro is enabled,
+ * with the bias MPLSensor::applyBiasCache() reapplies from the cache.
+ *
+ * The gyro events of a session started cold are either read from a
+ * trace recorded on a device (debug.sensors.record, the SENSOR_TRACE_EVENTS
+ * records) or generated here: 200 Hz, the device handheld for the first
+ * 10 s and then put down, the MPL reporting HIGH once it has seen 4 s of
+ * no motion. Each startup case writes a cache holding a gyro bias learned
+ * some time ago at some die temperature, loads it into a CalibrationStore
+ * and replays the session with the accuracy getBias() hands back as a
+ * floor for every event, as the MPL keeps reporting the reapplied bias
+ * until it learns a better one. The old rule, which capped a reapplied
+ * bias at MEDIUM whatever its age, is replayed alongside.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <hardware/sensors.h>
+
+#include "CalibrationStore.h"
+#include "SensorTrace.h"
+
+#define SEC                 1000000000LL
+#define GYRO_PERIOD_NS      (5 * 1000000LL)
+#define SESSION_NS          (30 * SEC)
+#define HANDHELD_NS         (10 * SEC)
+#define NO_MOTION_NS        (4 * SEC)
+
+struct gyro_status_t {
+    int64_t timestamp;          /* from the first gyro event */
+    int status;                 /* as reported cold */
+};
+
+struct session_t {
+    gyro_status_t *events;
+    size_t count, size;
+    int64_t first;
+};
+
+struct startup_t {
+    const char *name;
+    int64_t age;                /* of the cached bias, -1 for none */
+    int64_t tempDelta;          /* q16 deg C, now minus when learned */
+    bool trusted;               /* keeps the accuracy it was learned with */
+};
+
+static const startup_t g_startups[] = {
+    { "sensor service restart",     10 * SEC,           0,          true },
+    { "reboot, 30 min, +0.5 deg C", 1800 * SEC,         1L << 15,   true },
+    { "reboot, 30 min, +2 deg C",   1800 * SEC,         2L << 16,   false },
+    { "10 h later",                 36000 * SEC,        0,          false },
+    { "2 days later",               48 * 3600 * SEC,    0,          false },
+    { "no cache",                   -1,                 0,          false },
+};
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int addEvent(session_t *s, int64_t timestamp, int status)
+{
+    if (s->count == s->size) {
+        size_t size = s->size ? s->size * 2 : 4096;
+        gyro_status_t *events = (gyro_status_t *)
+                realloc(s->events, size * sizeof(*events));
+
+        if (!events)
+            return -ENOMEM;
+        s->events = events;
+        s->size = size;
+    }
+    if (!s->count)
+        s->first = timestamp;
+    s->events[s->count].timestamp = timestamp - s->first;
+    s->events[s->count].status = status;
+    s->count++;
+    return 0;
+}
+
+static int generateSession(session_t *s)
+{
+    for (int64_t t = 0; t < SESSION_NS; t += GYRO_PERIOD_NS) {
+        int status = t >= HANDHELD_NS + NO_MOTION_NS ?
+                SENSOR_STATUS_ACCURACY_HIGH : SENSOR_STATUS_UNRELIABLE;
+
+        if (addEvent(s, t, status))
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+static int traceRecord(const sensor_trace_record_t *rec, const void *payload,
+                       void *arg)
+{
+    session_t *s = (session_t *)arg;
+    const sensors_event_t *ev = (const sensors_event_t *)payload;
+    size_t n = rec->length / sizeof(sensors_event_t);
+
+    if (rec->type != SENSOR_TRACE_EVENTS)
+        return 0;
+    for (size_t i = 0; i < n; i++) {
+        if (ev[i].type == SENSOR_TYPE_GYROSCOPE &&
+                addEvent(s, ev[i].timestamp, ev[i].gyro.status))
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+/* time of the first HIGH event with 'floor' reapplied, -1 if none */
+static int64_t firstHigh(const session_t *s, int floor)
+{
+    for (size_t i = 0; i < s->count; i++) {
+        int status = s->events[i].status;
+
+        if (floor > status)
+            status = floor;
+        if (status >= SENSOR_STATUS_ACCURACY_HIGH)
+            return s->events[i].timestamp;
+    }
+    return -1;
+}
+
+/* accuracy getBias() hands back for the gyro in 'startup', 0 if none */
+static int reappliedAccuracy(const startup_t *startup, const char *dir)
+{
+    char path[256], cachePath[256];
+    cal_bias_cache_t cache;
+    struct timespec ts;
+    long bias[3];
+    int accuracy = 0, fd;
+    ssize_t put;
+
+    snprintf(path, sizeof(path), "%s/bias_warm_start.bin", dir);
+    snprintf(cachePath, sizeof(cachePath), "%s/bias_warm_start_cache.bin", dir);
+    unlink(cachePath);
+
+    if (startup->age >= 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        memset(&cache, 0, sizeof(cache));
+        cache.magic = CAL_CACHE_MAGIC;
+        cache.version = CAL_CACHE_VERSION;
+        cache.bias[CAL_BIAS_GYRO][0] = 11;
+        cache.accuracy[CAL_BIAS_GYRO] = SENSOR_STATUS_ACCURACY_HIGH;
+        cache.temperature[CAL_BIAS_GYRO] = 25L << 16;
+        cache.time[CAL_BIAS_GYRO] = (int64_t)ts.tv_sec * SEC + ts.tv_nsec -
+                startup->age;
+
+        fd = open(cachePath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        put = fd >= 0 ? write(fd, &cache, sizeof(cache)) : -1;
+        if (fd >= 0)
+            close(fd);
+        if (put != (ssize_t)sizeof(cache))
+            return -1;
+    }
+
+    CalibrationStore store(path, cachePath);
+    store.loadBiasCache();
+    if (!store.getBias(CAL_BIAS_GYRO, true, (25L << 16) + startup->tempDelta,
+                       bias, &accuracy))
+        accuracy = 0;
+    unlink(cachePath);
+    unlink(path);
+    return accuracy;
+}
+
+static void printTime(int64_t t)
+{
+    if (t < 0)
+        printf("   never");
+    else
+        printf(" %6.2f s", t / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    const char *tracePath = NULL, *dir = "/tmp";
+    session_t session;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+        switch (opt) {
+        case 't':
+            tracePath = optarg;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t trace] [-d dir]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    memset(&session, 0, sizeof(session));
+    if (tracePath) {
+        SensorTraceReader reader;
+        int err = reader.open(tracePath);
+
+        if (!err)
+            err = reader.replay(0, 0, traceRecord, &session);
+        if (err) {
+            fprintf(stderr, "cannot replay %s: %s\n", tracePath, strerror(-err));
+            return 2;
+        }
+        printf("%zu gyro events from %s\n", session.count, tracePath);
+    } else {
+        if (generateSession(&session))
+            return 2;
+        printf("%zu gyro events, handheld for %lld s, HIGH after %lld s "
+               "of no motion\n", session.count, HANDHELD_NS / SEC,
+               NO_MOTION_NS / SEC);
+    }
+
+    int64_t cold = firstHigh(&session, 0);
+    printf("%-28s accuracy  first HIGH:    now    old cap\n", "startup");
+    for (size_t i = 0; i < sizeof(g_startups) / sizeof(g_startups[0]); i++) {
+        const startup_t *startup = &g_startups[i];
+        int accuracy = reappliedAccuracy(startup, dir);
+        int capped = accuracy > SENSOR_STATUS_ACCURACY_MEDIUM ?
+                SENSOR_STATUS_ACCURACY_MEDIUM : accuracy;
+
+        if (accuracy < 0) {
+            fprintf(stderr, "cannot write the cache in %s\n", dir);
+            free(session.events);
+            return 2;
+        }
+
+        int64_t now = firstHigh(&session, accuracy);
+        int64_t old = firstHigh(&session, capped);
+        printf("%-28s %8d             ", startup->name, accuracy);
+        printTime(now);
+        printTime(old);
+        printf("\n");
+
+        /* never later than cold or than with the old cap */
+        if ((old >= 0 && (now < 0 || now > old)) ||
+                (cold >= 0 && (now < 0 || now > cold))) {
+            printf("%s: first HIGH event later than before\n", startup->name);
+            failed = 1;
+        }
+        if (startup->trusted)
+            failed |= check(now == 0, "  HIGH from the first event");
+        else
+            failed |= check(accuracy <= SENSOR_STATUS_ACCURACY_MEDIUM,
+                            "  MEDIUM at best");
+    }
+
+    free(session.events);
+    return failed;
+}
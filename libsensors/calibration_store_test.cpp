@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of CalibrationStore.
+ *
+ * Replays 10 minutes of what MPLSensor does with the store, on a
+ * simulated clock: a die temperature every 0.5 s (the MPL state changed),
+ * gyro biases converging and then following the temperature, a few accel
+ * and compass biases, sensors switched on and off now and then (each
+ * switch calls storeCalibration()), and isSaveDue() checked after every
+ * read. It counts the files that reach the disk, checks that they are at
+ * least CAL_STORE_MIN_INTERVAL_NS apart and that no bias waits more than
+ * two intervals for one, and times the HAL thread against writing the
+ * file in place at every switch, as inv_store_calibration() did.
+ *
+ * Then it checks that the file and the bias cache the store leaves
+ * behind hold the last state committed, that the dirty tracking follows
+ * the biases and the MPL state, and that each cached bias keeps its own
+ * learn time and temperature.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "CalibrationStore.h"
+
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof(a[0]))
+#define SEC                 1000000000LL
+#define READ_PERIOD_NS      (20 * 1000000LL)
+#define TEMP_PERIOD_NS      (500 * 1000000LL)
+
+/* sensor switches, in s; each one calls storeCalibration() */
+static const int g_switches[] = { 5, 6, 60, 61, 62, 120, 240, 241, 242, 360,
+                                  361, 480, 540, 541 };
+/* accel and compass biases learned, in s; see gyroBiasAt() for the gyro */
+static const int g_accelBias[] = { 20, 200 };
+static const int g_compassBias[] = { 30, 90, 300, 420 };
+
+/* simulated CLOCK_MONOTONIC, read by the writer thread too */
+static int64_t g_simNow;
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t simClock(void)
+{
+    return __atomic_load_n(&g_simNow, __ATOMIC_ACQUIRE);
+}
+
+static void setSimClock(int64_t now)
+{
+    __atomic_store_n(&g_simNow, now, __ATOMIC_RELEASE);
+}
+
+static bool happensAt(const int *times, size_t n, int64_t t)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (times[i] * SEC == t)
+            return true;
+    }
+    return false;
+}
+
+/* new gyro biases: converging at first, then following the temperature */
+static bool gyroBiasAt(int64_t t)
+{
+    return t == 3 * SEC || t == 8 * SEC || t == 15 * SEC ||
+            (t > 15 * SEC && t % (45 * SEC) == 0);
+}
+
+/* sensor whose bias is learned at 't', -1 if none */
+static int biasAt(int64_t t)
+{
+    if (gyroBiasAt(t))
+        return CAL_BIAS_GYRO;
+    if (happensAt(g_accelBias, ARRAY_SIZE(g_accelBias), t))
+        return CAL_BIAS_ACCEL;
+    if (happensAt(g_compassBias, ARRAY_SIZE(g_compassBias), t))
+        return CAL_BIAS_COMPASS;
+    return -1;
+}
+
+struct stats_t {
+    int64_t total;
+    int64_t max;
+    int count;
+};
+
+static void account(stats_t *stats, int64_t ns)
+{
+    stats->total += ns;
+    if (ns > stats->max)
+        stats->max = ns;
+    stats->count++;
+}
+
+static void report(const char *what, const stats_t *stats)
+{
+    printf("%-26s total %8.1f us  avg %7.1f us  max %7.1f us  (%d saves)\n",
+           what, stats->total / 1e3,
+           stats->count ? stats->total / 1e3 / stats->count : 0.,
+           stats->max / 1e3, stats->count);
+}
+
+struct replay_t {
+    unsigned int storeCalls;    /* storeCalibration() */
+    unsigned int commits;
+    unsigned int writes;        /* files that reached the disk */
+    int64_t minGap;             /* between two of them */
+    int64_t maxLatency;         /* from a bias update to its file */
+    long committedGyro;         /* gyro bias[0] in the last commit */
+    stats_t inPlace, behind;
+};
+
+/* what inv_store_calibration() does on the HAL thread */
+static int storeInPlace(const char *path, const unsigned char *data, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp)
+        return -errno;
+    if (fwrite(data, 1, len, fp) != len) {
+        fclose(fp);
+        return -EIO;
+    }
+    return fclose(fp) ? -errno : 0;
+}
+
+static void fillState(unsigned char *data, size_t len, int n)
+{
+    for (size_t i = 0; i < len; i++)
+        data[i] = (unsigned char)(i * 31 + n);
+}
+
+/* Runs 'minutes' of the schedule on the simulated clock, writing the
+   file in place to 'inPlacePath' wherever the old HAL did. The store is
+   gone on return, after its final write. */
+static int replay(const char *path, const char *cachePath,
+                  const char *inPlacePath, unsigned char *state, size_t len,
+                  int minutes, replay_t *res)
+{
+    int64_t begin = nowNs(), end = begin + minutes * 60 * SEC;
+    int64_t lastWrite = 0, uncommitted = 0, unwritten = 0, start;
+    long bias[CAL_BIAS_NUM][3] = {
+        { 100, -200, 300 }, { 10, 20, -30 }, { -5000, 2000, 7000 },
+    };
+    unsigned int writes;
+    int n = 0;
+
+    memset(res, 0, sizeof(*res));
+    res->minGap = INT64_MAX;
+    setSimClock(begin);
+
+    CalibrationStore store(path, cachePath, simClock);
+
+    for (int64_t now = begin; now < end; now += READ_PERIOD_NS) {
+        int64_t t = now - begin;
+        bool save = false;
+        int which;
+
+        setSimClock(now);
+
+        /* buildMpuEvent() */
+        if (t % TEMP_PERIOD_NS == 0) {
+            store.setTemperature((25L << 16) + (t / SEC) * 100);
+            store.markStateChanged();
+        }
+
+        /* readEvents() */
+        which = t % SEC == 0 ? biasAt(t) : -1;
+        if (which >= 0) {
+            bias[which][0] += 1 + t / SEC;
+            store.updateBias(which, bias[which], 3);
+            if (!uncommitted)
+                uncommitted = now;
+        }
+        if (t % SEC == 0 && happensAt(g_switches, ARRAY_SIZE(g_switches), t)) {
+            /* the old HAL wrote the whole file right here */
+            fillState(state, len, n);
+            start = nowNs();
+            if (storeInPlace(inPlacePath, state, len))
+                return -errno;
+            account(&res->inPlace, nowNs() - start);
+            save = true;
+        }
+        if (store.isSaveDue())
+            save = true;
+
+        /* storeCalibration() */
+        if (save) {
+            res->storeCalls++;
+            if (store.isDirty()) {
+                fillState(state, len, ++n);
+                start = nowNs();
+                store.commit(state, len);
+                account(&res->behind, nowNs() - start);
+                res->commits++;
+                res->committedGyro = bias[CAL_BIAS_GYRO][0];
+                if (uncommitted && !unwritten)
+                    unwritten = uncommitted;
+                uncommitted = 0;
+            }
+        }
+
+        writes = store.syncWriter();
+        if (writes != res->writes) {
+            res->writes = writes;
+            if (lastWrite && now - lastWrite < res->minGap)
+                res->minGap = now - lastWrite;
+            lastWrite = now;
+            if (unwritten && now - unwritten > res->maxLatency)
+                res->maxLatency = now - unwritten;
+            unwritten = 0;
+        }
+    }
+    return 0;
+}
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int readCache(const char *path, cal_bias_cache_t *cache)
+{
+    int fd = open(path, O_RDONLY);
+    ssize_t got = fd >= 0 ? read(fd, cache, sizeof(*cache)) : -1;
+
+    if (fd >= 0)
+        close(fd);
+    return got == (ssize_t)sizeof(*cache) ? 0 : -1;
+}
+
+static int writeCache(const char *path, const cal_bias_cache_t *cache)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ssize_t put = fd >= 0 ? write(fd, cache, sizeof(*cache)) : -1;
+
+    if (fd >= 0)
+        close(fd);
+    return put == (ssize_t)sizeof(*cache) ? 0 : -1;
+}
+
+/* a cache with a 10 minute old gyro bias, a two day old accel bias and a
+   compass bias learned at 45 deg C, all with accuracy 3 */
+static int checkBiasAging(const char *path, const char *cachePath)
+{
+    cal_bias_cache_t cache;
+    struct timespec ts;
+    int64_t now, learned[CAL_BIAS_NUM];
+    long bias[3], same[3] = { 11, 12, 13 };
+    int accuracy, failed = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = CAL_CACHE_MAGIC;
+    cache.version = CAL_CACHE_VERSION;
+    for (int i = 0; i < CAL_BIAS_NUM; i++) {
+        for (int j = 0; j < 3; j++)
+            cache.bias[i][j] = 10 * i + j + 11;
+        cache.accuracy[i] = 3;
+        cache.temperature[i] = 25L << 16;
+        cache.time[i] = now - 3600LL * 1000000000LL;
+    }
+    cache.time[CAL_BIAS_GYRO] = now - 600LL * 1000000000LL;
+    cache.time[CAL_BIAS_ACCEL] = now - 48LL * 3600LL * 1000000000LL;
+    cache.temperature[CAL_BIAS_COMPASS] = 45L << 16;
+    memcpy(learned, cache.time, sizeof(learned));
+    if (writeCache(cachePath, &cache))
+        return 1;
+
+    {
+        CalibrationStore store(path, cachePath);
+
+        failed |= check(!store.loadBiasCache(), "cache loads");
+        failed |= check(store.getBias(CAL_BIAS_GYRO, true, 51L << 15, bias, &accuracy) &&
+                        bias[0] == 11 && accuracy == 3,
+                        "10 min old bias at 0.5 deg C keeps its accuracy");
+        failed |= check(store.getBias(CAL_BIAS_GYRO, true, 27L << 16, bias, &accuracy) &&
+                        bias[0] == 11 && accuracy == 2,
+                        "... at 2 deg C it is usable at MEDIUM");
+        failed |= check(!store.getBias(CAL_BIAS_ACCEL, true, 25L << 16, bias, &accuracy),
+                        "two day old bias is not");
+        failed |= check(!store.getBias(CAL_BIAS_COMPASS, true, 25L << 16, bias, &accuracy),
+                        "bias learned 20 deg C away is not");
+        failed |= check(store.getBias(CAL_BIAS_COMPASS, false, 0, bias, &accuracy) &&
+                        accuracy == 2,
+                        "... unless the temperature is unknown, at MEDIUM");
+
+        /* what the HAL reads back after reapplying it at MEDIUM */
+        store.updateBias(CAL_BIAS_GYRO, same, 2);
+        failed |= check(!store.isDirty(), "reapplied bias leaves the store clean");
+
+        store.setTemperature(30L << 16);
+        store.updateBias(CAL_BIAS_ACCEL, same, 2);
+        failed |= check(store.isDirty(), "newly learned bias makes it dirty");
+        store.commit((const unsigned char *)same, sizeof(same));
+    }
+
+    failed |= check(!readCache(cachePath, &cache) &&
+                    cache.time[CAL_BIAS_GYRO] == learned[CAL_BIAS_GYRO] &&
+                    cache.accuracy[CAL_BIAS_GYRO] == 3 &&
+                    cache.time[CAL_BIAS_COMPASS] == learned[CAL_BIAS_COMPASS],
+                    "unchanged biases keep their learn time and accuracy");
+    failed |= check(cache.time[CAL_BIAS_ACCEL] >= now &&
+                    cache.temperature[CAL_BIAS_ACCEL] == (30L << 16) &&
+                    cache.accuracy[CAL_BIAS_ACCEL] == 2,
+                    "changed bias gets its own learn time and temperature");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    char path[256], tmpPath[sizeof(path) + 4], cachePath[256], inPlacePath[256];
+    const char *dir = "/tmp";
+    size_t len = 4096;
+    int minutes = 10;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "d:s:m:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 's':
+            len = (size_t)atoi(optarg);
+            break;
+        case 'm':
+            minutes = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-d dir] [-s state bytes] [-m minutes]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (!len || minutes <= 0)
+        return 2;
+
+    snprintf(path, sizeof(path), "%s/cal_store_test.bin", dir);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    snprintf(cachePath, sizeof(cachePath), "%s/cal_store_test_cache.bin", dir);
+    snprintf(inPlacePath, sizeof(inPlacePath), "%s/cal_store_test_inplace.bin", dir);
+    unlink(path);
+    unlink(cachePath);
+
+    unsigned char *state = (unsigned char *)malloc(len);
+    unsigned char *onDisk = (unsigned char *)malloc(len + 1);
+    long bias[3] = { 100, -200, 300 };
+    replay_t res;
+
+    if (!state || !onDisk)
+        return 2;
+
+    {
+        CalibrationStore store(path, cachePath);
+
+        failed |= check(!store.isDirty(), "clean after start");
+        store.updateBias(CAL_BIAS_GYRO, bias, 3);
+        failed |= check(store.isDirty(), "dirty after a bias changed");
+        failed |= check(!store.isSaveDue(), "bias save not due right after start");
+        store.commit(state, len);
+        store.updateBias(CAL_BIAS_GYRO, bias, 3);
+        failed |= check(!store.isDirty(), "clean after the same bias again");
+        store.markStateChanged();
+        failed |= check(store.isDirty(), "dirty after the MPL state changed");
+        failed |= check(!store.isSaveDue(), "state save not due right after a commit");
+    }
+
+    if (replay(path, cachePath, inPlacePath, state, len, minutes, &res)) {
+        fprintf(stderr, "cannot write %s: %s\n", inPlacePath, strerror(errno));
+        return 2;
+    }
+    unlink(inPlacePath);
+
+    printf("%zu byte state, %d minutes in %s\n", len, minutes, dir);
+    printf("%u storeCalibration() calls, %u commits, %u files written "
+           "(and one on exit)\n", res.storeCalls, res.commits, res.writes);
+    printf("writes at least %.0f s apart, a bias reached the disk after at "
+           "most %.0f s\n", res.minGap / 1e9, res.maxLatency / 1e9);
+    report("HAL thread, in place", &res.inPlace);
+    report("HAL thread, write behind", &res.behind);
+
+    failed |= check(res.writes > 0 &&
+                    res.writes <= (unsigned int)(minutes * 60 * SEC /
+                                                 CAL_STORE_MIN_INTERVAL_NS),
+                    "at most one file per CAL_STORE_MIN_INTERVAL_NS");
+    failed |= check(res.writes < 2 || res.minGap >= CAL_STORE_MIN_INTERVAL_NS,
+                    "files written at least an interval apart");
+    failed |= check(res.maxLatency <= 2 * CAL_STORE_MIN_INTERVAL_NS,
+                    "biases on disk within two intervals");
+    failed |= check(res.writes < (unsigned int)res.inPlace.count,
+                    "fewer files than the old HAL wrote");
+
+    int fd = open(path, O_RDONLY);
+    ssize_t got = fd >= 0 ? read(fd, onDisk, len + 1) : -1;
+    if (fd >= 0)
+        close(fd);
+    failed |= check(got == (ssize_t)len && !memcmp(onDisk, state, len),
+                    "file holds the last committed state");
+
+    {
+        CalibrationStore reader(path, cachePath);
+        int accuracy;
+
+        failed |= check(!reader.loadBiasCache() &&
+                        reader.getBias(CAL_BIAS_GYRO, false, 0, bias, &accuracy) &&
+                        bias[0] == res.committedGyro,
+                        "bias cache holds the last committed bias");
+    }
+    failed |= check(access(tmpPath, F_OK) != 0,
+                    "no temporary file left behind");
+
+    failed |= checkBiasAging(path, cachePath);
+
+    unlink(path);
+    unlink(cachePath);
+    free(state);
+    free(onDisk);
+    return failed;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of CompassCalibrator with a stand-in for Magnetic_Calibrate()
+ * that burns a fixed amount of CPU time.
+ *
+ *   latency  time the poll thread spends per sample, calibrating inline
+ *            (as the HAL used to) and handing the sample to the worker
+ *   stress   the poll loop of the HAL: raw samples arrive on one timer,
+ *            the gyro wakes MPLSensor::readEvents() (which reads RM) on
+ *            another, and M is read when the calibrator fd is readable.
+ *            Fails if M misses a sample or the loop spins on the fd.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "CompassCalibrator.h"
+
+static int64_t sCalibrateCostNs = 200000;
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleepUntil(int64_t when)
+{
+    struct timespec ts;
+    ts.tv_sec = when / 1000000000LL;
+    ts.tv_nsec = when % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int fakeCalibrate(void *cookie, int *in, sensors_vec_t *out)
+{
+    int64_t end = nowNs() + sCalibrateCostNs;
+
+    (void)cookie;
+    while (nowNs() < end)
+        ;
+    for (int i = 0; i < 3; i++)
+        out->v[i] = in[i] * 0.15f;
+    out->status = SENSOR_STATUS_ACCURACY_HIGH;
+    return 1;
+}
+
+struct stats_t {
+    int64_t total;
+    int64_t max;
+    int count;
+};
+
+static void account(stats_t *stats, int64_t ns)
+{
+    stats->total += ns;
+    if (ns > stats->max)
+        stats->max = ns;
+    stats->count++;
+}
+
+static void report(const char *what, const stats_t *stats)
+{
+    printf("%-28s avg %8.1f us  max %8.1f us  (%d samples)\n", what,
+           stats->count ? stats->total / 1e3 / stats->count : 0.,
+           stats->max / 1e3, stats->count);
+}
+
+/* z carries the sample number, to spot missed samples */
+static compass_raw_sample_t makeSample(int n, int64_t timestamp)
+{
+    compass_raw_sample_t raw = { { 100 + n % 7, -200 + n % 5, n }, timestamp };
+    return raw;
+}
+
+static int runLatency(int samples, int64_t period)
+{
+    CompassCalibrator calibrator(fakeCalibrate, NULL);
+    struct pollfd pfd = { calibrator.getFd(), POLLIN, 0 };
+    stats_t inl = { 0, 0, 0 }, handoff = { 0, 0, 0 }, ready = { 0, 0, 0 };
+    compass_data_t data;
+    sensors_vec_t out;
+    int64_t next = nowNs(), start;
+    int lost = 0;
+
+    for (int n = 0; n < samples; n++) {
+        compass_raw_sample_t raw = makeSample(n, next);
+
+        sleepUntil(next);
+        start = nowNs();
+        fakeCalibrate(NULL, raw.in, &out);
+        account(&inl, nowNs() - start);
+        next += period;
+    }
+
+    for (int n = 0; n < samples; n++) {
+        compass_raw_sample_t raw = makeSample(n, next);
+
+        sleepUntil(next);
+        start = nowNs();
+        calibrator.submit(raw);
+        account(&handoff, nowNs() - start);
+
+        /* the poll loop waits for the result like the HAL does */
+        if (poll(&pfd, 1, (int)(period / 1000000)) > 0 &&
+                calibrator.fetch(0, &data, 1, true) && data.timestamp == next)
+            account(&ready, nowNs() - start);
+        else
+            lost++;
+        next += period;
+    }
+
+    printf("Magnetic_Calibrate stand-in: %.1f us, %d samples every %.1f ms\n",
+           sCalibrateCostNs / 1e3, samples, period / 1e6);
+    report("poll thread, inline", &inl);
+    report("poll thread, worker", &handoff);
+    report("submit to calibrated sample", &ready);
+    printf("samples not ready within a period: %d\n", lost);
+    return lost ? 1 : 0;
+}
+
+static int startTimer(int64_t period)
+{
+    struct itimerspec spec;
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0)
+        return -errno;
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(fd, 0, &spec, NULL);
+    return fd;
+}
+
+static bool expired(int fd)
+{
+    uint64_t count;
+    return read(fd, &count, sizeof(count)) == sizeof(count);
+}
+
+enum {
+    CONSUMER_M = 0,
+    CONSUMER_RM,
+};
+
+struct consumer_t {
+    int received;
+    int missed;
+    int last;
+    stats_t delay;
+};
+
+static void consume(consumer_t *c, const compass_data_t &data)
+{
+    int n = (int)data.uncalibrated_magnetic.uncalib[2];
+
+    c->missed += n - c->last - 1;
+    c->last = n;
+    c->received++;
+    account(&c->delay, nowNs() - data.timestamp);
+}
+
+static int runStress(int samples, int64_t period, int64_t gyroPeriod,
+                     bool drainAlways)
+{
+    CompassCalibrator calibrator(fakeCalibrate, NULL);
+    consumer_t m, rm;
+    compass_data_t data;
+    char tokens[COMPASS_QUEUE_SIZE];
+    int rawFd = startTimer(period), gyroFd = startTimer(gyroPeriod);
+    uint32_t active = (1 << CONSUMER_M) | (1 << CONSUMER_RM);
+    int submitted = 0, spurious = 0, wakeups = 0;
+    int64_t end;
+
+    if (rawFd < 0 || gyroFd < 0) {
+        fprintf(stderr, "timerfd: %s\n", strerror(errno));
+        return 2;
+    }
+    memset(&m, 0, sizeof(m));
+    memset(&rm, 0, sizeof(rm));
+    m.last = rm.last = -1;
+
+    /* in the order of sensors_poll_context_t */
+    struct pollfd fds[3] = {
+        { gyroFd, POLLIN, 0 },
+        { rawFd, POLLIN, 0 },
+        { calibrator.getFd(), POLLIN, 0 },
+    };
+
+    end = 0;
+    while (!end || nowNs() < end) {
+        if (poll(fds, 3, 100) <= 0)
+            continue;
+        wakeups++;
+
+        /* the compass input device: hand the sample to the worker */
+        if ((fds[1].revents & POLLIN) && expired(rawFd) && submitted < samples) {
+            int64_t now = nowNs();
+            calibrator.submit(makeSample(submitted, now));
+            if (++submitted == samples)
+                end = now + 2 * period;
+        }
+
+        /* buildMpuEvent() and readEvents() on a gyro sample */
+        if ((fds[0].revents & POLLIN) && expired(gyroFd)) {
+            if (calibrator.fetch(CONSUMER_RM, &data, active, false))
+                consume(&rm, data);
+            /* what CompassSensor::fetchSample() used to do */
+            if (drainAlways)
+                while (read(calibrator.getFd(), tokens, sizeof(tokens)) > 0)
+                    ;
+        }
+
+        /* buildCompassEvent(), then readEvents() if M had a new sample */
+        if (fds[2].revents & POLLIN) {
+            if (calibrator.fetch(CONSUMER_M, &data, active, true)) {
+                consume(&m, data);
+                if (calibrator.fetch(CONSUMER_RM, &data, active, false))
+                    consume(&rm, data);
+            } else {
+                spurious++;
+            }
+        }
+    }
+    close(rawFd);
+    close(gyroFd);
+
+    printf("%d samples at %.1f Hz, gyro at %.1f Hz, calibration %.1f us%s\n",
+           samples, 1e9 / period, 1e9 / gyroPeriod, sCalibrateCostNs / 1e3,
+           drainAlways ? ", draining on every fetch" : "");
+    printf("M:  received %d, missed %d\n", m.received, m.missed);
+    report("M:  arrival to fetch", &m.delay);
+    printf("RM: received %d, missed %d\n", rm.received, rm.missed);
+    report("RM: arrival to fetch", &rm.delay);
+    printf("poll wake-ups %d, calibrator fd readable with nothing new %d\n",
+           wakeups, spurious);
+
+    return m.missed || rm.missed || spurious > samples / 100 ? 1 : 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] latency|stress\n"
+            "  -n samples   samples to run (default 1000)\n"
+            "  -r hz        sample rate (default 100)\n"
+            "  -g hz        gyro rate for stress (default 200)\n"
+            "  -c us        cost of one calibration (default 200)\n"
+            "  -o           stress: drain the fd on every fetch, as before\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int samples = 1000;
+    double hz = 100, gyroHz = 200;
+    bool drainAlways = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:g:c:o")) != -1) {
+        switch (opt) {
+        case 'n':
+            samples = atoi(optarg);
+            break;
+        case 'r':
+            hz = atof(optarg);
+            break;
+        case 'g':
+            gyroHz = atof(optarg);
+            break;
+        case 'c':
+            sCalibrateCostNs = (int64_t)(atof(optarg) * 1000);
+            break;
+        case 'o':
+            drainAlways = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || samples <= 0 || hz <= 0 || gyroHz <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!strcmp(argv[optind], "latency"))
+        return runLatency(samples, (int64_t)(1e9 / hz));
+    if (!strcmp(argv[optind], "stress"))
+        return runStress(samples, (int64_t)(1e9 / hz), (int64_t)(1e9 / gyroHz),
+                         drainAlways);
+
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays MPU IIO data through the per-sensor decimation of
+ * MPLSensor::readEvents(). The trace is either recorded on a device
+ * (debug.sensors.record) or generated here: gyro and accel at 200 Hz,
+ * with jittered timestamps.
+ *
+ * The clients are those of a mixed workload: the gyroscope at 200 Hz,
+ * the accelerometer at 5 Hz and the uncalibrated gyroscope at 1 Hz. The
+ * latter is asked for through batch(), which clamps periods to 200 ms
+ * before they reach mDelays[], so it is reported at 5 Hz.
+ *
+ * For each client it prints the events reported, their rate and the
+ * shortest and longest gap, with the rule readEvents() uses now and with
+ * the first one (a sample 7/8 of a period after the last reported one).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MpuPacketGenerator.h"
+#include "SampleDecimation.h"
+#include "SensorTrace.h"
+
+/* batch() keeps periods within this range */
+#define BATCH_MIN_PERIOD_NS     5000000LL
+#define BATCH_MAX_PERIOD_NS     200000000LL
+
+enum {
+    SOURCE_GYRO = 0,
+    SOURCE_ACCEL,
+};
+
+struct client_t {
+    const char *name;
+    int source;
+    double hz;                  /* requested */
+    int64_t period;             /* in mDelays[] */
+    /* rule in use, first rule */
+    int64_t due, last[2];
+    uint64_t reported[2];
+    int64_t minGap[2], maxGap[2];
+};
+
+struct replay_t {
+    client_t *clients;
+    int numClients;
+    uint64_t samples[2];
+    int64_t first, last;
+    /* partial packet carried over to the next IIO record */
+    unsigned char pending[MAX_PACKET_SIZE];
+    size_t pendingLen;
+};
+
+static int64_t batchPeriod(double hz)
+{
+    int64_t period = (int64_t)(1e9 / hz);
+
+    if (period < BATCH_MIN_PERIOD_NS)
+        period = BATCH_MIN_PERIOD_NS;
+    else if (period > BATCH_MAX_PERIOD_NS)
+        period = BATCH_MAX_PERIOD_NS;
+    return period;
+}
+
+/* what isDecimated() did first */
+static bool firstRuleEarly(int64_t last, int64_t timestamp, int64_t period)
+{
+    if (!last || timestamp < last)
+        return false;
+    return timestamp - last < period - period / 8;
+}
+
+static void report(client_t *c, int rule, int64_t timestamp)
+{
+    if (c->last[rule]) {
+        int64_t gap = timestamp - c->last[rule];
+        if (!c->minGap[rule] || gap < c->minGap[rule])
+            c->minGap[rule] = gap;
+        if (gap > c->maxGap[rule])
+            c->maxGap[rule] = gap;
+    }
+    c->last[rule] = timestamp;
+    c->reported[rule]++;
+}
+
+static void sample(replay_t *r, int source, int64_t timestamp)
+{
+    if (!r->first)
+        r->first = timestamp;
+    r->last = timestamp;
+    r->samples[source]++;
+
+    for (int i = 0; i < r->numClients; i++) {
+        client_t *c = &r->clients[i];
+        if (c->source != source)
+            continue;
+        if (takeSample(&c->due, timestamp, c->period))
+            report(c, 0, timestamp);
+        if (!firstRuleEarly(c->last[1], timestamp, c->period))
+            report(c, 1, timestamp);
+    }
+}
+
+/* bytes of the packet starting at 'data', 0 if the header is unknown */
+static size_t packetSize(unsigned short header)
+{
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_MARKER:
+    case DATA_FORMAT_EMPTY_MARKER:
+        return BYTES_PER_SENSOR;
+    case DATA_FORMAT_QUAT:
+    case DATA_FORMAT_6_AXIS:
+        return BYTES_QUAT_DATA;
+    case DATA_FORMAT_PED_STANDALONE:
+    case DATA_FORMAT_PED_QUAT:
+    case DATA_FORMAT_COMPASS:
+    case DATA_FORMAT_COMPASS_OF:
+    case DATA_FORMAT_GYRO:
+    case DATA_FORMAT_ACCEL:
+    case DATA_FORMAT_PRESSURE:
+    case 0: /* standalone step */
+        return BYTES_PER_SENSOR_PACKET;
+    default:
+        return 0;
+    }
+}
+
+static void parsePacket(replay_t *r, const unsigned char *data)
+{
+    unsigned short header;
+    int64_t timestamp;
+
+    memcpy(&header, data, sizeof(header));
+    memcpy(&timestamp, data + BYTES_PER_SENSOR, sizeof(timestamp));
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_GYRO:
+        sample(r, SOURCE_GYRO, timestamp);
+        break;
+    case DATA_FORMAT_ACCEL:
+        sample(r, SOURCE_ACCEL, timestamp);
+        break;
+    }
+}
+
+static int replayRecord(const sensor_trace_record_t *rec, const void *payload,
+                        void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+    const unsigned char *data = (const unsigned char *)payload;
+    size_t len = rec->length;
+
+    if (rec->type != SENSOR_TRACE_IIO)
+        return 0;
+
+    while (len) {
+        size_t n = sizeof(r->pending) - r->pendingLen;
+        size_t size;
+        unsigned short header;
+
+        if (n > len)
+            n = len;
+        memcpy(r->pending + r->pendingLen, data, n);
+        r->pendingLen += n;
+        data += n;
+        len -= n;
+
+        /* whole packets in the carried over bytes */
+        size_t done = 0;
+        while (r->pendingLen - done >= sizeof(header)) {
+            memcpy(&header, r->pending + done, sizeof(header));
+            size = packetSize(header);
+            if (!size) {
+                fprintf(stderr, "unknown packet header 0x%04x\n", header);
+                return -EINVAL;
+            }
+            if (r->pendingLen - done < size)
+                break;
+            parsePacket(r, r->pending + done);
+            done += size;
+        }
+        memmove(r->pending, r->pending + done, r->pendingLen - done);
+        r->pendingLen -= done;
+    }
+    return 0;
+}
+
+static int generateTrace(const char *path, double seconds, int jitterUs)
+{
+    mpu_gen_config_t config;
+    unsigned char buf[MAX_READ_SIZE];
+    struct timespec now;
+    size_t n;
+
+    MpuPacketGenerator::defaultConfig(&config);
+    config.period[MPU_GEN_COMPASS] = 0;
+    config.period[MPU_GEN_QUAT] = 0;
+    config.duration = (int64_t)(seconds * 1e9);
+    config.jitter = jitterUs * 1000;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    config.startTime = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    SensorTraceWriter *trace = SensorTraceWriter::create(path);
+    if (!trace)
+        return -1;
+    MpuPacketGenerator gen(&config);
+    while ((n = gen.read(buf, sizeof(buf))) > 0)
+        trace->recordAt(gen.time(), SENSOR_TRACE_IIO, 0, buf, n);
+    delete trace;
+    return 0;
+}
+
+static void printClient(const client_t *c, int rule, double seconds)
+{
+    printf("  %-22s %6.1f Hz asked, %6.1f Hz reported, %6llu events,"
+           " gap %6.1f..%6.1f ms\n",
+           c->name, c->hz, c->reported[rule] / seconds,
+           (unsigned long long)c->reported[rule],
+           c->minGap[rule] / 1e6, c->maxGap[rule] / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    const char *input = NULL;
+    char path[256];
+    double seconds = 60;
+    int jitterUs = 100;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "i:d:j:")) != -1) {
+        switch (opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'j':
+            jitterUs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-i trace] [-d seconds] [-j jitter us]\n"
+                    "  without -i, gyro and accel at 200 Hz are generated\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (!input) {
+        snprintf(path, sizeof(path), "/tmp/decimation_replay_%d.trace", getpid());
+        if (generateTrace(path, seconds, jitterUs)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 2;
+        }
+    }
+
+    client_t clients[] = {
+        { "gyroscope", SOURCE_GYRO, 200, 0, 0, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } },
+        { "accelerometer", SOURCE_ACCEL, 5, 0, 0, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } },
+        { "uncalibrated gyroscope", SOURCE_GYRO, 1, 0, 0, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } },
+    };
+    int numClients = sizeof(clients) / sizeof(clients[0]);
+    replay_t r;
+    SensorTraceReader reader;
+
+    memset(&r, 0, sizeof(r));
+    r.clients = clients;
+    r.numClients = numClients;
+    for (int i = 0; i < numClients; i++)
+        clients[i].period = batchPeriod(clients[i].hz);
+
+    int err = reader.open(input ? input : path);
+    if (!err)
+        err = reader.replay(0, 0, replayRecord, &r);
+    if (!input)
+        unlink(path);
+    if (err || r.last <= r.first) {
+        fprintf(stderr, "cannot replay %s: %d\n", input ? input : path, err);
+        return 2;
+    }
+
+    double span = (r.last - r.first) / 1e9;
+    uint64_t all = 0, out[2] = { 0, 0 };
+    for (int i = 0; i < numClients; i++) {
+        all += r.samples[clients[i].source];
+        for (int rule = 0; rule < 2; rule++)
+            out[rule] += clients[i].reported[rule];
+    }
+
+    printf("%.1f s replayed: %llu gyro and %llu accel samples (%.1f / %.1f Hz)\n",
+           span, (unsigned long long)r.samples[SOURCE_GYRO],
+           (unsigned long long)r.samples[SOURCE_ACCEL],
+           r.samples[SOURCE_GYRO] / span, r.samples[SOURCE_ACCEL] / span);
+    printf("reported with takeSample():\n");
+    for (int i = 0; i < numClients; i++)
+        printClient(&clients[i], 0, span);
+    printf("reported with the first rule:\n");
+    for (int i = 0; i < numClients; i++)
+        printClient(&clients[i], 1, span);
+    printf("events to the framework per second: %.1f without decimation,"
+           " %.1f now, %.1f with the first rule\n",
+           all / span, out[0] / span, out[1] / span);
+
+    for (int i = 0; i < numClients; i++) {
+        const client_t *c = &clients[i];
+        double expected = 1e9 / c->period;
+        double rate = c->reported[0] / span;
+        /* within one event over the replay */
+        if (rate < expected - 1 / span - 0.01 || rate > expected + 1 / span + 0.01) {
+            printf("%s: %.2f Hz reported, %.2f Hz expected\n", c->name,
+                   rate, expected);
+            failed = 1;
+        }
+    }
+    if (clients[0].reported[0] != r.samples[SOURCE_GYRO]) {
+        printf("gyroscope: samples dropped at the rate it asked for\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of DirectChannel with a reader in another process.
+ *
+ * This process writes gyro events into an ashmem ring at 200 Hz, the FAST
+ * direct report rate, the way MPLSensor::writeDirectReports() does. A
+ * forked reader maps the same region and follows the ring the way a
+ * direct channel client does: it takes a record once its counter is the
+ * next one expected, copies it and checks that the counter did not move
+ * meanwhile. It reports the latency from the write to the read (the event
+ * timestamp is the write time), the records lost to the writer lapping it
+ * and any record whose payload did not match its counter.
+ *
+ * The reader first keeps up, polling every millisecond: nothing may be
+ * lost. Then it stalls longer than the ring holds, every so often: the
+ * lost records must be detected, and no torn record accepted.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+
+#include "DirectChannel.h"
+
+#define TOKEN           7
+#define MAX_SAMPLES     100000
+
+struct phase_t {
+    const char *name;
+    size_t slots;
+    int pollUs;             /* reader sleep when there is nothing new */
+    int stallEvery;         /* records between reader stalls, 0 never */
+    int stallMs;
+};
+
+struct result_t {
+    unsigned int read;
+    unsigned int lost;
+    unsigned int torn;      /* payload does not belong to the counter */
+    unsigned int bad;       /* wrong token, type or version */
+    int64_t latency[4];     /* min, median, 99th percentile, max, ns */
+};
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int compareNs(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* event number 'n', every value derived from it */
+static void makeEvent(sensors_event_t *ev, uint32_t n)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->type = SENSOR_TYPE_GYROSCOPE;
+    ev->timestamp = nowNs();
+    ev->data[0] = (float)n;
+    ev->data[1] = -(float)n;
+    ev->data[2] = (float)(n % 1000) * 0.5f;
+}
+
+static bool eventMatches(const sensors_event_t *ev, uint32_t n)
+{
+    return ev->data[0] == (float)n && ev->data[1] == -(float)n &&
+            ev->data[2] == (float)(n % 1000) * 0.5f;
+}
+
+static void readerLoop(int fd, const phase_t *phase, unsigned int count,
+                       result_t *res)
+{
+    size_t size = phase->slots * sizeof(sensors_event_t);
+    const sensors_event_t *ring = (const sensors_event_t *)
+            mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int64_t *latency = (int64_t *)malloc(MAX_SAMPLES * sizeof(int64_t));
+    uint32_t expected = 1;
+    size_t pos = 0;
+    unsigned int sinceStall = 0;
+
+    memset(res, 0, sizeof(*res));
+    if (ring == MAP_FAILED || !latency)
+        return;
+
+    while (expected <= count) {
+        const sensors_event_t *slot = &ring[pos];
+        sensors_event_t copy;
+        uint32_t counter, again;
+
+        counter = (uint32_t)android_atomic_acquire_load(&slot->reserved0);
+        if (counter == 0 || (int32_t)(counter - expected) < 0) {
+            /* not written yet */
+            usleep(phase->pollUs);
+            continue;
+        }
+        memcpy(&copy, slot, sizeof(copy));
+        android_memory_barrier();
+        again = (uint32_t)android_atomic_acquire_load(&slot->reserved0);
+        if (again != counter)
+            continue;       /* overwritten while copied, look again */
+
+        if (counter != expected) {
+            /* the writer lapped the reader; the oldest record left is
+               the one in the next slot */
+            uint32_t oldest = counter - phase->slots + 1;
+
+            res->lost += oldest - expected;
+            expected = oldest;
+            if (++pos == phase->slots)
+                pos = 0;
+            continue;
+        }
+        if (copy.sensor != TOKEN || copy.type != SENSOR_TYPE_GYROSCOPE ||
+                copy.version != (int)sizeof(sensors_event_t))
+            res->bad++;
+        if (!eventMatches(&copy, counter))
+            res->torn++;
+        if (res->read < MAX_SAMPLES)
+            latency[res->read] = nowNs() - copy.timestamp;
+        res->read++;
+
+        expected++;
+        if (++pos == phase->slots)
+            pos = 0;
+        if (phase->stallEvery && ++sinceStall == (unsigned int)phase->stallEvery) {
+            sinceStall = 0;
+            usleep(phase->stallMs * 1000);
+        }
+    }
+
+    unsigned int samples = res->read < MAX_SAMPLES ? res->read : MAX_SAMPLES;
+    if (samples) {
+        qsort(latency, samples, sizeof(latency[0]), compareNs);
+        res->latency[0] = latency[0];
+        res->latency[1] = latency[samples / 2];
+        res->latency[2] = latency[samples * 99 / 100];
+        res->latency[3] = latency[samples - 1];
+    }
+    free(latency);
+    munmap((void *)ring, size);
+}
+
+/* writes 'count' events at 'period' ns into a new ring read by a child */
+static int runPhase(const phase_t *phase, unsigned int count, int64_t period,
+                    result_t *res)
+{
+    size_t size = phase->slots * sizeof(sensors_event_t);
+    int fd = ashmem_create_region("direct_channel_test", size);
+    int pipeFds[2];
+    pid_t pid;
+
+    if (fd < 0 || pipe(pipeFds) < 0)
+        return -errno;
+
+    /* the region is cleared when the channel maps it */
+    DirectChannel *channel = new DirectChannel(fd, size);
+    if (!channel->isValid()) {
+        delete channel;
+        close(fd);
+        return -ENOMEM;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        result_t childRes;
+
+        close(pipeFds[0]);
+        readerLoop(fd, phase, count, &childRes);
+        _exit(write(pipeFds[1], &childRes, sizeof(childRes)) ==
+              (ssize_t)sizeof(childRes) ? 0 : 1);
+    }
+    close(pipeFds[1]);
+    if (pid < 0) {
+        delete channel;
+        close(fd);
+        return -errno;
+    }
+
+    int64_t next = nowNs();
+    for (unsigned int n = 1; n <= count; n++) {
+        struct timespec ts;
+        sensors_event_t ev;
+
+        next += period;
+        ts.tv_sec = next / 1000000000LL;
+        ts.tv_nsec = next % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        makeEvent(&ev, n);
+        channel->write(&ev, TOKEN);
+    }
+
+    /* a reader that fell behind at the very end still gets to finish */
+    ssize_t got = read(pipeFds[0], res, sizeof(*res));
+    int status = 0;
+    waitpid(pid, &status, 0);
+    close(pipeFds[0]);
+    delete channel;
+    close(fd);
+    return got == (ssize_t)sizeof(*res) && WIFEXITED(status) &&
+            !WEXITSTATUS(status) ? 0 : -EIO;
+}
+
+int main(int argc, char **argv)
+{
+    static const phase_t phases[] = {
+        { "reader keeps up, 128 slots", 128, 1000, 0, 0 },
+        { "reader stalls 100 ms, 16 slots", 16, 1000, 50, 100 },
+    };
+    int64_t period = DIRECT_RATE_FAST_NS;
+    int seconds = 5, opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds per phase]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (seconds <= 0)
+        return 2;
+
+    unsigned int count = (unsigned int)(seconds * 1000000000LL / period);
+    printf("%u gyro events at %.0f Hz per phase\n", count, 1e9 / period);
+
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        const phase_t *phase = &phases[i];
+        result_t res;
+
+        if (runPhase(phase, count, period, &res)) {
+            printf("%s: reader failed\n", phase->name);
+            failed = 1;
+            continue;
+        }
+        printf("%s: %u read, %u lost, %u torn, %u bad\n", phase->name,
+               res.read, res.lost, res.torn, res.bad);
+        printf("  latency min %.1f us, median %.1f us, 99%% %.1f us, max %.1f us\n",
+               res.latency[0] / 1e3, res.latency[1] / 1e3,
+               res.latency[2] / 1e3, res.latency[3] / 1e3);
+
+        failed |= check(res.read + res.lost == count,
+                        "every record read or counted as lost");
+        failed |= check(!res.torn && !res.bad, "no torn or foreign record accepted");
+        if (phase->stallEvery)
+            failed |= check(res.lost > 0, "records the writer lapped are detected");
+        else
+            failed |= check(!res.lost, "nothing lost while the reader keeps up");
+    }
+    return failed;
+}
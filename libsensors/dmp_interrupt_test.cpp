@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Interrupt-to-event time of the DMP features, reading their attributes
+ * the way MPLSensor does now (read_attr_int64() on fds opened once) and
+ * the way it did before (fopen() and fscanf() per interrupt, then a
+ * dummy read() of the interrupt node).
+ *
+ * The attributes are plain files in a scratch directory. A driver thread
+ * stands in for the DMP: every period it writes a new value to the
+ * attributes of one feature and signals a pipe, which stands in for the
+ * POLLPRI wakeup of the attribute. The HAL thread polls the pipe, reads
+ * the attributes as readDmpOrientEvents(), readDmpSignificantMotionEvents()
+ * or readDmpPedometerEvents() does and fills in the event. It prints the
+ * time from the driver's write to the event, and the part of it spent in
+ * the HAL after the wakeup, for each feature and each way of reading.
+ * Sysfs regenerates an attribute on every read and a regular file does
+ * not, so the absolute numbers are a lower bound.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <hardware/sensors.h>
+
+#include "SysfsAttr.h"
+
+#define PERIOD_NS           1000000LL
+
+enum {
+    ATTR_ORIENT = 0,        /* event_display_orientation */
+    ATTR_SMD,               /* event_smd */
+    ATTR_VIBRATOR,          /* vibrator enable */
+    ATTR_PEDOMETER,         /* event_pedometer */
+    ATTR_STEPS,             /* pedometer_steps */
+    ATTR_COUNTER,           /* pedometer_counter */
+    ATTR_NUM
+};
+
+static const char *g_attrNames[ATTR_NUM] = {
+    "event_display_orientation", "event_smd", "vibrator_enable",
+    "event_pedometer", "pedometer_steps", "pedometer_counter",
+};
+
+enum {
+    FEATURE_ORIENT = 0,
+    FEATURE_SMD,
+    FEATURE_STEP_DETECTOR,
+    FEATURE_STEP_COUNT,
+    FEATURE_NUM
+};
+
+static const char *g_featureNames[FEATURE_NUM] = {
+    "screen orientation", "significant motion", "step detector",
+    "step count",
+};
+/* the old HAL only acked the step detector, with a plain read() */
+static const bool g_usedStdio[FEATURE_NUM] = { true, true, false, true };
+
+struct bench_t {
+    char paths[ATTR_NUM][256];
+    int fds[ATTR_NUM];
+    int feature;
+    bool oldWay;
+    int count;
+    int pipeFds[2];
+    int ackFds[2];          /* the HAL handled the last interrupt */
+    int64_t *written;       /* per interrupt, by the driver */
+    int64_t *latency;       /* driver write to event */
+    int64_t *handler;       /* wakeup to event */
+    int wrong;              /* events not holding the value written */
+};
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int compareNs(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void writeAttr(bench_t *b, int attr, int64_t value)
+{
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%lld\n", (long long)value);
+
+    /* values only grow, so the file never needs truncating */
+    if (pwrite(b->fds[attr], buf, len, 0) != len)
+        fprintf(stderr, "cannot write %s\n", g_attrNames[attr]);
+}
+
+/* what the old HAL did for an attribute: open it, scan it, close it */
+static int scanAttr(const char *path, int64_t *value)
+{
+    long long v;
+    int res;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return -1;
+    res = fscanf(fp, "%lld\n", &v);
+    fclose(fp);
+    if (res != 1)
+        return -1;
+    *value = v;
+    return 0;
+}
+
+static void *driverThread(void *arg)
+{
+    bench_t *b = (bench_t *)arg;
+    int64_t next = nowNs();
+
+    for (int n = 1; n <= b->count; n++) {
+        struct timespec ts;
+        char c = 1;
+
+        next += PERIOD_NS;
+        ts.tv_sec = next / 1000000000LL;
+        ts.tv_nsec = next % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        b->written[n - 1] = nowNs();
+        switch (b->feature) {
+        case FEATURE_ORIENT:
+            writeAttr(b, ATTR_ORIENT, n);
+            break;
+        case FEATURE_SMD:
+            writeAttr(b, ATTR_SMD, n);
+            break;
+        case FEATURE_STEP_DETECTOR:
+            writeAttr(b, ATTR_PEDOMETER, n);
+            break;
+        case FEATURE_STEP_COUNT:
+            writeAttr(b, ATTR_STEPS, n);
+            writeAttr(b, ATTR_COUNTER, n * 1000LL);
+            break;
+        }
+        if (write(b->pipeFds[1], &c, 1) != 1)
+            break;
+        /* the next value only once this one is read, or the check of
+           what the event holds would race with the driver */
+        if (read(b->ackFds[0], &c, 1) != 1)
+            break;
+    }
+    return NULL;
+}
+
+/* one interrupt of the feature, read one way or the other; whether the
+   event came out holding what the driver wrote for interrupt 'n' */
+static bool handleInterrupt(bench_t *b, int64_t n, sensors_event_t *ev)
+{
+    int64_t value = -1, vibrator = 0, steps = -1, stamp = -1;
+    char dummy[4];
+
+    memset(ev, 0, sizeof(*ev));
+    ev->version = sizeof(sensors_event_t);
+    switch (b->feature) {
+    case FEATURE_ORIENT:
+        if (b->oldWay) {
+            if (scanAttr(b->paths[ATTR_ORIENT], &value) < 0)
+                return false;
+            pread(b->fds[ATTR_ORIENT], dummy, 4, 0);
+        } else if (read_attr_int64(b->fds[ATTR_ORIENT], &value) < 0) {
+            return false;
+        }
+        ev->data[0] = (float)value;
+        ev->timestamp = nowNs();
+        return value == n;
+
+    case FEATURE_SMD:
+        /* the event comes from the MPL, the attribute only acks */
+        if (b->oldWay) {
+            if (scanAttr(b->paths[ATTR_VIBRATOR], &vibrator) < 0 ||
+                    pread(b->fds[ATTR_SMD], dummy, 4, 0) <= 0)
+                return false;
+        } else {
+            if (read_attr_int64(b->fds[ATTR_SMD], &value) < 0 || value != n ||
+                    read_attr_int64(b->fds[ATTR_VIBRATOR], &vibrator) < 0)
+                return false;
+        }
+        if (vibrator)
+            return false;
+        ev->data[0] = 1.f;
+        ev->timestamp = nowNs();
+        return true;
+
+    case FEATURE_STEP_DETECTOR:
+        if (b->oldWay) {
+            if (pread(b->fds[ATTR_PEDOMETER], dummy, 4, 0) <= 0)
+                return false;
+        } else if (read_attr_int64(b->fds[ATTR_PEDOMETER], &value) < 0 ||
+                   value != n) {
+            return false;
+        }
+        ev->data[0] = 1.f;
+        ev->timestamp = nowNs();
+        return true;
+
+    case FEATURE_STEP_COUNT:
+        if (b->oldWay) {
+            if (scanAttr(b->paths[ATTR_STEPS], &steps) < 0 ||
+                    scanAttr(b->paths[ATTR_COUNTER], &stamp) < 0)
+                return false;
+        } else if (read_attr_int64(b->fds[ATTR_STEPS], &steps) < 0 ||
+                   read_attr_int64(b->fds[ATTR_COUNTER], &stamp) < 0) {
+            return false;
+        }
+        ev->u64.step_counter = steps;
+        ev->timestamp = stamp;
+        return steps == n && stamp == n * 1000;
+    }
+    return false;
+}
+
+static int run(bench_t *b)
+{
+    pthread_t driver;
+    struct pollfd pfd;
+    int n = 0;
+
+    if (pipe(b->pipeFds) < 0)
+        return -errno;
+    if (pipe(b->ackFds) < 0) {
+        close(b->pipeFds[0]);
+        close(b->pipeFds[1]);
+        return -errno;
+    }
+    b->wrong = 0;
+    pfd.fd = b->pipeFds[0];
+    pfd.events = POLLIN;
+    if (pthread_create(&driver, NULL, driverThread, b)) {
+        close(b->pipeFds[0]);
+        close(b->pipeFds[1]);
+        close(b->ackFds[0]);
+        close(b->ackFds[1]);
+        return -EAGAIN;
+    }
+
+    while (n < b->count) {
+        sensors_event_t ev;
+        char c;
+
+        if (poll(&pfd, 1, 1000) <= 0)
+            break;
+        int64_t woke = nowNs();
+        if (read(b->pipeFds[0], &c, 1) != 1)
+            break;
+        bool right = handleInterrupt(b, n + 1, &ev);
+        int64_t done = nowNs();
+
+        b->wrong += !right;
+        b->latency[n] = done - b->written[n];
+        b->handler[n] = done - woke;
+        n++;
+        if (write(b->ackFds[1], &c, 1) != 1)
+            break;
+    }
+
+    /* a driver still waiting for an ack gets EOF */
+    close(b->ackFds[1]);
+    pthread_join(driver, NULL);
+    close(b->ackFds[0]);
+    close(b->pipeFds[0]);
+    close(b->pipeFds[1]);
+    return n == b->count ? 0 : -EIO;
+}
+
+static void report(const char *what, int64_t *samples, int count)
+{
+    qsort(samples, count, sizeof(samples[0]), compareNs);
+    printf("  %-10s median %6.1f us  99%% %6.1f us  max %7.1f us\n", what,
+           samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3,
+           samples[count - 1] / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "/tmp";
+    bench_t b;
+    int opt, failed = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.count = 2000;
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+            b.count = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir] [-n interrupts]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (b.count <= 0)
+        return 2;
+
+    for (int i = 0; i < ATTR_NUM; i++) {
+        snprintf(b.paths[i], sizeof(b.paths[i]), "%s/dmp_%s", dir,
+                 g_attrNames[i]);
+        b.fds[i] = open(b.paths[i], O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                        0600);
+        if (b.fds[i] < 0) {
+            fprintf(stderr, "cannot create %s: %s\n", b.paths[i],
+                    strerror(errno));
+            return 2;
+        }
+        writeAttr(&b, i, 0);
+    }
+    b.written = (int64_t *)malloc(b.count * sizeof(int64_t));
+    b.latency = (int64_t *)malloc(b.count * sizeof(int64_t));
+    b.handler = (int64_t *)malloc(b.count * sizeof(int64_t));
+    if (!b.written || !b.latency || !b.handler)
+        return 2;
+
+    printf("%d interrupts per feature, every %lld us\n", b.count,
+           PERIOD_NS / 1000);
+    for (int f = 0; f < FEATURE_NUM; f++) {
+        int64_t median[2];
+
+        b.feature = f;
+        for (int way = 0; way < 2; way++) {
+            b.oldWay = way;
+            for (int i = 0; i < ATTR_NUM; i++)
+                writeAttr(&b, i, 0);
+            if (run(&b)) {
+                printf("%s: interrupts lost\n", g_featureNames[f]);
+                failed = 1;
+                continue;
+            }
+            printf("%s, read as %s:\n", g_featureNames[f],
+                   way ? "before" : "now");
+            report("to event", b.latency, b.count);
+            report("in the HAL", b.handler, b.count);
+            median[way] = b.handler[b.count / 2];
+
+            failed |= check(!b.wrong, "  every event holds the value written");
+        }
+        if (g_usedStdio[f])
+            failed |= check(median[0] <= median[1],
+                            "  pread is not slower than fopen and fscanf");
+    }
+
+    for (int i = 0; i < ATTR_NUM; i++) {
+        close(b.fds[i]);
+        unlink(b.paths[i]);
+    }
+    free(b.written);
+    free(b.latency);
+    free(b.handler);
+    return failed;
+}
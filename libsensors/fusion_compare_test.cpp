@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares the built-in fusion (MahonyFusion) with the MPL.
+ *
+ * The gyro, accel and compass packets of a trace are fed to a 6-axis and
+ * a 9-axis filter the way MPLSensor::feedFusion() does, each one only
+ * with the samples it uses. With a trace recorded on a device
+ * (debug.sensors.record), the references are the game rotation vector
+ * and rotation vector events the MPL returned from poll(), which the
+ * trace holds too. The raw samples are in the chip frame: pass the
+ * mounting matrices of the device with -o and -c. Without a trace, one is
+ * generated (mpu_packet_gen's data: lying flat, turning at 0.5 rad/s) and
+ * the reference is its DMP quaternion.
+ *
+ * The heading of a game rotation vector is arbitrary, and that of the
+ * generated quaternion has no relation to the generated field, so those
+ * are compared by tilt (the angle between the up axes) and by how fast
+ * the heading difference drifts. The rotation vector against the MPL is
+ * also compared by the full rotation angle. All of it starts once the
+ * filters had some time to converge.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <hardware/sensors.h>
+
+#include "MahonyFusion.h"
+#include "MpuPacketGenerator.h"
+#include "SensorTrace.h"
+
+#define RAD2DEG     (180.0 / M_PI)
+
+/* limits for the generated trace; one gyro LSB is 0.06 deg/s, and the
+   generated rate alone is truncated by 0.05 deg/s */
+#define MAX_TILT_DEG            2.0
+#define MAX_DRIFT_DEG_S         0.1
+
+struct error_t {
+    uint64_t count;
+    double tiltSum, tiltMax;
+    /* full rotation angle, when the heading origins are the same */
+    double angleSum, angleMax;
+    /* heading difference */
+    double firstYaw, minYaw, maxYaw;
+    int64_t first, last;
+};
+
+struct compare_t {
+    MahonyFusion fusion6;
+    MahonyFusion fusion9;
+    signed char orient[9];
+    signed char compassOrient[9];
+    float gyroScale;            /* rad/s per LSB */
+    float compassScale;         /* uT per LSB */
+    int64_t start;              /* first sample */
+    int64_t settle;             /* ignored after 'start' */
+    int64_t now;                /* last sample */
+    error_t grv, rv;
+    unsigned char pending[MAX_PACKET_SIZE];
+    size_t pendingLen;
+
+    compare_t() : fusion6(false), fusion9(true) {}
+};
+
+static void rotate(const signed char *m, const float *in, float *out)
+{
+    for (int i = 0; i < 3; i++)
+        out[i] = m[i * 3] * in[0] + m[i * 3 + 1] * in[1] + m[i * 3 + 2] * in[2];
+}
+
+/* rotation angle from a to b, both x, y, z, w */
+static double angleBetween(const float *a, const float *b)
+{
+    double dot = 0;
+
+    for (int i = 0; i < 4; i++)
+        dot += (double)a[i] * b[i];
+    dot = fabs(dot);
+    return 2 * acos(dot > 1 ? 1 : dot) * RAD2DEG;
+}
+
+/* angle between the up axes, world z in device coordinates */
+static double tiltBetween(const float *a, const float *b)
+{
+    double ua[3], ub[3], dot = 0;
+    const float *q[2] = { a, b };
+    double *u[2] = { ua, ub };
+
+    for (int i = 0; i < 2; i++) {
+        double x = q[i][0], y = q[i][1], z = q[i][2], w = q[i][3];
+        u[i][0] = 2 * (x * z - w * y);
+        u[i][1] = 2 * (y * z + w * x);
+        u[i][2] = 1 - 2 * (x * x + y * y);
+    }
+    for (int i = 0; i < 3; i++)
+        dot += ua[i] * ub[i];
+    return acos(dot > 1 ? 1 : dot < -1 ? -1 : dot) * RAD2DEG;
+}
+
+/* heading of the device y axis, what a rotation about z changes */
+static double yaw(const float *q)
+{
+    double x = q[0], y = q[1], z = q[2], w = q[3];
+
+    return atan2(2 * (x * y - w * z), 1 - 2 * (x * x + z * z)) * RAD2DEG;
+}
+
+static void account(error_t *e, const float *fused, const float *ref,
+                    int64_t ts)
+{
+    double tilt = tiltBetween(fused, ref);
+    double angle = angleBetween(fused, ref);
+    double diff = yaw(fused) - yaw(ref);
+
+    if (e->count) {
+        /* unwrapped around the first difference */
+        while (diff - e->firstYaw > 180)
+            diff -= 360;
+        while (diff - e->firstYaw <= -180)
+            diff += 360;
+    } else {
+        e->firstYaw = e->minYaw = e->maxYaw = diff;
+        e->first = ts;
+    }
+    e->count++;
+    e->last = ts;
+    e->tiltSum += tilt;
+    if (tilt > e->tiltMax)
+        e->tiltMax = tilt;
+    e->angleSum += angle;
+    if (angle > e->angleMax)
+        e->angleMax = angle;
+    if (diff < e->minYaw)
+        e->minYaw = diff;
+    if (diff > e->maxYaw)
+        e->maxYaw = diff;
+}
+
+/* heading difference range over the compared time, deg/s */
+static double drift(const error_t *e)
+{
+    return e->last > e->first ?
+            (e->maxYaw - e->minYaw) / ((e->last - e->first) / 1e9) : 0;
+}
+
+static bool settled(const compare_t *c)
+{
+    return c->start && c->now - c->start >= c->settle;
+}
+
+static void compareEvents(compare_t *c, const sensors_event_t *ev, size_t n)
+{
+    float fused[4];
+    int64_t ts;
+
+    if (!settled(c))
+        return;
+    for (size_t i = 0; i < n; i++) {
+        if (ev[i].type == SENSOR_TYPE_GAME_ROTATION_VECTOR &&
+                c->fusion6.getRotationVector(fused, &ts))
+            account(&c->grv, fused, ev[i].data, ev[i].timestamp);
+        else if (ev[i].type == SENSOR_TYPE_ROTATION_VECTOR &&
+                c->fusion9.getRotationVector(fused, &ts))
+            account(&c->rv, fused, ev[i].data, ev[i].timestamp);
+    }
+}
+
+/* the generated DMP quaternion: q1..q3 in q30, x, y, z */
+static void compareQuat(compare_t *c, const unsigned char *data)
+{
+    float ref[4], fused[4];
+    int32_t v[3];
+    double sum = 0;
+    int64_t ts;
+
+    if (!settled(c))
+        return;
+    memcpy(v, data + 4, sizeof(v));
+    for (int i = 0; i < 3; i++) {
+        ref[i] = v[i] / (float)(1L << 30);
+        sum += (double)ref[i] * ref[i];
+    }
+    ref[3] = sum < 1 ? (float)sqrt(1 - sum) : 0.f;
+
+    if (c->fusion6.getRotationVector(fused, &ts))
+        account(&c->grv, fused, ref, c->now);
+    if (c->fusion9.getRotationVector(fused, &ts))
+        account(&c->rv, fused, ref, c->now);
+}
+
+static void parsePacket(compare_t *c, const unsigned char *data)
+{
+    unsigned short header;
+    int16_t s[3];
+    int64_t ts;
+    float in[3], out[3];
+
+    memcpy(&header, data, sizeof(header));
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_GYRO:
+        memcpy(s, data + 2, sizeof(s));
+        memcpy(&ts, data + BYTES_PER_SENSOR, sizeof(ts));
+        for (int i = 0; i < 3; i++)
+            in[i] = s[i] * c->gyroScale;
+        rotate(c->orient, in, out);
+        c->fusion6.handleGyro(out, ts);
+        c->fusion9.handleGyro(out, ts);
+        if (!c->start)
+            c->start = ts;
+        c->now = ts;
+        break;
+    case DATA_FORMAT_ACCEL:
+        memcpy(s, data + 2, sizeof(s));
+        for (int i = 0; i < 3; i++)
+            in[i] = s[i];
+        rotate(c->orient, in, out);
+        c->fusion6.handleAccel(out);
+        c->fusion9.handleAccel(out);
+        break;
+    case DATA_FORMAT_COMPASS:
+        memcpy(s, data + 2, sizeof(s));
+        for (int i = 0; i < 3; i++)
+            in[i] = s[i] * c->compassScale;
+        rotate(c->compassOrient, in, out);
+        c->fusion9.handleMag(out);
+        break;
+    case DATA_FORMAT_QUAT:
+        compareQuat(c, data);
+        break;
+    }
+}
+
+static size_t packetSize(unsigned short header)
+{
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_MARKER:
+    case DATA_FORMAT_EMPTY_MARKER:
+        return BYTES_PER_SENSOR;
+    case DATA_FORMAT_QUAT:
+    case DATA_FORMAT_6_AXIS:
+        return BYTES_QUAT_DATA;
+    case DATA_FORMAT_PED_STANDALONE:
+    case DATA_FORMAT_PED_QUAT:
+    case DATA_FORMAT_COMPASS:
+    case DATA_FORMAT_COMPASS_OF:
+    case DATA_FORMAT_GYRO:
+    case DATA_FORMAT_ACCEL:
+    case DATA_FORMAT_PRESSURE:
+    case 0: /* standalone step */
+        return BYTES_PER_SENSOR_PACKET;
+    default:
+        return 0;
+    }
+}
+
+static int replayRecord(const sensor_trace_record_t *rec, const void *payload,
+                        void *arg)
+{
+    compare_t *c = (compare_t *)arg;
+    const unsigned char *data = (const unsigned char *)payload;
+    size_t len = rec->length;
+
+    if (rec->type == SENSOR_TRACE_EVENTS) {
+        compareEvents(c, (const sensors_event_t *)payload,
+                      len / sizeof(sensors_event_t));
+        return 0;
+    }
+    if (rec->type != SENSOR_TRACE_IIO)
+        return 0;
+
+    while (len) {
+        size_t n = sizeof(c->pending) - c->pendingLen;
+        unsigned short header;
+
+        if (n > len)
+            n = len;
+        memcpy(c->pending + c->pendingLen, data, n);
+        c->pendingLen += n;
+        data += n;
+        len -= n;
+
+        size_t done = 0;
+        while (c->pendingLen - done >= sizeof(header)) {
+            memcpy(&header, c->pending + done, sizeof(header));
+            size_t size = packetSize(header);
+            if (!size)
+                return -1;
+            if (c->pendingLen - done < size)
+                break;
+            parsePacket(c, c->pending + done);
+            done += size;
+        }
+        memmove(c->pending, c->pending + done, c->pendingLen - done);
+        c->pendingLen -= done;
+    }
+    return 0;
+}
+
+static int generateTrace(const char *path, double seconds)
+{
+    mpu_gen_config_t config;
+    unsigned char buf[MAX_READ_SIZE];
+    size_t n;
+
+    MpuPacketGenerator::defaultConfig(&config);
+    config.duration = (int64_t)(seconds * 1e9);
+
+    SensorTraceWriter *trace = SensorTraceWriter::create(path);
+    if (!trace)
+        return -1;
+    MpuPacketGenerator gen(&config);
+    while ((n = gen.read(buf, sizeof(buf))) > 0)
+        trace->recordAt(gen.time(), SENSOR_TRACE_IIO, 0, buf, n);
+    delete trace;
+    return 0;
+}
+
+static int parseMatrix(const char *arg, signed char *m)
+{
+    int v[9];
+
+    if (sscanf(arg, "%d,%d,%d,%d,%d,%d,%d,%d,%d", &v[0], &v[1], &v[2],
+               &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) != 9)
+        return -1;
+    for (int i = 0; i < 9; i++)
+        m[i] = (signed char)v[i];
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const signed char identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    compare_t *c = new compare_t();
+    const char *input = NULL;
+    char path[256];
+    double seconds = 120, settle = 10;
+    float gyroLsbPerDps = 16.4f, compassUtPerLsb = 0.15f;
+    int opt, failed = 0;
+
+    memcpy(c->orient, identity, sizeof(identity));
+    memcpy(c->compassOrient, identity, sizeof(identity));
+    while ((opt = getopt(argc, argv, "i:d:s:g:m:o:c:")) != -1) {
+        switch (opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 's':
+            settle = atof(optarg);
+            break;
+        case 'g':
+            gyroLsbPerDps = atof(optarg);
+            break;
+        case 'm':
+            compassUtPerLsb = atof(optarg);
+            break;
+        case 'o':
+            if (parseMatrix(optarg, c->orient))
+                goto usage;
+            break;
+        case 'c':
+            if (parseMatrix(optarg, c->compassOrient))
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    c->gyroScale = (float)(M_PI / 180.0) / gyroLsbPerDps;
+    c->compassScale = compassUtPerLsb;
+    c->settle = (int64_t)(settle * 1e9);
+
+    if (!input) {
+        snprintf(path, sizeof(path), "/tmp/fusion_compare_%d.trace", getpid());
+        if (generateTrace(path, seconds)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 2;
+        }
+    }
+
+    {
+        SensorTraceReader reader;
+        int err = reader.open(input ? input : path);
+        if (!err)
+            err = reader.replay(0, 0, replayRecord, c);
+        if (!input)
+            unlink(path);
+        if (err || !c->grv.count) {
+            fprintf(stderr, "nothing to compare in %s: %d\n",
+                    input ? input : path, err);
+            return 2;
+        }
+    }
+
+    printf("%.1f s, first %.1f s skipped, against the %s\n",
+           (c->now - c->start) / 1e9, settle, input ? "MPL" : "DMP quaternion");
+    printf("%-24s %8s %10s %10s %12s %10s %10s\n", "", "samples",
+           "tilt mean", "tilt max", "drift deg/s", "angle mean", "angle max");
+    for (int i = 0; i < 2; i++) {
+        const error_t *e = i ? &c->rv : &c->grv;
+
+        printf("%-24s %8llu %10.3f %10.3f %12.4f", i ? "rotation vector" :
+               "game rotation vector", (unsigned long long)e->count,
+               e->count ? e->tiltSum / e->count : 0, e->tiltMax, drift(e));
+        /* the generated quaternion has its own heading origin */
+        if (i && input && e->count)
+            printf(" %10.3f %10.3f", e->angleSum / e->count, e->angleMax);
+        printf("\n");
+        if (!input && (e->tiltMax > MAX_TILT_DEG || drift(e) > MAX_DRIFT_DEG_S)) {
+            printf("  fused attitude off the generated one\n");
+            failed = 1;
+        }
+    }
+    delete c;
+    return failed;
+
+usage:
+    fprintf(stderr,
+            "usage: %s [-i trace] [-d seconds] [-s settle seconds]\n"
+            "          [-g gyro LSB/dps] [-m compass uT/LSB]\n"
+            "          [-o gyro/accel mounting matrix] [-c compass mounting matrix]\n"
+            "  matrices are 9 comma separated values, row major\n"
+            "  without -i, data is generated and compared with its DMP quaternion\n",
+            argv[0]);
+    return 2;
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the gyro bias vs. die temperature table of CalibrationStore
+ * on synthetic temperature ramps.
+ *
+ * A ramp from below -10 to above 60 deg C learns a bias at no-motion a
+ * few times per bin, the way MPLSensor::readEvents() does, and checks
+ * that each 2 deg C bin gets its own blended bias and that temperatures
+ * outside the table learn nothing. Lookups are checked right at the bin
+ * edges and outside the table. A second ramp up and down, with the die
+ * temperature wobbling across the edges, feeds takeGyroTempBias() the way
+ * MPLSensor::applyGyroTempBias() does every 0.5 s: a bias must be pushed
+ * on each bin change and on no other sample. Last, bins cached a while
+ * ago come back with an accuracy that follows their age.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <hardware/sensors.h>
+
+#include "CalibrationStore.h"
+
+#define SEC                 1000000000LL
+#define DEG(d)              ((int64_t)((d) * 65536.))
+/* the temperature step of the ramps, 0.05 deg C per 0.5 s sample */
+#define RAMP_STEP           DEG(0.05)
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+/* bias learned at no-motion at 'temperature', sample 'n' of its bin */
+static void biasAt(int64_t temperature, int n, long *bias)
+{
+    bias[0] = (long)(temperature >> 10) + 100 * n;
+    bias[1] = -(long)(temperature >> 12);
+    bias[2] = 5000 + n;
+}
+
+/* learns three samples per bin on a ramp; returns the failures */
+static int checkLearning(CalibrationStore *store)
+{
+    long learned[CAL_GYRO_TEMP_BINS][3], bias[3];
+    int samples[CAL_GYRO_TEMP_BINS];
+    int outside = 0, wrongBin = 0, failed = 0, accuracy;
+
+    memset(samples, 0, sizeof(samples));
+    for (int64_t t = DEG(-14); t <= DEG(64); t += RAMP_STEP) {
+        int bin = CalibrationStore::gyroTempBin(t);
+        int expected = t < DEG(-10) || t >= DEG(60) ? -1 :
+                (int)((t - DEG(-10)) / DEG(2));
+
+        wrongBin += bin != expected;
+        /* a no-motion event now and then, 3 per bin */
+        if ((t - DEG(-14)) % DEG(0.6) >= RAMP_STEP)
+            continue;
+        store->setTemperature(t);
+        if (bin >= 0 && samples[bin] >= 3)
+            continue;
+        biasAt(t, bin >= 0 ? samples[bin] : 0, bias);
+        if (store->learnGyroBias(bias) != bin) {
+            wrongBin++;
+            continue;
+        }
+        if (bin < 0) {
+            outside++;
+            continue;
+        }
+        for (int i = 0; i < 3; i++)
+            learned[bin][i] = samples[bin] ?
+                    (learned[bin][i] * 3 + bias[i]) / 4 : bias[i];
+        samples[bin]++;
+    }
+    failed |= check(!wrongBin, "2 deg C bins from -10 deg C, none outside");
+    failed |= check(outside > 0, "ramp learns outside the table too");
+
+    int complete = 0, matches = 0;
+    for (int bin = 0; bin < CAL_GYRO_TEMP_BINS; ++bin) {
+        int64_t mid = DEG(-10) + bin * DEG(2) + DEG(1);
+
+        complete += samples[bin] == 3;
+        matches += store->lookupGyroBias(mid, bias, &accuracy) &&
+                !memcmp(bias, learned[bin], sizeof(bias)) &&
+                accuracy == SENSOR_STATUS_ACCURACY_MEDIUM;
+    }
+    printf("%d of %d bins learned 3 times, %d hold the blended bias\n",
+           complete, CAL_GYRO_TEMP_BINS, matches);
+    failed |= check(complete == CAL_GYRO_TEMP_BINS &&
+                    matches == CAL_GYRO_TEMP_BINS,
+                    "each bin holds its own blended bias, at MEDIUM");
+    return failed;
+}
+
+/* bin a lookup at 'temperature' returns, -1 if none: the one whose
+   bottom edge looks up the same bias */
+static int lookedUpBin(CalibrationStore *store, int64_t temperature)
+{
+    long bias[3], want[3];
+    int accuracy;
+
+    if (!store->lookupGyroBias(temperature, bias, &accuracy))
+        return -1;
+    for (int bin = 0; bin < CAL_GYRO_TEMP_BINS; bin++) {
+        store->lookupGyroBias(DEG(-10) + bin * DEG(2), want, &accuracy);
+        if (!memcmp(bias, want, sizeof(bias)))
+            return bin;
+    }
+    return -2;
+}
+
+static int checkEdges(CalibrationStore *store)
+{
+    static const struct {
+        const char *name;
+        int64_t temperature;
+        int bin;
+    } edges[] = {
+        { "-40 deg C",                  DEG(-40),       -1 },
+        { "just below -10 deg C",       DEG(-10) - 1,   -1 },
+        { "-10 deg C",                  DEG(-10),       0 },
+        { "just below -8 deg C",        DEG(-8) - 1,    0 },
+        { "-8 deg C",                   DEG(-8),        1 },
+        { "24.99 deg C",                DEG(24.99),     17 },
+        { "25 deg C",                   DEG(25),        17 },
+        { "26 deg C",                   DEG(26),        18 },
+        { "59.99 deg C",                DEG(59.99),     34 },
+        { "just below 60 deg C",        DEG(60) - 1,    34 },
+        { "60 deg C",                   DEG(60),        -1 },
+        { "85 deg C",                   DEG(85),        -1 },
+    };
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        char what[64];
+        int bin = lookedUpBin(store, edges[i].temperature);
+
+        if (edges[i].bin < 0)
+            snprintf(what, sizeof(what), "lookup at %s finds nothing",
+                     edges[i].name);
+        else
+            snprintf(what, sizeof(what), "lookup at %s finds bin %d",
+                     edges[i].name, edges[i].bin);
+        failed |= check(bin == edges[i].bin &&
+                        CalibrationStore::gyroTempBin(edges[i].temperature) ==
+                        edges[i].bin, what);
+    }
+    return failed;
+}
+
+/* ramp up and back down with a wobble; count pushes against bin changes */
+static int checkPushes(CalibrationStore *store)
+{
+    int64_t t = DEG(-13);
+    int bin = -1, pushes = 0, changes = 0, wrong = 0, failed = 0;
+    int samples = 0, accuracy;
+    long bias[3];
+
+    for (int dir = 1; dir >= -1; dir -= 2) {
+        int64_t end = dir > 0 ? DEG(63) : DEG(-13);
+
+        while (dir > 0 ? t < end : t > end) {
+            /* +-0.3 deg C of noise on a 0.05 deg C per sample ramp
+               crosses most edges a few times */
+            int64_t wobble = (samples % 7 - 3) * DEG(0.1);
+            int64_t temperature = t + wobble;
+            int newBin = CalibrationStore::gyroTempBin(temperature);
+            bool changed = newBin != bin;
+            bool pushed = store->takeGyroTempBias(temperature, false, &bin,
+                                                  bias, &accuracy);
+
+            /* pushed on a change into a bin of the table, else never */
+            changes += changed && newBin >= 0;
+            wrong += pushed != (changed && newBin >= 0);
+            wrong += bin != newBin;
+            pushes += pushed;
+            samples++;
+            t += dir * RAMP_STEP;
+        }
+    }
+    printf("%d samples, %d bin changes into the table, %d biases pushed\n",
+           samples, changes, pushes);
+    failed |= check(!wrong && pushes == changes,
+                    "a bias is pushed on each bin change, only then");
+
+    bin = CalibrationStore::gyroTempBin(DEG(25));
+    failed |= check(!store->takeGyroTempBias(DEG(25.5), false, &bin, bias,
+                                             &accuracy) &&
+                    store->takeGyroTempBias(DEG(25.5), true, &bin, bias,
+                                            &accuracy),
+                    "same bin pushes nothing unless forced");
+    bin = 0;
+    failed |= check(!store->takeGyroTempBias(DEG(70), false, &bin, bias,
+                                             &accuracy) && bin == -1,
+                    "leaving the table pushes nothing");
+    return failed;
+}
+
+/* a cache with bin 17 learned 10 min ago, bin 18 three days ago */
+static int checkAging(const char *path, const char *cachePath)
+{
+    cal_bias_cache_t cache;
+    struct timespec ts;
+    int64_t now;
+    long bias[3], fresh[3] = { 1, 2, 3 };
+    int accuracy, failed = 0, fd;
+    ssize_t put;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = (int64_t)ts.tv_sec * SEC + ts.tv_nsec;
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = CAL_CACHE_MAGIC;
+    cache.version = CAL_CACHE_VERSION;
+    cache.gyroTempValid = (1ULL << 17) | (1ULL << 18);
+    cache.gyroTemp[17][0] = 17;
+    cache.gyroTemp[18][0] = 18;
+    cache.gyroTempTime[17] = now - 600 * SEC;
+    cache.gyroTempTime[18] = now - 72 * 3600 * SEC;
+
+    fd = open(cachePath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    put = fd >= 0 ? write(fd, &cache, sizeof(cache)) : -1;
+    if (fd >= 0)
+        close(fd);
+    if (put != (ssize_t)sizeof(cache))
+        return check(false, "cache written");
+
+    CalibrationStore store(path, cachePath);
+    failed |= check(!store.loadBiasCache(), "cache loads");
+    failed |= check(store.lookupGyroBias(DEG(25), bias, &accuracy) &&
+                    bias[0] == 17 && accuracy == SENSOR_STATUS_ACCURACY_MEDIUM,
+                    "bin learned 10 min ago is MEDIUM");
+    failed |= check(store.lookupGyroBias(DEG(27), bias, &accuracy) &&
+                    bias[0] == 18 && accuracy == SENSOR_STATUS_ACCURACY_LOW,
+                    "bin learned 3 days ago is LOW");
+    store.setTemperature(DEG(27));
+    store.learnGyroBias(fresh);
+    failed |= check(store.lookupGyroBias(DEG(27), bias, &accuracy) &&
+                    accuracy == SENSOR_STATUS_ACCURACY_MEDIUM,
+                    "... until it is learned again");
+
+    cache.version = CAL_CACHE_VERSION - 1;
+    fd = open(cachePath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    put = fd >= 0 ? write(fd, &cache, sizeof(cache)) : -1;
+    if (fd >= 0)
+        close(fd);
+    CalibrationStore old(path, cachePath);
+    failed |= check(put == (ssize_t)sizeof(cache) &&
+                    old.loadBiasCache() == -EINVAL &&
+                    !old.lookupGyroBias(DEG(25), bias, &accuracy),
+                    "cache without learn times is ignored");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "/tmp";
+    char path[256], cachePath[256];
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d dir]\n", argv[0]);
+            return 2;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/gyro_temp_bias_test.bin", dir);
+    snprintf(cachePath, sizeof(cachePath), "%s/gyro_temp_bias_test_cache.bin",
+             dir);
+    unlink(cachePath);
+
+    {
+        CalibrationStore store(path, cachePath);
+
+        failed |= checkLearning(&store);
+        failed |= checkEdges(&store);
+        failed |= checkPushes(&store);
+    }
+    failed |= checkAging(path, cachePath);
+
+    unlink(path);
+    unlink(cachePath);
+    return failed;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Writes synthetic MPU IIO data, either as a raw byte stream (to feed
+ * through a fifo in place of the iio device node) or as a sensor trace
+ * of SENSOR_TRACE_IIO records that SensorTraceReader can replay.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MpuPacketGenerator.h"
+#include "SensorTrace.h"
+
+static const char *sNames[MPU_GEN_NUM] = {
+    "gyro", "accel", "compass", "quat", "6axis", "pedquat", "step",
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] output\n"
+            "  -t           write a sensor trace instead of a raw stream\n"
+            "  -r name=hz   packet rate of a stream, 0 disables it; streams:\n"
+            "               gyro accel compass quat 6axis pedquat step\n"
+            "  -d seconds   amount of data to generate (default 10)\n"
+            "  -b packets   packets per batch burst (default 0, unbatched)\n"
+            "  -f bursts    bursts between flushes (default 0, none)\n"
+            "  -e percent   flushes that find the FIFO drained\n"
+            "  -p percent   reads cut short inside a packet\n"
+            "  -s percent   steps flagged in a data packet header\n"
+            "  -j us        timestamp jitter (default 0)\n"
+            "  -n bytes     bytes per read (default %d)\n"
+            "  -S seed      random seed (default 1)\n",
+            name, MAX_READ_SIZE);
+}
+
+static int setRate(mpu_gen_config_t *config, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+
+    if (!eq)
+        return -EINVAL;
+    for (int i = 0; i < MPU_GEN_NUM; i++) {
+        if (strlen(sNames[i]) == (size_t)(eq - arg) &&
+                !strncmp(arg, sNames[i], eq - arg)) {
+            double hz = atof(eq + 1);
+            config->period[i] = hz > 0 ? (int64_t)(1e9 / hz) : 0;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int writeAll(int fd, const unsigned char *data, size_t len)
+{
+    while (len) {
+        ssize_t res = write(fd, data, len);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    mpu_gen_config_t config;
+    SensorTraceWriter *trace = NULL;
+    unsigned char buf[MAX_SUSPEND_BATCH_PACKET_SIZE];
+    size_t readSize = MAX_READ_SIZE;
+    bool traceOutput = false;
+    struct timespec now;
+    int fd = -1;
+    int opt;
+    size_t n;
+
+    MpuPacketGenerator::defaultConfig(&config);
+    while ((opt = getopt(argc, argv, "tr:d:b:f:e:p:s:j:n:S:")) != -1) {
+        switch (opt) {
+        case 't':
+            traceOutput = true;
+            break;
+        case 'r':
+            if (setRate(&config, optarg)) {
+                fprintf(stderr, "unknown stream in '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            config.duration = (int64_t)(atof(optarg) * 1e9);
+            break;
+        case 'b':
+            config.burstPackets = atoi(optarg);
+            break;
+        case 'f':
+            config.flushBursts = atoi(optarg);
+            break;
+        case 'e':
+            config.emptyFlushPercent = atoi(optarg);
+            break;
+        case 'p':
+            config.partialPercent = atoi(optarg);
+            break;
+        case 's':
+            config.stepInHeaderPercent = atoi(optarg);
+            break;
+        case 'j':
+            config.jitter = (int)(atof(optarg) * 1000);
+            break;
+        case 'n':
+            readSize = strtoul(optarg, NULL, 0);
+            if (readSize == 0 || readSize > sizeof(buf))
+                readSize = sizeof(buf);
+            break;
+        case 'S':
+            config.seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* line the synthetic timestamps up with the trace header */
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    config.startTime = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    if (traceOutput) {
+        trace = SensorTraceWriter::create(argv[optind]);
+        if (!trace) {
+            fprintf(stderr, "cannot create %s\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+
+    MpuPacketGenerator gen(&config);
+    while ((n = gen.read(buf, readSize)) > 0) {
+        if (trace) {
+            trace->recordAt(gen.time(), SENSOR_TRACE_IIO, 0, buf, n);
+        } else if (writeAll(fd, buf, n)) {
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            close(fd);
+            return 1;
+        }
+    }
+
+    delete trace;
+    if (fd >= 0)
+        close(fd);
+
+    for (int i = 0; i < MPU_GEN_NUM; i++) {
+        if (gen.packets(i))
+            printf("%-8s %llu packets\n", sNames[i],
+                   (unsigned long long)gen.packets(i));
+    }
+    printf("step flags %llu, markers %llu, empty markers %llu\n",
+           (unsigned long long)gen.stepFlags(),
+           (unsigned long long)gen.markers(),
+           (unsigned long long)gen.emptyMarkers());
+    printf("%llu bytes, %llu partial reads\n",
+           (unsigned long long)gen.bytes(),
+           (unsigned long long)gen.partialReads());
+    return 0;
+}
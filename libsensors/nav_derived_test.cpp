@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the sensors MPLSensor::updateNavDerived() derives from the
+ * rotation vector (RotationMath.h).
+ *
+ * The MPL handlers they replace, inv_get_sensor_type_gravity(),
+ * _linear_acceleration() and _orientation(), are rebuilt here from the
+ * MPL's fixed point code (hal_outputs.c, results_holder.c), since the
+ * library only ships as a binary. Both are fed the quaternion and accel
+ * packets of a trace, recorded on a device (debug.sensors.record) or
+ * generated, and uniformly random attitudes with random accel readings,
+ * and their outputs are compared. Then the CPU time per sample of both
+ * is measured, for gravity, linear acceleration and orientation enabled
+ * together.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MpuPacketGenerator.h"
+#include "RotationMath.h"
+#include "SensorTrace.h"
+
+/* what the MPL reports, m/s^2 per q16 g */
+#define MPL_ACCEL_CONVERSION    (9.80665f / 65536.f)
+
+/* limits for the comparison */
+#define MAX_GRAVITY_ERROR       1e-3f   /* m/s^2 */
+#define MAX_ANGLE_ERROR         0.01f   /* degrees */
+/* azimuth and roll are undefined with the y axis this close to vertical */
+#define GIMBAL_LOCK_Z           0.9999f
+
+static inline long q29Mult(long a, long b)
+{
+    return (long)(((int64_t)a * b) >> 29);
+}
+
+/*
+ * The MPL side: quaternions are w, x, y, z in q30, accel is in q16 g.
+ */
+static void mplGravity(const long *q, long *g)
+{
+    g[0] = q29Mult(q[1], q[3]) - q29Mult(q[2], q[0]);
+    g[1] = q29Mult(q[2], q[3]) + q29Mult(q[1], q[0]);
+    g[2] = q29Mult(q[3], q[3]) + q29Mult(q[0], q[0]) - (1L << 30);
+}
+
+static void mplSensorGravity(const long *q, float *values)
+{
+    long g[3];
+
+    mplGravity(q, g);
+    for (int i = 0; i < 3; i++)
+        values[i] = (float)(g[i] >> 14) * MPL_ACCEL_CONVERSION;
+}
+
+static void mplSensorLinearAccel(const long *q, const long *accel, float *values)
+{
+    long g[3];
+
+    mplGravity(q, g);
+    for (int i = 0; i < 3; i++)
+        values[i] = (float)(accel[i] - (g[i] >> 14)) * MPL_ACCEL_CONVERSION;
+}
+
+static void mplSensorOrientation(const long *q, float *values)
+{
+    const float rad2deg = (float)(180.0 / M_PI);
+    long q00 = q29Mult(q[0], q[0]), q01 = q29Mult(q[0], q[1]);
+    long q02 = q29Mult(q[0], q[2]), q03 = q29Mult(q[0], q[3]);
+    long q11 = q29Mult(q[1], q[1]), q12 = q29Mult(q[1], q[2]);
+    long q13 = q29Mult(q[1], q[3]), q22 = q29Mult(q[2], q[2]);
+    long q23 = q29Mult(q[2], q[3]), q33 = q29Mult(q[3], q[3]);
+    long t1, t2, t3;
+
+    (void)q11;
+    /* x and y of the body y axis in the world frame */
+    t1 = q12 - q03;
+    t2 = q22 + q00 - (1L << 30);
+    values[0] = atan2f((float)t1, (float)t2) * rad2deg;
+    if (values[0] < 0)
+        values[0] += 360;
+
+    /* z of the body y axis */
+    t3 = q23 + q01;
+    values[1] = -atan2f((float)t3, sqrtf((float)t1 * t1 + (float)t2 * t2)) * rad2deg;
+    /* z of the body z axis */
+    t2 = q33 + q00 - (1L << 30);
+    if (t2 < 0) {
+        if (values[1] >= 0)
+            values[1] = 180.f - values[1];
+        else
+            values[1] = -180.f - values[1];
+    }
+
+    values[2] = atan2f((float)(q33 + q00 - (1L << 30)), (float)(q13 - q02)) *
+            rad2deg - 90;
+    if (values[2] >= 90)
+        values[2] = 180 - values[2];
+    if (values[2] < -90)
+        values[2] = -180 - values[2];
+}
+
+/*
+ * The HAL side: the rotation vector the MPL hands out, x, y, z, w with
+ * w >= 0, and the accel in m/s^2.
+ */
+struct derived_t {
+    float gravity[3];
+    float linearAccel[3];
+    float orientation[3];
+};
+
+static void halDerived(const float *rv, const float *accel, derived_t *out)
+{
+    float rot[9];
+
+    rot_from_quat(rv, rot);
+    rot_gravity(rot, out->gravity);
+    for (int i = 0; i < 3; i++)
+        out->linearAccel[i] = accel[i] - out->gravity[i];
+    rot_orientation(rot, out->orientation);
+}
+
+static void mplDerived(const long *q, const long *accel, derived_t *out)
+{
+    mplSensorGravity(q, out->gravity);
+    mplSensorLinearAccel(q, accel, out->linearAccel);
+    mplSensorOrientation(q, out->orientation);
+}
+
+static void toRotationVector(const long *q, float *rv)
+{
+    float sign = q[0] >= 0 ? 1.f : -1.f;
+
+    rv[0] = sign * q[1] / (float)(1L << 30);
+    rv[1] = sign * q[2] / (float)(1L << 30);
+    rv[2] = sign * q[3] / (float)(1L << 30);
+    rv[3] = sign * q[0] / (float)(1L << 30);
+}
+
+/*****************************************************************************/
+
+struct compare_t {
+    uint64_t samples;
+    uint64_t gimbal;            /* azimuth and roll skipped */
+    float maxGravity;
+    float maxLinearAccel;
+    float maxAngle[3];
+    long worstQuat[4];
+    int worstAngle;
+};
+
+static float angleError(float a, float b)
+{
+    float d = fabsf(a - b);
+    return d > 180.f ? 360.f - d : d;
+}
+
+static void compare(compare_t *c, const long *q, const long *accel)
+{
+    float rv[4], accelMs2[3];
+    derived_t mpl, hal;
+
+    toRotationVector(q, rv);
+    for (int i = 0; i < 3; i++)
+        accelMs2[i] = (float)accel[i] * MPL_ACCEL_CONVERSION;
+    mplDerived(q, accel, &mpl);
+    halDerived(rv, accelMs2, &hal);
+
+    c->samples++;
+    for (int i = 0; i < 3; i++) {
+        float e = fabsf(mpl.gravity[i] - hal.gravity[i]);
+        if (e > c->maxGravity)
+            c->maxGravity = e;
+        e = fabsf(mpl.linearAccel[i] - hal.linearAccel[i]);
+        if (e > c->maxLinearAccel)
+            c->maxLinearAccel = e;
+    }
+
+    /* the body y axis is along gravity: only pitch is defined */
+    bool gimbal = fabsf(hal.gravity[1] / ROT_GRAVITY_EARTH) > GIMBAL_LOCK_Z;
+    if (gimbal)
+        c->gimbal++;
+    for (int i = 0; i < 3; i++) {
+        if (gimbal && i != 1)
+            continue;
+        float e = angleError(mpl.orientation[i], hal.orientation[i]);
+        if (e > c->maxAngle[i]) {
+            c->maxAngle[i] = e;
+            if (e > MAX_ANGLE_ERROR) {
+                memcpy(c->worstQuat, q, sizeof(c->worstQuat));
+                c->worstAngle = i;
+            }
+        }
+    }
+}
+
+static int report(const char *what, const compare_t *c)
+{
+    bool ok = c->maxGravity <= MAX_GRAVITY_ERROR &&
+            c->maxLinearAccel <= MAX_GRAVITY_ERROR &&
+            c->maxAngle[0] <= MAX_ANGLE_ERROR &&
+            c->maxAngle[1] <= MAX_ANGLE_ERROR &&
+            c->maxAngle[2] <= MAX_ANGLE_ERROR;
+
+    printf("%-18s %8llu samples: gravity %.2e, linear accel %.2e m/s^2,"
+           " azimuth %.4f, pitch %.4f, roll %.4f deg  %s\n", what,
+           (unsigned long long)c->samples, c->maxGravity, c->maxLinearAccel,
+           c->maxAngle[0], c->maxAngle[1], c->maxAngle[2], ok ? "ok" : "FAILED");
+    if (!ok && c->maxAngle[c->worstAngle] > MAX_ANGLE_ERROR) {
+        float rv[4], accel[3] = { 0, 0, 0 };
+        derived_t mpl, hal;
+        long zero[3] = { 0, 0, 0 };
+
+        toRotationVector(c->worstQuat, rv);
+        mplDerived(c->worstQuat, zero, &mpl);
+        halDerived(rv, accel, &hal);
+        printf("  at rv %+.4f %+.4f %+.4f %+.4f: MPL %.2f %.2f %.2f, HAL %.2f %.2f %.2f\n",
+               rv[0], rv[1], rv[2], rv[3],
+               mpl.orientation[0], mpl.orientation[1], mpl.orientation[2],
+               hal.orientation[0], hal.orientation[1], hal.orientation[2]);
+    }
+    return ok ? 0 : 1;
+}
+
+/*****************************************************************************/
+
+struct replay_t {
+    compare_t cmp;
+    long accel[3];
+    unsigned char pending[MAX_PACKET_SIZE];
+    size_t pendingLen;
+};
+
+static size_t packetSize(unsigned short header)
+{
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_MARKER:
+    case DATA_FORMAT_EMPTY_MARKER:
+        return BYTES_PER_SENSOR;
+    case DATA_FORMAT_QUAT:
+    case DATA_FORMAT_6_AXIS:
+        return BYTES_QUAT_DATA;
+    case DATA_FORMAT_PED_STANDALONE:
+    case DATA_FORMAT_PED_QUAT:
+    case DATA_FORMAT_COMPASS:
+    case DATA_FORMAT_COMPASS_OF:
+    case DATA_FORMAT_GYRO:
+    case DATA_FORMAT_ACCEL:
+    case DATA_FORMAT_PRESSURE:
+    case 0: /* standalone step */
+        return BYTES_PER_SENSOR_PACKET;
+    default:
+        return 0;
+    }
+}
+
+static void parsePacket(replay_t *r, const unsigned char *data)
+{
+    unsigned short header;
+    int16_t s[3];
+    int32_t v[3];
+
+    memcpy(&header, data, sizeof(header));
+    switch (header & ~DATA_FORMAT_STEP) {
+    case DATA_FORMAT_ACCEL:
+        /* +-2g full scale, 16384 LSB/g, to q16 g */
+        memcpy(s, data + 2, sizeof(s));
+        for (int i = 0; i < 3; i++)
+            r->accel[i] = (long)s[i] << 2;
+        break;
+    case DATA_FORMAT_QUAT: {
+        long q[4];
+        double sum = 0;
+
+        memcpy(v, data + 4, sizeof(v));
+        for (int i = 0; i < 3; i++) {
+            q[i + 1] = v[i];
+            sum += (double)v[i] * v[i];
+        }
+        sum /= (double)(1LL << 60);
+        q[0] = sum < 1 ? (long)(sqrt(1 - sum) * (1L << 30)) : 0;
+        compare(&r->cmp, q, r->accel);
+        break;
+    }
+    }
+}
+
+static int replayRecord(const sensor_trace_record_t *rec, const void *payload,
+                        void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+    const unsigned char *data = (const unsigned char *)payload;
+    size_t len = rec->length;
+
+    if (rec->type != SENSOR_TRACE_IIO)
+        return 0;
+
+    while (len) {
+        size_t n = sizeof(r->pending) - r->pendingLen;
+        unsigned short header;
+
+        if (n > len)
+            n = len;
+        memcpy(r->pending + r->pendingLen, data, n);
+        r->pendingLen += n;
+        data += n;
+        len -= n;
+
+        size_t done = 0;
+        while (r->pendingLen - done >= sizeof(header)) {
+            memcpy(&header, r->pending + done, sizeof(header));
+            size_t size = packetSize(header);
+            if (!size)
+                return -1;
+            if (r->pendingLen - done < size)
+                break;
+            parsePacket(r, r->pending + done);
+            done += size;
+        }
+        memmove(r->pending, r->pending + done, r->pendingLen - done);
+        r->pendingLen -= done;
+    }
+    return 0;
+}
+
+static int generateTrace(const char *path, double seconds)
+{
+    mpu_gen_config_t config;
+    unsigned char buf[MAX_READ_SIZE];
+    size_t n;
+
+    MpuPacketGenerator::defaultConfig(&config);
+    config.period[MPU_GEN_GYRO] = 0;
+    config.period[MPU_GEN_COMPASS] = 0;
+    config.duration = (int64_t)(seconds * 1e9);
+
+    SensorTraceWriter *trace = SensorTraceWriter::create(path);
+    if (!trace)
+        return -1;
+    MpuPacketGenerator gen(&config);
+    while ((n = gen.read(buf, sizeof(buf))) > 0)
+        trace->recordAt(gen.time(), SENSOR_TRACE_IIO, 0, buf, n);
+    delete trace;
+    return 0;
+}
+
+/*****************************************************************************/
+
+/* uniformly distributed attitude (Shoemake) and an accel reading of up
+   to 2 g per axis */
+static void randomSample(unsigned int *seed, long *q, long *accel)
+{
+    double u1 = rand_r(seed) / (double)RAND_MAX;
+    double u2 = rand_r(seed) / (double)RAND_MAX * 2 * M_PI;
+    double u3 = rand_r(seed) / (double)RAND_MAX * 2 * M_PI;
+    double a = sqrt(1 - u1), b = sqrt(u1);
+
+    q[0] = (long)(a * sin(u2) * (1L << 30));
+    q[1] = (long)(a * cos(u2) * (1L << 30));
+    q[2] = (long)(b * sin(u3) * (1L << 30));
+    q[3] = (long)(b * cos(u3) * (1L << 30));
+    for (int i = 0; i < 3; i++)
+        accel[i] = (long)(rand_r(seed) % (4 << 16)) - (2 << 16);
+}
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* keeps the compiler from dropping the work */
+static volatile float sSink;
+
+static void benchmark(int samples)
+{
+    unsigned int seed = 7;
+    long (*q)[4] = (long (*)[4])malloc(samples * sizeof(*q));
+    long (*accel)[3] = (long (*)[3])malloc(samples * sizeof(*accel));
+    float (*rv)[4] = (float (*)[4])malloc(samples * sizeof(*rv));
+    float (*accelMs2)[3] = (float (*)[3])malloc(samples * sizeof(*accelMs2));
+    derived_t out;
+    int64_t start, mplNs, halNs;
+
+    if (!q || !accel || !rv || !accelMs2)
+        return;
+    for (int i = 0; i < samples; i++) {
+        randomSample(&seed, q[i], accel[i]);
+        toRotationVector(q[i], rv[i]);
+        for (int j = 0; j < 3; j++)
+            accelMs2[i][j] = (float)accel[i][j] * MPL_ACCEL_CONVERSION;
+    }
+
+    start = nowNs();
+    for (int i = 0; i < samples; i++) {
+        mplDerived(q[i], accel[i], &out);
+        sSink = out.orientation[0];
+    }
+    mplNs = nowNs() - start;
+
+    start = nowNs();
+    for (int i = 0; i < samples; i++) {
+        halDerived(rv[i], accelMs2[i], &out);
+        sSink = out.orientation[0];
+    }
+    halNs = nowNs() - start;
+
+    printf("CPU per sample, gravity + linear accel + orientation:"
+           " MPL handlers %.1f ns, updateNavDerived() %.1f ns\n",
+           (double)mplNs / samples, (double)halNs / samples);
+    free(q);
+    free(accel);
+    free(rv);
+    free(accelMs2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *input = NULL;
+    char path[256];
+    double seconds = 60;
+    int randomSamples = 1000000;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "i:d:n:")) != -1) {
+        switch (opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'n':
+            randomSamples = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-i trace] [-d seconds] [-n random samples]\n"
+                    "  without -i, quaternion and accel at 200 Hz are generated\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (!input) {
+        snprintf(path, sizeof(path), "/tmp/nav_derived_%d.trace", getpid());
+        if (generateTrace(path, seconds)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 2;
+        }
+    }
+
+    replay_t r;
+    SensorTraceReader reader;
+
+    memset(&r, 0, sizeof(r));
+    int err = reader.open(input ? input : path);
+    if (!err)
+        err = reader.replay(0, 0, replayRecord, &r);
+    if (!input)
+        unlink(path);
+    if (err || !r.cmp.samples) {
+        fprintf(stderr, "no quaternion in %s: %d\n", input ? input : path, err);
+        return 2;
+    }
+    failed |= report(input ? "trace" : "generated trace", &r.cmp);
+
+    compare_t rnd;
+    unsigned int seed = 1;
+    long q[4], accel[3];
+
+    memset(&rnd, 0, sizeof(rnd));
+    for (int i = 0; i < randomSamples; i++) {
+        randomSample(&seed, q, accel);
+        compare(&rnd, q, accel);
+    }
+    failed |= report("random attitudes", &rnd);
+    printf("  (%llu near gimbal lock, azimuth and roll not compared)\n",
+           (unsigned long long)rnd.gimbal);
+
+    benchmark(randomSamples);
+    return failed;
+}
@@ -25,10 +25,12 @@
 #include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/queue.h>
 #include <linux/input.h>
 
+#include <cutils/properties.h>
 #include <utils/Atomic.h>
 #include <utils/Log.h>
 
@@ -37,6 +39,7 @@
 #include "LightSensor.h"
 #include "ProximitySensor.h"
 #include "HeartRateSensor.h"
+#include "SensorTrace.h"
 
 /*****************************************************************************/
 /* The SENSORS Module */
@@ -119,14 +122,22 @@ struct sensors_poll_context_t {
     // return true if the constructor is completed
     bool isValid() { return mInitialized; };
     int flush(int handle);
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    int registerDirectChannel(const struct sensors_direct_mem_t *mem,
+                              int channelHandle);
+    int configDirectReport(int handle, int channelHandle,
+                           const struct sensors_direct_cfg_t *config);
+#endif
 
 private:
     enum {
         mpl = 0,
         compass,
+        compassCal,
         dmpOrient,
         dmpSign,
         dmpPed,
+        stepCount,
         light,
         proximity,
         heartrate,
@@ -143,6 +154,19 @@ private:
     /* Significant Motion wakelock support */
     bool mSMDWakelockHeld;
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    /* Direct report channels. A sensor reporting to one is kept enabled
+       at the fastest rate anyone asked for, whatever the framework does. */
+    DirectChannel *mDirectChannels[DIRECT_MAX_CHANNELS];
+    uint32_t mActiveMask;       // handles activated by the framework
+    uint32_t mDirectEnabledMask;// handles enabled in MPLSensor
+    int mBatchFlags[NumSensors];
+    int64_t mBatchPeriod[NumSensors];
+    int64_t mBatchTimeout[NumSensors];
+
+    int updateDirectSensor(int handle);
+#endif
+
     int handleToDriver(int handle) const {
         switch (handle) {
             case ID_GY:
@@ -186,6 +210,15 @@ sensors_poll_context_t::sensors_poll_context_t() {
     /* No significant motion events pending yet */
     mSMDWakelockHeld = false;
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    memset(mDirectChannels, 0, sizeof(mDirectChannels));
+    mActiveMask = 0;
+    mDirectEnabledMask = 0;
+    memset(mBatchFlags, 0, sizeof(mBatchFlags));
+    memset(mBatchPeriod, 0, sizeof(mBatchPeriod));
+    memset(mBatchTimeout, 0, sizeof(mBatchTimeout));
+#endif
+
    /* For Vendor-defined Accel Calibration File Load
     * Use the Following Constructor and Pass Your Load Cal File Function
     * 
@@ -195,11 +228,26 @@ sensors_poll_context_t::sensors_poll_context_t() {
     // Initialize pending flush queue
     SIMPLEQ_INIT(&pending_flush_items_head);
 
+    // Record raw and emitted data on request, on debuggable builds only
+    char debuggable[PROPERTY_VALUE_MAX], record[PROPERTY_VALUE_MAX];
+    property_get("ro.debuggable", debuggable, "0");
+    property_get(SENSOR_TRACE_PROPERTY, record, "0");
+    if (!strcmp(debuggable, "1") && !strcmp(record, "1"))
+        SensorTraceWriter::set(SensorTraceWriter::createInDir(SENSOR_TRACE_DIR));
+
     // populate the sensor list
     sensors = LOCAL_SENSORS +
        mplSensor->populateSensorList(&sSensorList[LOCAL_SENSORS],
                sizeof(sSensorList[0]) * (ARRAY_SIZE(sSensorList) - LOCAL_SENSORS));
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    for (int i = LOCAL_SENSORS; i < sensors; i++) {
+        if (MPLSensor::isDirectReportSensor(sSensorList[i].handle))
+            sSensorList[i].flags |= SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                    (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT);
+    }
+#endif
+
     mSensor[mpl] = mplSensor;
     mPollFds[mpl].fd = mSensor[mpl]->getFd();
     mPollFds[mpl].events = POLLIN;
@@ -210,6 +258,11 @@ sensors_poll_context_t::sensors_poll_context_t() {
     mPollFds[compass].events = POLLIN;
     mPollFds[compass].revents = 0;
 
+    mSensor[compassCal] = mplSensor;
+    mPollFds[compassCal].fd = mCompassSensor->getCalibratedFd();
+    mPollFds[compassCal].events = POLLIN;
+    mPollFds[compassCal].revents = 0;
+
     mSensor[dmpOrient] = mplSensor;
     mPollFds[dmpOrient].fd = ((MPLSensor*) mSensor[dmpOrient])->getDmpOrientFd();
     mPollFds[dmpOrient].events = POLLPRI;
@@ -225,6 +278,11 @@ sensors_poll_context_t::sensors_poll_context_t() {
     mPollFds[dmpPed].events = POLLPRI;
     mPollFds[dmpPed].revents = 0;
 
+    mSensor[stepCount] = mplSensor;
+    mPollFds[stepCount].fd = ((MPLSensor*) mSensor[stepCount])->getStepCountTimerFd();
+    mPollFds[stepCount].events = POLLIN;
+    mPollFds[stepCount].revents = 0;
+
     mSensor[light] = new LightSensor();
     mPollFds[light].fd = mSensor[light]->getFd();
     mPollFds[light].events = POLLIN;
@@ -255,10 +313,18 @@ sensors_poll_context_t::sensors_poll_context_t() {
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     FUNC_LOG;
+    SensorTraceWriter *trace = SensorTraceWriter::get();
+    SensorTraceWriter::set(NULL);
+    delete trace;
     for (int i = 0 ; i < numSensorDrivers ; i++) {
         delete mSensor[i];
     }
     delete mCompassSensor;
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    for (int i = 0; i < DIRECT_MAX_CHANNELS; i++) {
+        delete mDirectChannels[i];
+    }
+#endif
     for (int i = 0; i < numFds; i++) {
         close(mPollFds[i].fd);
     }
@@ -270,6 +336,15 @@ int sensors_poll_context_t::activate(int handle, int enabled) {
 
     int index = handleToDriver(handle);
     if (index < 0) return index;
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    if (MPLSensor::isDirectReportSensor(handle)) {
+        if (enabled)
+            mActiveMask |= (1 << handle);
+        else
+            mActiveMask &= ~(1 << handle);
+        return updateDirectSensor(handle);
+    }
+#endif
     int err =  mSensor[index]->enable(handle, enabled);
     return err;
 }
@@ -279,6 +354,13 @@ int sensors_poll_context_t::setDelay(int handle, int64_t ns)
     FUNC_LOG;
     int index = handleToDriver(handle);
     if (index < 0) return index;
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    if (MPLSensor::isDirectReportSensor(handle)) {
+        mBatchPeriod[handle] = ns;
+        if (mDirectEnabledMask & (1 << handle))
+            return updateDirectSensor(handle);
+    }
+#endif
     return mSensor[index]->setDelay(handle, ns);
 }
 
@@ -287,7 +369,8 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
     VHANDLER_LOG;
 
     int nbEvents = 0;
-    int nb, polltime = -1;
+    int nb;
+    sensors_event_t *events = data;
 
     if (mSMDWakelockHeld) {
         mSMDWakelockHeld = false;
@@ -312,11 +395,9 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
     }
     pthread_mutex_unlock(&flush_handles_mutex);
 
-    polltime = ((MPLSensor*) mSensor[mpl])->getStepCountPollTime();
-
     // look for new events
-    nb = poll(mPollFds, numSensorDrivers, polltime);
-    LOGI_IF(0, "poll nb=%d, count=%d, pt=%d", nb, count, polltime);
+    nb = poll(mPollFds, numSensorDrivers, -1);
+    LOGI_IF(0, "poll nb=%d, count=%d", nb, count);
     if (nb > 0) {
         for (int i = 0; count && i < numSensorDrivers; i++) {
             SensorBase* const sensor(mSensor[i]);
@@ -325,7 +406,7 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                 if (i == mpl) {
                     ((MPLSensor*) sensor)->buildMpuEvent();
                     mPollFds[i].revents = 0;
-                } else if (i == compass) {
+                } else if (i == compass || i == compassCal) {
                     ((MPLSensor*) sensor)->buildCompassEvent();
                     mPollFds[i].revents = 0;
                 } else if (i == dmpOrient) {
@@ -350,6 +431,17 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                     count -= nb;
                     nbEvents += nb;
                     data += nb;
+                } else if (i == stepCount) {
+                    nb = ((MPLSensor*) sensor)->readStepCountEvents(data, count);
+                    mPollFds[i].revents = 0;
+                    LOGI_IF(SensorBase::HANDLER_DATA, "sensors_mpl:readStepCount() - "
+                            "nb=%d, count=%d, nbEvents=%d, data->timestamp=%lld, ",
+                            nb, count, nbEvents, data->timestamp);
+                    count -= nb;
+                    nbEvents += nb;
+                    data += nb;
+                    /* nothing for readEvents() if the count did not change */
+                    continue;
                 } else if (i == light || i == proximity) {
                     LOGI_IF(0, "HAL: Light interrupt");
                     nb = sensor->readEvents(data, count);
@@ -376,35 +468,11 @@ int sensors_poll_context_t::pollEvents(sensors_event_t *data, int count)
                 }
             }
         }
-
-        /* to see if any step counter events */
-        if (((MPLSensor*) mSensor[mpl])->hasStepCountPendingEvents() == true) {
-            nb = 0;
-            nb = ((MPLSensor*) mSensor[mpl])->readDmpPedometerEvents(data, count, ID_SC, 0);
-            LOGI_IF(SensorBase::HANDLER_DATA, "sensors_mpl:readStepCount() - "
-                    "nb=%d, count=%d, nbEvents=%d, data->timestamp=%lld, ",
-                    nb, count, nbEvents, data->timestamp);
-            if (nb > 0) {
-                count -= nb;
-                nbEvents += nb;
-                data += nb;
-            }
-        }
-    } else if(nb == 0) {
-        /* to see if any step counter events */
-        if(((MPLSensor*) mSensor[mpl])->hasStepCountPendingEvents() == true) {
-            nb = 0;
-            nb = ((MPLSensor*) mSensor[mpl])->readDmpPedometerEvents(data, count, ID_SC, 0);
-            LOGI_IF(SensorBase::HANDLER_DATA, "sensors_mpl:readStepCount() - "
-                    "nb=%d, count=%d, nbEvents=%d, data->timestamp=%lld, ",
-                    nb, count, nbEvents, data->timestamp);
-            if (nb > 0) {
-                count -= nb;
-                nbEvents += nb;
-                data += nb;
-            }
-        }
     }
+
+    SensorTraceWriter *trace = SensorTraceWriter::get();
+    if (trace && nbEvents > 0)
+        trace->record(SENSOR_TRACE_EVENTS, 0, events, nbEvents * sizeof(*events));
     return nbEvents;
 }
 
@@ -419,9 +487,143 @@ int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns, int6
     FUNC_LOG;
     int index = handleToDriver(handle);
     if (index < 0) return index;
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    if (MPLSensor::isDirectReportSensor(handle)) {
+        mBatchFlags[handle] = flags;
+        mBatchPeriod[handle] = period_ns;
+        mBatchTimeout[handle] = timeout;
+        if (mDirectEnabledMask & (1 << handle))
+            return updateDirectSensor(handle);
+    }
+#endif
     return mSensor[index]->batch(handle, flags, period_ns, timeout);
 }
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+/* Bring the MPL state of a direct report capable sensor in line with what
+   the framework and the direct channels asked for. */
+int sensors_poll_context_t::updateDirectSensor(int handle)
+{
+    MPLSensor *mplSensor = (MPLSensor *) mSensor[mpl];
+    uint32_t bit = 1 << handle;
+    bool active = mActiveMask & bit;
+    int64_t direct = mplSensor->getDirectPeriod(handle);
+    int64_t period = mBatchPeriod[handle];
+    int err = 0;
+
+    mplSensor->setPollOutput(handle, active);
+
+    if (!active && !direct) {
+        if (mDirectEnabledMask & bit)
+            err = mplSensor->enable(handle, 0);
+        mDirectEnabledMask &= ~bit;
+        return err;
+    }
+
+    if (direct && (!active || !period || direct < period))
+        period = direct;
+    err = mplSensor->batch(handle, active ? mBatchFlags[handle] : 0, period,
+                           active ? mBatchTimeout[handle] : 0);
+    if (!err && !(mDirectEnabledMask & bit)) {
+        err = mplSensor->enable(handle, 1);
+        if (!err)
+            mDirectEnabledMask |= bit;
+    }
+    return err;
+}
+
+int sensors_poll_context_t::registerDirectChannel(
+        const struct sensors_direct_mem_t *mem, int channelHandle)
+{
+    FUNC_LOG;
+    MPLSensor *mplSensor = (MPLSensor *) mSensor[mpl];
+    int i;
+
+    if (!mem) {
+        /* unregister */
+        i = channelHandle - 1;
+        if (i < 0 || i >= DIRECT_MAX_CHANNELS || !mDirectChannels[i])
+            return -EINVAL;
+        mplSensor->removeDirectChannel(mDirectChannels[i]);
+        for (int h = 0; h < NumSensors; h++) {
+            if (MPLSensor::isDirectReportSensor(h))
+                updateDirectSensor(h);
+        }
+        delete mDirectChannels[i];
+        mDirectChannels[i] = NULL;
+        return 0;
+    }
+
+    if (mem->type != SENSOR_DIRECT_MEM_TYPE_ASHMEM ||
+            mem->format != SENSOR_DIRECT_FMT_SENSORS_EVENT ||
+            !mem->handle || mem->handle->numFds < 1)
+        return -EINVAL;
+
+    for (i = 0; i < DIRECT_MAX_CHANNELS; i++) {
+        if (!mDirectChannels[i])
+            break;
+    }
+    if (i == DIRECT_MAX_CHANNELS)
+        return -ENOSPC;
+
+    DirectChannel *channel = new DirectChannel(mem->handle->data[0], mem->size);
+    if (!channel->isValid()) {
+        delete channel;
+        return -ENOMEM;
+    }
+    mDirectChannels[i] = channel;
+    return i + 1;
+}
+
+int sensors_poll_context_t::configDirectReport(int handle, int channelHandle,
+        const struct sensors_direct_cfg_t *config)
+{
+    FUNC_LOG;
+    MPLSensor *mplSensor = (MPLSensor *) mSensor[mpl];
+    int i = channelHandle - 1;
+    int64_t period;
+    int err;
+
+    if (i < 0 || i >= DIRECT_MAX_CHANNELS || !mDirectChannels[i] || !config)
+        return -EINVAL;
+
+    switch (config->rate_level) {
+    case SENSOR_DIRECT_RATE_STOP:
+        period = 0;
+        break;
+    case SENSOR_DIRECT_RATE_NORMAL:
+        period = DIRECT_RATE_NORMAL_NS;
+        break;
+    case SENSOR_DIRECT_RATE_FAST:
+        period = DIRECT_RATE_FAST_NS;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    /* handle -1 stops every sensor of the channel */
+    if (handle == -1) {
+        if (period)
+            return -EINVAL;
+        mplSensor->removeDirectChannel(mDirectChannels[i]);
+        for (int h = 0; h < NumSensors; h++) {
+            if (MPLSensor::isDirectReportSensor(h))
+                updateDirectSensor(h);
+        }
+        return 0;
+    }
+
+    /* the token goes into sensors_event_t.sensor and must not be 0 */
+    err = mplSensor->configDirectReport(handle, mDirectChannels[i],
+                                        handle + 1, period);
+    if (!err)
+        err = updateDirectSensor(handle);
+    if (err)
+        return err;
+    return period ? handle + 1 : 0;
+}
+#endif
+
 void inv_pending_flush(int handle) {
     struct handle_entry *the_entry;
     pthread_mutex_lock(&flush_handles_mutex);
@@ -507,6 +709,23 @@ static int poll__flush(struct sensors_poll_device_1 *dev,
     return status;
 }
 
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+static int poll__register_direct_channel(struct sensors_poll_device_1 *dev,
+                      const struct sensors_direct_mem_t *mem, int channel_handle)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->registerDirectChannel(mem, channel_handle);
+}
+
+static int poll__config_direct_report(struct sensors_poll_device_1 *dev,
+                      int sensor_handle, int channel_handle,
+                      const struct sensors_direct_cfg_t *config)
+{
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->configDirectReport(sensor_handle, channel_handle, config);
+}
+#endif
+
 /******************************************************************************/
 
 /** Open a new instance of a sensor device using name */
@@ -526,7 +745,13 @@ static int open_sensors(const struct hw_module_t* module, const char* id,
     memset(&dev->device, 0, sizeof(sensors_poll_device_1));
 
     dev->device.common.tag = HARDWARE_DEVICE_TAG;
+#ifdef SENSORS_DEVICE_API_VERSION_1_4
+    dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_4;
+    dev->device.register_direct_channel = poll__register_direct_channel;
+    dev->device.config_direct_report = poll__config_direct_report;
+#else
     dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_3;
+#endif
     dev->device.flush           = poll__flush;
     dev->device.common.module   = const_cast<hw_module_t*>(module);
     dev->device.common.close    = poll__close;
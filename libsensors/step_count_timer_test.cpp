@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the step count timer (StepCountTimer.h).
+ *
+ * Arms a timerfd the way MPLSensor::updateStepCountTimer() does and counts
+ * how often a poll() on it wakes up, for the step counter enabled at the
+ * framework's rates with and without a report latency, then checks that a
+ * flush() makes the count readable right away and leaves the period alone.
+ */
+
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "StepCountTimer.h"
+
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int check(bool ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+/* wakeups of a poll() on 'fd' for 'duration' ns, as readEvents() sees them */
+static int countWakeups(int fd, int64_t duration, int64_t *first)
+{
+    int64_t start = nowNs(), end = start + duration;
+    int wakeups = 0;
+
+    *first = -1;
+    for (int64_t now = start; now < end; now = nowNs()) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        uint64_t expirations;
+
+        if (poll(&pfd, 1, (int)((end - now + 999999) / 1000000)) <= 0)
+            continue;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        if (*first < 0)
+            *first = nowNs() - start;
+        wakeups++;
+    }
+    return wakeups;
+}
+
+struct scenario_t {
+    const char *name;
+    int64_t pollTime;           /* batch() period, -1 if never called */
+    int64_t latency;            /* batch() timeout */
+};
+
+int main(int argc, char **argv)
+{
+    double seconds = 10;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds per case]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return 2;
+    }
+
+    const scenario_t scenarios[] = {
+        { "enabled, no rate asked", -1, 0 },
+        { "SENSOR_DELAY_NORMAL (200 ms)", 200000000LL, 0 },
+        { "SENSOR_DELAY_FASTEST (5 ms)", 5000000LL, 0 },
+        { "200 ms, 10 s latency", 200000000LL, 10000000000LL },
+        { "5 ms, 60 s latency", 5000000LL, 60000000000LL },
+    };
+    int64_t duration = (int64_t)(seconds * 1e9);
+    int64_t first;
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const scenario_t *s = &scenarios[i];
+        int64_t period = stepCountTimerPeriod(s->pollTime, s->latency);
+
+        armStepCountTimer(fd, period, false);
+        int wakeups = countWakeups(fd, duration, &first);
+        int expected = (int)(duration / period);
+
+        printf("%-32s period %8.3f s: %5d wakeups, %8.2f / s\n", s->name,
+               period / 1e9, wakeups, wakeups / seconds);
+        if (wakeups < expected - 1 || wakeups > expected + 1) {
+            printf("  %d wakeups expected\n", expected);
+            failed = 1;
+        }
+    }
+
+    /* flush() while batched for 10 s: read once right away, then back
+       on the 10 s period */
+    int64_t period = stepCountTimerPeriod(200000000LL, 10000000000LL);
+    armStepCountTimer(fd, period, false);
+    armStepCountTimer(fd, period, true);
+    int wakeups = countWakeups(fd, 2000000000LL, &first);
+    failed |= check(wakeups == 1 && first >= 0 && first < 50000000LL,
+                    "flush reads the count within 50 ms, once");
+
+    armStepCountTimer(fd, 0, false);
+    failed |= check(countWakeups(fd, 500000000LL, &first) == 0,
+                    "disabled step counter never wakes up");
+
+    close(fd);
+    return failed;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of TimestampNormalizer on synthetic clocks.
+ *
+ * A 50 Hz source is batched and drained every 10 s, and the device
+ * suspends for 2 ms, 30 s and 10 min along the way, which moves
+ * CLOCK_BOOTTIME away from CLOCK_MONOTONIC. The source stamps its
+ * samples with CLOCK_BOOTTIME, CLOCK_MONOTONIC or a kernel clock 100 s
+ * ahead of CLOCK_MONOTONIC, and the stamps are mapped back with the
+ * offset the HAL would see at each drain. For each clock it prints the
+ * domain picked, when it was identified and the error against the true
+ * CLOCK_BOOTTIME time, and checks that an identified clock is kept
+ * across the suspends and maps without error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TimestampNormalizer.h"
+
+#define SAMPLE_PERIOD_NS    20000000LL
+#define DRAIN_PERIOD_NS     (10LL * 1000000000LL)
+#define DRAIN_DELAY_NS      100000LL
+#define AWAKE_NS            (900LL * 1000000000LL)
+#define OTHER_CLOCK_NS      (100LL * 1000000000LL)
+/* a drain every 20 ms of samples is at most this late for the newest */
+#define ESTIMATE_MAX_ERROR  (SAMPLE_PERIOD_NS + DRAIN_DELAY_NS)
+
+struct suspend_t {
+    int64_t at;         /* awake time it starts at */
+    int64_t length;
+};
+
+static const suspend_t sSuspends[] = {
+    { 60LL * 1000000000LL, 2000000LL },
+    { 200LL * 1000000000LL, 30LL * 1000000000LL },
+    { 500LL * 1000000000LL, 600LL * 1000000000LL },
+};
+static const int sNumSuspends = sizeof(sSuspends) / sizeof(sSuspends[0]);
+
+enum { SRC_BOOT = 0, SRC_MONO, SRC_OTHER, SRC_NUM };
+static const char *sSourceNames[] = { "boottime", "monotonic", "other" };
+static const char *sDomainNames[] = { "boottime", "monotonic", "estimated" };
+
+struct result_t {
+    int64_t identifiedAt;       /* awake time, -1 if never */
+    int domainAtIdentify;
+    int changesAfter;           /* domain changes once identified */
+    int64_t maxError;           /* once identified, or all along */
+    int64_t maxSettledError;    /* estimated: past the first drain */
+};
+
+static int64_t absNs(int64_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+static void run(int source, result_t *res)
+{
+    TimestampNormalizer clock(TS_DOMAIN_UNKNOWN);
+    int64_t suspended = 0;      /* CLOCK_BOOTTIME - CLOCK_MONOTONIC */
+    int64_t nextSample = 0, nextDrain = DRAIN_PERIOD_NS;
+    int suspend = 0;
+    bool settled = false;
+
+    memset(res, 0, sizeof(*res));
+    res->identifiedAt = -1;
+
+    /* awake time is CLOCK_MONOTONIC */
+    while (nextDrain <= AWAKE_NS) {
+        int64_t drainAt = nextDrain;
+        bool beforeSuspend = false;
+
+        if (suspend < sNumSuspends && sSuspends[suspend].at < drainAt) {
+            /* the driver drains what it has when the device suspends */
+            drainAt = sSuspends[suspend].at;
+            beforeSuspend = true;
+        }
+
+        /* samples taken since the last drain, oldest first */
+        int64_t arrival = drainAt + suspended + DRAIN_DELAY_NS;
+        for (; nextSample <= drainAt; nextSample += SAMPLE_PERIOD_NS) {
+            int64_t boot = nextSample + suspended;
+            int64_t stamp = source == SRC_BOOT ? boot :
+                    source == SRC_MONO ? nextSample :
+                    nextSample + OTHER_CLOCK_NS;
+            int64_t out = clock.toBoottime(stamp, arrival, suspended);
+            int64_t error = absNs(out - boot);
+
+            if (clock.identified()) {
+                if (res->identifiedAt < 0) {
+                    res->identifiedAt = nextSample;
+                    res->domainAtIdentify = clock.domain();
+                } else if (clock.domain() != res->domainAtIdentify) {
+                    res->changesAfter++;
+                }
+            }
+            if (res->identifiedAt >= 0 || source == SRC_OTHER) {
+                if (error > res->maxError)
+                    res->maxError = error;
+            }
+            if (settled && error > res->maxSettledError)
+                res->maxSettledError = error;
+        }
+        settled = true;
+
+        if (beforeSuspend) {
+            suspended += sSuspends[suspend].length;
+            suspend++;
+            settled = false;
+        } else {
+            nextDrain += DRAIN_PERIOD_NS;
+        }
+    }
+}
+
+int main()
+{
+    int failed = 0;
+
+    printf("%-10s %-10s %14s %14s %16s\n", "clock", "picked", "identified s",
+           "max error ms", "settled err ms");
+    for (int source = 0; source < SRC_NUM; source++) {
+        result_t res;
+
+        run(source, &res);
+        char identifiedAt[16] = "-";
+        if (res.identifiedAt >= 0)
+            snprintf(identifiedAt, sizeof(identifiedAt), "%.1f",
+                     res.identifiedAt / 1e9);
+        printf("%-10s %-10s %14s %14.3f %16.3f\n", sSourceNames[source],
+               res.identifiedAt >= 0 ? sDomainNames[res.domainAtIdentify] : "estimated",
+               identifiedAt, res.maxError / 1e6, res.maxSettledError / 1e6);
+
+        if (source == SRC_OTHER) {
+            if (res.identifiedAt >= 0 || res.maxSettledError > ESTIMATE_MAX_ERROR) {
+                printf("  estimated offset off by more than %.3f ms\n",
+                       ESTIMATE_MAX_ERROR / 1e6);
+                failed = 1;
+            }
+            continue;
+        }
+        if (res.identifiedAt < 0 || res.domainAtIdentify != source) {
+            printf("  %s clock not identified\n", sSourceNames[source]);
+            failed = 1;
+        } else if (res.changesAfter || res.maxError) {
+            printf("  %d domain changes, %.3f ms error once identified\n",
+                   res.changesAfter, res.maxError / 1e6);
+            failed = 1;
+        }
+    }
+    return failed;
+}
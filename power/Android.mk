@@ -26,4 +26,44 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+# setInteractive timing with slow input nodes, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := power_interactive_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := interactive_test.c
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# recovery of a profile switch that failed half way, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := power_profile_retry_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := profile_retry_test.c
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# boostpulse once per window and the launch and vsync floors, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := power_boost_hints_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := boost_hints_test.c
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# writes and their order for every profile transition, on a fake sysfs
+include $(CLEAR_VARS)
+LOCAL_MODULE := power_profile_transitions_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := profile_transitions_test.c
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
 endif # TARGET_POWERHAL_VARIANT == exynos3
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of the boost hints, on a fake sysfs.
+ *
+ * INTERACTION must write boostpulse once per boost window however many
+ * hints come in it, not at all while the screen is off or the profile
+ * takes no boosts, and again on the next hint after a write that failed.
+ * LAUNCH and VSYNC must raise cpufreq_min_limit while they are on, within
+ * the ceiling of the profile and of the screen off policy, and hand it
+ * back to the profile floor once both are done.
+ */
+
+#include "fake_sysfs.h"
+
+#define MS              1000000LL
+#define FLOOD_NS        (500 * MS)
+#define FLOOD_PERIOD_US 1000
+
+static int check(int ok, const char *what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int node_is_int(int i, int value)
+{
+    char buf[16], want[16];
+
+    snprintf(want, sizeof(want), "%d", value);
+    return !strcmp(fake_sysfs_read(i, buf, sizeof(buf)), want);
+}
+
+static void hint(power_hint_t hint, int on)
+{
+    power_hint(NULL, hint, &on);
+}
+
+static void set_profile(int profile)
+{
+    power_hint(NULL, POWER_HINT_SET_PROFILE, &profile);
+}
+
+/* past the boost window of the last pulse */
+static void window_passes(void)
+{
+    usleep(BOOSTPULSE_DURATION_NS / 1000 + 10000);
+}
+
+static unsigned int boosts(void)
+{
+    return fake_sysfs_writes(FAKE_BOOSTPULSE);
+}
+
+static int test_boostpulse(void)
+{
+    unsigned int before, hints = 0;
+    int64_t start;
+    int failed = 0;
+
+    before = boosts();
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before + 1,
+                    "one pulse for two hints in a window");
+    window_passes();
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before + 2, "a pulse once the window is over");
+
+    /* a touch stream: one hint per ms */
+    window_passes();
+    before = boosts();
+    start = monotonic_ns();
+    while (monotonic_ns() - start < FLOOD_NS) {
+        power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+        hints++;
+        usleep(FLOOD_PERIOD_US);
+    }
+    printf("%u hints in %lld ms: %u boostpulse writes\n", hints,
+           FLOOD_NS / MS, boosts() - before);
+    failed |= check(boosts() - before <= FLOOD_NS / BOOSTPULSE_DURATION_NS + 1,
+                    "a hint flood costs one write per window");
+
+    /* a pulse that did not go through does not open a window */
+    window_passes();
+    fake_sysfs_set_fail(FAKE_BOOSTPULSE, 1);
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    fake_sysfs_set_fail(FAKE_BOOSTPULSE, 0);
+    before = boosts();
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before + 1,
+                    "the next hint pulses after a failed write");
+
+    window_passes();
+    before = boosts();
+    power_set_interactive(NULL, 0);
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before, "no pulse with the screen off");
+    power_set_interactive(NULL, 1);
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before + 1, "pulses again with the screen on");
+
+    window_passes();
+    set_profile(PROFILE_POWER_SAVE);
+    before = boosts();
+    power_hint(NULL, POWER_HINT_INTERACTION, NULL);
+    failed |= check(boosts() == before, "no pulse in the power save profile");
+    set_profile(PROFILE_BALANCED);
+
+    return failed;
+}
+
+static int test_min_freq(void)
+{
+    int failed = 0;
+
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, MIN_FREQ_NONE),
+                    "balanced: no floor");
+    hint(POWER_HINT_LAUNCH, 1);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, LAUNCH_MIN_FREQ),
+                    "launch raises the floor");
+    hint(POWER_HINT_VSYNC, 1);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, LAUNCH_MIN_FREQ),
+                    "vsync under a launch keeps the launch floor");
+    hint(POWER_HINT_LAUNCH, 0);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, VSYNC_MIN_FREQ),
+                    "launch done: back to the vsync floor");
+    hint(POWER_HINT_VSYNC, 0);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, MIN_FREQ_NONE),
+                    "vsync done: the floor handed back");
+
+    set_profile(PROFILE_HIGH_PERFORMANCE);
+    hint(POWER_HINT_LAUNCH, 1);
+    hint(POWER_HINT_LAUNCH, 0);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT,
+                                profiles[PROFILE_HIGH_PERFORMANCE].cpu_min),
+                    "high performance: back to the profile floor");
+
+    /* the sustained profile caps at its fixed point */
+    hint(POWER_HINT_SUSTAINED_PERFORMANCE, 1);
+    hint(POWER_HINT_LAUNCH, 1);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT,
+                                profiles[PROFILE_SUSTAINED_PERFORMANCE].cpu_max),
+                    "sustained: launch clamped to the ceiling");
+    hint(POWER_HINT_LAUNCH, 0);
+    hint(POWER_HINT_SUSTAINED_PERFORMANCE, 0);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT,
+                                profiles[PROFILE_HIGH_PERFORMANCE].cpu_min) &&
+                    node_is_int(FAKE_MAX_LIMIT, MAX_FREQ_NONE),
+                    "sustained off: high performance limits back");
+    set_profile(PROFILE_BALANCED);
+
+    power_set_interactive(NULL, 0);
+    hint(POWER_HINT_LAUNCH, 1);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, SCREEN_OFF_MAX_FREQ),
+                    "screen off: launch clamped to the ceiling");
+    power_set_interactive(NULL, 1);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, LAUNCH_MIN_FREQ) &&
+                    node_is_int(FAKE_MAX_LIMIT, MAX_FREQ_NONE),
+                    "screen on: the launch floor in full");
+    hint(POWER_HINT_LAUNCH, 0);
+    failed |= check(node_is_int(FAKE_MIN_LIMIT, MIN_FREQ_NONE),
+                    "launch done: the floor handed back");
+
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    power_init(NULL);
+    power_set_interactive(NULL, 1);
+
+    failed |= test_boostpulse();
+    failed |= test_min_freq();
+
+    fake_sysfs_cleanup();
+    return failed;
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake sysfs for the power HAL host tests. Including this builds power.c
+ * in with its writes going through fake_pwrite(), which can make the
+ * write of any node slow or fail. fake_sysfs_setup() creates every node
+ * as a plain file under a temporary directory and points the HAL at it,
+ * before power_init() opens any of them.
+ */
+
+#ifndef FAKE_SYSFS_H
+#define FAKE_SYSFS_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+ssize_t fake_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+#define pwrite fake_pwrite
+#include "power.c"
+#undef pwrite
+
+struct fake_node {
+    struct sysfs_node *node;
+    char path[PATH_MAX];
+    int delay_us;           /* every write takes this long */
+    int fail;               /* writes fail with EIO */
+    unsigned int writes;    /* writes that reached the file */
+    unsigned int seq;       /* order of the last of them, among all nodes */
+};
+
+enum {
+    FAKE_TOUCHSCREEN = 0,
+    FAKE_TOUCHKEY,
+    FAKE_BATT_LCD,
+    FAKE_BOOSTPULSE,
+    FAKE_MIN_LIMIT,
+    FAKE_MAX_LIMIT,
+    FAKE_GPU_MIN,
+    FAKE_GPU_MAX,
+    FAKE_DM_HOTPLUG,
+    FAKE_TUNABLES,
+    FAKE_COUNT = FAKE_TUNABLES + TUNABLE_COUNT,
+};
+
+static char g_fake_root[] = "/tmp/power_sysfs_XXXXXX";
+static struct fake_node g_fake_nodes[FAKE_COUNT];
+static pthread_mutex_t g_fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_fake_seq;
+
+static inline struct sysfs_node *fake_hal_node(int i)
+{
+    switch (i) {
+    case FAKE_TOUCHSCREEN: return &input_workers[INPUT_TOUCHSCREEN].node;
+    case FAKE_TOUCHKEY: return &input_workers[INPUT_TOUCHKEY].node;
+    case FAKE_BATT_LCD: return &input_workers[INPUT_BATT_LCD].node;
+    case FAKE_BOOSTPULSE: return &boostpulse_node;
+    case FAKE_MIN_LIMIT: return &min_limit_node;
+    case FAKE_MAX_LIMIT: return &max_limit_node;
+    case FAKE_GPU_MIN: return &gpu_min_node;
+    case FAKE_GPU_MAX: return &gpu_max_node;
+    case FAKE_DM_HOTPLUG: return &dm_hotplug_node;
+    default: return &tunable_nodes[i - FAKE_TUNABLES];
+    }
+}
+
+static inline void fake_sysfs_mkdirs(char *path)
+{
+    char *slash;
+
+    for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+}
+
+static inline int fake_sysfs_setup(void)
+{
+    int i, fd;
+
+    if (!mkdtemp(g_fake_root))
+        return -errno;
+
+    for (i = 0; i < FAKE_COUNT; i++) {
+        struct fake_node *f = &g_fake_nodes[i];
+
+        f->node = fake_hal_node(i);
+        snprintf(f->path, sizeof(f->path), "%s%s", g_fake_root, f->node->path);
+        fake_sysfs_mkdirs(f->path);
+        fd = open(f->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return -errno;
+        close(fd);
+        f->node->path = f->path;
+    }
+    return 0;
+}
+
+static inline struct fake_node *fake_node_of_fd(int fd)
+{
+    int i;
+
+    for (i = 0; i < FAKE_COUNT; i++) {
+        if (g_fake_nodes[i].node->fd == fd)
+            return &g_fake_nodes[i];
+    }
+    return NULL;
+}
+
+ssize_t fake_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    struct fake_node *f;
+    int delay_us = 0, fail = 0;
+    char value[64];
+
+    pthread_mutex_lock(&g_fake_lock);
+    f = fake_node_of_fd(fd);
+    if (f) {
+        delay_us = f->delay_us;
+        fail = f->fail;
+    }
+    pthread_mutex_unlock(&g_fake_lock);
+
+    if (delay_us)
+        usleep(delay_us);
+    if (fail) {
+        errno = EIO;
+        return -1;
+    }
+
+    /* a sysfs attribute holds the last value, not what was there before */
+    if (count >= sizeof(value))
+        count = sizeof(value) - 1;
+    memcpy(value, buf, count);
+    value[count++] = '\n';
+    if (ftruncate(fd, 0) < 0)
+        return -1;
+
+    pthread_mutex_lock(&g_fake_lock);
+    if (f) {
+        f->writes++;
+        f->seq = ++g_fake_seq;
+    }
+    pthread_mutex_unlock(&g_fake_lock);
+    return pwrite(fd, value, count, offset) < 0 ? -1 : (ssize_t)count - 1;
+}
+
+static inline void fake_sysfs_set_delay(int i, int delay_us)
+{
+    pthread_mutex_lock(&g_fake_lock);
+    g_fake_nodes[i].delay_us = delay_us;
+    pthread_mutex_unlock(&g_fake_lock);
+}
+
+static inline void fake_sysfs_set_fail(int i, int fail)
+{
+    pthread_mutex_lock(&g_fake_lock);
+    g_fake_nodes[i].fail = fail;
+    pthread_mutex_unlock(&g_fake_lock);
+}
+
+static inline unsigned int fake_sysfs_writes(int i)
+{
+    unsigned int writes;
+
+    pthread_mutex_lock(&g_fake_lock);
+    writes = g_fake_nodes[i].writes;
+    pthread_mutex_unlock(&g_fake_lock);
+    return writes;
+}
+
+/* When node 'i' was last written: a later write has a higher number. */
+static inline unsigned int fake_sysfs_seq(int i)
+{
+    unsigned int seq;
+
+    pthread_mutex_lock(&g_fake_lock);
+    seq = g_fake_nodes[i].seq;
+    pthread_mutex_unlock(&g_fake_lock);
+    return seq;
+}
+
+/* Puts 'value' in the node, as the kernel had it at boot. */
+static inline int fake_sysfs_preset(int i, const char *value)
+{
+    int fd = open(g_fake_nodes[i].path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    int err = 0;
+
+    if (fd < 0)
+        return -errno;
+    if (write(fd, value, strlen(value)) < 0 || write(fd, "\n", 1) < 0)
+        err = -errno;
+    close(fd);
+    return err;
+}
+
+/* The value in the node, "" if it was never written. */
+static inline const char *fake_sysfs_read(int i, char *buf, size_t len)
+{
+    int fd = open(g_fake_nodes[i].path, O_RDONLY | O_CLOEXEC);
+    ssize_t n = fd < 0 ? -1 : read(fd, buf, len - 1);
+
+    if (fd >= 0)
+        close(fd);
+    buf[n < 0 ? 0 : n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return buf;
+}
+
+/* Removes the nodes and the directories made for them. */
+static inline void fake_sysfs_cleanup(void)
+{
+    size_t root = strlen(g_fake_root);
+    char *slash;
+    int i;
+
+    for (i = 0; i < FAKE_COUNT; i++) {
+        char *path = g_fake_nodes[i].path;
+
+        unlink(path);
+        while ((slash = strrchr(path, '/')) && (size_t)(slash - path) > root) {
+            *slash = '\0';
+            rmdir(path);
+        }
+    }
+    rmdir(g_fake_root);
+}
+
+#endif  /* FAKE_SYSFS_H */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of setInteractive on a fake sysfs.
+ *
+ * The touchscreen, touchkey and battery lcd nodes take 40, 8 and 3 ms to
+ * write, like a slow touchscreen resume. For screen on and screen off it
+ * prints how long setInteractive took and when the last input node was
+ * set. Screen off must not return before all three nodes are off. Then
+ * the screen is toggled every millisecond, and every return from screen
+ * off must again find the nodes off, and the last state must stick.
+ */
+
+#include "fake_sysfs.h"
+
+#define TOGGLES     101
+
+static const int g_inputs[INPUT_COUNT] = {
+    FAKE_TOUCHSCREEN, FAKE_TOUCHKEY, FAKE_BATT_LCD,
+};
+static const int g_delays_us[INPUT_COUNT] = { 40000, 8000, 3000 };
+
+/* Input nodes not holding 'on'. */
+static int inputs_not_at(int on)
+{
+    char buf[16];
+    int i, wrong = 0;
+
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (atoi(fake_sysfs_read(g_inputs[i], buf, sizeof(buf))) != on)
+            wrong++;
+    }
+    return wrong;
+}
+
+/* Calls setInteractive, returns how long it took and when the inputs
+   held the state, in us. */
+static void measure(int on, double *call_us, double *done_us, int *wrong)
+{
+    int64_t start = monotonic_ns(), now;
+
+    power_set_interactive(NULL, on);
+    now = monotonic_ns();
+    *call_us = (now - start) / 1000.0;
+    *wrong = inputs_not_at(on);
+    while (inputs_not_at(on) && monotonic_ns() - start < 1000000000LL)
+        usleep(100);
+    *done_us = (monotonic_ns() - start) / 1000.0;
+}
+
+int main(void)
+{
+    double call_us, done_us;
+    int i, wrong, failed = 0, late = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    /* the screen is on at boot */
+    for (i = 0; i < INPUT_COUNT; i++) {
+        fake_sysfs_preset(g_inputs[i], "1");
+        fake_sysfs_set_delay(g_inputs[i], g_delays_us[i]);
+    }
+    power_init(NULL);
+
+    for (i = 0; i < 2; i++) {
+        int on = i == 0 ? 0 : 1;
+
+        measure(on, &call_us, &done_us, &wrong);
+        printf("screen %-3s: setInteractive took %7.2f ms, inputs set after "
+               "%6.2f ms, %d not set on return\n", on ? "on" : "off",
+               call_us / 1000, done_us / 1000, wrong);
+        if (!on && wrong) {
+            printf("  screen off returned before the inputs were off\n");
+            failed = 1;
+        }
+    }
+
+    for (i = 0; i < TOGGLES; i++) {
+        int on = i % 2;
+
+        power_set_interactive(NULL, on);
+        if (!on && inputs_not_at(0))
+            late++;
+        usleep(1000);
+    }
+    measure(0, &call_us, &done_us, &wrong);
+    printf("%d toggles 1 ms apart: %d screen offs returned early, final "
+           "state %s\n", TOGGLES, late, wrong ? "wrong" : "off");
+    if (late || wrong)
+        failed = 1;
+
+    fake_sysfs_cleanup();
+    return failed;
+}
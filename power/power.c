@@ -14,7 +14,12 @@
  * limitations under the License.
  */
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -29,44 +34,631 @@
 #define TOUCHSCREEN_POWER "/sys/class/sec/tsp/input/enabled"
 #define BATT_LCD_POWER "/sys/class/power_supply/battery/lcd"
 
-static void sysfs_write(char *path, char *s) {
+#define INTERACTIVE_PATH "/sys/devices/system/cpu/cpufreq/interactive/"
+#define BOOSTPULSE_PATH INTERACTIVE_PATH "boostpulse"
+#define CPUFREQ_MIN_LIMIT "/sys/power/cpufreq_min_limit"
+#define CPUFREQ_MAX_LIMIT "/sys/power/cpufreq_max_limit"
+#define GPU_MIN_FREQ "/sys/module/mali/parameters/mali_min_freq"
+#define GPU_MAX_FREQ "/sys/module/mali/parameters/mali_max_freq"
+#define DM_HOTPLUG "/sys/power/enable_dm_hotplug"
+
+/* boostpulse_duration as set by init.universal3470.rc; a pulse while the
+   previous one is still running would not change anything */
+#define BOOSTPULSE_DURATION_NS (100000 * 1000LL)
+
+/* cpufreq_min_limit floors while an app launches and while the framework
+   wants vsync (animations); -1 hands the floor back to the governor */
+#define LAUNCH_MIN_FREQ 1300000
+#define VSYNC_MIN_FREQ 900000
+#define MIN_FREQ_NONE -1
+#define MAX_FREQ_NONE -1
+
+/* while the screen is off the CPUs are capped, the governor samples less
+   often and idle CPUs are left alone longer, and the kernel may take
+   cores offline */
+#define SCREEN_OFF_MAX_FREQ 800000
+#define SCREEN_OFF_TIMER_RATE "50000"
+#define SCREEN_OFF_TIMER_SLACK "1000000"
+
+/* a profile transition that failed half way is applied again from a
+   timer, after 1 s and then backing off, rather than staying half done
+   until the next hint, which may be long coming with the screen off;
+   after the last try it is left to the next hint or screen change */
+#define PROFILE_RETRY_MIN_NS (1000 * 1000000LL)
+#define PROFILE_RETRY_TRIES 7
+
+enum {
+    MIN_FREQ_LAUNCH = 0,
+    MIN_FREQ_VSYNC,
+    MIN_FREQ_PROFILE,
+    MIN_FREQ_REQUESTS,
+};
+
+enum {
+    MAX_FREQ_PROFILE = 0,
+    MAX_FREQ_SCREEN_OFF,
+    MAX_FREQ_REQUESTS,
+};
+
+/* Profiles for POWER_HINT_SET_PROFILE, plus the internal ones the low
+   power and sustained performance hints switch to */
+enum {
+    PROFILE_POWER_SAVE = 0,
+    PROFILE_BALANCED,
+    PROFILE_HIGH_PERFORMANCE,
+    PROFILE_MAX,
+    PROFILE_SUSTAINED_PERFORMANCE = PROFILE_MAX,
+    PROFILE_COUNT,
+};
+
+/* interactive governor tunables owned by the profiles, in write order */
+enum {
+    TUNABLE_TIMER_RATE = 0,
+    TUNABLE_TIMER_SLACK,
+    TUNABLE_MIN_SAMPLE_TIME,
+    TUNABLE_HISPEED_FREQ,
+    TUNABLE_GO_HISPEED_LOAD,
+    TUNABLE_TARGET_LOADS,
+    TUNABLE_ABOVE_HISPEED_DELAY,
+    TUNABLE_COUNT,
+};
+
+struct power_profile {
+    const char *name;
+    const char *tunables[TUNABLE_COUNT];
+    int cpu_min, cpu_max;       /* kHz, -1 for no limit */
+    int gpu_min, gpu_max;       /* MHz, the Mali DVFS range */
+    int boost;                  /* honour interaction boosts */
+};
+
+/* Balanced is what init.universal3470.rc sets up at boot */
+static const struct power_profile profiles[PROFILE_COUNT] = {
+    [PROFILE_POWER_SAVE] = {
+        "power save",
+        { "50000", "400000", "20000", "600000", "99", "90", "79000" },
+        MIN_FREQ_NONE, 1000000, 160, 266, 0,
+    },
+    [PROFILE_BALANCED] = {
+        "balanced",
+        { "20000", "200000", "39000", "900000", "99",
+          "80 900000:93 1300000:98", "39000 1300000:79000" },
+        MIN_FREQ_NONE, MAX_FREQ_NONE, 160, 450, 1,
+    },
+    [PROFILE_HIGH_PERFORMANCE] = {
+        "high performance",
+        { "20000", "80000", "79000", "1300000", "85", "70", "19000" },
+        900000, MAX_FREQ_NONE, 340, 450, 1,
+    },
+    [PROFILE_SUSTAINED_PERFORMANCE] = {
+        /* a fixed point the device can hold without throttling */
+        "sustained performance",
+        { "20000", "200000", "39000", "1000000", "99", "90", "39000" },
+        1000000, 1000000, 340, 340, 0,
+    },
+};
+
+/* sysfs nodes written on hints are kept open */
+struct sysfs_node {
+    const char *path;
+    int fd;
+    int warned;
+    char last[32];      /* value written by sysfs_node_set, "" if unknown */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sysfs_node boostpulse_node = { BOOSTPULSE_PATH, -1, 0, "" };
+static struct sysfs_node min_limit_node = { CPUFREQ_MIN_LIMIT, -1, 0, "" };
+static struct sysfs_node max_limit_node = { CPUFREQ_MAX_LIMIT, -1, 0, "" };
+static struct sysfs_node gpu_min_node = { GPU_MIN_FREQ, -1, 0, "" };
+static struct sysfs_node gpu_max_node = { GPU_MAX_FREQ, -1, 0, "" };
+static struct sysfs_node dm_hotplug_node = { DM_HOTPLUG, -1, 0, "" };
+static struct sysfs_node tunable_nodes[TUNABLE_COUNT] = {
+    [TUNABLE_TIMER_RATE] = { INTERACTIVE_PATH "timer_rate", -1, 0, "" },
+    [TUNABLE_TIMER_SLACK] = { INTERACTIVE_PATH "timer_slack", -1, 0, "" },
+    [TUNABLE_MIN_SAMPLE_TIME] = { INTERACTIVE_PATH "min_sample_time", -1, 0, "" },
+    [TUNABLE_HISPEED_FREQ] = { INTERACTIVE_PATH "hispeed_freq", -1, 0, "" },
+    [TUNABLE_GO_HISPEED_LOAD] = { INTERACTIVE_PATH "go_hispeed_load", -1, 0, "" },
+    [TUNABLE_TARGET_LOADS] = { INTERACTIVE_PATH "target_loads", -1, 0, "" },
+    [TUNABLE_ABOVE_HISPEED_DELAY] = { INTERACTIVE_PATH "above_hispeed_delay", -1, 0, "" },
+};
+static int64_t last_boostpulse;
+
+/*
+ * The input devices are switched by one worker thread each, so a slow
+ * touchscreen does not hold up the others. Each worker writes the newest
+ * state it was asked for. Screen on returns without waiting for them;
+ * screen off waits until they are done, so the devices are off before
+ * the framework drops the wakelock it holds across the call.
+ */
+enum {
+    INPUT_TOUCHSCREEN = 0,
+    INPUT_TOUCHKEY,
+    INPUT_BATT_LCD,
+    INPUT_COUNT,
+};
+
+struct input_worker {
+    struct sysfs_node node;
+    pthread_cond_t cond;
+    int started;
+    int pending;        /* state to write, -1 for none */
+    int busy;           /* writing, with input_lock dropped */
+};
+
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t input_done = PTHREAD_COND_INITIALIZER;
+static struct input_worker input_workers[INPUT_COUNT] = {
+    [INPUT_TOUCHSCREEN] = {
+        { TOUCHSCREEN_POWER, -1, 0, "" }, PTHREAD_COND_INITIALIZER, 0, -1, 0,
+    },
+    [INPUT_TOUCHKEY] = {
+        { TOUCHKEY_POWER, -1, 0, "" }, PTHREAD_COND_INITIALIZER, 0, -1, 0,
+    },
+    [INPUT_BATT_LCD] = {
+        { BATT_LCD_POWER, -1, 0, "" }, PTHREAD_COND_INITIALIZER, 0, -1, 0,
+    },
+};
+static int min_freq_requests[MIN_FREQ_REQUESTS] = {
+    [MIN_FREQ_LAUNCH] = MIN_FREQ_NONE,
+    [MIN_FREQ_VSYNC] = MIN_FREQ_NONE,
+    [MIN_FREQ_PROFILE] = MIN_FREQ_NONE,
+};
+static int max_freq_requests[MAX_FREQ_REQUESTS] = {
+    [MAX_FREQ_PROFILE] = MAX_FREQ_NONE,
+    [MAX_FREQ_SCREEN_OFF] = MAX_FREQ_NONE,
+};
+static int min_freq_applied = MIN_FREQ_NONE;
+static int max_freq_applied = MAX_FREQ_NONE;
+static int user_profile = PROFILE_BALANCED;
+static int low_power;
+static int sustained_performance;
+static int screen_off;
+static int current_profile = -1;
+static int current_screen_off;
+static int profile_dirty;      /* some values of current_profile not set */
+static unsigned int failed_transitions; /* new targets that failed */
+static pthread_cond_t retry_cond;
+static int retry_started;
+
+/* Writes to a node that stays open. The interactive governor only creates
+   its nodes once init selects it, after boot has completed, and removes
+   them when it is switched away, so the node is (re)opened on demand. */
+static int sysfs_node_write(struct sysfs_node *node, const char *s)
+{
     char buf[80];
-    int len;
-    int fd = open(path, O_WRONLY);
+    int err;
 
-    if (fd < 0) {
+    if (node->fd < 0) {
+        node->fd = open(node->path, O_WRONLY | O_CLOEXEC);
+        if (node->fd < 0) {
+            err = -errno;
+            if (!node->warned) {
+                strerror_r(errno, buf, sizeof(buf));
+                ALOGE("Error opening %s: %s\n", node->path, buf);
+                node->warned = 1;
+            }
+            return err;
+        }
+        node->warned = 0;
+    }
+
+    if (pwrite(node->fd, s, strlen(s), 0) < 0) {
+        err = -errno;
         strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error opening %s: %s\n", path, buf);
+        ALOGE("Error writing to %s: %s\n", node->path, buf);
+        close(node->fd);
+        node->fd = -1;
+        return err;
+    }
+
+    return 0;
+}
+
+/* Writes 'value' unless the node already holds it. */
+static int sysfs_node_set(struct sysfs_node *node, const char *value)
+{
+    int err;
+
+    if (!strcmp(node->last, value))
+        return 0;
+
+    err = sysfs_node_write(node, value);
+    if (err || strlen(value) >= sizeof(node->last))
+        node->last[0] = '\0';
+    else
+        strcpy(node->last, value);
+
+    return err;
+}
+
+static int sysfs_node_set_int(struct sysfs_node *node, int value)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%d", value);
+    return sysfs_node_set(node, buf);
+}
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Called without input_lock held, by the worker of 'w' only. */
+static void input_write(struct input_worker *w, int on)
+{
+    const char *value = on ? "1" : "0";
+    int64_t start;
+
+    if (!strcmp(w->node.last, value))
         return;
+
+    start = monotonic_ns();
+    sysfs_node_set(&w->node, value);
+    ALOGD("%s: %s %s took %lld us", __func__, w->node.path, value,
+          (long long)(monotonic_ns() - start) / 1000);
+}
+
+static void *input_thread(void *arg)
+{
+    struct input_worker *w = arg;
+    int on;
+
+    pthread_mutex_lock(&input_lock);
+    for (;;) {
+        while (w->pending < 0)
+            pthread_cond_wait(&w->cond, &input_lock);
+        on = w->pending;
+        w->pending = -1;
+        w->busy = 1;
+        pthread_mutex_unlock(&input_lock);
+
+        input_write(w, on);
+
+        pthread_mutex_lock(&input_lock);
+        w->busy = 0;
+        if (w->pending < 0)
+            pthread_cond_broadcast(&input_done);
     }
 
-    len = write(fd, s, strlen(s));
-    if (len < 0) {
-        strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error writing to %s: %s\n", path, buf);
+    return NULL;
+}
+
+static void start_input_workers(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < INPUT_COUNT; i++) {
+        struct input_worker *w = &input_workers[i];
+
+        /* open now, so that screen on does not pay for it */
+        w->node.fd = open(w->node.path, O_WRONLY | O_CLOEXEC);
+        if (pthread_create(&thread, &attr, input_thread, w))
+            ALOGE("Error starting the worker for %s, writing it inline\n",
+                  w->node.path);
+        else
+            w->started = 1;
     }
+    pthread_attr_destroy(&attr);
+}
 
-    close(fd);
+static void update_profile(void);
+
+/* Waits with lock held until 'deadline' (CLOCK_MONOTONIC), or until
+   another target fails and the backoff starts over. */
+static void retry_wait(int64_t deadline, unsigned int seen)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (failed_transitions == seen &&
+            pthread_cond_timedwait(&retry_cond, &lock, &ts) != ETIMEDOUT)
+        ;
+}
+
+static void *retry_thread(void *arg)
+{
+    unsigned int seen;
+    int64_t delay;
+    int tries;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        seen = failed_transitions;
+        delay = PROFILE_RETRY_MIN_NS;
+        for (tries = 0; profile_dirty && tries < PROFILE_RETRY_TRIES; tries++) {
+            retry_wait(monotonic_ns() + delay, seen);
+            if (failed_transitions != seen)
+                break;
+            if (profile_dirty)
+                update_profile();
+            delay *= 2;
+        }
+        if (failed_transitions != seen)
+            continue;
+
+        if (profile_dirty)
+            ALOGW("%s: profile still not applied, waiting for the next hint",
+                  __func__);
+        while (failed_transitions == seen)
+            pthread_cond_wait(&retry_cond, &lock);
+    }
+
+    return NULL;
+}
+
+static void start_retry_thread(void)
+{
+    pthread_condattr_t cond_attr;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&retry_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_mutex_lock(&lock);
+    if (pthread_create(&thread, &attr, retry_thread, NULL))
+        ALOGE("Error starting the profile retry thread, retrying on hints only\n");
+    else
+        retry_started = 1;
+    pthread_mutex_unlock(&lock);
+    pthread_attr_destroy(&attr);
 }
 
 static void power_init(struct power_module *module)
 {
+    pthread_mutex_lock(&lock);
+    sysfs_node_set(&min_limit_node, "-1");
+    sysfs_node_set(&max_limit_node, "-1");
+    pthread_mutex_unlock(&lock);
+
+    start_input_workers();
+    start_retry_thread();
+}
+
+/* Called with lock held. A flood of touch events costs one write per
+   boost window. */
+static void boostpulse(void)
+{
+    int64_t now = monotonic_ns();
+
+    if (last_boostpulse && now - last_boostpulse < BOOSTPULSE_DURATION_NS)
+        return;
+
+    if (!sysfs_node_write(&boostpulse_node, "1"))
+        last_boostpulse = now;
+}
+
+/* Called with lock held. The highest floor and the lowest ceiling
+   requested win; a floor above the ceiling is clamped to it. The nodes
+   are only written when the result changes, in the order that keeps the
+   floor at or below the ceiling in between. */
+static int apply_freq_limits(void)
+{
+    int i, min_freq = MIN_FREQ_NONE, max_freq = MAX_FREQ_NONE;
+    int lowering;
+
+    for (i = 0; i < MIN_FREQ_REQUESTS; i++) {
+        if (min_freq_requests[i] > min_freq)
+            min_freq = min_freq_requests[i];
+    }
+    for (i = 0; i < MAX_FREQ_REQUESTS; i++) {
+        if (max_freq_requests[i] != MAX_FREQ_NONE &&
+                (max_freq == MAX_FREQ_NONE || max_freq_requests[i] < max_freq))
+            max_freq = max_freq_requests[i];
+    }
+    if (max_freq != MAX_FREQ_NONE && min_freq > max_freq)
+        min_freq = max_freq;
+
+    lowering = max_freq != MAX_FREQ_NONE &&
+            (max_freq_applied == MAX_FREQ_NONE || max_freq < max_freq_applied);
+
+    if (lowering && min_freq != min_freq_applied &&
+            !sysfs_node_set_int(&min_limit_node, min_freq))
+        min_freq_applied = min_freq;
+    if (max_freq != max_freq_applied &&
+            !sysfs_node_set_int(&max_limit_node, max_freq))
+        max_freq_applied = max_freq;
+    if (min_freq != min_freq_applied &&
+            !sysfs_node_set_int(&min_limit_node, min_freq))
+        min_freq_applied = min_freq;
+
+    ALOGV("%s: cpufreq limits %d..%d", __func__, min_freq_applied,
+          max_freq_applied);
+    return min_freq == min_freq_applied && max_freq == max_freq_applied ?
+            0 : -EAGAIN;
+}
+
+static void request_min_freq(int request, int freq)
+{
+    min_freq_requests[request] = freq;
+    apply_freq_limits();
+}
+
+/* Called with lock held. The DM hotplug node is optional, a kernel
+   without it just keeps all cores online. */
+static int set_dm_hotplug(int on)
+{
+    int err = sysfs_node_set(&dm_hotplug_node, on ? "1" : "0");
+
+    return err == -ENOENT ? 0 : err;
+}
+
+/* Called with lock held. Switches to the profile the hints and the user
+   selection add up to, with the screen off policy on top, writing only
+   the values that differ. Every call works out the whole target state
+   again, so values that could not be written, e.g. before the governor
+   is up, are retried from the retry thread and on the next hint or
+   screen change, and a transition that failed half way cannot stick. */
+static void update_profile(void)
+{
+    const struct power_profile *p;
+    const char *value;
+    int profile = user_profile, i, err = 0;
+
+    if (sustained_performance)
+        profile = PROFILE_SUSTAINED_PERFORMANCE;
+    else if (low_power)
+        profile = PROFILE_POWER_SAVE;
+
+    if (profile == current_profile && screen_off == current_screen_off &&
+            !profile_dirty)
+        return;
+    p = &profiles[profile];
+    if (profile != current_profile || screen_off != current_screen_off)
+        ALOGI("%s: switching to %s profile%s", __func__, p->name,
+              screen_off ? ", screen off" : "");
+
+    /* cores back online before the limits are raised for them */
+    if (!screen_off)
+        err |= set_dm_hotplug(0);
+
+    /* limits first, so the governor never runs the new tunables against
+       the old range */
+    min_freq_requests[MIN_FREQ_PROFILE] = p->cpu_min;
+    max_freq_requests[MAX_FREQ_PROFILE] = p->cpu_max;
+    max_freq_requests[MAX_FREQ_SCREEN_OFF] =
+            screen_off ? SCREEN_OFF_MAX_FREQ : MAX_FREQ_NONE;
+    err |= apply_freq_limits();
+
+    if (current_profile >= 0 && p->gpu_max < profiles[current_profile].gpu_max) {
+        err |= sysfs_node_set_int(&gpu_min_node, p->gpu_min);
+        err |= sysfs_node_set_int(&gpu_max_node, p->gpu_max);
+    } else {
+        err |= sysfs_node_set_int(&gpu_max_node, p->gpu_max);
+        err |= sysfs_node_set_int(&gpu_min_node, p->gpu_min);
+    }
+
+    for (i = 0; i < TUNABLE_COUNT; i++) {
+        value = p->tunables[i];
+        if (screen_off && i == TUNABLE_TIMER_RATE)
+            value = SCREEN_OFF_TIMER_RATE;
+        else if (screen_off && i == TUNABLE_TIMER_SLACK)
+            value = SCREEN_OFF_TIMER_SLACK;
+        err |= sysfs_node_set(&tunable_nodes[i], value);
+    }
+
+    if (screen_off)
+        err |= set_dm_hotplug(1);
+
+    /* a retry of the same target keeps its backoff */
+    if (err && (!profile_dirty || profile != current_profile ||
+            screen_off != current_screen_off)) {
+        failed_transitions++;
+        if (retry_started)
+            pthread_cond_signal(&retry_cond);
+    }
+
+    current_profile = profile;
+    current_screen_off = screen_off;
+    profile_dirty = err != 0;
 }
 
 static void power_set_interactive(struct power_module *module, int on)
 {
+    int i;
+
     ALOGD("%s: %s input devices", __func__, on ? "enabling" : "disabling");
-    sysfs_write(TOUCHSCREEN_POWER, on ? "1" : "0");
-    sysfs_write(TOUCHKEY_POWER, on ? "1" : "0");
-    sysfs_write(BATT_LCD_POWER, on ? "1" : "0");
+
+    /* the touchscreen resumes while the CPU policy is restored */
+    pthread_mutex_lock(&input_lock);
+    for (i = 0; i < INPUT_COUNT; i++) {
+        struct input_worker *w = &input_workers[i];
+
+        if (w->started) {
+            w->pending = on;
+            pthread_cond_signal(&w->cond);
+        }
+    }
+    pthread_mutex_unlock(&input_lock);
+
+    /* only if power_init could not start a worker */
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (!input_workers[i].started)
+            input_write(&input_workers[i], on);
+    }
+
+    /* synchronous, so that the interactive profile is back in place
+       before the framework turns the display on */
+    pthread_mutex_lock(&lock);
+    screen_off = !on;
+    update_profile();
+    pthread_mutex_unlock(&lock);
+
+    if (on)
+        return;
+
+    /* the writes ran alongside the policy switch, now wait for the rest */
+    pthread_mutex_lock(&input_lock);
+    for (i = 0; i < INPUT_COUNT; i++) {
+        struct input_worker *w = &input_workers[i];
+
+        while (w->started && (w->pending >= 0 || w->busy))
+            pthread_cond_wait(&input_done, &input_lock);
+    }
+    pthread_mutex_unlock(&input_lock);
 }
 
 static void power_hint(struct power_module *module, power_hint_t hint,
                        void *data) {
+    int on = data ? *(int *)data : 0;
+
+    pthread_mutex_lock(&lock);
+    if (profile_dirty)
+        update_profile();
+
     switch (hint) {
+    case POWER_HINT_INTERACTION:
+        if (screen_off)
+            break;
+        if (current_profile < 0 || profiles[current_profile].boost)
+            boostpulse();
+        break;
+    case POWER_HINT_LAUNCH:
+        /* data is 1 when the launch starts and 0 when it is done */
+        request_min_freq(MIN_FREQ_LAUNCH, on ? LAUNCH_MIN_FREQ : MIN_FREQ_NONE);
+        break;
+    case POWER_HINT_VSYNC:
+        request_min_freq(MIN_FREQ_VSYNC, on ? VSYNC_MIN_FREQ : MIN_FREQ_NONE);
+        break;
+    case POWER_HINT_LOW_POWER:
+        low_power = on;
+        update_profile();
+        break;
+    case POWER_HINT_SUSTAINED_PERFORMANCE:
+        sustained_performance = on;
+        update_profile();
+        break;
+    case POWER_HINT_SET_PROFILE:
+        if (on < 0 || on >= PROFILE_MAX)
+            break;
+        user_profile = on;
+        update_profile();
+        break;
     default:
         break;
     }
+    pthread_mutex_unlock(&lock);
+}
+
+static int power_get_feature(struct power_module *module, feature_t feature)
+{
+    if (feature == POWER_FEATURE_SUPPORTED_PROFILES)
+        return PROFILE_MAX;
+
+    return -1;
 }
 
 static struct hw_module_methods_t power_module_methods = {
@@ -87,4 +679,5 @@ struct power_module HAL_MODULE_INFO_SYM = {
     .init = power_init,
     .setInteractive = power_set_interactive,
     .powerHint = power_hint,
+    .getFeature = power_get_feature,
 };
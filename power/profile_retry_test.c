@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of a profile transition that fails half way, on a fake sysfs.
+ *
+ * One node fails while the profile or the screen state changes, so the
+ * transition stops half done, and recovers a while later. No hint comes
+ * after that: the HAL must finish the transition on its own. For each
+ * case it prints when the node recovered, when every node held the
+ * target state, and how many writes the failing node saw.
+ */
+
+#include "fake_sysfs.h"
+
+#define MS              1000000LL
+#define GIVE_UP_NS      (10000 * MS)
+
+struct retry_case {
+    const char *name;
+    int node;               /* fails for 'fail_ms' */
+    int fail_ms;
+    int profile;            /* -1 for a screen off instead */
+};
+
+static const struct retry_case g_cases[] = {
+    { "high performance, target_loads down", FAKE_TUNABLES +
+      TUNABLE_TARGET_LOADS, 100, PROFILE_HIGH_PERFORMANCE },
+    { "screen off, dm hotplug down", FAKE_DM_HOTPLUG, 2500, -1 },
+};
+
+static int node_is(int i, const char *value)
+{
+    char buf[64];
+
+    return !strcmp(fake_sysfs_read(i, buf, sizeof(buf)), value);
+}
+
+static int node_is_int(int i, int value)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%d", value);
+    return node_is(i, buf);
+}
+
+/* Nodes not holding what 'profile' wants, with the screen off policy. */
+static int mismatches(int profile, int off)
+{
+    const struct power_profile *p = &profiles[profile];
+    int i, wrong = 0, min_freq = p->cpu_min, max_freq = p->cpu_max;
+    const char *value;
+
+    if (off && (max_freq == MAX_FREQ_NONE || max_freq > SCREEN_OFF_MAX_FREQ))
+        max_freq = SCREEN_OFF_MAX_FREQ;
+    if (max_freq != MAX_FREQ_NONE && min_freq > max_freq)
+        min_freq = max_freq;
+
+    wrong += !node_is_int(FAKE_MIN_LIMIT, min_freq);
+    wrong += !node_is_int(FAKE_MAX_LIMIT, max_freq);
+    wrong += !node_is_int(FAKE_GPU_MIN, p->gpu_min);
+    wrong += !node_is_int(FAKE_GPU_MAX, p->gpu_max);
+    wrong += !node_is(FAKE_DM_HOTPLUG, off ? "1" : "0");
+    for (i = 0; i < TUNABLE_COUNT; i++) {
+        value = p->tunables[i];
+        if (off && i == TUNABLE_TIMER_RATE)
+            value = SCREEN_OFF_TIMER_RATE;
+        else if (off && i == TUNABLE_TIMER_SLACK)
+            value = SCREEN_OFF_TIMER_SLACK;
+        wrong += !node_is(FAKE_TUNABLES + i, value);
+    }
+    return wrong;
+}
+
+/* Returns when the target state held, in ns from the start, or -1. */
+static int64_t run(const struct retry_case *c, int profile, int off,
+                   unsigned int *writes)
+{
+    int64_t start, now;
+    unsigned int before = fake_sysfs_writes(c->node);
+    int recovered = 0;
+
+    fake_sysfs_set_fail(c->node, 1);
+    start = monotonic_ns();
+    if (c->profile < 0)
+        power_set_interactive(NULL, 0);
+    else
+        power_hint(NULL, POWER_HINT_SET_PROFILE, (void *)&c->profile);
+
+    for (;;) {
+        now = monotonic_ns() - start;
+        if (!recovered && now >= c->fail_ms * MS) {
+            fake_sysfs_set_fail(c->node, 0);
+            recovered = 1;
+        }
+        if (recovered && !mismatches(profile, off))
+            break;
+        if (now >= GIVE_UP_NS)
+            return -1;
+        usleep(1000);
+    }
+    *writes = fake_sysfs_writes(c->node) - before;
+    return now;
+}
+
+int main(void)
+{
+    unsigned int i, writes = 0;
+    int profile = PROFILE_BALANCED, off = 0, failed = 0;
+    int64_t held;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    power_init(NULL);
+    power_set_interactive(NULL, 1);
+    if (mismatches(profile, off)) {
+        printf("balanced profile not in place at boot\n");
+        failed = 1;
+    }
+
+    for (i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+        const struct retry_case *c = &g_cases[i];
+
+        if (c->profile < 0)
+            off = 1;
+        else
+            profile = c->profile;
+
+        held = run(c, profile, off, &writes);
+        if (held < 0) {
+            printf("%-40s: node back after %5d ms, target state not reached "
+                   "in %lld ms\n", c->name, c->fail_ms, GIVE_UP_NS / MS);
+            failed = 1;
+            continue;
+        }
+        printf("%-40s: node back after %5d ms, target state after %5lld ms, "
+               "%u writes to it\n", c->name, c->fail_ms, held / MS, writes);
+    }
+
+    fake_sysfs_cleanup();
+    return failed;
+}
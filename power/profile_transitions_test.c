@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host test of every transition between the power save, balanced, high
+ * performance and sustained performance profiles, with the screen on and
+ * with it off, on a fake sysfs.
+ *
+ * For each pair it diffs what the two profiles want in the policy nodes.
+ * After the transition every node must hold what the new profile wants,
+ * the nodes that differ must have been written once and the others not
+ * at all. Where a ceiling comes down its floor must be written first,
+ * and where it goes up, after it, so the floor never sits above the
+ * ceiling in between.
+ */
+
+#include "fake_sysfs.h"
+
+/* the nodes the profiles own */
+#define FAKE_POLICY     FAKE_MIN_LIMIT
+
+static const char *const g_node_names[FAKE_COUNT] = {
+    [FAKE_MIN_LIMIT] = "cpufreq_min_limit",
+    [FAKE_MAX_LIMIT] = "cpufreq_max_limit",
+    [FAKE_GPU_MIN] = "mali_min_freq",
+    [FAKE_GPU_MAX] = "mali_max_freq",
+    [FAKE_DM_HOTPLUG] = "enable_dm_hotplug",
+    [FAKE_TUNABLES + TUNABLE_TIMER_RATE] = "timer_rate",
+    [FAKE_TUNABLES + TUNABLE_TIMER_SLACK] = "timer_slack",
+    [FAKE_TUNABLES + TUNABLE_MIN_SAMPLE_TIME] = "min_sample_time",
+    [FAKE_TUNABLES + TUNABLE_HISPEED_FREQ] = "hispeed_freq",
+    [FAKE_TUNABLES + TUNABLE_GO_HISPEED_LOAD] = "go_hispeed_load",
+    [FAKE_TUNABLES + TUNABLE_TARGET_LOADS] = "target_loads",
+    [FAKE_TUNABLES + TUNABLE_ABOVE_HISPEED_DELAY] = "above_hispeed_delay",
+};
+
+static int g_profile = PROFILE_BALANCED;
+
+/* What 'profile' wants in policy node 'i', with the screen off policy. */
+static const char *wanted(int profile, int off, int i, char *buf, size_t len)
+{
+    const struct power_profile *p = &profiles[profile];
+    int min_freq = p->cpu_min, max_freq = p->cpu_max;
+
+    if (off && (max_freq == MAX_FREQ_NONE || max_freq > SCREEN_OFF_MAX_FREQ))
+        max_freq = SCREEN_OFF_MAX_FREQ;
+    if (max_freq != MAX_FREQ_NONE && min_freq > max_freq)
+        min_freq = max_freq;
+
+    switch (i) {
+    case FAKE_MIN_LIMIT: snprintf(buf, len, "%d", min_freq); break;
+    case FAKE_MAX_LIMIT: snprintf(buf, len, "%d", max_freq); break;
+    case FAKE_GPU_MIN: snprintf(buf, len, "%d", p->gpu_min); break;
+    case FAKE_GPU_MAX: snprintf(buf, len, "%d", p->gpu_max); break;
+    case FAKE_DM_HOTPLUG: snprintf(buf, len, "%s", off ? "1" : "0"); break;
+    default:
+        i -= FAKE_TUNABLES;
+        if (off && i == TUNABLE_TIMER_RATE)
+            snprintf(buf, len, "%s", SCREEN_OFF_TIMER_RATE);
+        else if (off && i == TUNABLE_TIMER_SLACK)
+            snprintf(buf, len, "%s", SCREEN_OFF_TIMER_SLACK);
+        else
+            snprintf(buf, len, "%s", p->tunables[i]);
+        break;
+    }
+    return buf;
+}
+
+/* Switches to 'profile' with the hint that selects it. */
+static void switch_to(int profile)
+{
+    int on = 1, off = 0;
+
+    if (profile == PROFILE_SUSTAINED_PERFORMANCE) {
+        power_hint(NULL, POWER_HINT_SUSTAINED_PERFORMANCE, &on);
+    } else {
+        /* under sustained this only selects what comes after it */
+        power_hint(NULL, POWER_HINT_SET_PROFILE, &profile);
+        if (g_profile == PROFILE_SUSTAINED_PERFORMANCE)
+            power_hint(NULL, POWER_HINT_SUSTAINED_PERFORMANCE, &off);
+    }
+    g_profile = profile;
+}
+
+static long long freq_of(const char *value)
+{
+    long long freq = atoll(value);
+
+    return freq == MAX_FREQ_NONE ? LLONG_MAX : freq;
+}
+
+/* The floor never above the ceiling: a ceiling that comes down is
+   written after its floor, one that goes up before it. */
+static int bad_order(int min, int max, const char *from_max, const char *to_max,
+                     const unsigned int *written)
+{
+    unsigned int min_seq = fake_sysfs_seq(min), max_seq = fake_sysfs_seq(max);
+
+    if (!written[min] || !written[max])
+        return 0;
+    if (freq_of(to_max) < freq_of(from_max))
+        return min_seq > max_seq;
+    return max_seq > min_seq;
+}
+
+static int transition(int from, int to, int off)
+{
+    char from_values[FAKE_COUNT][64], to_values[FAKE_COUNT][64], buf[64];
+    unsigned int before[FAKE_COUNT], written[FAKE_COUNT];
+    int i, changed = 0, writes = 0, failed = 0;
+
+    for (i = FAKE_POLICY; i < FAKE_COUNT; i++) {
+        wanted(from, off, i, from_values[i], sizeof(from_values[i]));
+        wanted(to, off, i, to_values[i], sizeof(to_values[i]));
+        before[i] = fake_sysfs_writes(i);
+    }
+
+    switch_to(to);
+
+    for (i = FAKE_POLICY; i < FAKE_COUNT; i++) {
+        int differs = strcmp(from_values[i], to_values[i]) != 0;
+
+        written[i] = fake_sysfs_writes(i) - before[i];
+        changed += differs;
+        writes += written[i];
+        if (strcmp(fake_sysfs_read(i, buf, sizeof(buf)), to_values[i])) {
+            printf("  %s holds \"%s\", not \"%s\"\n", g_node_names[i], buf,
+                   to_values[i]);
+            failed = 1;
+        }
+        if (written[i] != (unsigned int)differs) {
+            printf("  %s written %u times, %s\n", g_node_names[i], written[i],
+                   differs ? "changed" : "unchanged");
+            failed = 1;
+        }
+    }
+    if (bad_order(FAKE_MIN_LIMIT, FAKE_MAX_LIMIT, from_values[FAKE_MAX_LIMIT],
+                  to_values[FAKE_MAX_LIMIT], written)) {
+        printf("  cpufreq limits written in the wrong order\n");
+        failed = 1;
+    }
+    if (bad_order(FAKE_GPU_MIN, FAKE_GPU_MAX, from_values[FAKE_GPU_MAX],
+                  to_values[FAKE_GPU_MAX], written)) {
+        printf("  gpu limits written in the wrong order\n");
+        failed = 1;
+    }
+
+    printf("%-22s -> %-22s %2d changed, %2d writes  %s\n", profiles[from].name,
+           profiles[to].name, changed, writes, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main(void)
+{
+    int from, to, off, failed = 0;
+
+    if (fake_sysfs_setup()) {
+        fprintf(stderr, "cannot set up the fake sysfs\n");
+        return 2;
+    }
+    power_init(NULL);
+    power_set_interactive(NULL, 1);
+
+    for (off = 0; off <= 1; off++) {
+        printf("screen %s\n", off ? "off" : "on");
+        if (off)
+            power_set_interactive(NULL, 0);
+        for (from = 0; from < PROFILE_COUNT; from++) {
+            for (to = 0; to < PROFILE_COUNT; to++) {
+                if (to == from)
+                    continue;
+                if (g_profile != from)
+                    switch_to(from);
+                failed |= transition(from, to, off);
+            }
+        }
+    }
+
+    fake_sysfs_cleanup();
+    return failed;
+}